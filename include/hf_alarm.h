@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Header file for the hf_alarm.c
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#ifndef __HF_ALARM_H
+#define __HF_ALARM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include "FreeRTOS.h"
+
+/*
+ * Threshold alarms on the sensor samples. A rule watches one sensor: it is
+ * raised once the value has been at or beyond set for debounce_ms, and cleared
+ * once it has been back at or inside clear for debounce_ms, clear being on the
+ * near side of set so the value can wobble around either without flapping.
+ * The rules are evaluated as the power monitor hands in each sample, there is
+ * no polling of their own. A missing sample (SOM off, PVT stale, fan not
+ * driven) neither raises nor clears a rule, its state is held until samples
+ * come back; only a change of the rule clears it.
+ *
+ * Raising and clearing are logged, published on BMC_TOPIC_ALARM and run the
+ * actions of the rule; an action shared by several raised rules is undone
+ * when the last of them clears. The power off takes seconds waiting on the
+ * SOM, so it is not run by the sampler task: the raise is published with
+ * ALARM_EVENT_POWER_OFF and the power task runs it.
+ */
+#define ALARM_RULES		8
+#define ALARM_LOG_LEN		16
+#define ALARM_NONE		INT32_MIN	// no sample, same as POWER_HIST_NONE
+
+/* BMC_TOPIC_ALARM value: the rule in bits 7-0, raised or cleared */
+#define ALARM_EVENT_RAISED	(1u << 8)
+#define ALARM_EVENT_POWER_OFF	(1u << 9)	// raised with ALARM_ACT_POWER_OFF, power the SOM off
+#define ALARM_EVENT(rule, raised)	((rule) | ((raised) ? ALARM_EVENT_RAISED : 0))
+#define ALARM_EVENT_RULE(value)	((value) & 0xff)
+
+enum alarm_sensor {
+	ALARM_BOARD_MA,		// every board rail reading
+	ALARM_BOARD_MW,
+	ALARM_SOM_MA,		// every SOM rail reading
+	ALARM_SOM_MW,
+	ALARM_CPU_TEMP,		// 0.1 C, once a second from the SOM PVT
+	ALARM_NPU_TEMP,		// 0.1 C
+	ALARM_FAN_RPM,		// only while the fan is driven
+	ALARM_BOARD_ALERT,	// 1 while the INA226 alert latched within the last second
+	ALARM_SENSORS,
+};
+
+enum alarm_dir {
+	ALARM_OFF,		// rule not in use
+	ALARM_ABOVE,		// raised at or above set, cleared at or below clear
+	ALARM_BELOW,		// raised at or below set, cleared at or above clear
+};
+
+#define ALARM_ACT_LOG		(1u << 0)	// print the change, always kept in the alarm log
+#define ALARM_ACT_LED		(1u << 1)	// blink the LEDs, LED_ALARM
+#define ALARM_ACT_FAN		(1u << 2)	// both fans at full duty
+#define ALARM_ACT_POWER_OFF	(1u << 3)	// graceful SOM power off, CMD_POWER_OFF by the power task
+#define ALARM_ACTIONS		4
+
+struct alarm_rule {
+	uint8_t sensor;		// enum alarm_sensor
+	uint8_t dir;		// enum alarm_dir
+	uint8_t actions;	// ALARM_ACT_*
+	int32_t set;
+	int32_t clear;
+	uint32_t debounce_ms;
+};
+
+struct alarm_status {
+	uint8_t active;
+	int32_t value;		// last sample, ALARM_NONE if the last one was missing
+	uint32_t raised;	// times raised
+	uint32_t since_ms;	// in the current state, or the pending change if debouncing
+	uint8_t pending;	// a change is being debounced
+};
+
+struct alarm_log_entry {
+	TickType_t tick;
+	uint8_t rule;
+	uint8_t raised;
+	int32_t value;
+};
+
+void alarm_feed(enum alarm_sensor sensor, int32_t value);
+void alarm_tick(void);
+int alarm_get(int rule, struct alarm_rule *r, struct alarm_status *status);
+int alarm_set(int rule, const struct alarm_rule *r);
+int alarm_log_read(uint32_t from, struct alarm_log_entry *entry, uint32_t *next);
+extern const char *const alarm_sensor_names[ALARM_SENSORS];
+extern const char *const alarm_action_names[ALARM_ACTIONS];
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __HF_ALARM_H */
@@ -55,7 +55,8 @@ typedef enum {
 	LED_MCU_RUNING = 0x1u,
 	LED_SOM_BOOTING,
 	LED_SOM_KERNEL_RUNING,
-	LED_USER_INFO_RESET
+	LED_USER_INFO_RESET,
+	LED_ALARM
 } led_status_t;
 
 typedef enum {
@@ -75,6 +76,14 @@ typedef enum {
 	CMD_BOARD_STATUS,
 	CMD_POWER_INFO,
 	CMD_RESTART, // cold reboot with power off/on
+	CMD_LINK_BAUD, // negotiate the UART4 baud rate, see hf_som_link.h
+	CMD_LINK_ECHO, // echo the payload back, verifies the link after a rate change
+	CMD_TELEMETRY_SUB, // subscribe to pushed telemetry, see hf_som_telemetry.h
+	CMD_CPU_LOAD,
+	CMD_THERMAL_INFO,
+	CMD_BULK_OPEN, // windowed bulk read, see hf_som_bulk.h
+	CMD_BULK_ACK,
+	CMD_BULK_DATA,
 				 // You can continue adding other command types
 } CommandType;
 
@@ -95,12 +104,54 @@ typedef struct {
 typedef struct {
 	ListItem_t xListItem; // FreeRTOS list item, must be the first member of the struct
 	TaskHandle_t xTaskToNotify;
-	uint8_t cmd_result;			  // command result
-	uint8_t data[FRAME_DATA_MAX]; // command result Data
+	Message *reply;	// rx pool buffer handed over by the protocol task
 } WebCmd;
 
-extern QueueHandle_t xUart4MsgQueue;
-extern Message UART4_RxMsg;
+/* UART4 rx, circular dma, drained by uart4_protocol_task, a power of two (ring_buf_t) */
+#define UART4_RX_DMA_SIZE 1024
+extern uint8_t UART4_RxBuf[UART4_RX_DMA_SIZE];
+void uart4_rx_start(void);
+void uart4_rx_event_from_isr(uint16_t Size, BaseType_t *pxHigherPriorityTaskWoken);
+
+/* UART3 production line protocol rx, circular dma, drained by protocol_task, a power of two */
+#define UART3_RX_DMA_SIZE 256
+extern uint8_t UART3_RxBuf[UART3_RX_DMA_SIZE];
+void uart3_rx_start(void);
+void uart3_rx_event_from_isr(uint16_t Size, BaseType_t *pxHigherPriorityTaskWoken);
+void uart3_rx_error_from_isr(void);
+
+/* received frames live in a small pool and move to their consumer by pointer */
+#define SOM_RX_POOL_SIZE 4
+struct som_rx_pool_stats {
+	uint8_t free;
+	uint8_t low_water;
+	uint32_t exhausted;
+};
+void som_rx_release(Message *msg);
+void som_rx_pool_get_stats(struct som_rx_pool_stats *stats);
+
+/*
+ * Requests to the SOM travel in two lanes. Control commands (power off, reboot,
+ * restart, link management) go straight to the transmit lock. Everything else
+ * queues behind them: at most one bulk frame waits for the uart at a time, and
+ * at most SOM_LANE_BULK_INFLIGHT bulk requests are outstanding at the SOM.
+ */
+typedef enum {
+	SOM_LANE_CONTROL,
+	SOM_LANE_BULK,
+	SOM_LANE_MAX,
+} som_lane_t;
+#define SOM_LANE_BULK_INFLIGHT 2
+struct som_lane_stats {
+	uint32_t requests;
+	uint32_t timeouts;
+	uint32_t busy;		// no bulk slot within the request timeout
+	uint32_t wait_avg_ms;	// call to frame sent
+	uint32_t wait_max_ms;
+	uint32_t rtt_avg_ms;	// call to reply
+	uint32_t rtt_max_ms;
+};
+void som_lane_get_stats(som_lane_t lane, struct som_lane_stats *stats);
 
 typedef struct {
 	uint32_t consumption;
@@ -243,6 +294,8 @@ extern UART_HandleTypeDef huart6;
 #define MAGIC_NUMBER	0x45505EF1
 
 #define AT24C_ADDR (0x50<<1)
+/* page write size, 8 on the AT24C02/C, 16 on the AT24C02D */
+#define AT24C_PAGE_SIZE 8
 
 #define BMC_DEBUG_EN	0
 #define bmc_fmt(fmt)	"[%s-BMC]: " fmt
@@ -267,6 +320,10 @@ Gap		16		144
 B cbinfo	64		80
 Gap		16		64
 A cbinfo	64		0
+
+The power and dip state is journaled in the pages at 64, 72, 144, 152 and
+248 (see hf_eeprom.c), the record at SOM_PWRMGT_DIP_INFO_EEPROM_OFFSET is
+only read once to move it to the journal.
 */
 #define CBINFO_MAX_SIZE		64
 #define GAP_SIZE		16
@@ -317,6 +374,7 @@ power_switch_t get_som_power_state(void);
 void change_som_power_state(power_switch_t newState);
 void vRestartSOM(void);
 int web_cmd_handle(CommandType cmd, void *data, int data_len, uint32_t timeout);
+int som_cmd_request(CommandType cmd, void *data, int data_len, uint32_t timeout, uint8_t *replied);
 
 void eth_get_address(void);
 
@@ -338,6 +396,8 @@ int es_set_mcu_netmask(uint8_t *p_netmask_address);
 
 int es_get_mcu_gateway(uint8_t *p_gateway_address);
 int es_set_mcu_gateway(uint8_t *p_gateway_address);
+/* any of ip/netmask/gateway, NULL to keep, checked together and written at once */
+int es_set_mcu_netinfo(uint8_t *p_ip_address, uint8_t *p_netmask_address, uint8_t *p_gateway_address);
 
 int es_get_username_password(char *p_admin_name, char *p_admin_password);
 int es_set_username_password(const char *p_admin_name, const char *p_admin_password);
@@ -369,6 +429,16 @@ void vRestartSOM(void);
 deamon_stats_t get_som_daemon_state(void);
 void change_som_daemon_state(deamon_stats_t newState);
 
+struct som_liveness_stats {
+	uint32_t deadline_ms;	// no frame from the SOM for this long: daemon off
+	uint32_t idle_ms;	// time since the last valid frame
+	uint32_t heartbeats;
+	uint32_t polls;		// CMD_BOARD_STATUS sent because the link was quiet
+	uint32_t poll_fail;
+};
+int som_liveness_set_deadline(uint32_t ms);
+void som_liveness_get_stats(struct som_liveness_stats *stats);
+
 void TriggerSomPowerOffTimer(void);
 void vStopSomPowerOffTimer(void);
 void TriggerSomRebootTimer(void);
@@ -392,6 +462,9 @@ power_info get_power_info(void);
 int xSOMRestartHandle(void);
 int xSOMRebootHandle(void);
 
+int32_t es_set_fan_duty(struct fan_control_t *fan);
+int32_t es_get_fan_duty(struct fan_control_t *fan);
+
 int get_mcu_led_status(void);
 void set_mcu_led_status(led_status_t type);
 int es_restore_userdata_to_factory(void);
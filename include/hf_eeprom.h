@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Header file for the hf_eeprom.c
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#ifndef __HF_EEPROM_H
+#define __HF_EEPROM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+
+/*
+ * Write-back RAM mirror of the AT24C. Updates are diffed against the mirror,
+ * only the pages with changed bytes are marked dirty, and the flush task
+ * writes them a little later so the setters of one configuration change share
+ * the write. es_eeprom_sync() writes everything pending before it returns,
+ * for callers that need the data on the eeprom.
+ *
+ * es_eeprom_preload() reads the whole eeprom in one sequential read at boot,
+ * the loads that follow, all the copies and crcs checked at boot among them,
+ * are then served from the mirror without touching the bus.
+ */
+#define EEPROM_SIZE		256
+#define EEPROM_PAGES		(EEPROM_SIZE / AT24C_PAGE_SIZE)
+#define EEPROM_FLUSH_DELAY_MS	200
+
+/*
+ * Journal of small TLV records in the spare pages. Every append goes to the
+ * page after the newest record with the next sequence number, one record per
+ * page, so an update is a single page write: a torn write fails the crc and
+ * the previous record is still there. The pages take turns, which spreads the
+ * wear of the state written on every SOM power transition. At boot the newest
+ * valid record wins.
+ */
+#define JOURNAL_TAG_PWRMGT_DIP	1	// SomPwrMgtDIPInfo without the crc
+#define JOURNAL_VALUE_MAX	4
+
+struct es_journal_rec {
+	uint8_t seq;		// newer if (int8_t)(seq - other) > 0
+	uint8_t tag_len;	// tag in bits 7-4, value length in bits 3-0
+	uint8_t value[JOURNAL_VALUE_MAX];
+	uint16_t crc;		// crc16 ccitt of the bytes above
+} __attribute__((packed));
+
+struct eeprom_stats {
+	uint32_t updates;	// updates that changed the mirror
+	uint32_t bytes;		// bytes changed by the updates
+	uint32_t pages;		// pages written
+	uint32_t flushes;
+	uint32_t syncs;
+	uint32_t errors;	// page writes that failed, the page stays dirty
+	uint32_t dirty;		// pages waiting for the flush
+	uint32_t appends;	// journal records written
+	uint32_t hits;		// loads served from the preloaded mirror
+	uint32_t preload_us;	// time of the boot read, 0 if not preloaded
+	int8_t journal_slot;	// slot of the newest journal record, -1 if none
+	uint8_t journal_seq;
+};
+
+int es_eeprom_init(void);
+int es_eeprom_preload(void);
+int es_eeprom_load(uint16_t offset, void *buf, uint16_t len);
+int es_eeprom_update(uint16_t offset, const void *buf, uint16_t len);
+int es_eeprom_sync(void);
+void es_eeprom_get_stats(struct eeprom_stats *stats);
+int es_journal_load(uint8_t tag, void *value, uint8_t len);
+int es_journal_append(uint8_t tag, const void *value, uint8_t len);
+void hf_eeprom_task(void *argument);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __HF_EEPROM_H */
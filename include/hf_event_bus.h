@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Header file for the hf_event_bus.c
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#ifndef __HF_EVENT_BUS_H
+#define __HF_EVENT_BUS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "FreeRTOS.h"
+
+/*
+ * Publish/subscribe bus for BMC state changes. A subscriber picks topics with a
+ * mask and gets either a bounded queue it blocks on, or a callback run in the
+ * publisher's context (so it must be short, and ISR safe for the topics that
+ * are published from interrupts). A full queue drops the new event and counts
+ * it, the publisher never blocks. The last value of every topic is kept, so a
+ * subscriber can read the current state before waiting for changes.
+ */
+typedef enum {
+	BMC_TOPIC_SOM_POWER,	// power_switch_t
+	BMC_TOPIC_DAEMON,	// deamon_stats_t
+	BMC_TOPIC_DIP_SWITCH,	// bit 4 soft control, bit 3-0 bootsel
+	BMC_TOPIC_BUTTON,	// button_state_t, KEY_PRESS_DETECTED_STATE from the isr
+	BMC_TOPIC_POWER_GOOD,	// 1 dc power good, 0 off
+	BMC_TOPIC_ALARM,	// ALARM_EVENT(), a rule of hf_alarm.h raised or cleared, ALARM_EVENT_POWER_OFF to the power task
+	BMC_TOPIC_MAX,
+} bmc_topic_t;
+
+#define BMC_TOPIC_MASK(t)	(1u << (t))
+#define BMC_BUS_MAX_SUBSCRIBERS	8
+
+struct bmc_event {
+	uint8_t topic;
+	uint32_t value;
+	TickType_t tick;
+};
+
+typedef void (*bmc_bus_cb_t)(const struct bmc_event *ev, void *arg);
+
+struct bmc_bus_sub_stats {
+	uint32_t mask;
+	uint8_t queue;		// 1 queue subscriber, 0 callback
+	uint32_t delivered;
+	uint32_t dropped;
+};
+
+int bmc_bus_subscribe_queue(uint32_t mask, uint8_t depth);
+int bmc_bus_subscribe_cb(uint32_t mask, bmc_bus_cb_t cb, void *arg);
+int bmc_bus_wait(int sub, struct bmc_event *ev, TickType_t timeout);
+void bmc_bus_publish(bmc_topic_t topic, uint32_t value);
+void bmc_bus_publish_from_isr(bmc_topic_t topic, uint32_t value, BaseType_t *pxHigherPriorityTaskWoken);
+uint32_t bmc_bus_last(bmc_topic_t topic, uint32_t *count);
+int bmc_bus_get_sub_stats(int sub, struct bmc_bus_sub_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __HF_EVENT_BUS_H */
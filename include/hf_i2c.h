@@ -19,10 +19,108 @@ extern "C" {
 #include "stm32f4xx_hal.h"
 
 /* types ------------------------------------------------------------*/
+struct hf_i2c_req;
+/* called in isr or task context when the request is over, must not block */
+typedef void (*hf_i2c_done_t)(struct hf_i2c_req *req);
+
+/*
+ * One register transfer. Requests are queued per bus and run back to back from
+ * the transfer complete interrupt, the caller owns the request (and buf) until
+ * done is called.
+ */
+struct hf_i2c_req {
+	uint8_t addr;		// 8 bit slave address
+	uint8_t reg;
+	uint8_t write;
+	uint8_t *buf;
+	uint16_t len;		// 0: a write sends reg only, a read probes for an ack
+	uint16_t timeout_ms;	// 0 for HF_I2C_TIMEOUT_MS
+	hf_i2c_done_t done;
+	void *arg;
+	int status;		// HAL status, valid in done
+	struct hf_i2c_req *next;
+};
+
+struct hf_i2c_stats {
+	uint32_t requests;
+	uint32_t errors;	// nack, bus or arbitration errors
+	uint32_t timeouts;
+	uint32_t resets;	// peripheral reinit after a bus error or timeout
+	uint32_t queue_max;	// most requests waiting behind the active one
+	uint32_t busy_ms;	// longest request, queueing excluded
+	uint32_t sda_stuck;	// recoveries that found SDA held low
+	uint32_t recover_failed;	// SDA or SCL still held low after the recovery
+};
+
+enum {
+	HF_I2C_BREAKER_CLOSED,
+	HF_I2C_BREAKER_OPEN,		// requests fail with HAL_BUSY without touching the bus
+	HF_I2C_BREAKER_HALF_OPEN,	// one trial request in flight
+};
+
+/* a device is a slave address on a bus */
+struct hf_i2c_dev_stats {
+	uint8_t bus;		// 1 or 3
+	uint8_t addr;		// 7 bit
+	uint8_t state;		// HF_I2C_BREAKER_*
+	uint32_t requests;
+	uint32_t nacks;		// nacked probes excluded
+	uint32_t timeouts;
+	uint32_t arb_lost;
+	uint32_t bus_errors;	// misplaced start or stop, overrun
+	uint32_t recoveries;	// bus recoveries after a fault of this device
+	uint32_t rejected;	// failed fast while the breaker was open
+	uint32_t opens;
+	uint32_t last_us;	// latency of the completed requests, queueing excluded
+	uint32_t max_us;
+	uint32_t total_us;
+	uint32_t completed;
+};
+
+/* eeprom page writes, the write cycle is ack polled */
+struct hf_i2c_wr_stats {
+	uint32_t pages;
+	uint32_t polls;		// ack probes, the first one included
+	uint32_t timeouts;	// no ack within HF_I2C_WRITE_CYCLE_MAX_MS
+	uint32_t last_us;	// write cycle, stop of the page write to the ack
+	uint32_t min_us;
+	uint32_t max_us;
+	uint32_t total_us;
+};
+
 /* constants --------------------------------------------------------*/
+/* AT24C on I2C1, INA226, PAC1934 and PCA9450 on I2C3 are all fast mode parts */
+#define HF_I2C1_CLOCK_SPEED	400000
+#define HF_I2C3_CLOCK_SPEED	400000
+#define HF_I2C_TIMEOUT_MS	100
+/* AT24C tWR is 5 ms max */
+#define HF_I2C_WRITE_CYCLE_MAX_MS	10
+/* an ack probe takes ~50 us, 2 ms is at least one whole tick */
+#define HF_I2C_PROBE_TIMEOUT_MS	2
+/* devices tracked per bus, for the counters and the circuit breaker */
+#define HF_I2C_MAX_DEVS		8
+/* consecutive failures that open the breaker, open time doubles up to the max */
+#define HF_I2C_BREAKER_FAILS	3
+#define HF_I2C_BREAKER_OPEN_MS	1000
+#define HF_I2C_BREAKER_OPEN_MAX_MS	60000
+/* bus recovery: SCL pulses to free SDA, half period, longest clock stretch */
+#define HF_I2C_RECOVER_CLOCKS	9
+#define HF_I2C_RECOVER_HALF_US	5
+#define HF_I2C_STRETCH_MAX_US	1000
+/* a bus stuck busy is recovered at most this often from the request path */
+#define HF_I2C_RECOVER_MIN_MS	100
+
 /* macro ------------------------------------------------------------*/
 /* define------------------------------------------------------------*/
 /* functions prototypes ---------------------------------------------*/
+void hf_i2c_init(void);
+void hf_i2c_task(void *argument);
+int hf_i2c_submit(I2C_HandleTypeDef *hi2c, struct hf_i2c_req *req);
+int hf_i2c_xfer(I2C_HandleTypeDef *hi2c, struct hf_i2c_req *req);
+int hf_i2c_xfer_burst(I2C_HandleTypeDef *hi2c, struct hf_i2c_req *reqs, int n);
+int hf_i2c_get_stats(I2C_HandleTypeDef *hi2c, struct hf_i2c_stats *stats);
+int hf_i2c_get_dev_stats(int index, struct hf_i2c_dev_stats *stats);
+void hf_i2c_get_wr_stats(struct hf_i2c_wr_stats *stats);
 int hf_i2c_reg_write(I2C_HandleTypeDef *hi2c, uint8_t slave_addr, uint8_t reg_addr, uint8_t *data_ptr);
 int hf_i2c_reg_read(I2C_HandleTypeDef *hi2c, uint8_t slave_addr, uint8_t reg_addr, uint8_t *data_ptr);
 int hf_i2c_mem_read(I2C_HandleTypeDef *hi2c, uint8_t slave_addr, 
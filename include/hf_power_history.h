@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Header file for the hf_power_history.c
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#ifndef __HF_POWER_HISTORY_H
+#define __HF_POWER_HISTORY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+
+/*
+ * One sample a second of the power rails, the SOM PVT temperatures and the
+ * fan, kept in the 64 KB CCM RAM that nothing else uses. The samples are
+ * delta encoded into fixed size blocks, the first sample of a block is
+ * encoded against zero so every block decodes on its own, and the oldest
+ * block goes when the ring is full. A sample is a varint mask of the fields
+ * that changed followed by the zigzag varint deltas of those fields; a rail
+ * that moves by a few mA/mW takes one byte per value, a steady temperature
+ * or fan none.
+ */
+#define POWER_HIST_BLOCK_SIZE	512
+#define POWER_HIST_BLOCKS	64	// 32 KB
+#define POWER_HIST_NONE		INT32_MIN	// rail not sampled, telemetry stale
+
+enum power_hist_field {
+	POWER_HIST_BOARD_MW,
+	POWER_HIST_BOARD_MV,
+	POWER_HIST_BOARD_MA,
+	POWER_HIST_SOM_MW,
+	POWER_HIST_SOM_MV,
+	POWER_HIST_SOM_MA,
+	POWER_HIST_CPU_TEMP,	// 0.1 °C
+	POWER_HIST_NPU_TEMP,	// 0.1 °C
+	POWER_HIST_FAN_RPM,
+	POWER_HIST_FIELDS,
+};
+
+struct power_hist_sample {
+	uint32_t time;		// s since boot
+	int32_t val[POWER_HIST_FIELDS];
+};
+
+struct power_hist_stats {
+	uint32_t samples;	// kept
+	uint32_t oldest;	// time of the oldest sample kept
+	uint32_t newest;
+	uint32_t bytes;		// encoded, block headers excluded
+	uint32_t blocks;	// in use
+	uint32_t dropped;	// blocks dropped to make room
+};
+
+void power_hist_init(void);
+void power_hist_add(const struct power_hist_sample *sample);
+int power_hist_read(uint32_t from, uint32_t to, struct power_hist_sample *out, int max);
+void power_hist_get_stats(struct power_hist_stats *stats);
+extern const char *const power_hist_names[POWER_HIST_FIELDS];
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __HF_POWER_HISTORY_H */
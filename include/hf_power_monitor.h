@@ -0,0 +1,82 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Header file for the hf_power_monitor.c
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#ifndef __HF_POWER_MONITOR_H
+#define __HF_POWER_MONITOR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include "FreeRTOS.h"
+
+/*
+ * One task samples the board (INA226) and SOM (PAC1934) rails every
+ * POWER_MON_PERIOD_MS and folds the readings into 1 s, 10 s and 60 s windows
+ * of min, max and mean. The 1 s and 10 s windows move in 1 s steps, the 60 s
+ * window in 10 s steps. Readers copy a snapshot and never wait for the bus.
+ * The rails are only sampled while the SOM is powered, as the readers did
+ * before, so the windows empty out after a power off. With the INA226 ALERT
+ * line wired to an EXTI the board rail is also read as soon as the part flags
+ * a result or a limit, between the rounds. Every reading, and once a second
+ * the SOM PVT, is handed to the alarm rules of hf_alarm.h.
+ */
+#define POWER_MON_PERIOD_MS	100
+
+enum power_rail {
+	POWER_RAIL_BOARD,	// 12 V input, INA226
+	POWER_RAIL_SOM,		// SOM supply, PAC1934 channel 1
+	POWER_RAIL_MAX,
+};
+
+enum power_window {
+	POWER_WIN_1S,
+	POWER_WIN_10S,
+	POWER_WIN_60S,
+	POWER_WIN_MAX,
+};
+
+enum power_value {
+	POWER_VOLT,		// mV
+	POWER_CURR,		// mA
+	POWER_POWER,		// uW
+	POWER_VALUE_MAX,
+};
+
+struct power_window_stats {
+	uint32_t samples;	// 0 if the rail was not sampled in the window
+	uint32_t min[POWER_VALUE_MAX];
+	uint32_t max[POWER_VALUE_MAX];
+	uint32_t mean[POWER_VALUE_MAX];
+};
+
+struct power_rail_stats {
+	uint32_t age_ms;	// since the last sample, UINT32_MAX if never sampled
+	uint32_t last[POWER_VALUE_MAX];
+	uint32_t errors;	// failed reads
+	struct power_window_stats win[POWER_WIN_MAX];
+};
+
+struct power_mon_cost {
+	uint32_t rounds;	// sampling rounds, both rails
+	uint32_t last_us;	// time of the last round
+	uint32_t avg_us;
+	uint32_t max_us;
+	uint32_t overruns;	// rounds that took longer than the period
+	uint32_t early;		// board reads between the rounds, on an INA226 alert
+};
+
+int power_mon_get(enum power_rail rail, struct power_rail_stats *stats);
+int power_mon_get_last(enum power_rail rail, uint32_t *volt, uint32_t *curr, uint32_t *power);
+void power_mon_get_cost(struct power_mon_cost *cost);
+void hf_power_monitor_task(void *argument);
+void power_mon_kick_from_isr(BaseType_t *woken);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __HF_POWER_MONITOR_H */
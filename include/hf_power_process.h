@@ -15,6 +15,84 @@ extern "C" {
 #endif
 #include "hf_common.h"
 
+/*
+ * INA226 on the 12 V input. Every result averages avg conversions of the bus
+ * and shunt voltage, one result every (vbus_ct_us + vshunt_ct_us) * avg. The
+ * defaults give a result every 8.8 ms, four times the integration time of the
+ * reset settings, short enough for the alert to catch spikes of a few results
+ * the 100 ms power sampler misses. One alert function
+ * is latched by the part and reported at the next read. The part compares the
+ * averaged result against the limit, so an excursion much shorter than a
+ * result is averaged away: fewer averages catch shorter ones at more noise.
+ */
+enum {
+	INA226_ALERT_NONE,
+	INA226_ALERT_OVER_CURRENT,	// alert_limit in mA
+	INA226_ALERT_OVER_VOLTAGE,	// mV
+	INA226_ALERT_UNDER_VOLTAGE,	// mV
+	INA226_ALERT_OVER_POWER,	// mW
+	INA226_ALERT_MAX,
+};
+
+#define INA226_DEFAULT_AVG		4
+#define INA226_DEFAULT_CT_US		1100
+#define INA226_DEFAULT_OC_LIMIT_MA	20000
+
+struct ina226_cfg {
+	uint16_t avg;		// 1, 4, 16, 64, 128, 256, 512 or 1024
+	uint16_t vbus_ct_us;	// 140, 204, 332, 588, 1100, 2116, 4156 or 8244
+	uint16_t vshunt_ct_us;
+	uint8_t continuous;	// 0: one conversion per read, started after the read
+	uint8_t alert;		// INA226_ALERT_*
+	uint8_t alert_cnvr;	// also pull ALERT on conversion ready
+	uint32_t alert_limit;
+};
+
+struct ina226_stats {
+	uint32_t reads;		// bursts read
+	uint32_t fresh;		// reads with a new result, the others repeat the last one
+	uint32_t errors;
+	uint32_t configs;	// configurations written
+	uint32_t resets;	// reads that found the part back at its reset configuration
+	uint32_t alerts;	// reads with the latched alert flag set
+	uint32_t overflows;
+	TickType_t alert_tick;	// of the last alert
+};
+
+/*
+ * PAC1934: four channels with hardware power accumulators, channel 1 is the
+ * SOM supply. The accumulated power of every channel is kept in 64 bit
+ * counters from boot, energy and the mean power between any two reads of the
+ * counters come from them. A span the part was reset in, or not read for over
+ * an hour, is left out and counted in resyncs.
+ */
+#define PAC1934_CHANNELS	4
+#define PAC1934_SOM_CHANNEL	0
+#define PAC1934_SPS		1024	// samples/s of every channel
+
+struct pac1934_channel {
+	uint32_t volt;		// mV, at the last read
+	uint32_t curr;		// mA, at the last read
+	uint32_t power;		// uW, mean since the read before
+};
+
+struct pac1934_energy {
+	TickType_t tick;		// of the latest span added
+	uint64_t samples;		// accumulated since boot
+	uint64_t acc[PAC1934_CHANNELS];	// accumulated power, in samples of 3.2 V^2 / Rsense / 2^28
+	uint32_t errors;		// failed reads
+	uint32_t resyncs;		// spans left out
+};
+
 int get_board_power(uint32_t *volt, uint32_t *curr, uint32_t *power);
 int get_som_power(uint32_t *volt, uint32_t *curr, uint32_t *power);
+int ina226_set_cfg(const struct ina226_cfg *cfg);
+void ina226_get_cfg(struct ina226_cfg *cfg);
+void ina226_get_stats(struct ina226_stats *stats);
+uint32_t ina226_conv_time_us(const struct ina226_cfg *cfg);
+int pac1934_update(void);
+int pac1934_get_channel(int ch, struct pac1934_channel *c);
+void pac1934_get_energy(struct pac1934_energy *energy);
+uint64_t pac1934_energy_uwh(const struct pac1934_energy *energy, int ch);
+uint32_t pac1934_avg_power_uw(const struct pac1934_energy *from, const struct pac1934_energy *to, int ch);
 #endif /* __HF_I2C_H */
\ No newline at end of file
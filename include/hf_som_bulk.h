@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Header file for the hf_som_bulk.c
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#ifndef __HF_SOM_BULK_H
+#define __HF_SOM_BULK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "hf_common.h"
+
+/*
+ * Bulk read of SOM objects larger than one frame.
+ *
+ * 1. MCU sends CMD_BULK_OPEN with struct som_bulk_open, the SOM replies with
+ *    struct som_bulk_info: the object size (clipped to max_len, dmesg and logs
+ *    keep their tail) and the crc32 of the whole object (som_frame_crc32).
+ * 2. MCU sends CMD_BULK_ACK with struct som_bulk_ack. Every chunk below base
+ *    has been received, bit n of map stands for chunk base + n. The SOM sends
+ *    the chunks of [base, base + window) it has not sent yet, and resends the
+ *    missing ones below the highest received chunk. With SOM_BULK_ACK_TIMEOUT
+ *    it resends every missing chunk in the window.
+ * 3. Chunks come as MSG_NOTIFLY CMD_BULK_DATA frames, struct som_bulk_chunk.
+ * 4. An ack with base at the chunk count, or with SOM_BULK_ACK_ABORT, ends the
+ *    transfer on the SOM side.
+ *
+ * The MCU acks every half window, and at once when a chunk is missing.
+ */
+#define SOM_BULK_CHUNK_SIZE		(FRAME_DATA_MAX - 4)
+#define SOM_BULK_WINDOW			8	// chunks in flight, at most 32
+#define SOM_BULK_MAX_LEN		8192
+/* silence after which the missing chunks of the window are requested again */
+#define SOM_BULK_CHUNK_TIMEOUT_MS	300
+#define SOM_BULK_RETRY			5
+
+#define SOM_BULK_ACK_TIMEOUT		(1 << 0)
+#define SOM_BULK_ACK_ABORT		(1 << 1)
+
+typedef enum {
+	SOM_BULK_BOARD_INFO,
+	SOM_BULK_DAEMON_LOG,
+	SOM_BULK_DMESG,
+	SOM_BULK_OBJECT_MAX,
+} som_bulk_object_t;
+
+struct som_bulk_open {
+	uint8_t object;
+	uint8_t window;
+	uint16_t reserved;
+	uint32_t max_len;
+} __attribute__((packed));
+
+struct som_bulk_info {
+	uint32_t size;
+	uint32_t crc;
+} __attribute__((packed));
+
+struct som_bulk_ack {
+	uint8_t object;
+	uint8_t flags;		// SOM_BULK_ACK_*
+	uint16_t base;
+	uint32_t map;
+} __attribute__((packed));
+
+struct som_bulk_chunk {
+	uint8_t object;
+	uint8_t reserved;
+	uint16_t index;
+	uint8_t data[SOM_BULK_CHUNK_SIZE];
+} __attribute__((packed));
+
+struct som_bulk_stats {
+	uint32_t transfers;
+	uint32_t failed;
+	uint32_t chunks;
+	uint32_t duplicates;	// chunks received twice, a retransmit raced the original
+	uint32_t gaps;		// acks sent early for a missing chunk
+	uint32_t timeouts;	// acks sent after SOM_BULK_CHUNK_TIMEOUT_MS of silence
+	uint32_t last_bytes;
+	uint32_t last_ms;
+};
+
+void som_bulk_init(void);
+int som_bulk_read(som_bulk_object_t object, uint8_t *buf, uint32_t max_len, uint32_t *len);
+void som_bulk_push(Message *msg);
+void som_bulk_get_stats(struct som_bulk_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __HF_SOM_BULK_H */
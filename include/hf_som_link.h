@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Header file for the hf_som_link.c
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#ifndef __HF_SOM_LINK_H
+#define __HF_SOM_LINK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "hf_common.h"
+
+/*
+ * UART4 link speed negotiation with the SOM daemon.
+ *
+ * 1. MCU sends CMD_LINK_BAUD (MSG_REQUEST) at the current rate, the payload is a
+ *    list of little-endian u32 baud rates, highest first.
+ * 2. SOM replies at the current rate with the chosen rate in data[0..3], or a
+ *    non-zero cmd_result if it supports none of them. After the reply is fully
+ *    shifted out the SOM switches to the chosen rate.
+ * 3. MCU waits SOM_LINK_SWITCH_SETTLE_MS, switches and sends CMD_LINK_ECHO with a
+ *    pattern, the SOM replies with the same payload.
+ * 4. If the SOM receives no valid frame for SOM_LINK_REVERT_MS after switching,
+ *    or if the daemon restarts, it goes back to SOM_LINK_DEFAULT_BAUD. The MCU does
+ *    the same when the echo fails or the link quality check trips.
+ */
+#define SOM_LINK_DEFAULT_BAUD		115200
+#define SOM_LINK_MAX_BAUD		2000000
+#define SOM_LINK_AUTO_NEGOTIATE		1
+
+#define SOM_LINK_SWITCH_SETTLE_MS	20
+#define SOM_LINK_REVERT_MS		1000
+#define SOM_LINK_ECHO_LEN		64
+#define SOM_LINK_ECHO_RETRY		3
+/* errors within one quality window that force a fallback to the default rate */
+#define SOM_LINK_ERR_THRESHOLD		3
+/* hold-off before trying to negotiate again after a fallback */
+#define SOM_LINK_RETRY_MS		60000
+
+typedef enum {
+	LINK_CNT_TX_FRAMES,
+	LINK_CNT_TX_ERR,
+	LINK_CNT_RX_FRAMES,
+	LINK_CNT_RX_CHECKSUM_ERR,
+	LINK_CNT_RX_FORMAT_ERR,
+	LINK_CNT_RX_OVERRUN,		// rx dma ring lapped the protocol task
+	LINK_CNT_RX_LINE_ERR,		// uart framing/noise/overrun errors
+	LINK_CNT_RX_RESYNC,		// decoder header hunts after a bad frame
+	LINK_CNT_RX_DROPPED,		// bytes discarded while hunting for a header
+	LINK_CNT_RX_NOBUF,		// valid frames dropped, rx buffer pool exhausted
+	LINK_CNT_TIMEOUT,
+	LINK_CNT_MAX,
+} som_link_counter_t;
+
+struct som_link_stats {
+	uint32_t baudrate;
+	uint32_t ceiling;		// highest rate the next negotiation may propose
+	uint8_t unsupported;		// SOM daemon rejected CMD_LINK_BAUD
+	uint8_t crc_frames;		// SOM daemon speaks crc frames, see som_frame.h
+	uint32_t negotiations;
+	uint32_t negotiate_fail;
+	uint32_t fallbacks;
+	uint32_t cnt[LINK_CNT_MAX];
+};
+
+void som_link_count(som_link_counter_t counter);
+void som_link_count_from_isr(som_link_counter_t counter);
+void som_link_add(som_link_counter_t counter, uint32_t n);
+void som_link_set_crc_frames(uint8_t enable);
+uint8_t som_link_get_crc_frames(void);
+uint32_t som_link_get_baudrate(void);
+void som_link_get_stats(struct som_link_stats *stats);
+void som_link_request(uint32_t max_baud);
+void som_link_reset(void);
+void som_link_poll(deamon_stats_t daemon_state);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __HF_SOM_LINK_H */
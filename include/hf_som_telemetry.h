@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Header file for the hf_som_telemetry.c
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#ifndef __HF_SOM_TELEMETRY_H
+#define __HF_SOM_TELEMETRY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "hf_common.h"
+#include "web-server.h"
+
+/*
+ * The MCU subscribes with CMD_TELEMETRY_SUB once the SOM daemon is up. The SOM
+ * then pushes MSG_NOTIFLY frames every interval_ms, and early whenever a value
+ * moves past its delta:
+ *   CMD_PVT_INFO      PVTInfo
+ *   CMD_CPU_LOAD      struct som_cpu_load
+ *   CMD_THERMAL_INFO  struct som_thermal
+ * Daemons that reject the subscription are read on demand as before; a lost
+ * reply or a busy lane is retried on the next keeplive period. Without a
+ * subscription the PVT is read once a keeplive period for the alarms, and
+ * som_telemetry_peek_pvt() returns the last PVT from either source.
+ */
+#define SOM_TELEMETRY_PVT		(1 << 0)
+#define SOM_TELEMETRY_CPU_LOAD		(1 << 1)
+#define SOM_TELEMETRY_THERMAL		(1 << 2)
+#define SOM_TELEMETRY_ALL		(SOM_TELEMETRY_PVT | SOM_TELEMETRY_CPU_LOAD | SOM_TELEMETRY_THERMAL)
+
+#define SOM_TELEMETRY_INTERVAL_MS	1000
+#define SOM_TELEMETRY_TEMP_DELTA	2000	// m°C
+#define SOM_TELEMETRY_LOAD_DELTA	100	// 0.1 %
+
+#define SOM_CPU_CORES			4
+#define SOM_THERMAL_ZONES		4
+
+struct som_telemetry_sub {
+	uint8_t topics;		// SOM_TELEMETRY_*, 0 cancels the subscription
+	uint8_t reserved;
+	uint16_t interval_ms;	// periodic push
+	uint16_t temp_delta;	// m°C
+	uint16_t load_delta;	// 0.1 %
+} __attribute__((packed));
+
+struct som_cpu_load {
+	uint16_t total;			// 0.1 %
+	uint16_t core[SOM_CPU_CORES];	// 0.1 %
+} __attribute__((packed));
+
+struct som_thermal {
+	int32_t zone[SOM_THERMAL_ZONES];	// m°C
+} __attribute__((packed));
+
+struct som_telemetry_status {
+	uint8_t subscribed;
+	uint8_t unsupported;
+	uint16_t interval_ms;
+	uint32_t pushes;
+	uint32_t age_ms[3];	// per topic, UINT32_MAX if never received
+};
+
+int som_telemetry_get_pvt(PVTInfo *pvt);
+int som_telemetry_peek_pvt(PVTInfo *pvt);
+int som_telemetry_get_cpu_load(struct som_cpu_load *load);
+int som_telemetry_get_thermal(struct som_thermal *thermal);
+void som_telemetry_push(Message *msg);
+void som_telemetry_set_interval(uint16_t interval_ms);
+void som_telemetry_get_status(struct som_telemetry_status *status);
+void som_telemetry_poll(deamon_stats_t daemon_state);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __HF_SOM_TELEMETRY_H */
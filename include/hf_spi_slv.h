@@ -24,6 +24,7 @@
 		HAL_GPIO_WritePin(SPI2_NSS_GPIO_Port, SPI2_NSS_Pin, GPIO_PIN_SET); \
 	} while (0);
 
+void es_spi_init(void);
 int es_spi_write(uint8_t *buf, uint64_t addr, int len);
 int es_spi_read(uint8_t *dst, uint64_t src, int len);
 int eswin_rx(uint8_t *rcvBuf, uint64_t addr, int len);
@@ -65,6 +65,7 @@ void i2c_init(I2C_TypeDef *Instance);
 void i2c_deinit(I2C_TypeDef *Instance);
 void uart_init(USART_TypeDef *Instance);
 void uart_deinit(USART_TypeDef *Instance);
+int uart_set_baudrate(USART_TypeDef *Instance, uint32_t baudrate);
 int board_init(void);
 
 /* Private defines -----------------------------------------------------------*/
@@ -1,7 +1,6 @@
 #ifndef __ES_PROTOCOL_CORE_H__
 #define __ES_PROTOCOL_CORE_H__
 
-#include "ringbuffer.h"
 #include "stdint.h"
 #include "string.h"
 #include "stm32f4xx_hal.h"
@@ -10,6 +9,7 @@
 #define B_ERROR 1
 #define B_SUCCESS 0
 #define MAX_FRAME_LEN 32
+#define MAX_BATCH_LEN 64
 
 typedef struct {
 	const char *pname;
@@ -34,17 +34,10 @@ struct frame_data {
 		struct rtc_time_t rtc_time;
 		struct fan_control_t fan;
 		struct spi_slv_w32_t spislv32;
+		uint8_t batch[MAX_BATCH_LEN];
 	} data;
 };
 
-typedef struct {
-	b_frame_t frame_info;
-	ring_buf_t _frame_ring;
-	uint32_t _in_frame_buffer_size;
-	struct frame_data frame;
-	UART_HandleTypeDef *uart;
-} b_frame_class_t;
-
 typedef enum protocol_status_type {
 	CHECK_HEAD = 0,
 	CHECK_CMD = 1,
@@ -55,6 +48,36 @@ typedef enum protocol_status_type {
 	PROCESS_CMD = 6
 }protocol_status_type_e;
 
+struct b_frame_stats {
+	uint32_t frames;	// frames handed to the command handler
+	uint32_t dropped;	// bytes skipped while hunting for a header
+	uint32_t cmd_err;	// unknown command
+	uint32_t len_err;	// data longer than the frame_data union
+	uint32_t xor_err;
+	uint32_t tail_err;
+	uint32_t overrun;	// rx dma ring lapped the protocol task
+	uint32_t line_err;	// uart framing/noise/overrun errors
+	uint32_t batch_err;	// CMD_BATCH frames rejected or partly applied
+	uint32_t lat_avg_ms;	// from the rx event to the reply sent
+	uint32_t lat_max_ms;
+};
+
+struct b_frame_class;
+/* err is B_SUCCESS for a complete frame, B_ERROR when the frame was rejected */
+typedef void (*b_frame_handler_t)(struct b_frame_class *pframe, uint8_t err);
+
+typedef struct b_frame_class {
+	b_frame_t frame_info;
+	struct frame_data frame;
+	UART_HandleTypeDef *uart;
+	b_frame_handler_t handler;
+	/* parser state, carried over from one span to the next */
+	protocol_status_type_e state;
+	uint16_t pos;
+	uint8_t xor;
+	struct b_frame_stats stats;
+} b_frame_class_t;
+
 typedef enum protocol_cmd_type {
 	CMD_EEPROM_WP = 0x90,
 	CMD_GPIO = 0x91,
@@ -66,6 +89,7 @@ typedef enum protocol_cmd_type {
 	CMD_SET_TIME = 0x97,
 	CMD_SET_FAN_DUTY = 0x98,
 	CMD_SPI_SLV_WL = 0x99,
+	CMD_BATCH = 0x9a,
 	CMD_GET_DATE = 0xA6,
 	CMD_GET_TIME = 0xA7,
 	CMD_GET_FAN_DUTY = 0xa8,
@@ -73,10 +97,32 @@ typedef enum protocol_cmd_type {
 	CMD_RES = 0xb0
 }protocol_cmd_type_t;
 
-uint8_t es_frame_init(b_frame_class_t *pframe, b_frame_t *pframeinit);
-uint8_t es_check_head(b_frame_class_t *pframe);
-uint8_t es_get_cmd_and_data(b_frame_class_t *pframe);
-uint8_t es_check_tail(b_frame_class_t *pframe);
-uint8_t es_frame_put(b_frame_class_t *pframe, uint8_t *dat, uint32_t len);
+/*
+ * CMD_BATCH carries several set commands in one frame, as a list of TLVs:
+ * type (CMD_SET_IP, CMD_SET_NETMASK, CMD_SET_GATWAY, CMD_SET_MAC, CMD_SET_DATE,
+ * CMD_SET_TIME), length, and the payload of the single frame command, except
+ * that the year of CMD_SET_DATE is big endian. Every TLV is checked before any
+ * is applied. The date and time go to the RTC first, then the network settings
+ * and the MAC are written to the EEPROM once, and are on it before the reply,
+ * one CMD_BATCH frame with struct batch_status. A failure while applying stops
+ * there and can leave the batch partly applied: applied tells what took
+ * effect. A failed EEPROM write is reported at the first network or MAC TLV,
+ * without their applied bits.
+ */
+#define BATCH_APPLIED_NET	(1 << 0)
+#define BATCH_APPLIED_MAC	(1 << 1)
+#define BATCH_APPLIED_DATE	(1 << 2)
+#define BATCH_APPLIED_TIME	(1 << 3)
+
+struct batch_status {
+	uint8_t result;		// 0 ok, 1 failed
+	uint8_t index;		// TLV that failed, 0xff if none
+	uint8_t applied;	// BATCH_APPLIED_*, what took effect before a failure
+} __attribute__((packed));
+
+uint8_t es_frame_init(b_frame_class_t *pframe, b_frame_t *pframeinit, b_frame_handler_t handler);
+void es_frame_reset(b_frame_class_t *pframe);
+void es_frame_parse(b_frame_class_t *pframe, const uint8_t *dat, uint32_t len);
+void protocol_get_stats(struct b_frame_stats *stats);
 
 #endif
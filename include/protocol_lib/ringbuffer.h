@@ -2,31 +2,47 @@
 #define _RING_BUF_H_
 
 #include <stdint.h>
-// #include <stdio.h>
-// #include <stdlib.h>
-// #include <string.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/*
+ * Single producer, single consumer byte ring. The size is a power of two and
+ * the indices run free, so head - tail is the fill level and no flag is needed
+ * to tell full from empty. Only the producer moves head and only the consumer
+ * moves tail; each side publishes its index with release ordering after the
+ * data access and loads the other one with acquire ordering, which is all the
+ * locking needed between an ISR (or a DMA stream) and a task.
+ *
+ * Both sides can work in place: get a contiguous span, fill or parse it, then
+ * commit how much of it was used.
+ *
+ * A DMA producer cannot be held back, it commits what the hardware wrote and
+ * the consumer sees ring_buf_len() > size when it was lapped.
+ */
 typedef struct {
-    uint8_t *pHead;
-    uint8_t *pTail;
-    uint8_t *pWrite;
-    uint8_t *pRead;
-    uint8_t is_full; // New member to indicate if the ring buffer is full
-}ring_buf_t;
-
-uint8_t ring_buf_init(ring_buf_t *r, uint32_t size);
-void ring_buf_free(ring_buf_t *r);
-void ring_buf_clr(ring_buf_t *r);
-int32_t get_ring_buf_len(ring_buf_t *r);
-int32_t get_ring_buf_free_space(ring_buf_t *r);
-int32_t write_ring_buf(ring_buf_t *r, uint8_t *pBuff, uint32_t len);
-int32_t read_ring_buf(ring_buf_t *r, uint8_t *pBuff, uint32_t len);
-uint32_t ring_buf_check_get(ring_buf_t *r, uint8_t *buf, uint32_t len);
-int ring_buf_clr_len(ring_buf_t *r, uint32_t len);
+	uint8_t *buf;
+	uint32_t mask;		// size - 1
+	volatile uint32_t head;	// producer write index, free running
+	volatile uint32_t tail;	// consumer read index, free running
+} ring_buf_t;
+
+uint8_t ring_buf_init(ring_buf_t *r, uint8_t *buf, uint32_t size);
+uint32_t ring_buf_size(const ring_buf_t *r);
+
+/* producer side */
+uint32_t ring_buf_write_span(ring_buf_t *r, uint8_t **span);
+void ring_buf_write_commit(ring_buf_t *r, uint32_t len);
+uint32_t ring_buf_write(ring_buf_t *r, const uint8_t *data, uint32_t len);
+uint32_t ring_buf_write_realign(ring_buf_t *r);
+
+/* consumer side */
+uint32_t ring_buf_len(const ring_buf_t *r);
+uint32_t ring_buf_peek_span(ring_buf_t *r, const uint8_t **span);
+void ring_buf_read_commit(ring_buf_t *r, uint32_t len);
+uint32_t ring_buf_read(ring_buf_t *r, uint8_t *data, uint32_t len);
+void ring_buf_read_seek(ring_buf_t *r, uint32_t index);
 
 #ifdef __cplusplus
 }
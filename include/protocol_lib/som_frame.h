@@ -0,0 +1,89 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Byte stream decoder/encoder for the MCU <-> SOM UART4 frames.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#ifndef _SOM_FRAME_H_
+#define _SOM_FRAME_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "hf_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Two frame formats share the link, both little-endian:
+ *
+ * legacy: the fixed size Message, FRAME_HEADER ... XOR checksum, FRAME_TAIL.
+ *
+ * crc:    header   u32  FRAME_HEADER_CRC
+ *         id       u32  xTaskToNotify
+ *         msg_type u8
+ *         cmd_type u8
+ *         result   u8
+ *         data_len u8   <= FRAME_DATA_MAX
+ *         data     data_len bytes
+ *         crc      u32  over id..data
+ *         tail     u32  FRAME_TAIL
+ *
+ * The crc is the STM32 CRC unit one (CRC-32/MPEG-2, poly 0x04C11DB7, init
+ * 0xFFFFFFFF, no reflection, no final xor) fed with little-endian words, the
+ * last word zero padded.
+ *
+ * The MCU sends legacy frames until a valid crc frame has been received from
+ * the SOM daemon, a crc capable daemon always answers with crc frames.
+ *
+ * Both formats share the first 12 bytes with Message, so frames are assembled
+ * in buffers from the caller's pool and handed out in place as a Message.
+ */
+#define FRAME_HEADER		0xA55AAA55
+#define FRAME_HEADER_CRC	0xA55AAA5C
+#define FRAME_TAIL		0xBDBABDBA
+
+#define SOM_FRAME_CRC_OVERHEAD	20
+#define SOM_FRAME_MAX_LEN	(sizeof(Message) > SOM_FRAME_CRC_OVERHEAD + FRAME_DATA_MAX ? \
+				 sizeof(Message) : SOM_FRAME_CRC_OVERHEAD + FRAME_DATA_MAX)
+
+struct som_frame_stats {
+	uint32_t frames;	// valid frames decoded
+	uint32_t crc_err;	// crc or legacy checksum mismatch
+	uint32_t len_err;	// data_len over FRAME_DATA_MAX
+	uint32_t tail_err;	// tail magic mismatch
+	uint32_t resync;	// header hunts started after an error
+	uint32_t dropped;	// bytes discarded while hunting for a header
+	uint32_t nobuf;		// valid frames dropped, no free buffer to go on with
+};
+
+/* returns a free buffer of SOM_FRAME_MAX_LEN bytes, NULL if there is none */
+typedef uint8_t *(*som_frame_alloc_t)(void *arg);
+/* called for every valid frame, the handler owns msg from now on */
+typedef void (*som_frame_handler_t)(Message *msg, int crc, void *arg);
+
+struct som_frame_decoder {
+	uint8_t *buf;		// frame being assembled
+	uint16_t len;
+	struct som_frame_stats stats;
+	som_frame_alloc_t alloc;
+	som_frame_handler_t handler;
+	void *arg;
+};
+
+void som_frame_init(void);
+uint32_t som_frame_crc32(const uint8_t *p, uint32_t len);
+void som_frame_decoder_init(struct som_frame_decoder *dec, som_frame_alloc_t alloc,
+			    som_frame_handler_t handler, void *arg);
+void som_frame_decoder_reset(struct som_frame_decoder *dec);
+void som_frame_decoder_flush(struct som_frame_decoder *dec);
+void som_frame_decode(struct som_frame_decoder *dec, const uint8_t *data, size_t len);
+size_t som_frame_encode(const Message *msg, int crc, uint8_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,835 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Simulated clock, FreeRTOS and HAL for the host build of the I2C layer.
+ *
+ * The firmware runs as the only task. Transfers started with the HAL _IT calls
+ * complete from a simulated interrupt after the time the bytes take on the
+ * wire, timers and pended functions run as the timer task, and a blocking call
+ * runs these events in time order until it can return. The timer task can be
+ * made late, and its commands dropped as if its queue were full. The I2C
+ * driver task is a coroutine of its own, run ahead of everything else while it
+ * has notifications, as the highest priority task would be.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include "timers.h"
+#include "cmsis_os.h"
+#include "main.h"
+#include "hf_i2c.h"
+#include "i2c_sim.h"
+
+#define CYCLES_PER_US		(SIM_CORE_HZ / 1000000U)
+#define CYCLES_PER_TICK		(SIM_CORE_HZ / configTICK_RATE_HZ)
+/* cpu time of the interrupt handlers of one byte */
+#define BYTE_ISR_US		2
+/* HAL _IT calls spin up to 25 ms on a busy bus before giving up */
+#define HAL_BUSY_FLAG_US	25000
+#define MAX_TIMERS		8
+#define MAX_PENDED		8
+#define MAX_SEMS		16
+#define TASK_STACK		(64 * 1024)
+
+uint32_t SystemCoreClock = SIM_CORE_HZ;
+CoreDebug_Type sim_core_debug;
+GPIO_TypeDef sim_gpioa = { .name = 'A' }, sim_gpiob = { .name = 'B' }, sim_gpioc = { .name = 'C' };
+GPIO_TypeDef sim_gpiod = { .name = 'D' }, sim_gpioe = { .name = 'E' };
+I2C_TypeDef sim_i2c1 = { .id = 1 }, sim_i2c2 = { .id = 2 }, sim_i2c3 = { .id = 3 };
+I2C_HandleTypeDef hi2c1, hi2c3;
+
+static uint64_t now_cycles;
+static int in_isr;
+static DWT_Type dwt;
+static uint32_t rng = 1;
+
+struct sim_sem {
+	int count;
+	int max;
+};
+
+struct sim_timer {
+	TimerCallbackFunction_t cb;
+	void *id;
+	TickType_t period;
+	int armed;
+	uint64_t expiry;
+};
+
+static struct sim_sem sems[MAX_SEMS];
+static int nsems;
+static struct sim_timer timers[MAX_TIMERS];
+static int ntimers;
+static struct {
+	PendedFunction_t fn;
+	void *arg1;
+	uint32_t arg2;
+} pended[MAX_PENDED];
+static int npended;
+static uint32_t notified;
+/* the driver task, switched to by sim_step() */
+static struct {
+	ucontext_t ctx;
+	ucontext_t caller;
+	TaskFunction_t fn;
+	void *arg;
+	uint32_t value;		// notification bits
+	int waiting;		// in xTaskNotifyWait()
+	int running;
+	uint32_t runs;
+} drv;
+static uint32_t timer_drop_ppm;
+static uint64_t timer_late_cycles;
+static struct sim_timer_stats timer_stats;
+
+/* a transfer on the wire, decided at the address phase, delivered at the stop */
+struct sim_bus {
+	I2C_HandleTypeDef *hi2c;
+	GPIO_TypeDef *scl_port;
+	uint16_t scl_pin;
+	GPIO_TypeDef *sda_port;
+	uint16_t sda_pin;
+	int active;
+	int hung;
+	uint64_t done_at;
+	struct sim_dev *dev;
+	int mem;		// Mem_ call, the register is sent first
+	int read;
+	uint8_t reg;
+	uint8_t *data;
+	uint16_t size;
+	uint32_t error;
+	uint8_t sda_hold;	// SCL clocks until the slave lets SDA go
+	uint8_t scl_last;
+	struct sim_bus_stats stats;
+};
+
+static struct sim_bus buses[] = {
+	{ .hi2c = &hi2c1, .scl_port = &sim_gpiob, .scl_pin = GPIO_PIN_6,
+	  .sda_port = &sim_gpiob, .sda_pin = GPIO_PIN_7, .scl_last = 1 },
+	{ .hi2c = &hi2c3, .scl_port = &sim_gpioa, .scl_pin = GPIO_PIN_8,
+	  .sda_port = &sim_gpioc, .sda_pin = GPIO_PIN_9, .scl_last = 1 },
+};
+#define NBUSES	(sizeof(buses) / sizeof(buses[0]))
+
+static struct sim_dev *devs;
+
+void sim_assert(const char *file, int line)
+{
+	fprintf(stderr, "sim: assert at %s:%d\n", file, line);
+	abort();
+}
+
+uint32_t sim_random(void)
+{
+	/* xorshift32 */
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+static int sim_chance(uint32_t ppm)
+{
+	return ppm && sim_random() % 1000000 < ppm;
+}
+
+uint64_t sim_now_us(void)
+{
+	return now_cycles / CYCLES_PER_US;
+}
+
+static void sim_advance_to(uint64_t cycles)
+{
+	if (cycles > now_cycles)
+		now_cycles = cycles;
+}
+
+DWT_Type *sim_dwt(void)
+{
+	/* a read in a loop costs a few cycles */
+	now_cycles += 4;
+	dwt.CYCCNT = (uint32_t)now_cycles;
+	return &dwt;
+}
+
+static struct sim_bus *sim_bus_of(I2C_HandleTypeDef *hi2c)
+{
+	for (int i = 0; i < NBUSES; i++)
+		if (buses[i].hi2c == hi2c)
+			return &buses[i];
+	return NULL;
+}
+
+static void sim_bus_complete(struct sim_bus *bus)
+{
+	I2C_HandleTypeDef *hi2c = bus->hi2c;
+	struct sim_dev *dev = bus->dev;
+
+	bus->active = 0;
+	if (!bus->error && dev) {
+		if (bus->read) {
+			if (bus->mem)
+				dev->ops->write(dev, &bus->reg, 1);
+			dev->ops->read(dev, bus->data, bus->size);
+			dev->stats.read_bytes += bus->size;
+			if (sim_chance(dev->fault_ppm[SIM_FAULT_FLIP])) {
+				dev->stats.injected[SIM_FAULT_FLIP]++;
+				bus->data[sim_random() % bus->size] ^= 1u << (sim_random() % 8);
+			}
+		} else {
+			uint8_t buf[1 + 256];
+			int len = 0;
+
+			if (bus->mem)
+				buf[len++] = bus->reg;
+			memcpy(&buf[len], bus->data, bus->size);
+			len += bus->size;
+			if (!dev->ops->write(dev, buf, len))
+				bus->error = HAL_I2C_ERROR_AF;
+			dev->stats.write_bytes += len;
+		}
+	}
+
+	hi2c->State = HAL_I2C_STATE_READY;
+	hi2c->ErrorCode = bus->error;
+	in_isr = 1;
+	if (bus->error)
+		HAL_I2C_ErrorCallback(hi2c);
+	else if (bus->mem)
+		bus->read ? HAL_I2C_MemRxCpltCallback(hi2c) : HAL_I2C_MemTxCpltCallback(hi2c);
+	else
+		bus->read ? HAL_I2C_MasterRxCpltCallback(hi2c) : HAL_I2C_MasterTxCpltCallback(hi2c);
+	in_isr = 0;
+}
+
+/* run the next event due by limit, 0 if there is none */
+static int sim_step(uint64_t limit)
+{
+	struct sim_timer *timer = NULL;
+	struct sim_bus *bus = NULL;
+	uint64_t next = UINT64_MAX;
+	PendedFunction_t fn;
+	void *arg1;
+	uint32_t arg2;
+
+	if (drv.waiting && drv.value && !drv.running) {
+		drv.running = 1;
+		drv.runs++;
+		swapcontext(&drv.caller, &drv.ctx);
+		drv.running = 0;
+		return 1;
+	}
+	if (npended) {
+		fn = pended[0].fn;
+		arg1 = pended[0].arg1;
+		arg2 = pended[0].arg2;
+		memmove(&pended[0], &pended[1], --npended * sizeof(pended[0]));
+		fn(arg1, arg2);
+		return 1;
+	}
+	for (int i = 0; i < NBUSES; i++) {
+		if (buses[i].active && !buses[i].hung && buses[i].done_at < next) {
+			next = buses[i].done_at;
+			bus = &buses[i];
+		}
+	}
+	for (int i = 0; i < ntimers; i++) {
+		if (timers[i].armed && timers[i].expiry < next) {
+			next = timers[i].expiry;
+			timer = &timers[i];
+			bus = NULL;
+		}
+	}
+	if (UINT64_MAX == next || next > limit)
+		return 0;
+
+	sim_advance_to(next);
+	if (bus) {
+		sim_bus_complete(bus);
+	} else {
+		timer->armed = 0;
+		timer_stats.expired++;
+		timer->cb(timer);
+	}
+	return 1;
+}
+
+/* run the events due until the deadline, or until *cond is set */
+static int sim_run_until(uint64_t deadline, const int *cond)
+{
+	while (!cond || !*cond) {
+		if (!sim_step(deadline)) {
+			if (UINT64_MAX == deadline) {
+				fprintf(stderr, "sim: deadlock, the firmware waits for an event that never comes\n");
+				abort();
+			}
+			sim_advance_to(deadline);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+void sim_run_ms(uint32_t ms)
+{
+	sim_run_until(now_cycles + (uint64_t)ms * CYCLES_PER_TICK, NULL);
+}
+
+/* FreeRTOS */
+BaseType_t xPortIsInsideInterrupt(void)
+{
+	return in_isr;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	return (TickType_t)(now_cycles / CYCLES_PER_TICK);
+}
+
+TickType_t xTaskGetTickCountFromISR(void)
+{
+	return xTaskGetTickCount();
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	return drv.running ? (TaskHandle_t)&drv : &notified;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+	notified++;
+	return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t timeout)
+{
+	uint32_t n = notified;
+
+	notified = clear ? 0 : (n ? n - 1 : 0);
+	return n;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+	configASSERT(&drv == task && eSetBits == action);
+	drv.value |= value;
+	return pdPASS;
+}
+
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, eNotifyAction action,
+			      BaseType_t *woken)
+{
+	if (woken)
+		*woken = pdTRUE;
+	return xTaskNotify(task, value, action);
+}
+
+/* the driver task blocks until notified, the firmware task goes on meanwhile */
+BaseType_t xTaskNotifyWait(uint32_t clear_entry, uint32_t clear_exit, uint32_t *value,
+			   TickType_t timeout)
+{
+	configASSERT(drv.running && portMAX_DELAY == timeout);
+	drv.value &= ~clear_entry;
+	while (!drv.value) {
+		drv.waiting = 1;
+		swapcontext(&drv.ctx, &drv.caller);
+		drv.waiting = 0;
+	}
+	if (value)
+		*value = drv.value;
+	drv.value &= ~clear_exit;
+	return pdTRUE;
+}
+
+static void sim_task_entry(void)
+{
+	drv.fn(drv.arg);
+	sim_assert(__FILE__, __LINE__);
+}
+
+/* start the driver task, it runs until it first waits */
+static void sim_task_start(TaskFunction_t fn, void *arg)
+{
+	getcontext(&drv.ctx);
+	drv.ctx.uc_stack.ss_sp = malloc(TASK_STACK);
+	drv.ctx.uc_stack.ss_size = TASK_STACK;
+	drv.ctx.uc_link = NULL;
+	configASSERT(drv.ctx.uc_stack.ss_sp);
+	makecontext(&drv.ctx, sim_task_entry, 0);
+	drv.fn = fn;
+	drv.arg = arg;
+	drv.running = 1;
+	swapcontext(&drv.caller, &drv.ctx);
+	drv.running = 0;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+	sim_run_ms(ticks);
+}
+
+osStatus_t osDelay(uint32_t ticks)
+{
+	sim_run_ms(ticks);
+	return osOK;
+}
+
+static SemaphoreHandle_t sim_sem_create(int count, int max)
+{
+	configASSERT(nsems < MAX_SEMS);
+	sems[nsems].count = count;
+	sems[nsems].max = max;
+	return &sems[nsems++];
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+	return sim_sem_create(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+	return sim_sem_create(0, 1);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t timeout)
+{
+	uint64_t deadline;
+
+	configASSERT(!in_isr);
+	if (!sem->count && timeout) {
+		/* the only task blocks: run the interrupts and timers that could give it */
+		deadline = portMAX_DELAY == timeout ? UINT64_MAX :
+			   now_cycles + (uint64_t)timeout * CYCLES_PER_TICK;
+		sim_run_until(deadline, &sem->count);
+	}
+	if (!sem->count)
+		return pdFALSE;
+	sem->count--;
+	return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+	if (sem->count >= sem->max)
+		return pdFALSE;
+	sem->count++;
+	return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken)
+{
+	if (woken)
+		*woken = pdTRUE;
+	return xSemaphoreGive(sem);
+}
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t reload,
+			   void *id, TimerCallbackFunction_t cb)
+{
+	configASSERT(ntimers < MAX_TIMERS && !reload);
+	timers[ntimers].cb = cb;
+	timers[ntimers].id = id;
+	timers[ntimers].period = period;
+	return &timers[ntimers++];
+}
+
+void *pvTimerGetTimerID(TimerHandle_t timer)
+{
+	return timer->id;
+}
+
+/* a command that does not fit in the timer queue */
+static int sim_timer_drop(void)
+{
+	if (!sim_chance(timer_drop_ppm))
+		return 0;
+	timer_stats.dropped++;
+	return 1;
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t wait)
+{
+	if (sim_timer_drop())
+		return pdFAIL;
+	/* a tick timer expires on the tick boundary, the callback runs when the timer task gets to it */
+	timer->period = period;
+	timer->expiry = ((now_cycles / CYCLES_PER_TICK) + period) * CYCLES_PER_TICK + timer_late_cycles;
+	timer->armed = 1;
+	return pdPASS;
+}
+
+BaseType_t xTimerChangePeriodFromISR(TimerHandle_t timer, TickType_t period, BaseType_t *woken)
+{
+	return xTimerChangePeriod(timer, period, 0);
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t wait)
+{
+	if (sim_timer_drop())
+		return pdFAIL;
+	timer->armed = 0;
+	return pdPASS;
+}
+
+BaseType_t xTimerStopFromISR(TimerHandle_t timer, BaseType_t *woken)
+{
+	return xTimerStop(timer, 0);
+}
+
+BaseType_t xTimerPendFunctionCall(PendedFunction_t fn, void *arg1, uint32_t arg2, TickType_t wait)
+{
+	if (npended >= MAX_PENDED || sim_timer_drop())
+		return pdFAIL;
+	pended[npended].fn = fn;
+	pended[npended].arg1 = arg1;
+	pended[npended].arg2 = arg2;
+	npended++;
+	return pdPASS;
+}
+
+BaseType_t xTimerPendFunctionCallFromISR(PendedFunction_t fn, void *arg1, uint32_t arg2,
+					 BaseType_t *woken)
+{
+	return xTimerPendFunctionCall(fn, arg1, arg2, 0);
+}
+
+/* GPIO, the i2c pins are open drain with pull-ups, a slave can hold SDA low */
+void HAL_GPIO_Init(GPIO_TypeDef *port, GPIO_InitTypeDef *init)
+{
+	if (GPIO_MODE_AF_OD == init->Mode)
+		port->af |= init->Pin;
+	else
+		port->af &= ~init->Pin;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state)
+{
+	struct sim_bus *bus;
+
+	if (GPIO_PIN_SET == state)
+		port->ODR |= pin;
+	else
+		port->ODR &= ~pin;
+
+	for (int i = 0; i < NBUSES; i++) {
+		bus = &buses[i];
+		if (port != bus->scl_port || pin != bus->scl_pin)
+			continue;
+		/* a rising edge of SCL clocks one bit out of a stuck slave */
+		if (state && !bus->scl_last) {
+			bus->stats.clocks++;
+			if (bus->sda_hold)
+				bus->sda_hold--;
+		}
+		bus->scl_last = state;
+	}
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *port, uint16_t pin)
+{
+	for (int i = 0; i < NBUSES; i++)
+		if (port == buses[i].sda_port && pin == buses[i].sda_pin && buses[i].sda_hold)
+			return GPIO_PIN_RESET;
+	return (port->ODR & pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+/* I2C */
+static void sim_bus_cancel(struct sim_bus *bus)
+{
+	bus->active = 0;
+	bus->hung = 0;
+}
+
+void sim_i2c_disable(I2C_HandleTypeDef *hi2c)
+{
+	struct sim_bus *bus = sim_bus_of(hi2c);
+
+	hi2c->Instance->CR1 &= ~I2C_CR1_PE;
+	if (bus)
+		sim_bus_cancel(bus);
+}
+
+int sim_i2c_get_flag(I2C_HandleTypeDef *hi2c, uint32_t flag)
+{
+	struct sim_bus *bus = sim_bus_of(hi2c);
+
+	if (I2C_FLAG_BUSY != flag || !bus)
+		return 0;
+	return bus->active || bus->sda_hold;
+}
+
+void HAL_I2C_MspInit(I2C_HandleTypeDef *hi2c)
+{
+	struct sim_bus *bus = sim_bus_of(hi2c);
+	GPIO_InitTypeDef gpio = {
+		.Mode = GPIO_MODE_AF_OD,
+	};
+
+	if (!bus)
+		return;
+	gpio.Pin = bus->scl_pin;
+	HAL_GPIO_Init(bus->scl_port, &gpio);
+	gpio.Pin = bus->sda_pin;
+	HAL_GPIO_Init(bus->sda_port, &gpio);
+}
+
+HAL_StatusTypeDef HAL_I2C_Init(I2C_HandleTypeDef *hi2c)
+{
+	struct sim_bus *bus = sim_bus_of(hi2c);
+
+	if (HAL_I2C_STATE_RESET == hi2c->State) {
+		hi2c->Lock = HAL_UNLOCKED;
+		HAL_I2C_MspInit(hi2c);
+	}
+	if (bus) {
+		sim_bus_cancel(bus);
+		bus->stats.inits++;
+	}
+	hi2c->Instance->CR1 |= I2C_CR1_PE;
+	hi2c->ErrorCode = HAL_I2C_ERROR_NONE;
+	hi2c->State = HAL_I2C_STATE_READY;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_DeInit(I2C_HandleTypeDef *hi2c)
+{
+	sim_i2c_disable(hi2c);
+	hi2c->State = HAL_I2C_STATE_RESET;
+	return HAL_OK;
+}
+
+void i2c_init(I2C_TypeDef *Instance)
+{
+	I2C_HandleTypeDef *hi2c = I2C1 == Instance ? &hi2c1 : &hi2c3;
+
+	hi2c->Instance = Instance;
+	hi2c->Init.ClockSpeed = I2C1 == Instance ? HF_I2C1_CLOCK_SPEED : HF_I2C3_CLOCK_SPEED;
+	HAL_I2C_Init(hi2c);
+}
+
+void i2c_deinit(I2C_TypeDef *Instance)
+{
+	HAL_I2C_DeInit(I2C1 == Instance ? &hi2c1 : &hi2c3);
+}
+
+static struct sim_dev *sim_dev_at(int bus, uint8_t addr)
+{
+	for (struct sim_dev *dev = devs; dev; dev = dev->next)
+		if (dev->bus == bus && dev->addr == addr)
+			return dev;
+	return NULL;
+}
+
+/* bytes on the wire, with the start, repeated start and stop */
+static uint64_t sim_wire_cycles(struct sim_bus *bus, int bytes, int starts)
+{
+	uint64_t bits = bytes * 9 + starts * 2 + 1;
+
+	return bits * SIM_CORE_HZ / bus->hi2c->Init.ClockSpeed + bytes * BYTE_ISR_US * CYCLES_PER_US;
+}
+
+static HAL_StatusTypeDef sim_i2c_start(I2C_HandleTypeDef *hi2c, uint16_t addr, int mem,
+				       uint16_t reg, uint8_t *data, uint16_t size, int read)
+{
+	struct sim_bus *bus = sim_bus_of(hi2c);
+	struct sim_dev *dev;
+	int bytes = 1 + size + (mem ? 1 : 0) + (mem && read ? 1 : 0);
+	int starts = mem && read ? 2 : 1;
+	uint32_t r;
+
+	if (!bus || HAL_I2C_STATE_READY != hi2c->State || !(hi2c->Instance->CR1 & I2C_CR1_PE))
+		return HAL_BUSY;
+	if (bus->sda_hold) {
+		/* the HAL waits for BUSY to clear before giving up */
+		bus->stats.busy_errors++;
+		sim_advance_to(now_cycles + (uint64_t)HAL_BUSY_FLAG_US * CYCLES_PER_US);
+		hi2c->ErrorCode |= HAL_I2C_ERROR_TIMEOUT;
+		return HAL_ERROR;
+	}
+
+	dev = sim_dev_at(bus - buses == 0 ? 1 : 3, addr >> 1);
+	bus->active = 1;
+	bus->hung = 0;
+	bus->dev = dev;
+	bus->mem = mem;
+	bus->read = read;
+	bus->reg = reg;
+	bus->data = data;
+	bus->size = size;
+	bus->error = 0;
+	hi2c->State = read ? HAL_I2C_STATE_BUSY_RX : HAL_I2C_STATE_BUSY_TX;
+	hi2c->ErrorCode = HAL_I2C_ERROR_NONE;
+	hi2c->Instance->CR2 |= I2C_IT_EVT | I2C_IT_BUF | I2C_IT_ERR;
+	bus->stats.xfers++;
+
+	if (!dev) {
+		bus->error = HAL_I2C_ERROR_AF;
+		bytes = 1;
+	} else {
+		dev->stats.xfers++;
+		r = sim_random() % 1000000;
+		/* one draw per transfer, the fault kinds share it */
+		for (int k = 0; k < SIM_FAULT_MAX; k++) {
+			/* a flip is drawn on the data, a slave only gets stuck sending */
+			if (SIM_FAULT_FLIP == k || (SIM_FAULT_STUCK == k && !read))
+				continue;
+			if (r < dev->fault_ppm[k]) {
+				dev->stats.injected[k]++;
+				if (SIM_FAULT_NACK == k) {
+					bus->error = HAL_I2C_ERROR_AF;
+					bytes = 1;
+				} else if (SIM_FAULT_BERR == k || SIM_FAULT_ARLO == k) {
+					bus->error = SIM_FAULT_BERR == k ? HAL_I2C_ERROR_BERR :
+						     HAL_I2C_ERROR_ARLO;
+					bytes = 1 + sim_random() % bytes;
+				} else if (SIM_FAULT_TIMEOUT == k) {
+					bus->hung = 1;
+				} else if (SIM_FAULT_STUCK == k) {
+					bus->hung = 1;
+					bus->sda_hold = 1 + sim_random() % 9;
+				}
+				break;
+			}
+			r -= dev->fault_ppm[k];
+		}
+		if (!bus->error && !bus->hung && !dev->ops->addr(dev)) {
+			dev->stats.nacks++;
+			bus->error = HAL_I2C_ERROR_AF;
+			bytes = 1;
+		}
+	}
+	bus->done_at = now_cycles + sim_wire_cycles(bus, bytes, starts);
+	bus->stats.busy_us += sim_wire_cycles(bus, bytes, starts) / CYCLES_PER_US;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Master_Transmit_IT(I2C_HandleTypeDef *hi2c, uint16_t addr,
+					    uint8_t *data, uint16_t size)
+{
+	/* the first byte is the register pointer */
+	if (!size)
+		return HAL_ERROR;
+	return sim_i2c_start(hi2c, addr, 1, data[0], data + 1, size - 1, 0);
+}
+
+HAL_StatusTypeDef HAL_I2C_Master_Receive_IT(I2C_HandleTypeDef *hi2c, uint16_t addr,
+					   uint8_t *data, uint16_t size)
+{
+	return sim_i2c_start(hi2c, addr, 0, 0, data, size, 1);
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Write_IT(I2C_HandleTypeDef *hi2c, uint16_t addr, uint16_t reg,
+				      uint16_t reg_size, uint8_t *data, uint16_t size)
+{
+	return sim_i2c_start(hi2c, addr, 1, reg, data, size, 0);
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read_IT(I2C_HandleTypeDef *hi2c, uint16_t addr, uint16_t reg,
+				     uint16_t reg_size, uint8_t *data, uint16_t size)
+{
+	return sim_i2c_start(hi2c, addr, 1, reg, data, size, 1);
+}
+
+void sim_get_bus_stats(int bus, struct sim_bus_stats *stats)
+{
+	*stats = buses[1 == bus ? 0 : 1].stats;
+}
+
+/**
+ * @brief  Make the timer task misbehave.
+ * @param  drop_ppm timer commands failing as if the queue were full, in parts per million
+ * @param  late_ms timer callbacks run this much after the expiry, a starved timer task
+ */
+void sim_timer_faults(uint32_t drop_ppm, uint32_t late_ms)
+{
+	timer_drop_ppm = drop_ppm;
+	timer_late_cycles = (uint64_t)late_ms * CYCLES_PER_TICK;
+}
+
+void sim_get_timer_stats(struct sim_timer_stats *stats)
+{
+	*stats = timer_stats;
+	stats->driver_runs = drv.runs;
+}
+
+void sim_dev_add(struct sim_dev *dev)
+{
+	struct sim_dev **p = &devs;
+
+	while (*p)
+		p = &(*p)->next;
+	*p = dev;
+}
+
+struct sim_dev *sim_dev_find(const char *name)
+{
+	for (struct sim_dev *dev = devs; dev; dev = dev->next)
+		if (!strcmp(dev->name, name))
+			return dev;
+	return NULL;
+}
+
+/**
+ * @brief  Set fault rates from "dev:kind=prob[,kind=prob...]", dev may be "all".
+ * @retval 0, -1 if the spec is malformed
+ */
+int sim_fault_parse(const char *spec)
+{
+	static const char *kinds[SIM_FAULT_MAX] = {
+		"nack", "timeout", "berr", "arlo", "flip", "stuck",
+	};
+	char buf[128], *name, *item, *save, *eq;
+	struct sim_dev *dev;
+	double prob;
+	int k;
+
+	snprintf(buf, sizeof(buf), "%s", spec);
+	name = buf;
+	item = strchr(buf, ':');
+	if (!item)
+		return -1;
+	*item++ = '\0';
+	if (strcmp(name, "all") && !sim_dev_find(name))
+		return -1;
+
+	for (item = strtok_r(item, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+		eq = strchr(item, '=');
+		if (!eq)
+			return -1;
+		*eq = '\0';
+		for (k = 0; k < SIM_FAULT_MAX && strcmp(kinds[k], item); k++)
+			;
+		prob = atof(eq + 1);
+		if (SIM_FAULT_MAX == k || prob < 0 || prob > 1)
+			return -1;
+		for (dev = devs; dev; dev = dev->next)
+			if (!strcmp(name, "all") || !strcmp(name, dev->name))
+				dev->fault_ppm[k] = (uint32_t)(prob * 1000000);
+	}
+	return 0;
+}
+
+void sim_init(uint32_t seed)
+{
+	rng = seed ? seed : 1;
+	i2c_init(I2C1);
+	i2c_init(I2C3);
+	/* the write protect pin idles high */
+	HAL_GPIO_WritePin(EEPROM_WP_GPIO_Port, EEPROM_WP_Pin, GPIO_PIN_SET);
+	HAL_GPIO_WritePin(buses[0].scl_port, buses[0].scl_pin, GPIO_PIN_SET);
+	HAL_GPIO_WritePin(buses[1].scl_port, buses[1].scl_pin, GPIO_PIN_SET);
+	HAL_GPIO_WritePin(buses[0].sda_port, buses[0].sda_pin, GPIO_PIN_SET);
+	HAL_GPIO_WritePin(buses[1].sda_port, buses[1].sda_pin, GPIO_PIN_SET);
+	hf_i2c_init();
+	sim_task_start(hf_i2c_task, NULL);
+}
@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Host build of the I2C layer against virtual devices: the simulated clock,
+ * the bus and the AT24C, INA226 and PAC1934 models.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#ifndef __I2C_SIM_H
+#define __I2C_SIM_H
+
+#include <stdint.h>
+
+#include "stm32f4xx_hal.h"
+
+/*
+ * Time only moves when the firmware waits: a blocking take, osDelay() or a
+ * busy wait on the cycle counter runs the pending interrupts and timers in
+ * time order, so a run is deterministic for a given seed and fault set.
+ */
+#define SIM_CORE_HZ		168000000U
+
+uint64_t sim_now_us(void);
+void sim_run_ms(uint32_t ms);
+
+/* faults injected per transfer, in parts per million */
+enum sim_fault {
+	SIM_FAULT_NACK,		// address nacked
+	SIM_FAULT_TIMEOUT,	// transfer never completes
+	SIM_FAULT_BERR,		// misplaced start or stop
+	SIM_FAULT_ARLO,		// arbitration lost
+	SIM_FAULT_FLIP,		// one bit of the read data flipped
+	SIM_FAULT_STUCK,	// reset in the middle of a read, SDA held low
+	SIM_FAULT_MAX,
+};
+
+struct sim_dev;
+
+struct sim_dev_ops {
+	/* address phase, 0 to nack */
+	int (*addr)(struct sim_dev *dev);
+	/* buf[0] is the register pointer, at the stop, 0 if a data byte was nacked */
+	int (*write)(struct sim_dev *dev, const uint8_t *buf, int len);
+	void (*read)(struct sim_dev *dev, uint8_t *buf, int len);
+};
+
+struct sim_dev_stats {
+	uint32_t xfers;
+	uint32_t nacks;		// addresses nacked by the model, injected ones excluded
+	uint32_t read_bytes;
+	uint32_t write_bytes;
+	uint32_t injected[SIM_FAULT_MAX];
+};
+
+struct sim_dev {
+	const char *name;
+	uint8_t bus;		// 1 or 3
+	uint8_t addr;		// 7 bit
+	const struct sim_dev_ops *ops;
+	void *priv;
+	uint32_t fault_ppm[SIM_FAULT_MAX];
+	struct sim_dev_stats stats;
+	struct sim_dev *next;
+};
+
+struct sim_bus_stats {
+	uint32_t xfers;
+	uint64_t busy_us;	// time the bus carried transfers
+	uint32_t busy_errors;	// transfers refused with SDA held low
+	uint32_t inits;		// peripheral (re)initialisations
+	uint32_t clocks;	// SCL pulses sent by hand
+};
+
+struct sim_timer_stats {
+	uint32_t expired;	// callbacks run
+	uint32_t dropped;	// commands failed by sim_timer_faults()
+	uint32_t driver_runs;	// times the I2C driver task was notified and ran
+};
+
+/* what a run of i2c_sim_main.c found, past its printout */
+struct i2c_sim_results {
+	uint32_t eeprom_syncs;
+	uint32_t eeprom_failed;		// syncs that returned an error
+	uint32_t eeprom_mismatched;	// syncs that returned ok, the eeprom unlike the image
+	int eeprom_final_diff;		// bytes off after the faults stop and the last sync
+	int journal_lost;		// the last journal record did not load back
+	int mirror_differs;		// the mirror the loads come from is not the eeprom
+	int32_t energy_err_ppm;		// worst PAC1934 channel energy error
+	uint32_t spikes;
+	uint32_t spikes_alerted;	// reported by the latched INA226 alert
+	uint32_t timeouts;		// both buses
+	uint32_t resets;		// bus recoveries
+	uint32_t recover_failed;
+};
+
+extern struct i2c_sim_results i2c_sim_results;
+int i2c_sim_run(int argc, char **argv);
+
+void sim_init(uint32_t seed);
+void sim_dev_add(struct sim_dev *dev);
+struct sim_dev *sim_dev_find(const char *name);
+int sim_fault_parse(const char *spec);
+void sim_get_bus_stats(int bus, struct sim_bus_stats *stats);
+void sim_timer_faults(uint32_t drop_ppm, uint32_t late_ms);
+void sim_get_timer_stats(struct sim_timer_stats *stats);
+uint32_t sim_random(void);
+
+/* AT24C: page writes roll over inside the page, the address is nacked during tWR */
+struct sim_dev *sim_at24c_create(const char *name, uint8_t bus, uint8_t addr, uint16_t size,
+				 uint8_t page, uint32_t twr_us);
+uint8_t *sim_at24c_mem(struct sim_dev *dev);
+uint32_t sim_at24c_page_writes(struct sim_dev *dev, int page);
+
+/* INA226: conversions complete on the configured averaging and conversion times */
+struct sim_dev *sim_ina226_create(const char *name, uint8_t bus, uint8_t addr, uint32_t shunt_uohm);
+void sim_ina226_set(struct sim_dev *dev, int32_t bus_uv, int32_t current_ua, int32_t noise_ua);
+
+/* PAC1934: sampled at the CTRL rate, readings and accumulators latched by a refresh */
+struct sim_dev *sim_pac1934_create(const char *name, uint8_t bus, uint8_t addr, uint32_t shunt_mohm);
+void sim_pac1934_set(struct sim_dev *dev, int ch, int32_t bus_uv, int32_t current_ua, int32_t noise_ua);
+
+#endif /* __I2C_SIM_H */
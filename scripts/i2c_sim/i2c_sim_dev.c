@@ -0,0 +1,691 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Virtual AT24C eeprom, INA226 and PAC1934 power monitors for the host build
+ * of the I2C layer, modelled on their datasheets as far as the firmware can
+ * tell the difference.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "i2c_sim.h"
+
+static void *sim_zalloc(size_t size)
+{
+	void *p = calloc(1, size);
+
+	if (!p)
+		abort();
+	return p;
+}
+
+static struct sim_dev *sim_dev_create(const char *name, uint8_t bus, uint8_t addr,
+				      const struct sim_dev_ops *ops, void *priv)
+{
+	struct sim_dev *dev = sim_zalloc(sizeof(*dev));
+
+	dev->name = name;
+	dev->bus = bus;
+	dev->addr = addr;
+	dev->ops = ops;
+	dev->priv = priv;
+	sim_dev_add(dev);
+	return dev;
+}
+
+/* gaussian noise for the analog inputs */
+static double sim_noise(double sigma)
+{
+	double u1 = (sim_random() + 1.0) / 4294967297.0;
+	double u2 = (sim_random() + 1.0) / 4294967297.0;
+
+	if (sigma <= 0)
+		return 0;
+	return sigma * sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+/*
+ * AT24C: the word address sets the pointer, data bytes fill the page buffer
+ * and roll over at the end of the page, the stop starts the internal write
+ * cycle and the address is nacked until it is over. Reads run on through the
+ * whole array. With WP high the data bytes are nacked and nothing is written.
+ */
+struct at24c {
+	uint16_t size;
+	uint8_t page;
+	uint32_t twr_us;
+	uint16_t ptr;
+	uint64_t busy_until;
+	uint8_t *mem;
+	uint32_t *page_writes;
+};
+
+static int at24c_addr(struct sim_dev *dev)
+{
+	struct at24c *ee = dev->priv;
+
+	return sim_now_us() >= ee->busy_until;
+}
+
+static int at24c_write(struct sim_dev *dev, const uint8_t *buf, int len)
+{
+	struct at24c *ee = dev->priv;
+	uint16_t base;
+
+	ee->ptr = buf[0] % ee->size;
+	if (len < 2)
+		return 1;
+	if (GPIO_PIN_SET == HAL_GPIO_ReadPin(EEPROM_WP_GPIO_Port, EEPROM_WP_Pin))
+		return 0;
+
+	base = ee->ptr - ee->ptr % ee->page;
+	for (int i = 1; i < len; i++) {
+		ee->mem[ee->ptr] = buf[i];
+		ee->ptr = base + (ee->ptr + 1 - base) % ee->page;
+	}
+	ee->page_writes[base / ee->page]++;
+	ee->busy_until = sim_now_us() + ee->twr_us;
+	return 1;
+}
+
+static void at24c_read(struct sim_dev *dev, uint8_t *buf, int len)
+{
+	struct at24c *ee = dev->priv;
+
+	for (int i = 0; i < len; i++) {
+		buf[i] = ee->mem[ee->ptr];
+		ee->ptr = (ee->ptr + 1) % ee->size;
+	}
+}
+
+static const struct sim_dev_ops at24c_ops = {
+	.addr = at24c_addr,
+	.write = at24c_write,
+	.read = at24c_read,
+};
+
+struct sim_dev *sim_at24c_create(const char *name, uint8_t bus, uint8_t addr, uint16_t size,
+				 uint8_t page, uint32_t twr_us)
+{
+	struct at24c *ee = sim_zalloc(sizeof(*ee));
+
+	ee->size = size;
+	ee->page = page;
+	ee->twr_us = twr_us;
+	ee->mem = sim_zalloc(size);
+	ee->page_writes = sim_zalloc(size / page * sizeof(ee->page_writes[0]));
+	/* an erased part reads all ones */
+	memset(ee->mem, 0xff, size);
+	return sim_dev_create(name, bus, addr, &at24c_ops, ee);
+}
+
+uint8_t *sim_at24c_mem(struct sim_dev *dev)
+{
+	return ((struct at24c *)dev->priv)->mem;
+}
+
+uint32_t sim_at24c_page_writes(struct sim_dev *dev, int page)
+{
+	return ((struct at24c *)dev->priv)->page_writes[page];
+}
+
+/*
+ * INA226: 16 bit big endian registers behind a pointer, a read of more than
+ * two bytes repeats the register. A conversion completes every (bus + shunt
+ * conversion time) * averages, continuously or once per config write in the
+ * triggered mode, the result registers and CVRF are updated then and the
+ * enabled alert function is checked against every result. current = shunt *
+ * cal / 2048, power = current * bus / 20000, as the part computes them. A
+ * result is the mean current over its conversion time, so a spike shorter
+ * than that is averaged down. The noise given is the one of a single 1.1 ms
+ * shunt conversion, it goes down with the square root of the integration time.
+ */
+#define INA226_CONFIG		0x00
+#define INA226_SHUNT		0x01
+#define INA226_BUS		0x02
+#define INA226_POWER		0x03
+#define INA226_CURRENT		0x04
+#define INA226_CAL		0x05
+#define INA226_MASK		0x06
+#define INA226_ALERT		0x07
+#define INA226_MANUF_ID		0xfe
+#define INA226_DIE_ID		0xff
+#define INA226_CONFIG_RESET	0x4127
+#define INA226_SOL		(1u << 15)
+#define INA226_SUL		(1u << 14)
+#define INA226_BOL		(1u << 13)
+#define INA226_BUL		(1u << 12)
+#define INA226_POL		(1u << 11)
+#define INA226_AFF		(1u << 4)
+#define INA226_CVRF		(1u << 3)
+#define INA226_MASK_WRITABLE	0xfc03
+
+#define INA226_STEPS		16
+
+struct ina226 {
+	uint32_t shunt_uohm;
+	int32_t bus_uv;
+	int32_t current_ua;
+	int32_t noise_ua;
+	struct {
+		uint64_t t;
+		int32_t ua;
+	} steps[INA226_STEPS];	// current changes, oldest first
+	int nsteps;
+	uint8_t ptr;
+	uint16_t regs[8];
+	uint64_t conv_start;
+	uint64_t conv_done;	// conversions completed since conv_start
+	uint32_t conversions;
+	uint32_t alerts;	// results past the alert limit
+};
+
+static const uint16_t ina226_avgs[] = { 1, 4, 16, 64, 128, 256, 512, 1024 };
+static const uint16_t ina226_cts[] = { 140, 204, 332, 588, 1100, 2116, 4156, 8244 };
+
+static uint32_t ina226_conv_us(struct ina226 *ina)
+{
+	uint16_t cfg = ina->regs[INA226_CONFIG];
+
+	return (ina226_cts[(cfg >> 6) & 7] + ina226_cts[(cfg >> 3) & 7]) * ina226_avgs[(cfg >> 9) & 7];
+}
+
+static void ina226_reset(struct ina226 *ina)
+{
+	memset(ina->regs, 0, sizeof(ina->regs));
+	ina->regs[INA226_CONFIG] = INA226_CONFIG_RESET;
+	ina->conv_start = sim_now_us();
+	ina->conv_done = 0;
+}
+
+static int ina226_alert(struct ina226 *ina)
+{
+	uint16_t mask = ina->regs[INA226_MASK];
+	int16_t limit = ina->regs[INA226_ALERT];
+
+	if (mask & INA226_SOL)
+		return (int16_t)ina->regs[INA226_SHUNT] > limit;
+	if (mask & INA226_SUL)
+		return (int16_t)ina->regs[INA226_SHUNT] < limit;
+	if (mask & INA226_BOL)
+		return ina->regs[INA226_BUS] > (uint16_t)limit;
+	if (mask & INA226_BUL)
+		return ina->regs[INA226_BUS] < (uint16_t)limit;
+	if (mask & INA226_POL)
+		return ina->regs[INA226_POWER] > (uint16_t)limit;
+	return 0;
+}
+
+/* mean current from start to end, from the recorded steps */
+static double ina226_mean_ua(struct ina226 *ina, uint64_t start, uint64_t end)
+{
+	double sum = 0;
+	int32_t ua = ina->nsteps ? ina->steps[0].ua : ina->current_ua;
+	uint64_t t = start;
+
+	if (end <= start)
+		return ua;
+	for (int i = 0; i < ina->nsteps && ina->steps[i].t < end; i++) {
+		if (ina->steps[i].t > t) {
+			sum += (double)ua * (ina->steps[i].t - t);
+			t = ina->steps[i].t;
+		}
+		ua = ina->steps[i].ua;
+	}
+	sum += (double)ua * (end - t);
+	return sum / (end - start);
+}
+
+static void ina226_convert(struct ina226 *ina, uint64_t end)
+{
+	uint16_t cfg = ina->regs[INA226_CONFIG];
+	double t = ina226_avgs[(cfg >> 9) & 7] * ina226_cts[(cfg >> 3) & 7] / 1100.0;
+	double ua, shunt, bus, current;
+
+	ua = ina226_mean_ua(ina, end - MIN(end, ina226_conv_us(ina)), end) + sim_noise(ina->noise_ua / sqrt(t));
+	shunt = round(ua * ina->shunt_uohm / 1e6 / 2.5);
+	shunt = fmax(fmin(shunt, 32767), -32768);
+	bus = fmin(round(ina->bus_uv / 1250.0), 0x7fff);
+	ina->regs[INA226_SHUNT] = (uint16_t)(int16_t)shunt;
+	ina->regs[INA226_BUS] = (uint16_t)bus;
+	current = trunc(shunt * ina->regs[INA226_CAL] / 2048);
+	ina->regs[INA226_CURRENT] = (uint16_t)(int16_t)current;
+	ina->regs[INA226_POWER] = (uint16_t)fmin(fabs(current) * bus / 20000, 0xffff);
+	ina->regs[INA226_MASK] |= INA226_CVRF;
+	ina->conversions++;
+	if (ina226_alert(ina)) {
+		ina->regs[INA226_MASK] |= INA226_AFF;
+		ina->alerts++;
+	}
+}
+
+/* bring the result registers up to date */
+static void ina226_update(struct ina226 *ina)
+{
+	uint16_t mode = ina->regs[INA226_CONFIG] & 7;
+	uint64_t n;
+
+	/* shunt and bus, triggered or continuous */
+	if (3 != mode && 7 != mode)
+		return;
+	n = (sim_now_us() - ina->conv_start) / ina226_conv_us(ina);
+	if (3 == mode)
+		n = MIN(n, 1);
+	if (n == ina->conv_done)
+		return;
+	/* every result is checked against the alert limit, only the last one is kept */
+	for (uint64_t i = MAX(ina->conv_done, n > 256 ? n - 256 : 0); i < n; i++)
+		ina226_convert(ina, ina->conv_start + (i + 1) * ina226_conv_us(ina));
+	ina->conv_done = n;
+}
+
+static int ina226_addr(struct sim_dev *dev)
+{
+	return 1;
+}
+
+static int ina226_write(struct sim_dev *dev, const uint8_t *buf, int len)
+{
+	struct ina226 *ina = dev->priv;
+	uint16_t val;
+
+	ina->ptr = buf[0];
+	if (len < 3)
+		return 1;
+	val = (buf[1] << 8) | buf[2];
+	ina226_update(ina);
+	switch (ina->ptr) {
+	case INA226_CONFIG:
+		if (val & 0x8000) {
+			ina226_reset(ina);
+			break;
+		}
+		/* a new configuration restarts the conversion and clears CVRF */
+		ina->regs[INA226_CONFIG] = val;
+		ina->regs[INA226_MASK] &= ~INA226_CVRF;
+		ina->conv_start = sim_now_us();
+		ina->conv_done = 0;
+		break;
+	case INA226_CAL:
+		ina->regs[INA226_CAL] = val & 0x7fff;
+		break;
+	case INA226_MASK:
+		ina->regs[INA226_MASK] = (val & INA226_MASK_WRITABLE) |
+					 (ina->regs[INA226_MASK] & ~INA226_MASK_WRITABLE);
+		break;
+	case INA226_ALERT:
+		ina->regs[INA226_ALERT] = val;
+		break;
+	default:
+		/* read only, the data byte is still acked */
+		break;
+	}
+	return 1;
+}
+
+static void ina226_read(struct sim_dev *dev, uint8_t *buf, int len)
+{
+	struct ina226 *ina = dev->priv;
+	uint16_t val;
+
+	ina226_update(ina);
+	if (INA226_MANUF_ID == ina->ptr)
+		val = 0x5449;
+	else if (INA226_DIE_ID == ina->ptr)
+		val = 0x2260;
+	else if (ina->ptr < 8)
+		val = ina->regs[ina->ptr];
+	else
+		val = 0;
+	for (int i = 0; i < len; i++)
+		buf[i] = i & 1 ? val & 0xff : val >> 8;
+	/* reading the mask/enable register clears the flags */
+	if (INA226_MASK == ina->ptr)
+		ina->regs[INA226_MASK] &= ~(INA226_CVRF | INA226_AFF);
+}
+
+static const struct sim_dev_ops ina226_ops = {
+	.addr = ina226_addr,
+	.write = ina226_write,
+	.read = ina226_read,
+};
+
+struct sim_dev *sim_ina226_create(const char *name, uint8_t bus, uint8_t addr, uint32_t shunt_uohm)
+{
+	struct ina226 *ina = sim_zalloc(sizeof(*ina));
+
+	ina->shunt_uohm = shunt_uohm;
+	ina226_reset(ina);
+	return sim_dev_create(name, bus, addr, &ina226_ops, ina);
+}
+
+void sim_ina226_set(struct sim_dev *dev, int32_t bus_uv, int32_t current_ua, int32_t noise_ua)
+{
+	struct ina226 *ina = dev->priv;
+
+	ina226_update(ina);
+	ina->bus_uv = bus_uv;
+	ina->current_ua = current_ua;
+	ina->noise_ua = noise_ua;
+	if (INA226_STEPS == ina->nsteps)
+		memmove(ina->steps, ina->steps + 1, --ina->nsteps * sizeof(ina->steps[0]));
+	ina->steps[ina->nsteps].t = sim_now_us();
+	ina->steps[ina->nsteps].ua = current_ua;
+	ina->nsteps++;
+}
+
+/*
+ * PAC1934: four channels sampled at the CTRL rate into 48 bit power
+ * accumulators. A REFRESH latches the accumulators, the sample count and the
+ * last readings into the readable registers and clears the accumulators,
+ * REFRESH_V latches without clearing. The latched values become readable 1 ms
+ * after the refresh, a read before that still gets the previous ones. CTRL,
+ * CHANNEL_DIS and NEG_PWR writes take effect at the next refresh, the _ACT
+ * registers show the settings in use and the _LAT ones those of the last
+ * refresh. Block reads walk through the registers, each with its own size.
+ */
+#define PAC_REFRESH		0x00
+#define PAC_CTRL		0x01
+#define PAC_ACC_COUNT		0x02
+#define PAC_VPOWER_ACC		0x03
+#define PAC_VBUS		0x07
+#define PAC_VSENSE		0x0b
+#define PAC_VBUS_AVG		0x0f
+#define PAC_VSENSE_AVG		0x13
+#define PAC_VPOWER		0x17
+#define PAC_CHANNEL_DIS		0x1c
+#define PAC_NEG_PWR		0x1d
+#define PAC_REFRESH_G		0x1e
+#define PAC_REFRESH_V		0x1f
+#define PAC_SLOW		0x20
+#define PAC_CTRL_ACT		0x21
+#define PAC_CHANNEL_DIS_ACT	0x22
+#define PAC_NEG_PWR_ACT		0x23
+#define PAC_CTRL_LAT		0x24
+#define PAC_CHANNEL_DIS_LAT	0x25
+#define PAC_NEG_PWR_LAT		0x26
+#define PAC_PRODUCT_ID		0xfd
+#define PAC_MANUF_ID		0xfe
+#define PAC_REVISION_ID		0xff
+#define PAC_CHANNELS		4
+#define PAC_AVG			8
+#define PAC_LATCH_US		1000
+
+struct pac_latch {
+	uint32_t acc_count;
+	uint64_t acc[PAC_CHANNELS];
+	uint16_t vbus[PAC_CHANNELS];
+	uint16_t vsense[PAC_CHANNELS];
+	uint16_t vbus_avg[PAC_CHANNELS];
+	uint16_t vsense_avg[PAC_CHANNELS];
+	uint32_t vpower[PAC_CHANNELS];
+	uint8_t ctrl, channel_dis, neg_pwr;
+};
+
+struct pac1934 {
+	uint32_t shunt_mohm;
+	int32_t bus_uv[PAC_CHANNELS];
+	int32_t current_ua[PAC_CHANNELS];
+	int32_t noise_ua[PAC_CHANNELS];
+	uint8_t ptr;
+	/* written, active from the next refresh */
+	uint8_t ctrl, channel_dis, neg_pwr, slow;
+	/* in use */
+	uint8_t ctrl_act, channel_dis_act, neg_pwr_act;
+	uint64_t next_sample_us;
+	uint32_t acc_count;
+	uint64_t acc[PAC_CHANNELS];
+	uint16_t vbus[PAC_CHANNELS];
+	uint16_t vsense[PAC_CHANNELS];
+	uint16_t vbus_hist[PAC_CHANNELS][PAC_AVG];
+	uint16_t vsense_hist[PAC_CHANNELS][PAC_AVG];
+	uint32_t vpower[PAC_CHANNELS];
+	/* readable, and the next latch waiting for the 1 ms to pass */
+	struct pac_latch shown, pending;
+	uint64_t pending_at;
+	int has_pending;
+};
+
+static uint32_t pac_sample_us(uint8_t ctrl)
+{
+	static const uint32_t sps[] = { 1024, 256, 64, 8 };
+
+	return 1000000 / sps[ctrl >> 6];
+}
+
+static void pac_sample(struct pac1934 *pac)
+{
+	double ua, v, vsense;
+	int32_t vb, vs;
+
+	for (int ch = 0; ch < PAC_CHANNELS; ch++) {
+		if (pac->channel_dis_act & (0x80 >> ch))
+			continue;
+		ua = pac->current_ua[ch] + sim_noise(pac->noise_ua[ch]);
+		v = pac->bus_uv[ch] / 1e6;
+		vsense = ua / 1e6 * pac->shunt_mohm / 1e3;
+		/* bidirectional channels are signed with half the range */
+		if (pac->neg_pwr_act & (0x08 >> ch))
+			vb = (int32_t)fmax(fmin(round(v / 32 * 32768), 32767), -32768);
+		else
+			vb = (int32_t)fmax(fmin(round(v / 32 * 65536), 65535), 0);
+		if (pac->neg_pwr_act & (0x80 >> ch))
+			vs = (int32_t)fmax(fmin(round(vsense / 0.1 * 32768), 32767), -32768);
+		else
+			vs = (int32_t)fmax(fmin(round(vsense / 0.1 * 65536), 65535), 0);
+
+		pac->vbus[ch] = (uint16_t)vb;
+		pac->vsense[ch] = (uint16_t)vs;
+		memmove(&pac->vbus_hist[ch][1], &pac->vbus_hist[ch][0], (PAC_AVG - 1) * 2);
+		memmove(&pac->vsense_hist[ch][1], &pac->vsense_hist[ch][0], (PAC_AVG - 1) * 2);
+		pac->vbus_hist[ch][0] = pac->vbus[ch];
+		pac->vsense_hist[ch][0] = pac->vsense[ch];
+		/* 28 bit product, left aligned in the 32 bit register */
+		pac->vpower[ch] = (uint32_t)(((int64_t)vb * vs) >> 4) << 4;
+		pac->acc[ch] = (pac->acc[ch] + (((int64_t)vb * vs) >> 4)) & 0xffffffffffffull;
+	}
+	pac->acc_count = (pac->acc_count + 1) & 0xffffff;
+}
+
+static void pac_update(struct pac1934 *pac)
+{
+	uint64_t now = sim_now_us();
+
+	if (pac->has_pending && now >= pac->pending_at) {
+		pac->shown = pac->pending;
+		pac->has_pending = 0;
+	}
+	while (pac->next_sample_us <= now) {
+		pac_sample(pac);
+		pac->next_sample_us += pac_sample_us(pac->ctrl_act);
+	}
+}
+
+static void pac_refresh(struct pac1934 *pac, int clear)
+{
+	struct pac_latch *l = &pac->pending;
+	uint32_t sum_b, sum_s;
+
+	pac_update(pac);
+	l->acc_count = pac->acc_count;
+	memcpy(l->acc, pac->acc, sizeof(l->acc));
+	memcpy(l->vbus, pac->vbus, sizeof(l->vbus));
+	memcpy(l->vsense, pac->vsense, sizeof(l->vsense));
+	memcpy(l->vpower, pac->vpower, sizeof(l->vpower));
+	for (int ch = 0; ch < PAC_CHANNELS; ch++) {
+		sum_b = sum_s = 0;
+		for (int i = 0; i < PAC_AVG; i++) {
+			sum_b += pac->vbus_hist[ch][i];
+			sum_s += pac->vsense_hist[ch][i];
+		}
+		l->vbus_avg[ch] = sum_b / PAC_AVG;
+		l->vsense_avg[ch] = sum_s / PAC_AVG;
+	}
+	l->ctrl = pac->ctrl_act;
+	l->channel_dis = pac->channel_dis_act;
+	l->neg_pwr = pac->neg_pwr_act;
+	pac->pending_at = sim_now_us() + PAC_LATCH_US;
+	pac->has_pending = 1;
+
+	if (clear) {
+		pac->acc_count = 0;
+		memset(pac->acc, 0, sizeof(pac->acc));
+	}
+	/* the new settings are used from here on */
+	if ((pac->ctrl ^ pac->ctrl_act) >> 6)
+		pac->next_sample_us = sim_now_us() + pac_sample_us(pac->ctrl);
+	pac->ctrl_act = pac->ctrl;
+	pac->channel_dis_act = pac->channel_dis;
+	pac->neg_pwr_act = pac->neg_pwr;
+}
+
+static int pac_reg_size(uint8_t reg)
+{
+	if (PAC_ACC_COUNT == reg)
+		return 3;
+	if (reg >= PAC_VPOWER_ACC && reg < PAC_VBUS)
+		return 6;
+	if (reg >= PAC_VBUS && reg < PAC_VPOWER)
+		return 2;
+	if (reg >= PAC_VPOWER && reg < PAC_VPOWER + PAC_CHANNELS)
+		return 4;
+	return 1;
+}
+
+static uint64_t pac_reg_value(struct pac1934 *pac, uint8_t reg)
+{
+	struct pac_latch *l = &pac->shown;
+
+	if (PAC_ACC_COUNT == reg)
+		return l->acc_count;
+	if (reg >= PAC_VPOWER_ACC && reg < PAC_VBUS)
+		return l->acc[reg - PAC_VPOWER_ACC];
+	if (reg >= PAC_VBUS && reg < PAC_VSENSE)
+		return l->vbus[reg - PAC_VBUS];
+	if (reg >= PAC_VSENSE && reg < PAC_VBUS_AVG)
+		return l->vsense[reg - PAC_VSENSE];
+	if (reg >= PAC_VBUS_AVG && reg < PAC_VSENSE_AVG)
+		return l->vbus_avg[reg - PAC_VBUS_AVG];
+	if (reg >= PAC_VSENSE_AVG && reg < PAC_VPOWER)
+		return l->vsense_avg[reg - PAC_VSENSE_AVG];
+	if (reg >= PAC_VPOWER && reg < PAC_VPOWER + PAC_CHANNELS)
+		return l->vpower[reg - PAC_VPOWER];
+
+	switch (reg) {
+	case PAC_CTRL:
+		return pac->ctrl;
+	case PAC_CHANNEL_DIS:
+		return pac->channel_dis;
+	case PAC_NEG_PWR:
+		return pac->neg_pwr;
+	case PAC_SLOW:
+		return pac->slow;
+	case PAC_CTRL_ACT:
+		return pac->ctrl_act;
+	case PAC_CHANNEL_DIS_ACT:
+		return pac->channel_dis_act;
+	case PAC_NEG_PWR_ACT:
+		return pac->neg_pwr_act;
+	case PAC_CTRL_LAT:
+		return l->ctrl;
+	case PAC_CHANNEL_DIS_LAT:
+		return l->channel_dis;
+	case PAC_NEG_PWR_LAT:
+		return l->neg_pwr;
+	case PAC_PRODUCT_ID:
+		return 0x5b;
+	case PAC_MANUF_ID:
+		return 0x5d;
+	case PAC_REVISION_ID:
+		return 0x03;
+	default:
+		return 0;
+	}
+}
+
+static int pac_addr(struct sim_dev *dev)
+{
+	return 1;
+}
+
+static int pac_write(struct sim_dev *dev, const uint8_t *buf, int len)
+{
+	struct pac1934 *pac = dev->priv;
+
+	pac->ptr = buf[0];
+	/* the refresh commands are a send byte, data after them is ignored */
+	switch (pac->ptr) {
+	case PAC_REFRESH:
+	case PAC_REFRESH_G:
+		pac_refresh(pac, 1);
+		return 1;
+	case PAC_REFRESH_V:
+		pac_refresh(pac, 0);
+		return 1;
+	}
+	if (len < 2)
+		return 1;
+
+	pac_update(pac);
+	switch (pac->ptr) {
+	case PAC_CTRL:
+		pac->ctrl = buf[1];
+		break;
+	case PAC_CHANNEL_DIS:
+		pac->channel_dis = buf[1];
+		break;
+	case PAC_NEG_PWR:
+		pac->neg_pwr = buf[1];
+		break;
+	case PAC_SLOW:
+		pac->slow = buf[1];
+		break;
+	}
+	return 1;
+}
+
+static void pac_read(struct sim_dev *dev, uint8_t *buf, int len)
+{
+	struct pac1934 *pac = dev->priv;
+	uint8_t reg = pac->ptr;
+	uint64_t val;
+	int size, i = 0;
+
+	pac_update(pac);
+	while (i < len) {
+		size = pac_reg_size(reg);
+		val = pac_reg_value(pac, reg);
+		for (int b = size - 1; b >= 0 && i < len; b--)
+			buf[i++] = val >> (8 * b);
+		reg++;
+	}
+}
+
+static const struct sim_dev_ops pac1934_ops = {
+	.addr = pac_addr,
+	.write = pac_write,
+	.read = pac_read,
+};
+
+struct sim_dev *sim_pac1934_create(const char *name, uint8_t bus, uint8_t addr, uint32_t shunt_mohm)
+{
+	struct pac1934 *pac = sim_zalloc(sizeof(*pac));
+
+	pac->shunt_mohm = shunt_mohm;
+	pac->next_sample_us = sim_now_us() + pac_sample_us(0);
+	return sim_dev_create(name, bus, addr, &pac1934_ops, pac);
+}
+
+void sim_pac1934_set(struct sim_dev *dev, int ch, int32_t bus_uv, int32_t current_ua, int32_t noise_ua)
+{
+	struct pac1934 *pac = dev->priv;
+
+	pac_update(pac);
+	pac->bus_uv[ch] = bus_uv;
+	pac->current_ua[ch] = current_ua;
+	pac->noise_ua[ch] = noise_ua;
+}
@@ -0,0 +1,577 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Host bench and regression run of the I2C, eeprom cache and power monitor
+ * code against the virtual devices of i2c_sim_dev.c.
+ *
+ * Build, from the top of the tree:
+ *   gcc -O2 -std=gnu11 -Iscripts/i2c_sim/include -Iinclude -Iscripts/i2c_sim -o i2c_sim \
+ *       scripts/i2c_sim/i2c_sim.c scripts/i2c_sim/i2c_sim_dev.c scripts/i2c_sim/i2c_sim_main.c \
+ *       src/hf_i2c.c src/hf_eeprom.c src/hf_power_history.c -lm
+ *
+ * Every run starts with the boot reads of es_init_info_in_eeprom(), record by
+ * record and then from the preloaded mirror, and prints both times.
+ *
+ * Modes:
+ *   eeprom  random configuration updates through the write-back cache and
+ *           journal, every sync checked against the eeprom model
+ *   power   get_board_power() and get_som_power() against the INA226 and
+ *           PAC1934 models, error against the simulated rails, the energy
+ *           of the four PAC1934 channels against the simulated loads, then
+ *           short over-current spikes against the latched INA226 alert
+ *   history count seconds of 1 s means of both rails, load steps, drifting
+ *           temperatures and fan and SOM off spans through the power history,
+ *           read back and checked, with the encoded size per sample
+ *   all     eeprom and power
+ *
+ * Faults are set per device with -f dev:kind=prob[,kind=prob...], dev is
+ * eeprom, ina226, pac1934 or all, kind is nack, timeout, berr, arlo, flip or
+ * stuck. -t drop,late_ms fails that share of the timer commands as if the
+ * timer queue were full and runs the timer callbacks late_ms after they are
+ * due, as a starved timer task would. -a sets the INA226 averaging and
+ * conversion time. The exit status
+ * is 1 if the eeprom ends up with other content than was written through the
+ * cache, a PAC1934 channel energy is off by more than 0.1%, or the history
+ * reads back other samples than were added. The findings are also left in
+ * i2c_sim_results, test/native/test_i2c_sim builds this file with UNIT_TEST,
+ * without main(), and runs i2c_sim_run() as the command line would.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "hf_i2c.h"
+#include "hf_eeprom.h"
+#include "hf_power_process.h"
+#include "hf_power_history.h"
+#include "i2c_sim.h"
+
+/* journal pages, see journal_slots in hf_eeprom.c */
+static const uint8_t journal_pages[] = { 64, 72, 144, 152, 248 };
+
+#define SPIKE_MS	30
+
+static struct sim_dev *eeprom, *ina226, *pac1934;
+static int verbose;
+
+struct i2c_sim_results i2c_sim_results;
+
+static int is_journal(int offset)
+{
+	for (int i = 0; i < sizeof(journal_pages); i++)
+		if (offset >= journal_pages[i] && offset < journal_pages[i] + AT24C_PAGE_SIZE)
+			return 1;
+	return 0;
+}
+
+/* bytes of the eeprom model that differ from the image written through the cache */
+static int eeprom_diff(const uint8_t *image)
+{
+	const uint8_t *mem = sim_at24c_mem(eeprom);
+	int diff = 0;
+
+	for (int i = 0; i < EEPROM_SIZE; i++)
+		if (!is_journal(i) && mem[i] != image[i])
+			diff++;
+	return diff;
+}
+
+/*
+ * The loads of es_init_info_in_eeprom() with a journal in place, on a board
+ * whose server info fails its crc: the defaults are written and read back.
+ */
+static uint64_t boot_reads(uint8_t fill, int *reads)
+{
+	uint8_t buf[EEPROM_SIZE], value[JOURNAL_VALUE_MAX];
+	uint64_t start = sim_now_us();
+
+	*reads = 0;
+	*reads += !es_eeprom_load(CARRIER_BOARD_INFO_EEPROM_MAIN_OFFSET, buf, sizeof(CarrierBoardInfo));
+	*reads += !es_eeprom_load(CARRIER_BOARD_INFO_EEPROM_BACKUP_OFFSET, buf, sizeof(CarrierBoardInfo));
+	*reads += !es_eeprom_load(MCU_SERVER_INFO_EEPROM_OFFSET, buf, sizeof(MCUServerInfo));
+	memset(buf, fill, sizeof(MCUServerInfo));
+	es_eeprom_update(MCU_SERVER_INFO_EEPROM_OFFSET, buf, sizeof(MCUServerInfo));
+	*reads += !es_eeprom_load(MCU_SERVER_INFO_EEPROM_OFFSET, buf, sizeof(MCUServerInfo));
+	es_journal_load(JOURNAL_TAG_PWRMGT_DIP, value, offsetof(SomPwrMgtDIPInfo, crc32Checksum));
+	*reads += sizeof(journal_pages);
+	return sim_now_us() - start;
+}
+
+static void run_boot(void)
+{
+	struct eeprom_stats stats;
+	uint64_t single, bulk;
+	int reads;
+
+	single = boot_reads(0x5a, &reads);
+	bulk = sim_now_us();
+	if (es_eeprom_preload())
+		printf("boot: preload failed\n");
+	bulk = sim_now_us() - bulk;
+	bulk += boot_reads(0xa5, &reads);
+	es_eeprom_get_stats(&stats);
+	printf("boot: %d record loads %llu us, preloaded %llu us (%lu us for the %d byte read)\n",
+	       reads, (unsigned long long)single, (unsigned long long)bulk,
+	       (unsigned long)stats.preload_us, EEPROM_SIZE);
+	/* the rewritten server info goes out, as the journal migration syncs at boot */
+	es_eeprom_sync();
+}
+
+static int run_eeprom(int count)
+{
+	uint8_t image[EEPROM_SIZE], data[AT24C_PAGE_SIZE], value[JOURNAL_VALUE_MAX], last[JOURNAL_VALUE_MAX];
+	struct eeprom_stats stats;
+	struct hf_i2c_wr_stats wr;
+	struct sim_bus_stats bus;
+	uint32_t syncs = 0, failed = 0, bad = 0, writes = 0, max_writes = 0;
+	uint64_t start, sync_us = 0;
+	int offset, len, appended = 0, ret = 0;
+
+	/* the mirror starts out as the boot preload leaves it */
+	memcpy(image, sim_at24c_mem(eeprom), EEPROM_SIZE);
+	for (int n = 0; n < count; n++) {
+		/* a setter changes a few bytes of one record */
+		do {
+			offset = sim_random() % EEPROM_SIZE;
+			len = 1 + sim_random() % AT24C_PAGE_SIZE;
+		} while (offset + len > EEPROM_SIZE || is_journal(offset) || is_journal(offset + len - 1));
+		for (int i = 0; i < len; i++)
+			data[i] = sim_random();
+		memcpy(&image[offset], data, len);
+		es_eeprom_update(offset, data, len);
+
+		if (0 == sim_random() % 4) {
+			for (int i = 0; i < JOURNAL_VALUE_MAX; i++)
+				value[i] = sim_random();
+			es_journal_append(JOURNAL_TAG_PWRMGT_DIP, value, sizeof(value));
+			memcpy(last, value, sizeof(last));
+			appended = 1;
+		}
+		if (0 == sim_random() % 8) {
+			start = sim_now_us();
+			syncs++;
+			if (es_eeprom_sync()) {
+				failed++;
+			} else {
+				sync_us += sim_now_us() - start;
+				if (eeprom_diff(image))
+					bad++;
+			}
+		}
+		sim_run_ms(sim_random() % 50);
+	}
+
+	/* the faults stop, what is still dirty must make it to the eeprom */
+	memset(eeprom->fault_ppm, 0, sizeof(eeprom->fault_ppm));
+	sim_run_ms(HF_I2C_BREAKER_OPEN_MAX_MS);
+	if (es_eeprom_sync() || eeprom_diff(image)) {
+		i2c_sim_results.eeprom_final_diff = eeprom_diff(image);
+		printf("eeprom: %d bytes differ after the final sync\n", eeprom_diff(image));
+		ret = 1;
+	}
+	if (appended && (es_journal_load(JOURNAL_TAG_PWRMGT_DIP, value, sizeof(value)) ||
+			 memcmp(value, last, sizeof(value)))) {
+		i2c_sim_results.journal_lost = 1;
+		printf("eeprom: the journal lost the last record\n");
+		ret = 1;
+	}
+	/* the mirror the loads are served from, journal pages included */
+	if (es_eeprom_load(0, image, EEPROM_SIZE) || memcmp(image, sim_at24c_mem(eeprom), EEPROM_SIZE)) {
+		i2c_sim_results.mirror_differs = 1;
+		printf("eeprom: the mirror differs from the eeprom\n");
+		ret = 1;
+	}
+	i2c_sim_results.eeprom_syncs = syncs;
+	i2c_sim_results.eeprom_failed = failed;
+	i2c_sim_results.eeprom_mismatched = bad;
+
+	for (int i = 0; i < EEPROM_PAGES; i++) {
+		writes += sim_at24c_page_writes(eeprom, i);
+		max_writes = MAX(max_writes, sim_at24c_page_writes(eeprom, i));
+	}
+	es_eeprom_get_stats(&stats);
+	hf_i2c_get_wr_stats(&wr);
+	sim_get_bus_stats(1, &bus);
+	printf("eeprom: %d updates, %lu changed bytes, %lu syncs (%lu failed, %lu mismatched)\n",
+	       count, (unsigned long)stats.bytes, (unsigned long)syncs, (unsigned long)failed,
+	       (unsigned long)bad);
+	printf("eeprom: %lu page writes, most on one page %lu, %lu journal appends\n",
+	       (unsigned long)writes, (unsigned long)max_writes, (unsigned long)stats.appends);
+	printf("eeprom: sync avg %llu us, write cycle avg %lu us max %lu us, %.1f polls per page\n",
+	       (unsigned long long)(syncs - failed ? sync_us / (syncs - failed) : 0),
+	       (unsigned long)(wr.pages ? wr.total_us / wr.pages : 0), (unsigned long)wr.max_us,
+	       wr.pages ? (double)wr.polls / wr.pages : 0.0);
+	printf("i2c1: %lu transfers, %llu us on the wire\n", (unsigned long)bus.xfers,
+	       (unsigned long long)bus.busy_us);
+	return ret;
+}
+
+static void power_err(const char *name, uint32_t got, int64_t want, int64_t *sum, int64_t *max)
+{
+	int64_t err = (int64_t)got - want;
+
+	if (err < 0)
+		err = -err;
+	*sum += err;
+	*max = MAX(*max, err);
+	if (verbose)
+		printf("%s %lu expected %lld\n", name, (unsigned long)got, (long long)want);
+}
+
+/*
+ * Short over-current spikes between the reads of a 100 ms sampler: how many
+ * show in the readings, and how many the latched INA226 alert reports.
+ */
+static int run_spikes(int count, int32_t board_uv, int32_t board_ua)
+{
+	struct ina226_stats before, after;
+	struct ina226_cfg cfg;
+	uint32_t volt, curr, power;
+	int sampled = 0, alerted = 0, at;
+
+	ina226_get_cfg(&cfg);
+	if (INA226_ALERT_OVER_CURRENT != cfg.alert || !count)
+		return 0;
+	for (int n = 0; n < count; n++) {
+		ina226_get_stats(&before);
+		at = 5 + sim_random() % 60;
+		sim_run_ms(at);
+		sim_ina226_set(ina226, board_uv, (cfg.alert_limit + 5000) * 1000, 20000);
+		sim_run_ms(SPIKE_MS);
+		sim_ina226_set(ina226, board_uv, board_ua, 20000);
+		sim_run_ms(100 - at - SPIKE_MS);
+		if (!get_board_power(&volt, &curr, &power) && curr > cfg.alert_limit)
+			sampled++;
+		ina226_get_stats(&after);
+		if (after.alerts != before.alerts)
+			alerted++;
+	}
+	i2c_sim_results.spikes = count;
+	i2c_sim_results.spikes_alerted = alerted;
+	printf("spikes: %d of %d ms over %lu mA, %d in the readings, %d reported by the alert\n",
+	       count, SPIKE_MS, (unsigned long)cfg.alert_limit, sampled, alerted);
+	return 0;
+}
+
+/* the PAC1934 rails, the SOM on channel 1 */
+static const int32_t pac_uv[PAC1934_CHANNELS] = { 12000000, 5000000, 3300000, 900000 };
+static const int32_t pac_ua[PAC1934_CHANNELS] = { 1200000, 2000000, 500000, 3000000 };
+
+/*
+ * Energy of every channel over the run against the simulated loads. The
+ * counters only cover what was read, from the first read to the last.
+ */
+static int check_energy(const struct pac1934_energy *from)
+{
+	struct pac1934_energy to;
+	uint64_t got, want;
+	double secs, err;
+	int ret = 0;
+
+	pac1934_get_energy(&to);
+	secs = (double)(to.samples - from->samples) / 1024;
+	printf("pac1934: %.1f s accumulated, %lu errors, %lu spans left out\n", secs,
+	       (unsigned long)to.errors, (unsigned long)to.resyncs);
+	for (int ch = 0; ch < PAC1934_CHANNELS; ch++) {
+		got = pac1934_energy_uwh(&to, ch) - pac1934_energy_uwh(from, ch);
+		want = (uint64_t)((double)pac_uv[ch] * pac_ua[ch] / 1e6 * secs / 3600);
+		err = want ? 100.0 * ((double)got - want) / want : 0;
+		printf("pac1934 ch%d: %llu uWh expected %llu (%+.3f%%), mean %lu uW expected %lu\n",
+		       ch + 1, (unsigned long long)got, (unsigned long long)want, err,
+		       (unsigned long)pac1934_avg_power_uw(from, &to, ch),
+		       (unsigned long)((int64_t)pac_uv[ch] * pac_ua[ch] / 1000000));
+		i2c_sim_results.energy_err_ppm = MAX(i2c_sim_results.energy_err_ppm,
+						     (int32_t)((err < 0 ? -err : err) * 10000));
+		if (err > 0.1 || err < -0.1)
+			ret = 1;
+	}
+	return ret;
+}
+
+static int run_power(int count)
+{
+	/* 12 V in, 2.5 A board */
+	const int32_t board_uv = 12000000, board_ua = 2500000;
+	const int32_t som_uv = pac_uv[0], som_ua = pac_ua[0];
+	int64_t sum[6] = { 0 }, max[6] = { 0 };
+	struct pac1934_energy energy;
+	struct ina226_stats ina;
+	uint32_t volt, curr, power;
+	uint64_t start, board_us = 0, som_us = 0;
+	int ok[2] = { 0 };
+	int ret;
+
+	sim_ina226_set(ina226, board_uv, board_ua, 20000);
+	for (int ch = 0; ch < PAC1934_CHANNELS; ch++)
+		sim_pac1934_set(pac1934, ch, pac_uv[ch], pac_ua[ch], 10000);
+	sim_run_ms(100);
+	/* the first read only latches, the counters start at the second */
+	get_som_power(&volt, &curr, &power);
+	sim_run_ms(100);
+	get_som_power(&volt, &curr, &power);
+	pac1934_get_energy(&energy);
+
+	for (int n = 0; n < count; n++) {
+		sim_run_ms(100);
+		start = sim_now_us();
+		if (!get_board_power(&volt, &curr, &power)) {
+			board_us += sim_now_us() - start;
+			ok[0]++;
+			power_err("board mV", volt, board_uv / 1000, &sum[0], &max[0]);
+			power_err("board mA", curr, board_ua / 1000, &sum[1], &max[1]);
+			power_err("board mW", power / 1000, (int64_t)board_uv / 1000 * board_ua / 1000000,
+				  &sum[2], &max[2]);
+		}
+		start = sim_now_us();
+		if (!get_som_power(&volt, &curr, &power)) {
+			som_us += sim_now_us() - start;
+			ok[1]++;
+			power_err("som mV", volt, som_uv / 1000, &sum[3], &max[3]);
+			power_err("som mA", curr, som_ua / 1000, &sum[4], &max[4]);
+			power_err("som mW", power / 1000, (int64_t)som_uv / 1000 * som_ua / 1000000,
+				  &sum[5], &max[5]);
+		}
+	}
+
+	ina226_get_stats(&ina);
+	printf("ina226: %lu reads, %lu with a new result, %lu errors, %lu configurations\n",
+	       (unsigned long)ina.reads, (unsigned long)ina.fresh, (unsigned long)ina.errors,
+	       (unsigned long)ina.configs);
+	for (int i = 0; i < 2; i++) {
+		printf("%s: %d/%d reads, %llu us per read, error avg/max %lld/%lld mV %lld/%lld mA %lld/%lld mW\n",
+		       i ? "som (pac1934)" : "board (ina226)", ok[i], count,
+		       (unsigned long long)(ok[i] ? (i ? som_us : board_us) / ok[i] : 0),
+		       (long long)(ok[i] ? sum[3 * i] / ok[i] : 0), (long long)max[3 * i],
+		       (long long)(ok[i] ? sum[3 * i + 1] / ok[i] : 0), (long long)max[3 * i + 1],
+		       (long long)(ok[i] ? sum[3 * i + 2] / ok[i] : 0), (long long)max[3 * i + 2]);
+	}
+	ret = check_energy(&energy);
+	return run_spikes(count / 10, board_uv, board_ua) | ret;
+}
+
+/* one rail for a second, ten reads 100 ms apart as the sampler takes them */
+static void history_rail(int som, int32_t *val)
+{
+	uint32_t volt, curr, power;
+	uint64_t sum[3] = { 0 };
+	int n = 0;
+
+	for (int i = 0; i < 10; i++) {
+		sim_run_ms(50);
+		if ((som ? get_som_power : get_board_power)(&volt, &curr, &power))
+			continue;
+		sum[0] += power;
+		sum[1] += volt;
+		sum[2] += curr;
+		n++;
+	}
+	val[0] = n ? sum[0] / n / 1000 : POWER_HIST_NONE;
+	val[1] = n ? sum[1] / n : POWER_HIST_NONE;
+	val[2] = n ? sum[2] / n : POWER_HIST_NONE;
+}
+
+static int run_history(int count)
+{
+	struct power_hist_sample *added, got[16];
+	struct power_hist_stats stats;
+	int32_t board_ua = 2500000, som_ua = 1200000, temp = 550, fan = 3000;
+	int off = 0, n, k, bad = 0, first;
+	uint32_t from;
+
+	added = calloc(count, sizeof(*added));
+	power_hist_init();
+	for (int t = 0; t < count; t++) {
+		/* a load step every 30 s or so, a 2 min SOM off span every 20 min */
+		if (!(sim_random() % 30)) {
+			board_ua = 1500000 + sim_random() % 2000000;
+			som_ua = board_ua / 2;
+		}
+		if (!(sim_random() % 1200))
+			off = 120;
+		if (!(sim_random() % 10))
+			temp += (int)(sim_random() % 3) - 1;
+		if (!(sim_random() % 60))
+			fan = 2500 + sim_random() % 1000;
+		sim_ina226_set(ina226, 12000000, board_ua, 20000);
+		sim_pac1934_set(pac1934, 0, 12000000, som_ua, 10000);
+
+		added[t].time = t + 1;
+		history_rail(0, &added[t].val[POWER_HIST_BOARD_MW]);
+		if (off) {
+			off--;
+			sim_run_ms(500);
+			for (int i = POWER_HIST_SOM_MW; i < POWER_HIST_FIELDS; i++)
+				added[t].val[i] = POWER_HIST_NONE;
+		} else {
+			history_rail(1, &added[t].val[POWER_HIST_SOM_MW]);
+			added[t].val[POWER_HIST_CPU_TEMP] = temp;
+			added[t].val[POWER_HIST_NPU_TEMP] = temp - 30;
+			added[t].val[POWER_HIST_FAN_RPM] = fan;
+		}
+		power_hist_add(&added[t]);
+	}
+
+	power_hist_get_stats(&stats);
+	first = stats.oldest - 1;
+	from = 0;
+	k = first;
+	while ((n = power_hist_read(from, UINT32_MAX, got, 16)) > 0) {
+		for (int i = 0; i < n; i++, k++)
+			if (k >= count || memcmp(&got[i], &added[k], sizeof(got[i])))
+				bad++;
+		from = got[n - 1].time + 1;
+	}
+	if (k != count)
+		bad++;
+	printf("history: %d seconds, %lu samples kept from %lu to %lu s in %lu blocks, %lu dropped\n",
+	       count, (unsigned long)stats.samples, (unsigned long)stats.oldest,
+	       (unsigned long)stats.newest, (unsigned long)stats.blocks, (unsigned long)stats.dropped);
+	printf("history: %lu bytes, %.2f bytes/sample, %.1f h in the %d KB ring, %d bad samples read back\n",
+	       (unsigned long)stats.bytes, (double)stats.bytes / stats.samples,
+	       (double)POWER_HIST_BLOCKS * (POWER_HIST_BLOCK_SIZE - 16) / ((double)stats.bytes / stats.samples) / 3600,
+	       POWER_HIST_BLOCKS * POWER_HIST_BLOCK_SIZE / 1024, bad);
+	free(added);
+	return !!bad;
+}
+
+static void print_i2c_stats(void)
+{
+	static const char *states[] = { "closed", "open", "half" };
+	struct hf_i2c_dev_stats dev;
+	struct sim_timer_stats timer;
+	struct hf_i2c_stats stats;
+	struct sim_bus_stats bus;
+
+	for (int i = 0; i < 2; i++) {
+		hf_i2c_get_stats(i ? &hi2c3 : &hi2c1, &stats);
+		sim_get_bus_stats(i ? 3 : 1, &bus);
+		printf("i2c%d: requests %lu errors %lu timeouts %lu resets %lu stuck %lu failed %lu, "
+		       "busy refusals %lu, hand clocks %lu\n", i ? 3 : 1,
+		       (unsigned long)stats.requests, (unsigned long)stats.errors,
+		       (unsigned long)stats.timeouts, (unsigned long)stats.resets,
+		       (unsigned long)stats.sda_stuck, (unsigned long)stats.recover_failed,
+		       (unsigned long)bus.busy_errors, (unsigned long)bus.clocks);
+		i2c_sim_results.timeouts += stats.timeouts;
+		i2c_sim_results.resets += stats.resets;
+		i2c_sim_results.recover_failed += stats.recover_failed;
+	}
+	sim_get_timer_stats(&timer);
+	printf("timer task: %lu callbacks, %lu commands dropped; i2c task: %lu runs\n",
+	       (unsigned long)timer.expired, (unsigned long)timer.dropped,
+	       (unsigned long)timer.driver_runs);
+	for (int i = 0; !hf_i2c_get_dev_stats(i, &dev); i++)
+		printf("i2c%u 0x%02x %-6s requests %lu nacks %lu timeouts %lu arb %lu berr %lu "
+		       "recov %lu rejected %lu opens %lu avg %lu us\n",
+		       dev.bus, dev.addr, states[dev.state], (unsigned long)dev.requests,
+		       (unsigned long)dev.nacks, (unsigned long)dev.timeouts, (unsigned long)dev.arb_lost,
+		       (unsigned long)dev.bus_errors, (unsigned long)dev.recoveries,
+		       (unsigned long)dev.rejected, (unsigned long)dev.opens,
+		       (unsigned long)(dev.completed ? dev.total_us / dev.completed : 0));
+	for (struct sim_dev *d = eeprom; d; d = d->next)
+		printf("%s: injected nack %lu timeout %lu berr %lu arlo %lu flip %lu stuck %lu\n", d->name,
+		       (unsigned long)d->stats.injected[SIM_FAULT_NACK],
+		       (unsigned long)d->stats.injected[SIM_FAULT_TIMEOUT],
+		       (unsigned long)d->stats.injected[SIM_FAULT_BERR],
+		       (unsigned long)d->stats.injected[SIM_FAULT_ARLO],
+		       (unsigned long)d->stats.injected[SIM_FAULT_FLIP],
+		       (unsigned long)d->stats.injected[SIM_FAULT_STUCK]);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n count] [-s seed] [-w twr_us] [-f dev:kind=prob,...] "
+		"[-t drop,late_ms] [-a avg,ct_us] [-v] eeprom|power|history|all\n", prog);
+	exit(2);
+}
+
+/* the command line, the exit status */
+int i2c_sim_run(int argc, char **argv)
+{
+	const char *faults[8];
+	struct ina226_cfg cfg;
+	uint32_t seed = 1, twr_us = 3500, avg = 0, ct = 0, late = 0;
+	double drop = 0;
+	int count = 1000, nfaults = 0, ret = 0, opt;
+	const char *mode;
+
+	while ((opt = getopt(argc, argv, "n:s:w:f:t:a:v")) != -1) {
+		switch (opt) {
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			twr_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			if (nfaults < 8)
+				faults[nfaults++] = optarg;
+			break;
+		case 't':
+			if (2 != sscanf(optarg, "%lf,%u", &drop, &late) || drop < 0 || drop > 1)
+				usage(argv[0]);
+			break;
+		case 'a':
+			if (2 != sscanf(optarg, "%u,%u", &avg, &ct))
+				usage(argv[0]);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		usage(argv[0]);
+	mode = argv[optind];
+
+	/* the parts of the board, as hf_i2c.c addresses them */
+	eeprom = sim_at24c_create("eeprom", 1, AT24C_ADDR >> 1, EEPROM_SIZE, AT24C_PAGE_SIZE, twr_us);
+	ina226 = sim_ina226_create("ina226", 3, 0x44, 1000);
+	pac1934 = sim_pac1934_create("pac1934", 3, 0x10, 4);
+	for (int i = 0; i < nfaults; i++) {
+		if (sim_fault_parse(faults[i])) {
+			fprintf(stderr, "bad fault spec %s\n", faults[i]);
+			usage(argv[0]);
+		}
+	}
+	sim_init(seed);
+	sim_timer_faults((uint32_t)(drop * 1000000), late);
+	es_eeprom_init();
+	run_boot();
+	if (avg) {
+		ina226_get_cfg(&cfg);
+		cfg.avg = avg;
+		cfg.vbus_ct_us = cfg.vshunt_ct_us = ct;
+		if (ina226_set_cfg(&cfg)) {
+			fprintf(stderr, "unsupported ina226 averaging or conversion time\n");
+			return 2;
+		}
+	}
+
+	if (!strcmp(mode, "eeprom") || !strcmp(mode, "all"))
+		ret |= run_eeprom(count);
+	if (!strcmp(mode, "power") || !strcmp(mode, "all"))
+		ret |= run_power(count);
+	if (!strcmp(mode, "history"))
+		ret |= run_history(count);
+	print_i2c_stats();
+	printf("simulated %.3f s\n", sim_now_us() / 1e6);
+
+	return ret;
+}
+
+#ifndef UNIT_TEST
+int main(int argc, char **argv)
+{
+	return i2c_sim_run(argc, argv);
+}
+#endif
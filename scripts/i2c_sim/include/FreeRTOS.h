@@ -0,0 +1,39 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Host build of the I2C simulator: the part of the FreeRTOS api the I2C and
+ * eeprom layers use, run single threaded on the simulated clock of i2c_sim.c.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#ifndef __SIM_FREERTOS_H
+#define __SIM_FREERTOS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+
+#define pdFALSE			((BaseType_t)0)
+#define pdTRUE			((BaseType_t)1)
+#define pdFAIL			pdFALSE
+#define pdPASS			pdTRUE
+#define portMAX_DELAY		((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS	((TickType_t)1)
+#define configTICK_RATE_HZ	1000
+#define pdMS_TO_TICKS(ms)	((TickType_t)(ms))
+#define configASSERT(x)		do { if (!(x)) sim_assert(__FILE__, __LINE__); } while (0)
+
+/* interrupts only run between the steps of the simulator, nothing to mask */
+#define taskENTER_CRITICAL()			do { } while (0)
+#define taskEXIT_CRITICAL()			do { } while (0)
+#define taskENTER_CRITICAL_FROM_ISR()		((UBaseType_t)0)
+#define taskEXIT_CRITICAL_FROM_ISR(x)		((void)(x))
+#define portYIELD_FROM_ISR(x)			((void)(x))
+
+void sim_assert(const char *file, int line);
+BaseType_t xPortIsInsideInterrupt(void);
+
+#endif /* __SIM_FREERTOS_H */
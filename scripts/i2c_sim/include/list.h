@@ -0,0 +1,21 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Host build of the I2C simulator, see FreeRTOS.h.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#ifndef __SIM_LIST_H
+#define __SIM_LIST_H
+
+#include "FreeRTOS.h"
+
+typedef struct xLIST_ITEM {
+	TickType_t xItemValue;
+	struct xLIST_ITEM *pxNext;
+	struct xLIST_ITEM *pxPrevious;
+	void *pvOwner;
+	void *pvContainer;
+} ListItem_t;
+
+#endif /* __SIM_LIST_H */
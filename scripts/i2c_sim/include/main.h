@@ -0,0 +1,24 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Host build of the I2C simulator: the board definitions the I2C and eeprom
+ * layers use, in place of include/main.h.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#ifndef __SIM_MAIN_H
+#define __SIM_MAIN_H
+
+#include "stm32f4xx_hal.h"
+#include "hf_common.h"
+
+extern I2C_HandleTypeDef hi2c1;
+extern I2C_HandleTypeDef hi2c3;
+
+void i2c_init(I2C_TypeDef *Instance);
+void i2c_deinit(I2C_TypeDef *Instance);
+
+#define EEPROM_WP_Pin GPIO_PIN_8
+#define EEPROM_WP_GPIO_Port GPIOC
+
+#endif /* __SIM_MAIN_H */
@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Host build of the I2C simulator: the part of the STM32F4 HAL the I2C layer
+ * uses. The I2C peripherals, the pins and the cycle counter are backed by the
+ * bus and device models of i2c_sim.c.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#ifndef __SIM_STM32F4XX_HAL_H
+#define __SIM_STM32F4XX_HAL_H
+
+#include <stdint.h>
+
+typedef enum {
+	HAL_OK		= 0x00U,
+	HAL_ERROR	= 0x01U,
+	HAL_BUSY	= 0x02U,
+	HAL_TIMEOUT	= 0x03U,
+} HAL_StatusTypeDef;
+
+typedef enum {
+	HAL_UNLOCKED	= 0x00U,
+	HAL_LOCKED	= 0x01U,
+} HAL_LockTypeDef;
+
+/* gpio */
+typedef struct {
+	volatile uint32_t ODR;
+	uint32_t af;		// pins handed to a peripheral
+	char name;
+} GPIO_TypeDef;
+
+typedef struct {
+	uint32_t Pin;
+	uint32_t Mode;
+	uint32_t Pull;
+	uint32_t Speed;
+	uint32_t Alternate;
+} GPIO_InitTypeDef;
+
+typedef enum {
+	GPIO_PIN_RESET = 0,
+	GPIO_PIN_SET,
+} GPIO_PinState;
+
+#define GPIO_PIN_0		((uint16_t)0x0001)
+#define GPIO_PIN_1		((uint16_t)0x0002)
+#define GPIO_PIN_2		((uint16_t)0x0004)
+#define GPIO_PIN_3		((uint16_t)0x0008)
+#define GPIO_PIN_4		((uint16_t)0x0010)
+#define GPIO_PIN_5		((uint16_t)0x0020)
+#define GPIO_PIN_6		((uint16_t)0x0040)
+#define GPIO_PIN_7		((uint16_t)0x0080)
+#define GPIO_PIN_8		((uint16_t)0x0100)
+#define GPIO_PIN_9		((uint16_t)0x0200)
+#define GPIO_PIN_10		((uint16_t)0x0400)
+#define GPIO_PIN_11		((uint16_t)0x0800)
+#define GPIO_PIN_12		((uint16_t)0x1000)
+#define GPIO_PIN_13		((uint16_t)0x2000)
+#define GPIO_PIN_14		((uint16_t)0x4000)
+#define GPIO_PIN_15		((uint16_t)0x8000)
+
+#define GPIO_MODE_INPUT		0x00000000U
+#define GPIO_MODE_OUTPUT_PP	0x00000001U
+#define GPIO_MODE_OUTPUT_OD	0x00000011U
+#define GPIO_MODE_AF_OD		0x00000012U
+#define GPIO_NOPULL		0x00000000U
+#define GPIO_PULLUP		0x00000001U
+#define GPIO_SPEED_FREQ_LOW	0x00000000U
+#define GPIO_SPEED_FREQ_VERY_HIGH	0x00000003U
+#define GPIO_AF4_I2C1		0x04U
+#define GPIO_AF4_I2C3		0x04U
+
+extern GPIO_TypeDef sim_gpioa, sim_gpiob, sim_gpioc, sim_gpiod, sim_gpioe;
+#define GPIOA			(&sim_gpioa)
+#define GPIOB			(&sim_gpiob)
+#define GPIOC			(&sim_gpioc)
+#define GPIOD			(&sim_gpiod)
+#define GPIOE			(&sim_gpioe)
+
+void HAL_GPIO_Init(GPIO_TypeDef *port, GPIO_InitTypeDef *init);
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state);
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *port, uint16_t pin);
+
+/* i2c */
+typedef struct {
+	volatile uint32_t CR1;
+	volatile uint32_t CR2;
+	volatile uint32_t SR2;
+	int id;
+} I2C_TypeDef;
+
+typedef struct {
+	uint32_t ClockSpeed;
+	uint32_t DutyCycle;
+	uint32_t OwnAddress1;
+	uint32_t AddressingMode;
+	uint32_t DualAddressMode;
+	uint32_t OwnAddress2;
+	uint32_t GeneralCallMode;
+	uint32_t NoStretchMode;
+} I2C_InitTypeDef;
+
+typedef enum {
+	HAL_I2C_STATE_RESET	= 0x00U,
+	HAL_I2C_STATE_READY	= 0x20U,
+	HAL_I2C_STATE_BUSY	= 0x24U,
+	HAL_I2C_STATE_BUSY_TX	= 0x21U,
+	HAL_I2C_STATE_BUSY_RX	= 0x22U,
+} HAL_I2C_StateTypeDef;
+
+typedef struct {
+	I2C_TypeDef *Instance;
+	I2C_InitTypeDef Init;
+	HAL_LockTypeDef Lock;
+	volatile HAL_I2C_StateTypeDef State;
+	volatile uint32_t ErrorCode;
+} I2C_HandleTypeDef;
+
+#define HAL_I2C_ERROR_NONE	0x00000000U
+#define HAL_I2C_ERROR_BERR	0x00000001U
+#define HAL_I2C_ERROR_ARLO	0x00000002U
+#define HAL_I2C_ERROR_AF	0x00000004U
+#define HAL_I2C_ERROR_OVR	0x00000008U
+#define HAL_I2C_ERROR_DMA	0x00000010U
+#define HAL_I2C_ERROR_TIMEOUT	0x00000020U
+
+#define I2C_MEMADD_SIZE_8BIT	0x00000001U
+#define I2C_CR1_PE		0x00000001U
+#define I2C_CR1_SWRST		0x00008000U
+#define I2C_FLAG_BUSY		0x00100002U
+#define I2C_IT_BUF		0x00000400U
+#define I2C_IT_EVT		0x00000200U
+#define I2C_IT_ERR		0x00000100U
+
+extern I2C_TypeDef sim_i2c1, sim_i2c2, sim_i2c3;
+#define I2C1			(&sim_i2c1)
+#define I2C2			(&sim_i2c2)
+#define I2C3			(&sim_i2c3)
+
+#define __HAL_I2C_ENABLE(h)	((h)->Instance->CR1 |= I2C_CR1_PE)
+#define __HAL_I2C_DISABLE(h)	sim_i2c_disable(h)
+#define __HAL_I2C_GET_FLAG(h, f)	sim_i2c_get_flag((h), (f))
+#define __HAL_I2C_DISABLE_IT(h, it)	((h)->Instance->CR2 &= ~(it))
+
+void sim_i2c_disable(I2C_HandleTypeDef *hi2c);
+int sim_i2c_get_flag(I2C_HandleTypeDef *hi2c, uint32_t flag);
+
+HAL_StatusTypeDef HAL_I2C_Init(I2C_HandleTypeDef *hi2c);
+HAL_StatusTypeDef HAL_I2C_DeInit(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_MspInit(I2C_HandleTypeDef *hi2c);
+HAL_StatusTypeDef HAL_I2C_Master_Transmit_IT(I2C_HandleTypeDef *hi2c, uint16_t addr,
+					    uint8_t *data, uint16_t size);
+HAL_StatusTypeDef HAL_I2C_Master_Receive_IT(I2C_HandleTypeDef *hi2c, uint16_t addr,
+					   uint8_t *data, uint16_t size);
+HAL_StatusTypeDef HAL_I2C_Mem_Write_IT(I2C_HandleTypeDef *hi2c, uint16_t addr, uint16_t reg,
+				      uint16_t reg_size, uint8_t *data, uint16_t size);
+HAL_StatusTypeDef HAL_I2C_Mem_Read_IT(I2C_HandleTypeDef *hi2c, uint16_t addr, uint16_t reg,
+				     uint16_t reg_size, uint8_t *data, uint16_t size);
+void HAL_I2C_MemTxCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_MasterRxCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c);
+
+/* uart, only named by the common header */
+typedef struct {
+	void *Instance;
+} UART_HandleTypeDef;
+
+/* core */
+typedef struct {
+	volatile uint32_t CTRL;
+	volatile uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct {
+	volatile uint32_t DEMCR;
+} CoreDebug_Type;
+
+#define DWT_CTRL_CYCCNTENA_Msk		0x00000001U
+#define CoreDebug_DEMCR_TRCENA_Msk	0x01000000U
+
+/* every read of the cycle counter moves the clock on, so busy waits end */
+DWT_Type *sim_dwt(void);
+extern CoreDebug_Type sim_core_debug;
+#define DWT			(sim_dwt())
+#define CoreDebug		(&sim_core_debug)
+
+extern uint32_t SystemCoreClock;
+
+#endif /* __SIM_STM32F4XX_HAL_H */
@@ -0,0 +1,914 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-only
+"""
+Simulated SOM daemon for the MCU <-> SOM UART4 protocol.
+
+The BMC firmware talks to a daemon on the P550 SOM over UART4 (see
+include/protocol_lib/som_frame.h for the frame formats). This script stands in
+for that daemon, so the BMC side can be exercised without a booted SOM, and it
+can stand in for the BMC to measure the protocol on a host.
+
+Modes:
+  serve  answer every CommandType like the SOM daemon does, on a serial port
+         (wire it to UART4 in place of the SOM) or on a new pseudo-terminal.
+         Replies can be delayed, dropped or corrupted.
+  bench  act as the BMC: send requests stop-and-wait (or with several
+         outstanding, as concurrent web/console tasks do) and report round trip
+         latency percentiles, commands/s and line utilisation. --self runs a
+         daemon on a pty pair in the same process.
+  fuzz   act as the SOM towards a real BMC and interleave malformed frames
+         (bit flips, truncation, bogus lengths, false headers, noise) with the
+         normal replies. After every burst the BMC must still send a valid
+         request within --liveness seconds, otherwise the burst is reported as
+         a stall and the exit status is 1.
+
+--bmc runs the host build of the BMC side (scripts/som_sim, the som_bmc
+binary: hf_protocol_process.c and som_frame.c on FreeRTOS and HAL shims) on the
+other end of a pty, so serve and fuzz exercise the firmware code, and bench
+measures web_cmd_handle() against the in-process daemon instead of the Python
+client.
+
+Examples:
+  som_daemon_sim.py serve --port /dev/ttyUSB2 --latency 5 --loss 0.01
+  som_daemon_sim.py bench --self --count 2000 --crc
+  som_daemon_sim.py bench --self --crc --bulk dmesg --window 8 --loss 0.02
+  som_daemon_sim.py fuzz --port /dev/ttyUSB2 --bursts 500 --seed 1
+  som_daemon_sim.py bench --bmc ./som_bmc --count 2000 --outstanding 4
+  som_daemon_sim.py fuzz --bmc ./som_bmc --bursts 100 --seed 1
+
+Only the Python standard library is needed.
+
+Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+"""
+
+import argparse
+import heapq
+import os
+import random
+import select
+import signal
+import struct
+import subprocess
+import sys
+import termios
+import threading
+import time
+import tty
+
+FRAME_HEADER = 0xA55AAA55
+FRAME_HEADER_CRC = 0xA55AAA5C
+FRAME_TAIL = 0xBDBABDBA
+FRAME_DATA_MAX = 250
+LEGACY_LEN = 4 + 4 + 4 + FRAME_DATA_MAX + 1 + 4
+CRC_OVERHEAD = 20
+
+MSG_REQUEST, MSG_REPLY, MSG_NOTIFLY, MSG_HEARTBEAT = 1, 2, 3, 4
+
+# CommandType in include/hf_common.h
+CMD_POWER_OFF = 0x01
+CMD_REBOOT = 0x02
+CMD_READ_BOARD_INFO = 0x03
+CMD_CONTROL_LED = 0x04
+CMD_PVT_INFO = 0x05
+CMD_BOARD_STATUS = 0x06
+CMD_POWER_INFO = 0x07
+CMD_RESTART = 0x08
+CMD_LINK_BAUD = 0x09
+CMD_LINK_ECHO = 0x0A
+CMD_TELEMETRY_SUB = 0x0B
+CMD_CPU_LOAD = 0x0C
+CMD_THERMAL_INFO = 0x0D
+CMD_BULK_OPEN = 0x0E
+CMD_BULK_ACK = 0x0F
+CMD_BULK_DATA = 0x10
+
+CMD_NAMES = {v: k for k, v in globals().items() if k.startswith("CMD_")}
+
+HAL_OK, HAL_ERROR = 0, 1
+
+# hf_som_link.h / hf_som_telemetry.h
+LINK_DEFAULT_BAUD = 115200
+LINK_REVERT_S = 1.0
+TELEMETRY_PVT, TELEMETRY_CPU_LOAD, TELEMETRY_THERMAL = 1, 2, 4
+
+# hf_som_bulk.h
+BULK_CHUNK_SIZE = FRAME_DATA_MAX - 4
+BULK_OBJECTS = ("boardinfo", "log", "dmesg")
+BULK_ACK_TIMEOUT, BULK_ACK_ABORT = 1, 2
+BULK_CHUNK_TIMEOUT_S = 0.3
+BULK_RETRY = 5
+
+LEGACY_HDR = struct.pack("<I", FRAME_HEADER)
+CRC_HDR = struct.pack("<I", FRAME_HEADER_CRC)
+
+# rx gap after which a partial frame is given up, like the BMC protocol task
+IDLE_FLUSH_S = 0.1
+
+
+def _crc_table():
+    table = []
+    for i in range(256):
+        crc = i << 24
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x04C11DB7) if crc & 0x80000000 else (crc << 1)
+        table.append(crc & 0xFFFFFFFF)
+    return table
+
+
+CRC_TABLE = _crc_table()
+
+
+def crc32(data):
+    """CRC-32/MPEG-2 over little-endian words, as the STM32 CRC unit computes it."""
+    data = bytes(data) + b"\0" * (-len(data) % 4)
+    crc = 0xFFFFFFFF
+    for i in range(0, len(data), 4):
+        # the unit shifts the word in msb first, that is byte 3 of the LE word
+        for b in data[i + 3], data[i + 2], data[i + 1], data[i]:
+            crc = ((crc << 8) & 0xFFFFFFFF) ^ CRC_TABLE[(crc >> 24) ^ b]
+    return crc
+
+
+class Frame:
+    __slots__ = ("id", "msg_type", "cmd_type", "result", "data", "crc")
+
+    def __init__(self, msg_type, cmd_type, data=b"", id=0, result=HAL_OK, crc=True):
+        self.id = id
+        self.msg_type = msg_type
+        self.cmd_type = cmd_type
+        self.result = result
+        self.data = bytes(data)
+        self.crc = crc
+
+    def encode(self):
+        if len(self.data) > FRAME_DATA_MAX:
+            raise ValueError("data_len %d over %d" % (len(self.data), FRAME_DATA_MAX))
+        hdr = struct.pack("<IBBBB", self.id, self.msg_type, self.cmd_type, self.result,
+                          len(self.data))
+        if self.crc:
+            body = hdr + self.data
+            return CRC_HDR + body + struct.pack("<II", crc32(body), FRAME_TAIL)
+        checksum = self.msg_type ^ self.cmd_type ^ len(self.data)
+        for b in self.data:
+            checksum ^= b
+        return (LEGACY_HDR + hdr + self.data.ljust(FRAME_DATA_MAX, b"\0") +
+                struct.pack("<BI", checksum, FRAME_TAIL))
+
+    def __repr__(self):
+        return "Frame(id=%#x type=%d cmd=%s result=%d len=%d %s)" % (
+            self.id, self.msg_type, CMD_NAMES.get(self.cmd_type, self.cmd_type),
+            self.result, len(self.data), "crc" if self.crc else "legacy")
+
+
+class Decoder:
+    """Stream decoder with header resync, the same rules as src/som_frame.c."""
+
+    def __init__(self):
+        self.buf = bytearray()
+        self.frames = 0
+        self.errors = 0
+        self.dropped = 0
+
+    def _hunt(self):
+        starts = [i for i in (self.buf.find(LEGACY_HDR), self.buf.find(CRC_HDR)) if i >= 0]
+        if starts:
+            skip = min(starts)
+        else:
+            # keep a tail that may still grow into a header
+            skip = max(len(self.buf) - 3, 0)
+        self.dropped += skip
+        del self.buf[:skip]
+        return bool(starts)
+
+    def _resync(self):
+        self.errors += 1
+        self.dropped += 1
+        del self.buf[:1]
+
+    def _step(self):
+        if not self._hunt() or len(self.buf) < 12:
+            return None
+        header, id, msg_type, cmd_type, result, data_len = struct.unpack_from("<IIBBBB", self.buf)
+        if data_len > FRAME_DATA_MAX:
+            self._resync()
+            return True
+        legacy = header == FRAME_HEADER
+        total = LEGACY_LEN if legacy else CRC_OVERHEAD + data_len
+        if len(self.buf) < total:
+            return None
+        if struct.unpack_from("<I", self.buf, total - 4)[0] != FRAME_TAIL:
+            self._resync()
+            return True
+        data = bytes(self.buf[12:12 + data_len])
+        if legacy:
+            checksum = msg_type ^ cmd_type ^ data_len
+            for b in data:
+                checksum ^= b
+            ok = checksum == self.buf[12 + FRAME_DATA_MAX]
+        else:
+            ok = crc32(self.buf[4:12 + data_len]) == struct.unpack_from("<I", self.buf, 12 + data_len)[0]
+        if not ok:
+            self._resync()
+            return True
+        del self.buf[:total]
+        self.frames += 1
+        return Frame(msg_type, cmd_type, data, id, result, not legacy)
+
+    def feed(self, data):
+        self.buf += data
+        out = []
+        while True:
+            r = self._step()
+            if r is None:
+                return out
+            if r is not True:
+                out.append(r)
+
+    def flush(self):
+        """The line went quiet: a pending partial frame was a false header."""
+        out = []
+        while self.buf:
+            self._resync()
+            out += self.feed(b"")
+        return out
+
+
+class Port:
+    """A raw tty, either a serial device or one end of a pty pair."""
+
+    def __init__(self, fd, name, baud=LINK_DEFAULT_BAUD, pace=False):
+        self.fd = fd
+        self.name = name
+        # a pty moves bytes at memory speed, pace writes to the simulated line rate
+        self.pace = pace
+        self.tx_idle_at = 0.0
+        self.tx_bytes = 0
+        self.rx_bytes = 0
+        self.lock = threading.Lock()
+        tty.setraw(fd)
+        self.set_baud(baud)
+
+    @classmethod
+    def open(cls, path, baud):
+        return cls(os.open(path, os.O_RDWR | os.O_NOCTTY), path, baud,
+                   pace=path.startswith("/dev/pts/"))
+
+    @classmethod
+    def pty_pair(cls, baud=LINK_DEFAULT_BAUD):
+        master, slave = os.openpty()
+        return (cls(master, "pty master", baud, pace=True),
+                cls(slave, os.ttyname(slave), baud, pace=True))
+
+    def set_baud(self, baud):
+        speed = getattr(termios, "B%d" % baud, None)
+        if speed is None:
+            raise ValueError("baud rate %d not supported by termios" % baud)
+        attr = termios.tcgetattr(self.fd)
+        attr[4] = attr[5] = speed
+        termios.tcsetattr(self.fd, termios.TCSADRAIN, attr)
+        self.baud = baud
+
+    def write(self, data):
+        with self.lock:
+            if self.pace:
+                # 8N1, 10 bit times per byte, the peer sees the frame once its last byte is in
+                now = time.monotonic()
+                self.tx_idle_at = max(self.tx_idle_at, now) + len(data) * 10.0 / self.baud
+                time.sleep(self.tx_idle_at - now)
+            view = memoryview(data)
+            while view:
+                n = os.write(self.fd, view)
+                view = view[n:]
+            self.tx_bytes += len(data)
+
+    def drain(self):
+        if self.pace:
+            time.sleep(max(self.tx_idle_at - time.monotonic(), 0))
+        try:
+            termios.tcdrain(self.fd)
+        except termios.error:
+            pass
+
+    def read(self, timeout):
+        r, _, _ = select.select([self.fd], [], [], max(timeout, 0))
+        if not r:
+            return b""
+        try:
+            data = os.read(self.fd, 4096)
+        except OSError:
+            # pty peer closed
+            return b""
+        self.rx_bytes += len(data)
+        return data
+
+
+class Daemon:
+    """Answers the BMC like the SOM daemon, with optional impairments."""
+
+    def __init__(self, port, args, log=print):
+        self.port = port
+        self.args = args
+        self.log = log
+        self.rng = random.Random(args.seed)
+        self.dec = Decoder()
+        self.timers = []
+        self.timer_seq = 0
+        self.crc = not args.legacy
+        self.revert_at = None
+        self.telemetry = None
+        self.bulk = None
+        self.pvt = [45000, 43000, 2400]
+        self.load = [150, 120, 180, 140, 160]
+        self.thermal = [45000, 44000, 43000, 41000]
+        self.stats = {"requests": 0, "replies": 0, "lost": 0, "corrupted": 0,
+                      "notifies": 0, "heartbeats": 0, "bulk_chunks": 0, "bulk_resent": 0}
+        if args.heartbeat:
+            self.after(args.heartbeat, self.heartbeat)
+
+    def after(self, delay, fn, *a):
+        self.timer_seq += 1
+        heapq.heappush(self.timers, (time.monotonic() + delay, self.timer_seq, fn, a))
+
+    def run_timers(self):
+        now = time.monotonic()
+        while self.timers and self.timers[0][0] <= now:
+            _, _, fn, a = heapq.heappop(self.timers)
+            fn(*a)
+        if self.revert_at and now >= self.revert_at:
+            self.log("no valid frame since the rate switch, back to %d" % LINK_DEFAULT_BAUD)
+            self.revert_at = None
+            self.port.set_baud(LINK_DEFAULT_BAUD)
+
+    def next_timeout(self):
+        deadlines = [t[0] for t in self.timers[:1]]
+        if self.revert_at:
+            deadlines.append(self.revert_at)
+        if not deadlines:
+            return IDLE_FLUSH_S
+        return min(IDLE_FLUSH_S, min(deadlines) - time.monotonic())
+
+    def send(self, frame, impair=False):
+        raw = bytearray(frame.encode())
+        if impair:
+            if self.rng.random() < self.args.loss:
+                self.stats["lost"] += 1
+                return
+            if self.rng.random() < self.args.corrupt:
+                self.stats["corrupted"] += 1
+                bit = self.rng.randrange(len(raw) * 8)
+                raw[bit // 8] ^= 1 << (bit % 8)
+        self.port.write(raw)
+
+    def heartbeat(self):
+        self.send(Frame(MSG_HEARTBEAT, 0, crc=self.crc))
+        self.stats["heartbeats"] += 1
+        self.after(self.args.heartbeat, self.heartbeat)
+
+    def notify(self, cmd, data=b""):
+        self.send(Frame(MSG_NOTIFLY, cmd, data, crc=self.crc))
+        self.stats["notifies"] += 1
+
+    def _walk(self, values, step, lo, hi):
+        for i, v in enumerate(values):
+            values[i] = min(max(v + self.rng.randint(-step, step), lo), hi)
+
+    def pvt_data(self):
+        self.pvt[0] = min(max(self.pvt[0] + self.rng.randint(-300, 300), 30000), 95000)
+        self.pvt[1] = min(max(self.pvt[1] + self.rng.randint(-300, 300), 30000), 95000)
+        return struct.pack("<iii", *self.pvt)
+
+    def load_data(self):
+        self._walk(self.load, 30, 0, 1000)
+        self.load[0] = sum(self.load[1:]) // 4
+        return struct.pack("<5H", *self.load)
+
+    def thermal_data(self):
+        self._walk(self.thermal, 200, 25000, 100000)
+        return struct.pack("<4i", *self.thermal)
+
+    def push_telemetry(self, generation):
+        sub = self.telemetry
+        if not sub or sub["generation"] != generation:
+            return
+        if sub["topics"] & TELEMETRY_PVT:
+            self.notify(CMD_PVT_INFO, self.pvt_data())
+        if sub["topics"] & TELEMETRY_CPU_LOAD:
+            self.notify(CMD_CPU_LOAD, self.load_data())
+        if sub["topics"] & TELEMETRY_THERMAL:
+            self.notify(CMD_THERMAL_INFO, self.thermal_data())
+        self.after(sub["interval"] / 1000.0, self.push_telemetry, generation)
+
+    def switch_baud(self, baud):
+        self.port.drain()
+        self.port.set_baud(baud)
+        self.revert_at = time.monotonic() + LINK_REVERT_S
+        self.log("switched to %d" % baud)
+
+    def bulk_object(self, obj, max_len):
+        if obj == 0:
+            info = struct.pack("<IBHBBB18sB", 0xF15E5045, 1, 0x0550, 2, 1, 0,
+                               b"SIM0000000000000001"[:18], 0)
+            blob = (info + bytes(range(256)) * 4)[:1024]
+            return blob[:max_len]
+        fmt = "[%10.6f] som-daemon: heartbeat %d, load %d.%d%%\n" if obj == 1 else \
+              "[%10.6f] kernel: eth0: link up, 1000Mbps, seq %d, irq %d.%d\n"
+        lines = [fmt % (i * 0.5, i, i % 100, i % 10) for i in range(600)]
+        # logs keep their tail
+        return "".join(lines).encode()[-max_len:] if max_len else b""
+
+    def bulk_send(self, indexes):
+        bulk = self.bulk
+        for i in indexes:
+            chunk = bulk["data"][i * BULK_CHUNK_SIZE:(i + 1) * BULK_CHUNK_SIZE]
+            self.send(Frame(MSG_NOTIFLY, CMD_BULK_DATA, struct.pack("<BBH", bulk["object"], 0, i) + chunk,
+                            crc=self.crc), impair=True)
+            self.stats["bulk_chunks"] += 1
+
+    def bulk_ack(self, data):
+        obj, flags, base, bitmap = struct.unpack_from("<BBHI", data)
+        bulk = self.bulk
+        if not bulk or bulk["object"] != obj:
+            return HAL_ERROR, b"", None
+        if flags & BULK_ACK_ABORT or base >= bulk["chunks"]:
+            self.bulk = None
+            return HAL_OK, b"", None
+        # a chunk the bmc skipped over was lost on the way
+        highest = base + bitmap.bit_length()
+        send = []
+        for i in range(base, min(base + bulk["window"], bulk["chunks"])):
+            if bitmap >> (i - base) & 1:
+                continue
+            if i >= bulk["next"]:
+                send.append(i)
+            elif flags & BULK_ACK_TIMEOUT or i < highest:
+                send.append(i)
+                self.stats["bulk_resent"] += 1
+        if send:
+            bulk["next"] = max(bulk["next"], send[-1] + 1)
+        return HAL_OK, b"", lambda: self.bulk_send(send)
+
+    def answer(self, req):
+        """Returns (result, data) for a request, plus an action run after the reply."""
+        cmd, data = req.cmd_type, req.data
+        if cmd in (CMD_REBOOT, CMD_CONTROL_LED, CMD_BOARD_STATUS):
+            return HAL_OK, b"", None
+        if cmd == CMD_POWER_OFF:
+            # the daemon shuts linux down, opensbi then reports it is safe to cut power
+            return HAL_OK, b"", lambda: self.after(self.args.shutdown_delay, self.notify, CMD_POWER_OFF)
+        if cmd == CMD_RESTART:
+            return HAL_OK, b"", lambda: self.after(self.args.shutdown_delay, self.notify, CMD_RESTART)
+        if cmd == CMD_READ_BOARD_INFO:
+            info = struct.pack("<IBHBBB18sB", 0xF15E5045, 1, 0x0550, 2, 1, 0,
+                               b"SIM0000000000000001"[:18], 0)
+            return HAL_OK, info + struct.pack("<I", crc32(info)), None
+        if cmd == CMD_PVT_INFO:
+            return HAL_OK, self.pvt_data(), None
+        if cmd == CMD_POWER_INFO:
+            return HAL_OK, struct.pack("<III", 9500, 790, 12000), None
+        if cmd == CMD_CPU_LOAD:
+            return HAL_OK, self.load_data(), None
+        if cmd == CMD_THERMAL_INFO:
+            return HAL_OK, self.thermal_data(), None
+        if cmd == CMD_LINK_ECHO:
+            return HAL_OK, data, None
+        if cmd == CMD_LINK_BAUD:
+            if self.args.max_baud == 0 or len(data) < 4:
+                return HAL_ERROR, b"", None
+            rates = struct.unpack("<%dI" % (len(data) // 4), data[:len(data) // 4 * 4])
+            for rate in rates:
+                if rate <= self.args.max_baud and hasattr(termios, "B%d" % rate):
+                    return HAL_OK, struct.pack("<I", rate), lambda: self.switch_baud(rate)
+            return HAL_ERROR, b"", None
+        if cmd == CMD_TELEMETRY_SUB:
+            if self.args.no_telemetry or len(data) < 8:
+                return HAL_ERROR, b"", None
+            topics, _, interval, _, _ = struct.unpack_from("<BBHHH", data)
+            generation = (self.telemetry or {}).get("generation", 0) + 1
+            if not topics or not interval:
+                self.telemetry = {"generation": generation, "topics": 0, "interval": 0}
+                return HAL_OK, data, None
+            self.telemetry = {"generation": generation, "topics": topics, "interval": interval}
+            return HAL_OK, data, lambda: self.after(interval / 1000.0, self.push_telemetry, generation)
+        if cmd == CMD_BULK_OPEN:
+            if len(data) < 8:
+                return HAL_ERROR, b"", None
+            obj, window, _, max_len = struct.unpack_from("<BBHI", data)
+            if obj >= len(BULK_OBJECTS):
+                return HAL_ERROR, b"", None
+            blob = self.bulk_object(obj, max_len)
+            self.bulk = {"object": obj, "data": blob, "window": min(max(window, 1), 32), "next": 0,
+                         "chunks": (len(blob) + BULK_CHUNK_SIZE - 1) // BULK_CHUNK_SIZE}
+            return HAL_OK, struct.pack("<II", len(blob), crc32(blob)), None
+        if cmd == CMD_BULK_ACK:
+            if len(data) < 8:
+                return HAL_ERROR, b"", None
+            return self.bulk_ack(data)
+        return HAL_ERROR, b"", None
+
+    def reply(self, req):
+        result, data, action = self.answer(req)
+        self.send(Frame(MSG_REPLY, req.cmd_type, data, req.id, result, self.crc), impair=True)
+        self.stats["replies"] += 1
+        if action:
+            action()
+
+    def handle(self, frame):
+        self.revert_at = None
+        if frame.msg_type != MSG_REQUEST:
+            self.log("unexpected %r" % frame)
+            return
+        self.stats["requests"] += 1
+        if self.args.verbose:
+            self.log("rx %r" % frame)
+        delay = self.args.latency / 1000.0
+        if self.args.jitter:
+            delay += self.rng.uniform(0, self.args.jitter / 1000.0)
+        if delay > 0:
+            self.after(delay, self.reply, frame)
+        else:
+            self.reply(frame)
+
+    def poll(self):
+        data = self.port.read(self.next_timeout())
+        frames = self.dec.feed(data) if data else self.dec.flush()
+        for frame in frames:
+            self.handle(frame)
+        self.run_timers()
+        return frames
+
+    def run(self, stop=None):
+        while not (stop and stop.is_set()):
+            self.poll()
+
+
+def percentile(sorted_values, p):
+    if not sorted_values:
+        return float("nan")
+    k = min(int(round(p / 100.0 * (len(sorted_values) - 1))), len(sorted_values) - 1)
+    return sorted_values[k]
+
+
+class BulkClient:
+    """The BMC side of a bulk read, the same acking rules as src/hf_som_bulk.c."""
+
+    def __init__(self, port, args):
+        self.port = port
+        self.args = args
+        self.dec = Decoder()
+        self.replies = {}
+        self.next_id = 1
+        self.base = 0
+        self.bitmap = 0
+        self.fresh = 0
+        self.stats = {"chunks": 0, "duplicates": 0, "gaps": 0, "timeouts": 0}
+
+    def on_chunk(self, frame):
+        if len(frame.data) < 4:
+            return
+        obj, _, index = struct.unpack_from("<BBH", frame.data)
+        if obj != self.object or index >= self.chunks:
+            return
+        if index < self.base or index - self.base >= 32 or self.bitmap >> (index - self.base) & 1:
+            self.stats["duplicates"] += 1
+            return
+        payload = frame.data[4:]
+        if len(payload) != min(self.size - index * BULK_CHUNK_SIZE, BULK_CHUNK_SIZE):
+            return
+        self.buf[index * BULK_CHUNK_SIZE:index * BULK_CHUNK_SIZE + len(payload)] = payload
+        self.bitmap |= 1 << (index - self.base)
+        while self.bitmap & 1:
+            self.bitmap >>= 1
+            self.base += 1
+        self.stats["chunks"] += 1
+        self.fresh += 1
+
+    def pump(self, timeout):
+        data = self.port.read(timeout)
+        for frame in (self.dec.feed(data) if data else self.dec.flush()):
+            if frame.msg_type == MSG_REPLY:
+                self.replies[frame.id] = frame
+            elif frame.msg_type == MSG_NOTIFLY and frame.cmd_type == CMD_BULK_DATA:
+                self.on_chunk(frame)
+
+    def request(self, cmd, data):
+        """web_cmd_handle(): chunks keep being stored while the reply is awaited."""
+        id = self.next_id
+        self.next_id += 1
+        self.port.write(Frame(MSG_REQUEST, cmd, data, id, crc=self.args.crc).encode())
+        deadline = time.monotonic() + self.args.timeout
+        while time.monotonic() < deadline:
+            self.pump(deadline - time.monotonic())
+            reply = self.replies.pop(id, None)
+            if reply:
+                return reply.result, reply.data
+        return "timeout", b""
+
+    def ack(self, flags=0):
+        return self.request(CMD_BULK_ACK, struct.pack("<BBHI", self.object, flags, self.base, self.bitmap))[0]
+
+    def wait_chunk(self, timeout):
+        deadline = time.monotonic() + timeout
+        while not self.fresh and time.monotonic() < deadline:
+            self.pump(deadline - time.monotonic())
+        got, self.fresh = self.fresh, 0
+        return got
+
+    def read(self, obj, max_len, window):
+        self.object = obj
+        ret, info = self.request(CMD_BULK_OPEN, struct.pack("<BBHI", obj, window, 0, max_len))
+        if ret != HAL_OK:
+            return ret, b""
+        self.size, crc = struct.unpack("<II", info)
+        self.chunks = (self.size + BULK_CHUNK_SIZE - 1) // BULK_CHUNK_SIZE
+        self.buf = bytearray(self.size)
+        acked = 0
+        gap_base = None
+        retry = 0
+        ret = self.ack()
+        while self.base < self.chunks:
+            if ret == "timeout" and retry < BULK_RETRY:
+                ret = HAL_OK
+            if ret != HAL_OK:
+                break
+            if not self.wait_chunk(BULK_CHUNK_TIMEOUT_S):
+                retry += 1
+                if retry > BULK_RETRY:
+                    ret = "timeout"
+                    break
+                self.stats["timeouts"] += 1
+                acked = self.base
+                ret = self.ack(BULK_ACK_TIMEOUT)
+                continue
+            retry = 0
+            if self.bitmap and gap_base != self.base:
+                self.stats["gaps"] += 1
+                gap_base = acked = self.base
+                ret = self.ack()
+            elif self.base - acked >= window // 2 and self.base < self.chunks:
+                acked = self.base
+                ret = self.ack()
+        if self.base >= self.chunks:
+            self.ack()
+            return (HAL_OK if crc32(self.buf) == crc else "crc mismatch"), bytes(self.buf)
+        self.ack(BULK_ACK_ABORT)
+        return ret, b""
+
+
+def bench_bulk(args, port):
+    obj = BULK_OBJECTS.index(args.bulk)
+    client = BulkClient(port, args)
+    start = time.perf_counter()
+    ret, data = client.read(obj, args.bulk_size, args.window)
+    elapsed = time.perf_counter() - start
+    if ret != HAL_OK:
+        print("bulk read of %s failed: %s" % (args.bulk, ret))
+        return 1
+    rate = len(data) / elapsed
+    print("%s: %d bytes in %.3f s, window %d" % (args.bulk, len(data), elapsed, args.window))
+    print("%.0f B/s effective, %.1f%% of the %d baud raw line rate (%.0f B/s)" %
+          (rate, 100.0 * rate * 10 / port.baud, port.baud, port.baud / 10.0))
+    print(" ".join("%s %d" % kv for kv in client.stats.items()))
+    return 0
+
+
+def start_bmc(args, peer, *mode):
+    """som_bmc with UART4 on the pty peer, mode is run or bench and its options."""
+    return subprocess.Popen([args.bmc, "--port", peer.name] + [str(v) for v in mode])
+
+
+def bench_bmc(args):
+    stop = threading.Event()
+    master, peer = Port.pty_pair(args.baud)
+    daemon = Daemon(master, args, log=lambda s: None)
+    threading.Thread(target=daemon.run, args=(stop,), daemon=True).start()
+    bmc = start_bmc(args, peer, "bench", "-n", args.count, "-c", args.cmd, "-o", args.outstanding,
+                    "-p", args.payload, "-T", int(args.timeout * 1000))
+    ret = bmc.wait()
+    stop.set()
+    print("daemon: " + " ".join("%s %d" % kv for kv in daemon.stats.items()))
+    # som_bmc exits 1 on timeouts, expected when replies are dropped or corrupted
+    return 0 if ret == 1 and (args.loss or args.corrupt) else ret
+
+
+def bench(args):
+    if args.bmc:
+        return bench_bmc(args)
+    stop = threading.Event()
+    if args.self:
+        master, port = Port.pty_pair(args.baud)
+        daemon = Daemon(master, args, log=lambda s: None)
+        thread = threading.Thread(target=daemon.run, args=(stop,), daemon=True)
+        thread.start()
+    else:
+        port = Port.open(args.port, args.baud)
+
+    if args.bulk:
+        ret = bench_bulk(args, port)
+        stop.set()
+        return ret
+
+    dec = Decoder()
+    cmd = getattr(sys.modules[__name__], "CMD_" + args.cmd.upper())
+    payload = bytes(args.payload)
+    pending = {}
+    rtts = []
+    timeouts = errors = 0
+    next_id = 1
+    sent = 0
+    start = time.perf_counter()
+
+    while sent < args.count or pending:
+        while sent < args.count and len(pending) < args.outstanding:
+            req = Frame(MSG_REQUEST, cmd, payload, next_id, crc=args.crc)
+            pending[next_id] = time.perf_counter()
+            port.write(req.encode())
+            next_id = next_id % 0xFFFFFFFF + 1
+            sent += 1
+        data = port.read(0.01)
+        now = time.perf_counter()
+        for frame in (dec.feed(data) if data else dec.flush()):
+            t0 = pending.pop(frame.id, None) if frame.msg_type == MSG_REPLY else None
+            if t0 is None:
+                continue
+            rtts.append(now - t0)
+            if frame.result != HAL_OK:
+                errors += 1
+        for id, t0 in list(pending.items()):
+            if now - t0 > args.timeout:
+                del pending[id]
+                timeouts += 1
+
+    elapsed = time.perf_counter() - start
+    stop.set()
+    rtts.sort()
+    ms = [v * 1000 for v in rtts]
+    wire = port.tx_bytes + port.rx_bytes
+    print("%d requests, %d replies, %d failed, %d timeouts in %.2f s" %
+          (sent, len(rtts), errors, timeouts, elapsed))
+    print("%.1f cmds/s" % (len(rtts) / elapsed))
+    print("rtt ms: p50 %.2f  p90 %.2f  p99 %.2f  max %.2f" %
+          (percentile(ms, 50), percentile(ms, 90), percentile(ms, 99), percentile(ms, 100)))
+    # 10 bit times per byte on an 8N1 line, both directions share the count
+    print("wire: %d bytes, %.1f%% of a %d baud full duplex line" %
+          (wire, 100.0 * wire * 10 / (elapsed * port.baud * 2), port.baud))
+    print("decoder: %d frames, %d errors, %d bytes dropped" % (dec.frames, dec.errors, dec.dropped))
+    return 0 if not timeouts or args.loss or args.corrupt else 1
+
+
+def mutants(rng, crc):
+    """Malformed frames the BMC decoder has to survive."""
+    base = Frame(MSG_REPLY, rng.randrange(1, 14), bytes(rng.randrange(256) for _ in range(rng.randrange(64))),
+                 rng.getrandbits(32), crc=crc).encode()
+
+    def bitflip():
+        raw = bytearray(base)
+        for _ in range(rng.randrange(1, 4)):
+            bit = rng.randrange(len(raw) * 8)
+            raw[bit // 8] ^= 1 << (bit % 8)
+        return bytes(raw)
+
+    def truncated():
+        return base[:rng.randrange(1, len(base))]
+
+    def bad_len():
+        raw = bytearray(base)
+        raw[11] = rng.randrange(FRAME_DATA_MAX + 1, 256)
+        return bytes(raw)
+
+    def bad_tail():
+        return base[:-4] + struct.pack("<I", rng.getrandbits(32))
+
+    def false_header():
+        hdr = rng.choice((LEGACY_HDR, CRC_HDR))
+        return hdr + bytes(rng.randrange(256) for _ in range(rng.randrange(300)))
+
+    def noise():
+        return bytes(rng.randrange(256) for _ in range(rng.randrange(1, 512)))
+
+    def header_storm():
+        return (LEGACY_HDR + CRC_HDR) * rng.randrange(1, 80)
+
+    return rng.choice((bitflip, truncated, bad_len, bad_tail, false_header, noise, header_storm))()
+
+
+def fuzz(args):
+    # the BMC only polls a quiet link, pushed telemetry would keep it from sending requests
+    args.no_telemetry = True
+    bmc = None
+    if args.bmc:
+        port, peer = Port.pty_pair(args.baud)
+        bmc = start_bmc(args, peer, "run")
+    else:
+        port = Port.open(args.port, args.baud)
+    daemon = Daemon(port, args, log=lambda s: print("daemon:", s))
+    rng = random.Random(args.seed)
+    stalls = 0
+
+    for burst in range(args.bursts):
+        for _ in range(rng.randrange(1, args.burst_len + 1)):
+            port.write(mutants(rng, daemon.crc))
+        deadline = time.monotonic() + args.liveness
+        alive = False
+        while time.monotonic() < deadline:
+            if any(f.msg_type == MSG_REQUEST for f in daemon.poll()):
+                alive = True
+                break
+        if not alive:
+            stalls += 1
+            print("burst %d: no valid request from the BMC within %.1f s" % (burst, args.liveness))
+        elif args.verbose:
+            print("burst %d ok" % burst)
+
+    print("%d bursts, %d stalls, %d requests answered" % (args.bursts, stalls, daemon.stats["requests"]))
+    if bmc:
+        bmc.terminate()
+        if bmc.wait():
+            stalls += 1
+    return 1 if stalls else 0
+
+
+def serve(args):
+    if args.port:
+        port = Port.open(args.port, args.baud)
+        print("serving on %s at %d baud" % (port.name, port.baud))
+    else:
+        port, peer = Port.pty_pair(args.baud)
+        # keep the slave open so the master does not see hangups between clients
+        print("serving on %s" % peer.name, flush=True)
+    bmc = start_bmc(args, peer, "run") if args.bmc else None
+    daemon = Daemon(port, args)
+    signal.signal(signal.SIGTERM, signal.default_int_handler)
+    try:
+        daemon.run()
+    except KeyboardInterrupt:
+        pass
+    if bmc:
+        bmc.terminate()
+        bmc.wait()
+    print(" ".join("%s %d" % kv for kv in daemon.stats.items()))
+    print("decoder: %d frames, %d errors, %d bytes dropped" %
+          (daemon.dec.frames, daemon.dec.errors, daemon.dec.dropped))
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[1],
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="mode", required=True)
+
+    common = argparse.ArgumentParser(add_help=False)
+    common.add_argument("--port", help="serial device, a new pty when omitted (serve)")
+    common.add_argument("--baud", type=int, default=LINK_DEFAULT_BAUD)
+    common.add_argument("--seed", type=int, help="random seed for reproducible runs")
+    common.add_argument("-v", "--verbose", action="store_true")
+    common.add_argument("--bmc", help="som_bmc binary to run on a pty as the BMC (serve, bench, fuzz)")
+
+    daemon = argparse.ArgumentParser(add_help=False)
+    daemon.add_argument("--latency", type=float, default=0, help="reply delay in ms")
+    daemon.add_argument("--jitter", type=float, default=0, help="extra random delay up to ms")
+    daemon.add_argument("--loss", type=float, default=0, help="probability a reply is dropped")
+    daemon.add_argument("--corrupt", type=float, default=0, help="probability a reply gets a bit flip")
+    daemon.add_argument("--legacy", action="store_true", help="answer with legacy frames only")
+    daemon.add_argument("--max-baud", type=int, default=2000000,
+                        help="highest rate accepted in CMD_LINK_BAUD, 0 rejects the command")
+    daemon.add_argument("--no-telemetry", action="store_true", help="reject CMD_TELEMETRY_SUB")
+    daemon.add_argument("--heartbeat", type=float, default=0, help="MSG_HEARTBEAT period in s, 0 off")
+    daemon.add_argument("--shutdown-delay", type=float, default=2.0,
+                        help="s before the CMD_POWER_OFF/CMD_RESTART notification")
+
+    sub.add_parser("serve", parents=[common, daemon], help="answer as the SOM daemon")
+
+    p = sub.add_parser("bench", parents=[common, daemon], help="measure as the BMC")
+    p.add_argument("--self", action="store_true", help="bench against an in-process daemon on a pty")
+    p.add_argument("--count", type=int, default=1000)
+    p.add_argument("--outstanding", type=int, default=1, help="requests in flight")
+    p.add_argument("--cmd", default="board_status", help="command name without CMD_")
+    p.add_argument("--payload", type=int, default=0, help="request payload bytes")
+    p.add_argument("--crc", action="store_true", help="send crc frames")
+    p.add_argument("--timeout", type=float, default=1.0)
+    p.add_argument("--bulk", choices=BULK_OBJECTS, help="bulk read an object instead of --cmd")
+    p.add_argument("--bulk-size", type=int, default=8192, help="max object bytes")
+    p.add_argument("--window", type=int, default=8, help="bulk chunks in flight, 1 is stop-and-wait")
+
+    p = sub.add_parser("fuzz", parents=[common, daemon], help="feed malformed frames to a BMC")
+    p.add_argument("--bursts", type=int, default=100)
+    p.add_argument("--burst-len", type=int, default=8, help="max malformed frames per burst")
+    p.add_argument("--liveness", type=float, default=3.0,
+                   help="s the BMC has to send a valid request after a burst")
+
+    args = parser.parse_args()
+    if args.bmc and args.port:
+        parser.error("--bmc runs on a new pty, drop --port")
+    if args.mode == "bench" and args.bmc and args.bulk:
+        parser.error("--bulk is read by the Python client, drop --bmc")
+    if args.mode == "bench" and not args.self and not args.port and not args.bmc:
+        parser.error("bench needs --port, --self or --bmc")
+    if args.mode == "fuzz" and not args.port and not args.bmc:
+        parser.error("fuzz needs --port or --bmc")
+    if args.mode == "bench":
+        args.payload = min(args.payload, FRAME_DATA_MAX)
+    return {"serve": serve, "bench": bench, "fuzz": fuzz}[args.mode](args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
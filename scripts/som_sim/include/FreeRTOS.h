@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Host build of the SOM protocol layer: the part of the FreeRTOS api it uses,
+ * with every task a POSIX thread and the tick the monotonic clock in ms.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#ifndef __SIM_FREERTOS_H
+#define __SIM_FREERTOS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+
+#define pdFALSE			((BaseType_t)0)
+#define pdTRUE			((BaseType_t)1)
+#define pdFAIL			pdFALSE
+#define pdPASS			pdTRUE
+#define portMAX_DELAY		((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS	((TickType_t)1)
+#define configTICK_RATE_HZ	1000
+#define configMAX_PRIORITIES	56
+#define pdMS_TO_TICKS(ms)	((TickType_t)(ms))
+#define configASSERT(x)		do { if (!(x)) sim_assert(__FILE__, __LINE__); } while (0)
+
+/*
+ * One recursive lock stands for the scheduler: critical sections, the
+ * "interrupts" of the uart and timer threads and every kernel object take it,
+ * so a critical section keeps them all out as on the target.
+ */
+#define taskENTER_CRITICAL()			sim_enter_critical()
+#define taskEXIT_CRITICAL()			sim_exit_critical()
+#define taskENTER_CRITICAL_FROM_ISR()		(sim_enter_critical(), (UBaseType_t)0)
+#define taskEXIT_CRITICAL_FROM_ISR(x)		((void)(x), sim_exit_critical())
+#define portYIELD_FROM_ISR(x)			((void)(x))
+
+void sim_enter_critical(void);
+void sim_exit_critical(void);
+void sim_assert(const char *file, int line);
+
+#endif /* __SIM_FREERTOS_H */
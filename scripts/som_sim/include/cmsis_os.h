@@ -0,0 +1,13 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Host build of the SOM protocol layer, see FreeRTOS.h.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#ifndef __SIM_CMSIS_OS_H
+#define __SIM_CMSIS_OS_H
+
+#include "cmsis_os2.h"
+
+#endif /* __SIM_CMSIS_OS_H */
@@ -0,0 +1,19 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Host build of the SOM protocol layer, see FreeRTOS.h.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#ifndef __SIM_CMSIS_OS2_H
+#define __SIM_CMSIS_OS2_H
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+typedef int osStatus_t;
+#define osOK	0
+
+osStatus_t osDelay(uint32_t ticks);
+
+#endif /* __SIM_CMSIS_OS2_H */
@@ -0,0 +1,40 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Host build of the SOM protocol layer, see FreeRTOS.h: the FreeRTOS list,
+ * circular and doubly linked with the end marker in the list.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#ifndef __SIM_LIST_H
+#define __SIM_LIST_H
+
+#include "FreeRTOS.h"
+
+typedef struct xLIST_ITEM {
+	TickType_t xItemValue;
+	struct xLIST_ITEM *pxNext;
+	struct xLIST_ITEM *pxPrevious;
+	void *pvOwner;
+	struct xLIST *pvContainer;
+} ListItem_t;
+
+typedef struct xLIST {
+	UBaseType_t uxNumberOfItems;
+	ListItem_t xListEnd;
+} List_t;
+
+#define listSET_LIST_ITEM_OWNER(item, owner)	((item)->pvOwner = (void *)(owner))
+#define listGET_LIST_ITEM_OWNER(item)		((item)->pvOwner)
+#define listGET_HEAD_ENTRY(list)		((list)->xListEnd.pxNext)
+#define listGET_END_MARKER(list)		((ListItem_t const *)&(list)->xListEnd)
+#define listGET_NEXT(item)			((item)->pxNext)
+#define listLIST_IS_EMPTY(list)			((list)->uxNumberOfItems == 0 ? pdTRUE : pdFALSE)
+#define listIS_CONTAINED_WITHIN(list, item)	((item)->pvContainer == (list) ? pdTRUE : pdFALSE)
+
+void vListInitialise(List_t *list);
+void vListInitialiseItem(ListItem_t *item);
+void vListInsertEnd(List_t *list, ListItem_t *item);
+UBaseType_t uxListRemove(ListItem_t *item);
+
+#endif /* __SIM_LIST_H */
@@ -0,0 +1,20 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Host build of the SOM protocol layer: no network stack, only the address
+ * check of include/lwip.h the production line protocol uses.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#ifndef __SIM_LWIP_H
+#define __SIM_LWIP_H
+
+#include <stdint.h>
+
+static inline int is_valid_ethaddr(const uint8_t *addr)
+{
+	/* not multicast, not all zeroes */
+	return !(addr[0] & 0x01) && (addr[0] | addr[1] | addr[2] | addr[3] | addr[4] | addr[5]);
+}
+
+#endif /* __SIM_LWIP_H */
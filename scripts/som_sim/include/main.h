@@ -0,0 +1,22 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Host build of the SOM protocol layer: the board definitions the protocol
+ * code uses, in place of include/main.h.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#ifndef __SIM_MAIN_H
+#define __SIM_MAIN_H
+
+#include "stm32f4xx_hal.h"
+#include "hf_common.h"
+
+extern UART_HandleTypeDef huart4;
+extern TIM_HandleTypeDef htim4;
+
+void uart_init(USART_TypeDef *Instance);
+void uart_deinit(USART_TypeDef *Instance);
+int uart_set_baudrate(USART_TypeDef *Instance, uint32_t baudrate);
+
+#endif /* __SIM_MAIN_H */
@@ -0,0 +1,13 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Host build of the SOM protocol layer, see stm32f4xx_hal.h.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#ifndef __SIM_STM32F4XX_H
+#define __SIM_STM32F4XX_H
+
+#include "stm32f4xx_hal.h"
+
+#endif /* __SIM_STM32F4XX_H */
@@ -0,0 +1,146 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Host build of the SOM protocol layer: the part of the STM32F4 HAL the
+ * protocol code uses. UART4 is backed by a pseudo-terminal, see
+ * som_sim_uart.c; the production line UART and the board pins only record
+ * what the code asked for.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#ifndef __SIM_STM32F4XX_HAL_H
+#define __SIM_STM32F4XX_HAL_H
+
+#include <stdint.h>
+
+typedef enum {
+	HAL_OK		= 0x00U,
+	HAL_ERROR	= 0x01U,
+	HAL_BUSY	= 0x02U,
+	HAL_TIMEOUT	= 0x03U,
+} HAL_StatusTypeDef;
+
+#define HAL_MAX_DELAY		0xFFFFFFFFU
+
+/* gpio */
+typedef struct {
+	volatile uint32_t ODR;
+	char name;
+} GPIO_TypeDef;
+
+typedef struct {
+	uint32_t Pin;
+	uint32_t Mode;
+	uint32_t Pull;
+	uint32_t Speed;
+	uint32_t Alternate;
+} GPIO_InitTypeDef;
+
+typedef enum {
+	GPIO_PIN_RESET = 0,
+	GPIO_PIN_SET,
+} GPIO_PinState;
+
+#define GPIO_PIN_0		((uint16_t)0x0001)
+#define GPIO_PIN_1		((uint16_t)0x0002)
+#define GPIO_PIN_2		((uint16_t)0x0004)
+#define GPIO_PIN_3		((uint16_t)0x0008)
+#define GPIO_PIN_4		((uint16_t)0x0010)
+#define GPIO_PIN_5		((uint16_t)0x0020)
+#define GPIO_PIN_6		((uint16_t)0x0040)
+#define GPIO_PIN_7		((uint16_t)0x0080)
+#define GPIO_PIN_8		((uint16_t)0x0100)
+#define GPIO_PIN_9		((uint16_t)0x0200)
+#define GPIO_PIN_10		((uint16_t)0x0400)
+#define GPIO_PIN_11		((uint16_t)0x0800)
+#define GPIO_PIN_12		((uint16_t)0x1000)
+#define GPIO_PIN_13		((uint16_t)0x2000)
+#define GPIO_PIN_14		((uint16_t)0x4000)
+#define GPIO_PIN_15		((uint16_t)0x8000)
+
+#define GPIO_MODE_INPUT		0x00000000U
+#define GPIO_MODE_OUTPUT_PP	0x00000001U
+#define GPIO_NOPULL		0x00000000U
+#define GPIO_SPEED_FREQ_LOW	0x00000000U
+
+extern GPIO_TypeDef sim_gpioa, sim_gpiob, sim_gpioc, sim_gpiod, sim_gpioe;
+extern GPIO_TypeDef sim_gpiof, sim_gpiog, sim_gpioh, sim_gpioi;
+#define GPIOA			(&sim_gpioa)
+#define GPIOB			(&sim_gpiob)
+#define GPIOC			(&sim_gpioc)
+#define GPIOD			(&sim_gpiod)
+#define GPIOE			(&sim_gpioe)
+#define GPIOF			(&sim_gpiof)
+#define GPIOG			(&sim_gpiog)
+#define GPIOH			(&sim_gpioh)
+#define GPIOI			(&sim_gpioi)
+
+void HAL_GPIO_Init(GPIO_TypeDef *port, GPIO_InitTypeDef *init);
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state);
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *port, uint16_t pin);
+
+/* uart */
+typedef struct {
+	int id;
+} USART_TypeDef;
+
+typedef struct {
+	uint32_t BaudRate;
+} UART_InitTypeDef;
+
+typedef enum {
+	HAL_UART_STATE_RESET	= 0x00U,
+	HAL_UART_STATE_READY	= 0x20U,
+	HAL_UART_STATE_BUSY_RX	= 0x22U,
+} HAL_UART_StateTypeDef;
+
+typedef struct {
+	USART_TypeDef *Instance;
+	UART_InitTypeDef Init;
+	volatile HAL_UART_StateTypeDef RxState;
+} UART_HandleTypeDef;
+
+typedef struct {
+	void *Instance;
+} DMA_HandleTypeDef;
+
+extern USART_TypeDef sim_usart3, sim_uart4, sim_usart6;
+#define USART3			(&sim_usart3)
+#define UART4			(&sim_uart4)
+#define USART6			(&sim_usart6)
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size,
+				    uint32_t timeout);
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef *huart, uint8_t *buf, uint16_t size);
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size);
+uint32_t HAL_RCC_GetPCLK1Freq(void);
+
+/* tim, the fan pwm */
+typedef struct {
+	uint32_t Period;
+} TIM_Base_InitTypeDef;
+
+typedef struct {
+	void *Instance;
+	TIM_Base_InitTypeDef Init;
+} TIM_HandleTypeDef;
+
+typedef struct {
+	uint32_t OCMode;
+	uint32_t Pulse;
+	uint32_t OCPolarity;
+	uint32_t OCFastMode;
+} TIM_OC_InitTypeDef;
+
+#define TIM_CHANNEL_1		0x00000000U
+#define TIM_CHANNEL_2		0x00000004U
+#define TIM_OCMODE_PWM1		0x00000060U
+#define TIM_OCPOLARITY_HIGH	0x00000000U
+#define TIM_OCFAST_ENABLE	0x00000004U
+
+HAL_StatusTypeDef HAL_TIM_PWM_ConfigChannel(TIM_HandleTypeDef *htim, TIM_OC_InitTypeDef *config,
+					    uint32_t channel);
+HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef *htim, uint32_t channel);
+HAL_StatusTypeDef HAL_TIM_PWM_Stop(TIM_HandleTypeDef *htim, uint32_t channel);
+
+#endif /* __SIM_STM32F4XX_HAL_H */
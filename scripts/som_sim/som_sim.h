@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Host build of the SOM protocol layer: hf_protocol_process.c, som_frame.c and
+ * the link, telemetry, bulk and event bus code run as threads on Linux, with
+ * UART4 on a pseudo-terminal or a serial port where the SOM daemon, simulated
+ * or real, answers.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#ifndef __SOM_SIM_H
+#define __SOM_SIM_H
+
+#include <stdint.h>
+
+/*
+ * UART4: frames go out on fd, and whatever is read from it is written into
+ * the circular rx buffer and reported as an rx event, as the dma and the idle
+ * line interrupt do. Transmit takes the time the bytes take on the wire at the
+ * configured baud rate.
+ */
+int sim_uart_open(const char *path);
+int sim_uart_openpty(int *peer);
+void sim_uart_attach(int fd);
+
+struct sim_uart_stats {
+	uint32_t tx_bytes;
+	uint32_t rx_bytes;
+	uint32_t rx_events;
+};
+
+void sim_uart_get_stats(struct sim_uart_stats *stats);
+
+/* start the uart4 protocol and keeplive tasks with the SOM powered on */
+void sim_protocol_start(void);
+
+#endif /* __SOM_SIM_H */
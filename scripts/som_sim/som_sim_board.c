@@ -0,0 +1,213 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * The rest of the board for the host build of the SOM protocol layer: the SOM
+ * power state, the interrupt callback of hf_it_callback.c for UART4, and
+ * stubs for what the production line protocol sets (pins, fans, network,
+ * RTC, SPI slave), kept in memory.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include "cmsis_os2.h"
+#include "main.h"
+#include "hf_common.h"
+#include "hf_event_bus.h"
+#include "hf_eeprom.h"
+#include "hf_spi_slv.h"
+#include "som_sim.h"
+
+GPIO_TypeDef sim_gpioa = { .name = 'A' }, sim_gpiob = { .name = 'B' }, sim_gpioc = { .name = 'C' };
+GPIO_TypeDef sim_gpiod = { .name = 'D' }, sim_gpioe = { .name = 'E' }, sim_gpiof = { .name = 'F' };
+GPIO_TypeDef sim_gpiog = { .name = 'G' }, sim_gpioh = { .name = 'H' }, sim_gpioi = { .name = 'I' };
+
+UART_HandleTypeDef huart3 = { .Instance = USART3 };
+UART_HandleTypeDef huart4 = { .Instance = UART4, .Init = { .BaudRate = 115200 } };
+DMA_HandleTypeDef hdma_uart4_rx;
+TIM_HandleTypeDef htim4;
+uint32_t pwm_period = 1000;
+
+uint8_t ip_address[4] = { 192, 168, 1, 100 };
+uint8_t netmask_address[4] = { 255, 255, 255, 0 };
+uint8_t getway_address[4] = { 192, 168, 1, 1 };
+uint8_t mac_address[6];
+SemaphoreHandle_t gNet_Mutex;
+
+void uart4_protocol_task(void *argument);
+void deamon_keeplive_task(void *argument);
+
+static power_switch_t som_power_state = SOM_POWER_OFF;
+static int led_status = LED_MCU_RUNING;
+static struct rtc_date_t rtc_date = { 2024, 1, 1, 1 };
+static struct rtc_time_t rtc_time;
+
+void HAL_GPIO_Init(GPIO_TypeDef *port, GPIO_InitTypeDef *init)
+{
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state)
+{
+	if (GPIO_PIN_SET == state)
+		port->ODR |= pin;
+	else
+		port->ODR &= ~pin;
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *port, uint16_t pin)
+{
+	return (port->ODR & pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_ConfigChannel(TIM_HandleTypeDef *htim, TIM_OC_InitTypeDef *config,
+					    uint32_t channel)
+{
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef *htim, uint32_t channel)
+{
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Stop(TIM_HandleTypeDef *htim, uint32_t channel)
+{
+	return HAL_OK;
+}
+
+/* as hf_it_callback.c */
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size)
+{
+	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+
+	if (huart->Instance == UART4)
+		uart4_rx_event_from_isr(Size, &xHigherPriorityTaskWoken);
+	else if (huart->Instance == USART3)
+		uart3_rx_event_from_isr(Size, &xHigherPriorityTaskWoken);
+}
+
+/* as hf_power_process.c */
+power_switch_t get_som_power_state(void)
+{
+	power_switch_t state;
+
+	taskENTER_CRITICAL();
+	state = som_power_state;
+	taskEXIT_CRITICAL();
+	return state;
+}
+
+void change_som_power_state(power_switch_t newState)
+{
+	power_switch_t oldState;
+
+	taskENTER_CRITICAL();
+	oldState = som_power_state;
+	som_power_state = newState;
+	taskEXIT_CRITICAL();
+	if (oldState != newState)
+		bmc_bus_publish(BMC_TOPIC_SOM_POWER, newState);
+}
+
+void som_reset_control(uint8_t reset)
+{
+}
+
+void vRestartSOM(void)
+{
+	change_som_power_state(SOM_POWER_OFF);
+	osDelay(pdMS_TO_TICKS(2000));
+	change_som_power_state(SOM_POWER_ON);
+}
+
+int get_mcu_led_status(void)
+{
+	return led_status;
+}
+
+void set_mcu_led_status(led_status_t type)
+{
+	led_status = type;
+}
+
+/* production line setters */
+void es_eeprom_wp(uint8_t flag)
+{
+}
+
+int es_eeprom_sync(void)
+{
+	return 0;
+}
+
+int es_set_mcu_mac(uint8_t *p_mac_address, uint8_t index)
+{
+	memcpy(mac_address, p_mac_address, sizeof(mac_address));
+	return 0;
+}
+
+int es_set_mcu_netinfo(uint8_t *p_ip_address, uint8_t *p_netmask_address, uint8_t *p_gateway_address)
+{
+	memcpy(ip_address, p_ip_address, 4);
+	memcpy(netmask_address, p_netmask_address, 4);
+	memcpy(getway_address, p_gateway_address, 4);
+	return 0;
+}
+
+void dynamic_change_eth(void)
+{
+}
+
+int32_t es_set_rtc_date(struct rtc_date_t *sdate)
+{
+	rtc_date = *sdate;
+	return 0;
+}
+
+int32_t es_set_rtc_time(struct rtc_time_t *stime)
+{
+	rtc_time = *stime;
+	return 0;
+}
+
+int32_t es_get_rtc_date(struct rtc_date_t *sdate)
+{
+	*sdate = rtc_date;
+	return 0;
+}
+
+int32_t es_get_rtc_time(struct rtc_time_t *stime)
+{
+	*stime = rtc_time;
+	return 0;
+}
+
+int es_spi_write(uint8_t *buf, uint64_t addr, int len)
+{
+	return 0;
+}
+
+int eswin_rx(uint8_t *rcvBuf, uint64_t addr, int len)
+{
+	memset(rcvBuf, 0, len);
+	return 0;
+}
+
+/**
+ * @brief  Power the SOM on and start the tasks of the protocol layer as
+ *         main.c does, UART4 must be attached already.
+ */
+void sim_protocol_start(void)
+{
+	gNet_Mutex = xSemaphoreCreateMutex();
+	change_som_power_state(SOM_POWER_ON);
+	xTaskCreate(uart4_protocol_task, "uart4_protocol", 0, NULL, 0, NULL);
+	/* the rx dma is armed by the power task once the SOM is released */
+	osDelay(10);
+	uart4_rx_start();
+	xTaskCreate(deamon_keeplive_task, "keeplive", 0, NULL, 0, NULL);
+}
@@ -0,0 +1,297 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * som_bmc: the BMC side of the SOM UART4 protocol built for the host.
+ *
+ * hf_protocol_process.c, som_frame.c and the link, telemetry and bulk code run
+ * unchanged on the FreeRTOS and HAL shims of scripts/som_sim/include, with
+ * UART4 on --port or on a new pty whose SOM end is printed. Point
+ * scripts/som_daemon_sim.py (or a SOM) at the other end.
+ *
+ *   run    keep the link alive for -t seconds (0: until killed) and print the
+ *          daemon state changes, the liveness and uart counters
+ *   bench  -n requests of -c through web_cmd_handle() from -o tasks at once,
+ *          round trip percentiles and commands/s as the Python bench prints
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include "cmsis_os2.h"
+#include "main.h"
+#include "hf_common.h"
+#include "hf_event_bus.h"
+#include "som_sim.h"
+
+static const char *const cmd_names[] = {
+	[CMD_POWER_OFF] = "power_off",
+	[CMD_REBOOT] = "reboot",
+	[CMD_READ_BOARD_INFO] = "read_board_info",
+	[CMD_CONTROL_LED] = "control_led",
+	[CMD_PVT_INFO] = "pvt_info",
+	[CMD_BOARD_STATUS] = "board_status",
+	[CMD_POWER_INFO] = "power_info",
+	[CMD_RESTART] = "restart",
+	[CMD_LINK_BAUD] = "link_baud",
+	[CMD_LINK_ECHO] = "link_echo",
+	[CMD_TELEMETRY_SUB] = "telemetry_sub",
+	[CMD_CPU_LOAD] = "cpu_load",
+	[CMD_THERMAL_INFO] = "thermal_info",
+};
+
+static struct {
+	CommandType cmd;
+	int count;
+	int outstanding;
+	int payload;
+	uint32_t timeout;
+	int next;		// next request to send
+	double *rtt_ms;
+	int errors;
+	int timeouts;
+	SemaphoreHandle_t done;
+} bench;
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int parse_cmd(const char *name)
+{
+	char *end;
+	long v = strtol(name, &end, 0);
+
+	if (!*end && v > 0 && v < (long)(sizeof(cmd_names) / sizeof(cmd_names[0])))
+		return v;
+	if (!strncasecmp(name, "CMD_", 4))
+		name += 4;
+	for (size_t i = 0; i < sizeof(cmd_names) / sizeof(cmd_names[0]); i++)
+		if (cmd_names[i] && !strcasecmp(name, cmd_names[i]))
+			return i;
+	return -1;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* nearest rank, as percentile() in som_daemon_sim.py */
+static double percentile(const double *v, int n, int p)
+{
+	int k;
+
+	if (!n)
+		return 0;
+	k = (n * p + 99) / 100 - 1;
+	return v[k < 0 ? 0 : k];
+}
+
+static void print_stats(void)
+{
+	struct som_liveness_stats live;
+	struct sim_uart_stats uart;
+
+	som_liveness_get_stats(&live);
+	sim_uart_get_stats(&uart);
+	printf("daemon %s, idle %u ms, %u heartbeats, %u polls, %u failed\n",
+	       SOM_DAEMON_ON == get_som_daemon_state() ? "on" : "off",
+	       live.idle_ms, live.heartbeats, live.polls, live.poll_fail);
+	printf("uart: %u bytes out, %u bytes in, %u rx events\n",
+	       uart.tx_bytes, uart.rx_bytes, uart.rx_events);
+}
+
+/* wait until the keeplive task has heard the daemon, 0 on time out */
+static int wait_daemon(uint32_t ms)
+{
+	int sub = bmc_bus_subscribe_queue(BMC_TOPIC_MASK(BMC_TOPIC_DAEMON), 4);
+	TickType_t start = xTaskGetTickCount();
+	struct bmc_event ev;
+
+	if (sub < 0)
+		return 0;
+	while (SOM_DAEMON_ON != get_som_daemon_state()) {
+		if (xTaskGetTickCount() - start >= pdMS_TO_TICKS(ms))
+			return 0;
+		bmc_bus_wait(sub, &ev, pdMS_TO_TICKS(100));
+	}
+	return 1;
+}
+
+static void bench_task(void *argument)
+{
+	uint8_t data[FRAME_DATA_MAX] = {0};
+	double t0;
+	int i, ret;
+
+	for (;;) {
+		taskENTER_CRITICAL();
+		i = bench.next < bench.count ? bench.next++ : -1;
+		taskEXIT_CRITICAL();
+		if (i < 0)
+			break;
+		t0 = now_ms();
+		ret = web_cmd_handle(bench.cmd, bench.payload ? data : NULL, bench.payload, bench.timeout);
+		taskENTER_CRITICAL();
+		if (HAL_TIMEOUT == ret)
+			bench.timeouts++;
+		else if (HAL_OK != ret)
+			bench.errors++;
+		bench.rtt_ms[i] = HAL_TIMEOUT == ret ? -1 : now_ms() - t0;
+		taskEXIT_CRITICAL();
+	}
+	xSemaphoreGive(bench.done);
+	vTaskDelete(NULL);
+}
+
+static int run_bench(void)
+{
+	struct sim_uart_stats uart;
+	double start, elapsed;
+	int replies = 0;
+
+	bench.rtt_ms = calloc(bench.count, sizeof(*bench.rtt_ms));
+	bench.done = xSemaphoreCreateCounting(bench.outstanding, 0);
+	if (!bench.rtt_ms || !bench.done)
+		return 1;
+	if (!wait_daemon(5000)) {
+		printf("no SOM daemon on the line\n");
+		return 1;
+	}
+	start = now_ms();
+	for (int i = 0; i < bench.outstanding; i++)
+		xTaskCreate(bench_task, "bench", 256, NULL, 0, NULL);
+	for (int i = 0; i < bench.outstanding; i++)
+		xSemaphoreTake(bench.done, portMAX_DELAY);
+	elapsed = (now_ms() - start) / 1e3;
+
+	for (int i = 0; i < bench.count; i++)
+		if (bench.rtt_ms[i] >= 0)
+			bench.rtt_ms[replies++] = bench.rtt_ms[i];
+	qsort(bench.rtt_ms, replies, sizeof(*bench.rtt_ms), cmp_double);
+	sim_uart_get_stats(&uart);
+	printf("%d requests, %d replies, %d failed, %d timeouts in %.2f s\n",
+	       bench.count, replies, bench.errors, bench.timeouts, elapsed);
+	printf("%.1f cmds/s\n", replies / elapsed);
+	printf("rtt ms: p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n",
+	       percentile(bench.rtt_ms, replies, 50), percentile(bench.rtt_ms, replies, 90),
+	       percentile(bench.rtt_ms, replies, 99), percentile(bench.rtt_ms, replies, 100));
+	/* 10 bit times per byte on an 8N1 line, both directions share the count */
+	printf("wire: %u bytes, %.1f%% of a %u baud full duplex line\n",
+	       uart.tx_bytes + uart.rx_bytes,
+	       100.0 * (uart.tx_bytes + uart.rx_bytes) * 10 / (elapsed * huart4.Init.BaudRate * 2),
+	       (unsigned)huart4.Init.BaudRate);
+	print_stats();
+	return bench.timeouts ? 1 : 0;
+}
+
+static int run(int seconds)
+{
+	TickType_t start = xTaskGetTickCount();
+
+	while (!stop && (!seconds || xTaskGetTickCount() - start < pdMS_TO_TICKS(seconds * 1000)))
+		osDelay(100);
+	print_stats();
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [--port PATH] run [-t SECONDS]\n"
+		"       %s [--port PATH] bench [-n COUNT] [-c CMD] [-o OUTSTANDING] [-p PAYLOAD] [-T TIMEOUT_MS]\n"
+		"UART4 goes on PATH, a new pty when omitted. CMD is a CommandType name or number.\n",
+		prog, prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option longopts[] = {
+		{ "port", required_argument, NULL, 'P' },
+		{ NULL, 0, NULL, 0 },
+	};
+	const char *port = NULL, *mode;
+	int opt, seconds = 0, peer;
+
+	bench.cmd = CMD_BOARD_STATUS;
+	bench.count = 1000;
+	bench.outstanding = 1;
+	bench.timeout = 1000;
+
+	while ((opt = getopt_long(argc, argv, "+P:", longopts, NULL)) != -1) {
+		if ('P' != opt)
+			usage(argv[0]);
+		port = optarg;
+	}
+	if (optind >= argc)
+		usage(argv[0]);
+	mode = argv[optind];
+	optind++;
+	while ((opt = getopt(argc, argv, "t:n:c:o:p:T:")) != -1) {
+		switch (opt) {
+		case 't': seconds = atoi(optarg); break;
+		case 'n': bench.count = atoi(optarg); break;
+		case 'o': bench.outstanding = atoi(optarg); break;
+		case 'p': bench.payload = atoi(optarg); break;
+		case 'T': bench.timeout = strtoul(optarg, NULL, 0); break;
+		case 'c':
+			bench.cmd = parse_cmd(optarg);
+			if ((int)bench.cmd < 0)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (bench.count < 1 || bench.outstanding < 1 || bench.payload < 0 || bench.payload > FRAME_DATA_MAX)
+		usage(argv[0]);
+
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	if (port) {
+		if (sim_uart_open(port) < 0) {
+			perror(port);
+			return 1;
+		}
+	} else {
+		if (sim_uart_openpty(&peer) < 0) {
+			perror("pty");
+			return 1;
+		}
+		printf("SOM end on %s\n", ttyname(peer));
+	}
+	sim_protocol_start();
+
+	if (!strcmp(mode, "run"))
+		return run(seconds);
+	if (!strcmp(mode, "bench"))
+		return run_bench();
+	usage(argv[0]);
+	return 2;
+}
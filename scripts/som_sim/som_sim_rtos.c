@@ -0,0 +1,539 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * FreeRTOS for the host build of the SOM protocol layer.
+ *
+ * Every task is a POSIX thread and there are no priorities: the host
+ * scheduler runs the tasks, the uart rx thread and the timer thread side by
+ * side. One recursive lock stands for the scheduler, critical sections hold
+ * it and every blocking call waits on one condition variable under it, woken
+ * by every give, send and notify. The tick is the monotonic clock in ms.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+#include "timers.h"
+#include "list.h"
+#include "cmsis_os2.h"
+#include "som_sim.h"
+
+struct sim_task {
+	pthread_t thread;
+	const char *name;
+	TaskFunction_t fn;
+	void *arg;
+	uint32_t value;		// notification value
+	uint8_t pending;	// notification state
+};
+
+struct sim_sem {
+	UBaseType_t count;
+	UBaseType_t max;
+};
+
+struct sim_queue {
+	UBaseType_t len;
+	UBaseType_t item_size;
+	UBaseType_t head;
+	UBaseType_t count;
+	uint8_t *items;
+};
+
+struct sim_timer {
+	const char *name;
+	TickType_t period;
+	TickType_t expiry;
+	UBaseType_t reload;
+	uint8_t active;
+	void *id;
+	TimerCallbackFunction_t cb;
+	struct sim_timer *next;
+};
+
+static pthread_mutex_t kernel = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static pthread_cond_t changed;
+static struct timespec boot;
+static __thread struct sim_task *self;
+static __thread int depth;		// critical section nesting of this thread
+
+static struct sim_timer *timers;
+static pthread_t timer_thread;
+static int timer_started;
+
+__attribute__((constructor)) static void sim_rtos_init(void)
+{
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&changed, &attr);
+	pthread_condattr_destroy(&attr);
+	clock_gettime(CLOCK_MONOTONIC, &boot);
+}
+
+void sim_assert(const char *file, int line)
+{
+	fprintf(stderr, "assert at %s:%d\n", file, line);
+	abort();
+}
+
+void sim_enter_critical(void)
+{
+	pthread_mutex_lock(&kernel);
+	depth++;
+}
+
+void sim_exit_critical(void)
+{
+	depth--;
+	pthread_mutex_unlock(&kernel);
+}
+
+/* under the lock: something a blocked call may wait for has happened */
+static void sim_wake(void)
+{
+	pthread_cond_broadcast(&changed);
+}
+
+static struct timespec sim_deadline(TickType_t ticks)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec += ticks / 1000;
+	ts.tv_nsec += (long)(ticks % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	return ts;
+}
+
+/*
+ * Under the lock, not nested in a critical section: wait for a wake up until
+ * the deadline, 0 once the deadline has passed. Blocking inside a critical
+ * section is a bug on the target as well.
+ */
+static int sim_block(TickType_t timeout, const struct timespec *deadline)
+{
+	configASSERT(depth == 1);
+	if (!timeout)
+		return 0;
+	if (portMAX_DELAY == timeout)
+		return pthread_cond_wait(&changed, &kernel) == 0;
+	return pthread_cond_timedwait(&changed, &kernel, deadline) != ETIMEDOUT;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (TickType_t)((ts.tv_sec - boot.tv_sec) * 1000 + (ts.tv_nsec - boot.tv_nsec) / 1000000);
+}
+
+TickType_t xTaskGetTickCountFromISR(void)
+{
+	return xTaskGetTickCount();
+}
+
+/* tasks */
+static void *sim_task_entry(void *arg)
+{
+	self = arg;
+	self->fn(self->arg);
+	return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+		       UBaseType_t prio, TaskHandle_t *handle)
+{
+	struct sim_task *task = calloc(1, sizeof(*task));
+
+	if (!task)
+		return pdFAIL;
+	task->name = name;
+	task->fn = fn;
+	task->arg = arg;
+	if (pthread_create(&task->thread, NULL, sim_task_entry, task)) {
+		free(task);
+		return pdFAIL;
+	}
+	pthread_detach(task->thread);
+	if (handle)
+		*handle = task;
+	return pdPASS;
+}
+
+/* only a task deleting itself */
+void vTaskDelete(TaskHandle_t task)
+{
+	configASSERT(!task || task == self);
+	pthread_exit(NULL);
+}
+
+/* threads not made by xTaskCreate, the test or main thread, get one on first use */
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	if (!self) {
+		self = calloc(1, sizeof(*self));
+		configASSERT(self);
+		self->thread = pthread_self();
+		self->name = "host";
+	}
+	return self;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+	struct timespec ts = {
+		.tv_sec = ticks / 1000,
+		.tv_nsec = (long)(ticks % 1000) * 1000000,
+	};
+
+	while (nanosleep(&ts, &ts) && EINTR == errno)
+		;
+}
+
+osStatus_t osDelay(uint32_t ticks)
+{
+	vTaskDelay(ticks);
+	return osOK;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+	sim_enter_critical();
+	task->value++;
+	task->pending = 1;
+	sim_wake();
+	sim_exit_critical();
+	return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+{
+	xTaskNotifyGive(task);
+	if (woken)
+		*woken = pdTRUE;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t timeout)
+{
+	struct sim_task *me = xTaskGetCurrentTaskHandle();
+	struct timespec deadline = sim_deadline(timeout);
+	uint32_t value;
+
+	sim_enter_critical();
+	while (!me->value && sim_block(timeout, &deadline))
+		;
+	value = me->value;
+	if (value)
+		me->value = clear ? 0 : value - 1;
+	me->pending = 0;
+	sim_exit_critical();
+	return value;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clear_entry, uint32_t clear_exit, uint32_t *value,
+			   TickType_t timeout)
+{
+	struct sim_task *me = xTaskGetCurrentTaskHandle();
+	struct timespec deadline = sim_deadline(timeout);
+	BaseType_t ret;
+
+	sim_enter_critical();
+	if (!me->pending)
+		me->value &= ~clear_entry;
+	while (!me->pending && sim_block(timeout, &deadline))
+		;
+	if (value)
+		*value = me->value;
+	ret = me->pending ? pdTRUE : pdFALSE;
+	if (ret)
+		me->value &= ~clear_exit;
+	me->pending = 0;
+	sim_exit_critical();
+	return ret;
+}
+
+BaseType_t xTaskNotifyStateClear(TaskHandle_t task)
+{
+	BaseType_t was;
+
+	if (!task)
+		task = xTaskGetCurrentTaskHandle();
+	sim_enter_critical();
+	was = task->pending ? pdTRUE : pdFALSE;
+	task->pending = 0;
+	sim_exit_critical();
+	return was;
+}
+
+/* semaphores */
+static SemaphoreHandle_t sim_sem_create(UBaseType_t max, UBaseType_t initial)
+{
+	struct sim_sem *sem = calloc(1, sizeof(*sem));
+
+	if (sem) {
+		sem->max = max;
+		sem->count = initial;
+	}
+	return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+	return sim_sem_create(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+	return sim_sem_create(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial)
+{
+	return sim_sem_create(max, initial);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t timeout)
+{
+	struct timespec deadline = sim_deadline(timeout);
+	BaseType_t ret = pdFALSE;
+
+	sim_enter_critical();
+	while (!sem->count && sim_block(timeout, &deadline))
+		;
+	if (sem->count) {
+		sem->count--;
+		ret = pdTRUE;
+	}
+	sim_exit_critical();
+	return ret;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+	BaseType_t ret = pdFALSE;
+
+	sim_enter_critical();
+	if (sem->count < sem->max) {
+		sem->count++;
+		ret = pdTRUE;
+		sim_wake();
+	}
+	sim_exit_critical();
+	return ret;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken)
+{
+	if (woken)
+		*woken = pdTRUE;
+	return xSemaphoreGive(sem);
+}
+
+/* queues */
+QueueHandle_t xQueueCreate(UBaseType_t len, UBaseType_t item_size)
+{
+	struct sim_queue *queue = calloc(1, sizeof(*queue));
+
+	if (!queue)
+		return NULL;
+	queue->items = calloc(len, item_size);
+	if (!queue->items) {
+		free(queue);
+		return NULL;
+	}
+	queue->len = len;
+	queue->item_size = item_size;
+	return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+	free(queue->items);
+	free(queue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t timeout)
+{
+	struct timespec deadline = sim_deadline(timeout);
+	BaseType_t ret = pdFALSE;
+
+	sim_enter_critical();
+	while (queue->count == queue->len && sim_block(timeout, &deadline))
+		;
+	if (queue->count < queue->len) {
+		memcpy(queue->items + (queue->head + queue->count) % queue->len * queue->item_size,
+		       item, queue->item_size);
+		queue->count++;
+		ret = pdTRUE;
+		sim_wake();
+	}
+	sim_exit_critical();
+	return ret;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken)
+{
+	if (woken)
+		*woken = pdTRUE;
+	return xQueueSend(queue, item, 0);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t timeout)
+{
+	struct timespec deadline = sim_deadline(timeout);
+	BaseType_t ret = pdFALSE;
+
+	sim_enter_critical();
+	while (!queue->count && sim_block(timeout, &deadline))
+		;
+	if (queue->count) {
+		memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+		queue->head = (queue->head + 1) % queue->len;
+		queue->count--;
+		ret = pdTRUE;
+		sim_wake();
+	}
+	sim_exit_critical();
+	return ret;
+}
+
+/* timers, the callbacks run in the timer thread without the lock, as the timer task */
+static void *sim_timer_task(void *arg)
+{
+	struct timespec deadline;
+	struct sim_timer *t, *next;
+	TickType_t now;
+
+	sim_enter_critical();
+	for (;;) {
+		now = xTaskGetTickCount();
+		next = NULL;
+		for (t = timers; t; t = t->next) {
+			if (t->active && (!next || (int32_t)(t->expiry - next->expiry) < 0))
+				next = t;
+		}
+		if (!next) {
+			pthread_cond_wait(&changed, &kernel);
+			continue;
+		}
+		if ((int32_t)(next->expiry - now) > 0) {
+			deadline = sim_deadline(next->expiry - now);
+			pthread_cond_timedwait(&changed, &kernel, &deadline);
+			continue;
+		}
+		if (next->reload)
+			next->expiry += next->period;
+		else
+			next->active = 0;
+		sim_exit_critical();
+		next->cb(next);
+		sim_enter_critical();
+	}
+	return NULL;
+}
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t reload,
+			   void *id, TimerCallbackFunction_t cb)
+{
+	struct sim_timer *t = calloc(1, sizeof(*t));
+
+	if (!t)
+		return NULL;
+	t->name = name;
+	t->period = period;
+	t->reload = reload;
+	t->id = id;
+	t->cb = cb;
+	sim_enter_critical();
+	t->next = timers;
+	timers = t;
+	if (!timer_started && !pthread_create(&timer_thread, NULL, sim_timer_task, NULL)) {
+		pthread_detach(timer_thread);
+		timer_started = 1;
+	}
+	sim_exit_critical();
+	return t;
+}
+
+void *pvTimerGetTimerID(TimerHandle_t timer)
+{
+	return timer->id;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t wait)
+{
+	sim_enter_critical();
+	timer->expiry = xTaskGetTickCount() + timer->period;
+	timer->active = 1;
+	sim_wake();
+	sim_exit_critical();
+	return pdPASS;
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t wait)
+{
+	sim_enter_critical();
+	timer->active = 0;
+	sim_wake();
+	sim_exit_critical();
+	return pdPASS;
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t wait)
+{
+	timer->period = period;
+	return xTimerStart(timer, wait);
+}
+
+/* lists */
+void vListInitialise(List_t *list)
+{
+	list->xListEnd.xItemValue = portMAX_DELAY;
+	list->xListEnd.pxNext = &list->xListEnd;
+	list->xListEnd.pxPrevious = &list->xListEnd;
+	list->xListEnd.pvContainer = NULL;
+	list->uxNumberOfItems = 0;
+}
+
+void vListInitialiseItem(ListItem_t *item)
+{
+	item->pvContainer = NULL;
+}
+
+void vListInsertEnd(List_t *list, ListItem_t *item)
+{
+	ListItem_t *end = &list->xListEnd;
+
+	item->pxNext = end;
+	item->pxPrevious = end->pxPrevious;
+	end->pxPrevious->pxNext = item;
+	end->pxPrevious = item;
+	item->pvContainer = list;
+	list->uxNumberOfItems++;
+}
+
+UBaseType_t uxListRemove(ListItem_t *item)
+{
+	List_t *list = item->pvContainer;
+
+	item->pxNext->pxPrevious = item->pxPrevious;
+	item->pxPrevious->pxNext = item->pxNext;
+	item->pvContainer = NULL;
+	return --list->uxNumberOfItems;
+}
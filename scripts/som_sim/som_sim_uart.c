@@ -0,0 +1,204 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * UART4 of the host build on a file descriptor, a pty or a serial port.
+ *
+ * The rx thread stands for the circular dma and the idle line interrupt: it
+ * writes what it reads at the dma position of the buffer handed to
+ * HAL_UARTEx_ReceiveToIdle_DMA() and calls HAL_UARTEx_RxEventCallback() with
+ * the new position under the kernel lock, as from an interrupt.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "main.h"
+#include "hf_som_link.h"
+#include "som_sim.h"
+
+USART_TypeDef sim_usart3 = { 3 }, sim_uart4 = { 4 }, sim_usart6 = { 6 };
+
+static struct {
+	int fd;
+	pthread_t thread;
+	int started;
+	UART_HandleTypeDef *huart;	// rx armed
+	uint8_t *buf;
+	uint16_t size;
+	uint16_t pos;			// dma write position
+	struct sim_uart_stats stats;
+} uart = {
+	.fd = -1,
+};
+
+static void sim_uart_raw(int fd)
+{
+	struct termios tio;
+
+	if (tcgetattr(fd, &tio) == 0) {
+		cfmakeraw(&tio);
+		tcsetattr(fd, TCSANOW, &tio);
+	}
+}
+
+/**
+ * @brief  Open a serial port or the slave of a pty for UART4, raw mode.
+ * @retval the fd, -1 on error
+ */
+int sim_uart_open(const char *path)
+{
+	int fd = open(path, O_RDWR | O_NOCTTY);
+
+	if (fd < 0)
+		return -1;
+	sim_uart_raw(fd);
+	sim_uart_attach(fd);
+	return fd;
+}
+
+/**
+ * @brief  Put UART4 on the master of a new pty.
+ * @param  peer set to the slave, the SOM end of the line
+ * @retval the master fd, -1 on error
+ */
+int sim_uart_openpty(int *peer)
+{
+	int fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+	if (fd < 0 || grantpt(fd) || unlockpt(fd))
+		return -1;
+	*peer = open(ptsname(fd), O_RDWR | O_NOCTTY);
+	if (*peer < 0)
+		return -1;
+	sim_uart_raw(*peer);
+	sim_uart_attach(fd);
+	return fd;
+}
+
+static void sim_uart_event(const uint8_t *data, int n)
+{
+	int k;
+
+	sim_enter_critical();
+	while (n > 0 && uart.huart) {
+		k = n < uart.size - uart.pos ? n : uart.size - uart.pos;
+		for (int i = 0; i < k; i++)
+			uart.buf[uart.pos + i] = data[i];
+		data += k;
+		n -= k;
+		uart.stats.rx_bytes += k;
+		uart.stats.rx_events++;
+		/* at the end of the buffer the dma reports the full size, then wraps */
+		uart.pos += k;
+		HAL_UARTEx_RxEventCallback(uart.huart, uart.pos);
+		if (uart.pos == uart.size)
+			uart.pos = 0;
+	}
+	sim_exit_critical();
+}
+
+static void *sim_uart_rx(void *arg)
+{
+	struct pollfd pfd;
+	uint8_t data[256];
+	int n;
+
+	for (;;) {
+		pfd.fd = uart.fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+		n = read(uart.fd, data, sizeof(data));
+		if (n < 0 && (EINTR == errno || EAGAIN == errno || EIO == errno)) {
+			/* EIO: the other end of the pty is not open yet */
+			usleep(10000);
+			continue;
+		}
+		if (n <= 0)
+			continue;
+		sim_uart_event(data, n);
+	}
+	return NULL;
+}
+
+void sim_uart_attach(int fd)
+{
+	uart.fd = fd;
+	if (!uart.started && !pthread_create(&uart.thread, NULL, sim_uart_rx, NULL)) {
+		pthread_detach(uart.thread);
+		uart.started = 1;
+	}
+}
+
+void sim_uart_get_stats(struct sim_uart_stats *stats)
+{
+	sim_enter_critical();
+	*stats = uart.stats;
+	sim_exit_critical();
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size,
+				    uint32_t timeout)
+{
+	uint32_t baud = huart->Init.BaudRate ? huart->Init.BaudRate : SOM_LINK_DEFAULT_BAUD;
+	int n, done = 0;
+
+	/* the production line uart goes nowhere */
+	if (UART4 != huart->Instance)
+		return HAL_OK;
+	if (uart.fd < 0)
+		return HAL_ERROR;
+	while (done < size) {
+		n = write(uart.fd, data + done, size - done);
+		if (n < 0 && EINTR == errno)
+			continue;
+		if (n < 0)
+			return HAL_ERROR;
+		done += n;
+	}
+	sim_enter_critical();
+	uart.stats.tx_bytes += size;
+	sim_exit_critical();
+	/* 8N1, 10 bit times a byte */
+	usleep((uint64_t)size * 10 * 1000000 / baud);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef *huart, uint8_t *buf, uint16_t size)
+{
+	if (UART4 != huart->Instance) {
+		huart->RxState = HAL_UART_STATE_BUSY_RX;
+		return HAL_OK;
+	}
+	sim_enter_critical();
+	uart.huart = huart;
+	uart.buf = buf;
+	uart.size = size;
+	uart.pos = 0;
+	huart->RxState = HAL_UART_STATE_BUSY_RX;
+	sim_exit_critical();
+	return HAL_OK;
+}
+
+uint32_t HAL_RCC_GetPCLK1Freq(void)
+{
+	return 42000000;
+}
+
+int uart_set_baudrate(USART_TypeDef *Instance, uint32_t baudrate)
+{
+	if (UART4 != Instance)
+		return -1;
+	huart4.Init.BaudRate = baudrate;
+	return 0;
+}
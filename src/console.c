@@ -20,15 +20,28 @@
 #include "queue.h"
 // #include "stm32f401xc.h"
 #include "stm32f4xx_hal.h"
+#include "main.h"
 #include "stdio.h"
 #include "stdlib.h"
 #include "string.h"
+#include "ctype.h"
+#include "stdarg.h"
 #include "hf_common.h"
 #include "web-server.h"
 #include "hf_power_process.h"
 #include "hf_spi_slv.h"
 #include "telnet_som_console.h"
 #include "console.h"
+#include "hf_som_link.h"
+#include "hf_som_telemetry.h"
+#include "hf_som_bulk.h"
+#include "hf_event_bus.h"
+#include "hf_i2c.h"
+#include "hf_eeprom.h"
+#include "hf_power_monitor.h"
+#include "hf_power_history.h"
+#include "hf_alarm.h"
+#include "protocol_lib/protocol.h"
 #include "semphr.h"
 
 extern SemaphoreHandle_t gEEPROM_Mutex;
@@ -77,6 +90,20 @@ static BaseType_t prvCommandTempGet(char *pcWriteBuffer, size_t xWriteBufferLen,
 
 // get the overall power consumption, current and voltage
 static BaseType_t prvCommandPwrDissipationGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString);
+// get the min, mean and max of the power rails over the sampler windows
+static BaseType_t prvCommandPowerStatsGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString);
+// get the 1 s power and thermal history of the last seconds
+static BaseType_t prvCommandHistoryGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString);
+// get the energy and mean power of the PAC1934 rails
+static BaseType_t prvCommandEnergyGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString);
+// get the INA226 averaging, conversion time and alert setup, and its read counters
+static BaseType_t prvCommandIna226Get(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString);
+// set the INA226 averaging, conversion time and over current alert limit
+static BaseType_t prvCommandIna226Set(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString);
+// get the alarm rules, their state and the alarm log
+static BaseType_t prvCommandAlarmGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString);
+// set an alarm rule
+static BaseType_t prvCommandAlarmSet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString);
 
 // get the power status of the som board: on or off
 static BaseType_t prvCommandSomPwrStatusGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString);
@@ -85,6 +112,32 @@ static BaseType_t prvCommandSomPwrStatusSet(char *pcWriteBuffer, size_t xWriteBu
 
 // get the software status of the som board: running or stopped
 static BaseType_t prvCommandSomSwWorkStatusGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString);
+// get the negotiated som uart link speed and error counters
+static BaseType_t prvCommandSomLinkGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString);
+// renegotiate the som uart link speed
+static BaseType_t prvCommandSomLinkSet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString);
+// get the som daemon liveness status and deadline
+static BaseType_t prvCommandSomLiveGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString);
+// set the som daemon liveness deadline
+static BaseType_t prvCommandSomLiveSet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString);
+// get the per lane request latency towards the som
+static BaseType_t prvCommandSomLaneGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString);
+// get the uart3 production line protocol frame counters and latency
+static BaseType_t prvCommandProtoGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString);
+// get the last value of the event bus topics and the subscriber counters
+static BaseType_t prvCommandBusGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString);
+// get the i2c bus counters and the eeprom write cycle times
+static BaseType_t prvCommandI2cGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString);
+// get the per device i2c counters, latency and circuit breaker state
+static BaseType_t prvCommandI2cDevGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString);
+// get the eeprom write-back cache counters
+static BaseType_t prvCommandEepromGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString);
+// get the som telemetry subscription status, cpu load and thermal zones
+static BaseType_t prvCommandTelemetryGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString);
+// set the som telemetry push interval
+static BaseType_t prvCommandTelemetrySet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString);
+// read a large object from the som with a windowed bulk transfer
+static BaseType_t prvCommandBulkGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString);
 // reboot the som board
 static BaseType_t prvCommandReboot(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString);
 
@@ -133,6 +186,24 @@ static const char *prvpcMapTaskState(eTaskState eState)
     }
 }
 
+/*
+*   snprintf returning what went into the buffer, not what the whole output
+*   would have taken, so that pcWb += len; size -= len; stays inside the CLI
+*   write buffer when the output is cut short.
+*/
+static int prvSnprintf(char *pcBuf, size_t size, const char *pcFmt, ...)
+{
+    va_list args;
+    int len;
+
+    va_start(args, pcFmt);
+    len = vsnprintf(pcBuf, size, pcFmt, args);
+    va_end(args);
+    if (len < 0)
+        return 0;
+    return (size_t)len < size ? len : (size ? (int)size - 1 : 0);
+}
+
 static const CLI_Command_Definition_t xCommands[] =
 {
     {
@@ -243,6 +314,48 @@ static const CLI_Command_Definition_t xCommands[] =
         prvCommandPwrDissipationGet,
         0
     },
+    {
+        "power-g",
+        "\r\npower-g: Get the min/mean/max voltage, current and power of the board and som rails over 1 s, 10 s and 60 s, and the sampling cost.\r\n",
+        prvCommandPowerStatsGet,
+        0
+    },
+    {
+        "hist-g",
+        "\r\nhist-g <seconds>: Get the 1 s history of the board and som power, voltage and current, the pvt temperatures (0.1 C) and the fan speed over the last seconds, as csv.\r\n",
+        prvCommandHistoryGet,
+        1
+    },
+    {
+        "energy-g",
+        "\r\nenergy-g: Get the energy since boot and the mean power since boot and since the last energy-g of the four PAC1934 rails, from the hardware accumulators.\r\n",
+        prvCommandEnergyGet,
+        0
+    },
+    {
+        "ina226-g",
+        "\r\nina226-g: Get the board power monitor averaging, conversion times and alert limit, and its read, fresh result, alert and reset counters.\r\n",
+        prvCommandIna226Get,
+        0
+    },
+    {
+        "ina226-s",
+        "\r\nina226-s <avg> <ct us> <limit mA>: Set the board power monitor averaging (1-1024), bus and shunt conversion time (140-8244 us) and over current alert limit (0: off).\r\n",
+        prvCommandIna226Set,
+        3
+    },
+    {
+        "alarm-g",
+        "\r\nalarm-g: Get the alarm rules with their last sample and state, and the log of raised and cleared alarms.\r\n",
+        prvCommandAlarmGet,
+        0
+    },
+    {
+        "alarm-s",
+        "\r\nalarm-s <rule> <sensor> <above/below/off> <set> <clear> <debounce ms> <actions>: Set alarm rule 0-7. Sensors board_ma, board_mw, som_ma, som_mw, cpu_temp_dc, npu_temp_dc (0.1 C), fan_rpm, board_alert (1 after an INA226 alert). Actions a comma list of log, led, fan, poweroff, or none.\r\n",
+        prvCommandAlarmSet,
+        7
+    },
     {
         "sompower-g",
         "\r\nsompower-g: Get the som power status. ON or OFF.\r\n",
@@ -261,6 +374,84 @@ static const CLI_Command_Definition_t xCommands[] =
         prvCommandSomSwWorkStatusGet,
         0
     },
+    {
+        "somlink-g",
+        "\r\nsomlink-g: Get the som uart link speed and error rates.\r\n",
+        prvCommandSomLinkGet,
+        0
+    },
+    {
+        "somlink-s",
+        "\r\nsomlink-s <max baud>: Renegotiate the som uart link up to <max baud>, 0 for the default 115200.\r\n",
+        prvCommandSomLinkSet,
+        1
+    },
+    {
+        "somlive-g",
+        "\r\nsomlive-g: Get the som daemon liveness: time since the last frame, deadline, heartbeats and polls.\r\n",
+        prvCommandSomLiveGet,
+        0
+    },
+    {
+        "somlive-s",
+        "\r\nsomlive-s <deadline ms>: Declare the som daemon dead after <deadline ms> without a frame (2000-60000).\r\n",
+        prvCommandSomLiveSet,
+        1
+    },
+    {
+        "somlane-g",
+        "\r\nsomlane-g: Get the request count, queue wait and round trip latency of the control and bulk lanes to the som.\r\n",
+        prvCommandSomLaneGet,
+        0
+    },
+    {
+        "proto-g",
+        "\r\nproto-g: Get the frame, error and latency counters of the uart3 production line protocol.\r\n",
+        prvCommandProtoGet,
+        0
+    },
+    {
+        "bus-g",
+        "\r\nbus-g: Get the last value of every event bus topic and the delivered/dropped events of the subscribers.\r\n",
+        prvCommandBusGet,
+        0
+    },
+    {
+        "i2c-g",
+        "\r\ni2c-g: Get the request, error, timeout and reset counters of the i2c1 and i2c3 bus queues, and the eeprom write cycle times.\r\n",
+        prvCommandI2cGet,
+        0
+    },
+    {
+        "i2cdev-g",
+        "\r\ni2cdev-g: Get the nack, timeout, arbitration lost, bus error and recovery counters, transfer latency and circuit breaker state of every i2c device.\r\n",
+        prvCommandI2cDevGet,
+        0
+    },
+    {
+        "eeprom-g",
+        "\r\neeprom-g: Get the eeprom cache counters: changed bytes, pages written, flushes and pages waiting.\r\n",
+        prvCommandEepromGet,
+        0
+    },
+    {
+        "telemetry-g",
+        "\r\ntelemetry-g: Get the som telemetry subscription, cpu load and thermal zones.\r\n",
+        prvCommandTelemetryGet,
+        0
+    },
+    {
+        "telemetry-s",
+        "\r\ntelemetry-s <interval ms>: Set the som telemetry push interval, 0 cancels the subscription.\r\n",
+        prvCommandTelemetrySet,
+        1
+    },
+    {
+        "bulk-g",
+        "\r\nbulk-g <boardinfo/log/dmesg> <max bytes>: Bulk read an object from the som, print it and the transfer throughput.\r\n",
+        prvCommandBulkGet,
+        2
+    },
     {
         "reboot",
         "\r\nreboot <cold/warm>: cold or warm reboot the kernel on som board.\r\n",
@@ -732,9 +923,7 @@ static BaseType_t prvCommandIPSet(char *pcWriteBuffer, size_t xWriteBufferLen, c
     ip.ip_addr1 = 0xff & (naddr >> 8);
     ip.ip_addr2 = 0xff & (naddr >> 16);
     ip.ip_addr3 = 0xff & (naddr >> 24);
-    esENTER_CRITICAL(gEEPROM_Mutex, portMAX_DELAY);
     es_set_eth(&ip, NULL, NULL, NULL);
-    esEXIT_CRITICAL(gEEPROM_Mutex);
 
     IP4_ADDR(&ip4_addr, buf[0], buf[1], buf[2], buf[3]);
     p_addr = ip4addr_ntoa(&ip4_addr);
@@ -779,9 +968,7 @@ static BaseType_t prvCommandNetMaskSet(char *pcWriteBuffer, size_t xWriteBufferL
     netmask.netmask_addr1 = 0xff & (naddr >> 8);
     netmask.netmask_addr2 = 0xff & (naddr >> 16);
     netmask.netmask_addr3 = 0xff & (naddr >> 24);
-    esENTER_CRITICAL(gEEPROM_Mutex, portMAX_DELAY);
     es_set_eth(NULL, &netmask, NULL, NULL);
-    esEXIT_CRITICAL(gEEPROM_Mutex);
 
     IP4_ADDR(&ip4_addr, buf[0], buf[1], buf[2], buf[3]);
     p_addr = ip4addr_ntoa(&ip4_addr);
@@ -826,9 +1013,7 @@ static BaseType_t prvCommandGateWaySet(char *pcWriteBuffer, size_t xWriteBufferL
     gw.getway_addr1 = 0xff & (naddr >> 8);
     gw.getway_addr2 = 0xff & (naddr >> 16);
     gw.getway_addr3 = 0xff & (naddr >> 24);
-    esENTER_CRITICAL(gEEPROM_Mutex, portMAX_DELAY);
     es_set_eth(NULL, NULL, &gw, NULL);
-    esEXIT_CRITICAL(gEEPROM_Mutex);
 
     IP4_ADDR(&ip4_addr, buf[0], buf[1], buf[2], buf[3]);
     p_addr = ip4addr_ntoa(&ip4_addr);
@@ -1119,7 +1304,7 @@ static BaseType_t prvCommandTempGet(char *pcWriteBuffer, size_t xWriteBufferLen,
     int ret = HAL_OK;
     PVTInfo pvtInfo;
 
-    ret = web_cmd_handle(CMD_PVT_INFO, &pvtInfo, sizeof(PVTInfo), 1000);
+    ret = som_telemetry_get_pvt(&pvtInfo);
     if (HAL_OK != ret) {
          snprintf(pcWriteBuffer, xWriteBufferLen, "Failed to get PVT info(errcode:%d)\n", ret);
     }
@@ -1151,11 +1336,7 @@ static BaseType_t prvCommandPwrDissipationGet(char *pcWriteBuffer, size_t xWrite
     milliCur = power_info.current;
     microWatt = power_info.consumption;
 #else
-    int pwrStaus;
-    pwrStaus = get_som_power_state();
-    if (pwrStaus == SOM_POWER_ON) {
-        get_board_power(&millivolt, &milliCur, &microWatt);
-    }
+    power_mon_get_last(POWER_RAIL_BOARD, &millivolt, &milliCur, &microWatt);
 #endif
     snprintf(pcWriteBuffer, xWriteBufferLen,"consumption:%ld.%3.3ld(W)  voltage:%ld.%03ld(V)  current:%ld.%03ld(A)\n",
         microWatt / 1000000, microWatt % 1000000, millivolt / 1000, millivolt % 1000, milliCur / 1000, milliCur % 1000);
@@ -1163,6 +1344,356 @@ static BaseType_t prvCommandPwrDissipationGet(char *pcWriteBuffer, size_t xWrite
 }
 
 
+/**
+* @brief Show the power rail windows of the sampler, one rail per call
+* @param *pcWriteBuffer FreeRTOS CLI write buffer.
+* @param xWriteBufferLen Length of write buffer.
+* @param *pcCommandString pointer to the command name.
+* @retval FreeRTOS status
+*/
+static BaseType_t prvCommandPowerStatsGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString)
+{
+    static const char *rails[] = { "board", "som" };
+    static const char *windows[] = { "1s", "10s", "60s" };
+    static int index = -1;
+    struct power_rail_stats stats;
+    struct power_mon_cost cost;
+    struct power_window_stats *win;
+    char *pcWb = pcWriteBuffer;
+    size_t size = xWriteBufferLen;
+    int len;
+
+    if (index < 0) {
+        power_mon_get_cost(&cost);
+        snprintf(pcWriteBuffer, xWriteBufferLen,
+            "Sampling every %d ms: rounds %lu  last/avg/max %lu/%lu/%lu us  overruns %lu\r\n",
+            POWER_MON_PERIOD_MS, cost.rounds, cost.last_us, cost.avg_us, cost.max_us, cost.overruns);
+        index = 0;
+        return pdTRUE;
+    }
+    if (power_mon_get(index, &stats)) {
+        index = -1;
+        pcWriteBuffer[0] = '\0';
+        return pdFALSE;
+    }
+    if (UINT32_MAX == stats.age_ms)
+        len = prvSnprintf(pcWb, size, "%s: never sampled, errors %lu\r\n", rails[index], stats.errors);
+    else
+        len = prvSnprintf(pcWb, size, "%s: %lu mV %lu mA %lu mW, %lu ms ago, errors %lu\r\n", rails[index],
+            stats.last[POWER_VOLT], stats.last[POWER_CURR], stats.last[POWER_POWER] / 1000,
+            stats.age_ms, stats.errors);
+    pcWb += len; size -= len;
+    for (int i = 0; i < POWER_WIN_MAX; i++) {
+        win = &stats.win[i];
+        len = prvSnprintf(pcWb, size, "  %-3s %4lu samples  min/mean/max %lu/%lu/%lu mV  %lu/%lu/%lu mA  %lu/%lu/%lu mW\r\n",
+            windows[i], win->samples,
+            win->min[POWER_VOLT], win->mean[POWER_VOLT], win->max[POWER_VOLT],
+            win->min[POWER_CURR], win->mean[POWER_CURR], win->max[POWER_CURR],
+            win->min[POWER_POWER] / 1000, win->mean[POWER_POWER] / 1000, win->max[POWER_POWER] / 1000);
+        pcWb += len; size -= len;
+    }
+    index++;
+
+    return pdTRUE;
+}
+
+/**
+* @brief Show the power history as csv, a few samples per call
+* @param *pcWriteBuffer FreeRTOS CLI write buffer.
+* @param xWriteBufferLen Length of write buffer.
+* @param *pcCommandString pointer to the command name.
+* @retval FreeRTOS status
+*/
+static BaseType_t prvCommandHistoryGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString)
+{
+    static struct power_hist_sample samples[6];
+    static uint32_t from, to;
+    static int started;
+    struct power_hist_stats stats;
+    const char *pcSeconds;
+    BaseType_t xParamLen;
+    uint32_t seconds;
+    int len = 0, row, n;
+
+    if (!started) {
+        pcSeconds = FreeRTOS_CLIGetParameter(pcCommandString, 1, &xParamLen);
+        seconds = strtoul(pcSeconds, NULL, 10);
+        to = xTaskGetTickCount() / configTICK_RATE_HZ;
+        from = seconds < to ? to - seconds : 0;
+        power_hist_get_stats(&stats);
+        len = prvSnprintf(pcWriteBuffer, xWriteBufferLen,
+            "History: %lu samples from %lu to %lu s, %lu bytes in %lu blocks, %lu.%02lu bytes/sample, %lu blocks dropped\r\ntime",
+            stats.samples, stats.oldest, stats.newest, stats.bytes, stats.blocks,
+            stats.samples ? stats.bytes / stats.samples : 0,
+            stats.samples ? stats.bytes * 100 / stats.samples % 100 : 0, stats.dropped);
+        for (int i = 0; i < POWER_HIST_FIELDS; i++)
+            len += prvSnprintf(pcWriteBuffer + len, xWriteBufferLen - len, ",%s", power_hist_names[i]);
+        snprintf(pcWriteBuffer + len, xWriteBufferLen - len, "\r\n");
+        started = 1;
+        return pdTRUE;
+    }
+    n = power_hist_read(from, to, samples, 6);
+    if (!n) {
+        started = 0;
+        pcWriteBuffer[0] = '\0';
+        return pdFALSE;
+    }
+    /* whole rows only: a row that does not fit is dropped and comes first on the next call */
+    for (int k = 0; k < n; k++) {
+        row = len;
+        len += prvSnprintf(pcWriteBuffer + len, xWriteBufferLen - len, "%lu", samples[k].time);
+        for (int i = 0; i < POWER_HIST_FIELDS; i++) {
+            if (POWER_HIST_NONE == samples[k].val[i])
+                len += prvSnprintf(pcWriteBuffer + len, xWriteBufferLen - len, ",");
+            else
+                len += prvSnprintf(pcWriteBuffer + len, xWriteBufferLen - len, ",%ld", samples[k].val[i]);
+        }
+        len += prvSnprintf(pcWriteBuffer + len, xWriteBufferLen - len, "\r\n");
+        if (k && (size_t)len + 1 >= xWriteBufferLen) {
+            pcWriteBuffer[row] = '\0';
+            break;
+        }
+        from = samples[k].time + 1;
+    }
+
+    return pdTRUE;
+}
+
+/**
+* @brief Show the PAC1934 rail energy counters, one rail per call
+* @param *pcWriteBuffer FreeRTOS CLI write buffer.
+* @param xWriteBufferLen Length of write buffer.
+* @param *pcCommandString pointer to the command name.
+* @retval FreeRTOS status
+*/
+static BaseType_t prvCommandEnergyGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString)
+{
+    static const char *rails[PAC1934_CHANNELS] = { "som", "ch2", "ch3", "ch4" };
+    static struct pac1934_energy last;  // of the last energy-g
+    static struct pac1934_energy now;
+    static struct pac1934_energy zero;
+    static int index = -1;
+    struct pac1934_channel c;
+    uint64_t uwh;
+
+    if (index < 0) {
+        pac1934_get_energy(&now);
+        snprintf(pcWriteBuffer, xWriteBufferLen,
+            "Accumulated %lu s since boot, %lu s since the last energy-g, errors %lu, spans left out %lu\r\n",
+            (uint32_t)(now.samples / PAC1934_SPS), (uint32_t)((now.samples - last.samples) / PAC1934_SPS),
+            now.errors, now.resyncs);
+        index = 0;
+        return pdTRUE;
+    }
+    if (index >= PAC1934_CHANNELS) {
+        last = now;
+        index = -1;
+        pcWriteBuffer[0] = '\0';
+        return pdFALSE;
+    }
+    pac1934_get_channel(index, &c);
+    uwh = pac1934_energy_uwh(&now, index);
+    snprintf(pcWriteBuffer, xWriteBufferLen,
+        "ch%d %-3s: %lu mV %lu mA %lu mW  %lu.%06lu Wh  mean %lu mW since boot, %lu mW since the last energy-g\r\n",
+        index + 1, rails[index], c.volt, c.curr, c.power / 1000,
+        (uint32_t)(uwh / 1000000), (uint32_t)(uwh % 1000000),
+        pac1934_avg_power_uw(&zero, &now, index) / 1000, pac1934_avg_power_uw(&last, &now, index) / 1000);
+    index++;
+
+    return pdTRUE;
+}
+
+/**
+* @brief Show the INA226 configuration and read counters
+* @param *pcWriteBuffer FreeRTOS CLI write buffer.
+* @param xWriteBufferLen Length of write buffer.
+* @param *pcCommandString pointer to the command name.
+* @retval FreeRTOS status
+*/
+static BaseType_t prvCommandIna226Get(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString)
+{
+    static const char *alerts[] = { "none", "over current", "over voltage", "under voltage", "over power" };
+    static const char *units[] = { "", "mA", "mV", "mV", "mW" };
+    struct ina226_stats stats;
+    struct ina226_cfg cfg;
+    int len;
+
+    ina226_get_cfg(&cfg);
+    ina226_get_stats(&stats);
+    len = prvSnprintf(pcWriteBuffer, xWriteBufferLen,
+        "avg %u  vbus/vshunt %u/%u us  %s  result every %lu us  alert %s %lu %s%s\r\n",
+        cfg.avg, cfg.vbus_ct_us, cfg.vshunt_ct_us, cfg.continuous ? "continuous" : "triggered",
+        ina226_conv_time_us(&cfg), alerts[cfg.alert], cfg.alert_limit, units[cfg.alert],
+        cfg.alert_cnvr ? " + conversion ready" : "");
+    snprintf(pcWriteBuffer + len, xWriteBufferLen - len,
+        "reads %lu  fresh %lu  errors %lu  configs %lu  resets %lu  alerts %lu (last %lu ms ago)  overflows %lu\r\n",
+        stats.reads, stats.fresh, stats.errors, stats.configs, stats.resets, stats.alerts,
+        stats.alerts ? (xTaskGetTickCount() - stats.alert_tick) * portTICK_PERIOD_MS : 0, stats.overflows);
+
+    return pdFALSE;
+}
+
+/**
+* @brief Set the INA226 averaging, conversion time and over current limit
+* @param *pcWriteBuffer FreeRTOS CLI write buffer.
+* @param xWriteBufferLen Length of write buffer.
+* @param *pcCommandString pointer to the command name.
+* @retval FreeRTOS status
+*/
+static BaseType_t prvCommandIna226Set(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString)
+{
+    const char *pcAvg, *pcCt, *pcLimit;
+    BaseType_t xParamLen;
+    struct ina226_cfg cfg;
+    uint32_t limit;
+
+    pcAvg = FreeRTOS_CLIGetParameter(pcCommandString, 1, &xParamLen);
+    pcCt = FreeRTOS_CLIGetParameter(pcCommandString, 2, &xParamLen);
+    pcLimit = FreeRTOS_CLIGetParameter(pcCommandString, 3, &xParamLen);
+
+    ina226_get_cfg(&cfg);
+    cfg.avg = strtoul(pcAvg, NULL, 10);
+    cfg.vbus_ct_us = cfg.vshunt_ct_us = strtoul(pcCt, NULL, 10);
+    limit = strtoul(pcLimit, NULL, 10);
+    cfg.alert = limit ? INA226_ALERT_OVER_CURRENT : INA226_ALERT_NONE;
+    cfg.alert_limit = limit;
+    if (ina226_set_cfg(&cfg)) {
+        snprintf(pcWriteBuffer, xWriteBufferLen, "Failed to set ina226, check avg, ct and limit\r\n");
+        return pdFALSE;
+    }
+    snprintf(pcWriteBuffer, xWriteBufferLen, "ina226 set, a result every %lu us\r\n", ina226_conv_time_us(&cfg));
+
+    return pdFALSE;
+}
+
+/**
+* @brief Show the alarm rules one per call, then the alarm log
+* @param *pcWriteBuffer FreeRTOS CLI write buffer.
+* @param xWriteBufferLen Length of write buffer.
+* @param *pcCommandString pointer to the command name.
+* @retval FreeRTOS status
+*/
+static BaseType_t prvCommandAlarmGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString)
+{
+    static const char *dirs[] = { "off", "above", "below" };
+    static uint32_t log_from;
+    static int index = -1;
+    struct alarm_log_entry entry;
+    struct alarm_status status;
+    struct alarm_rule rule;
+    char actions[32] = "none";
+    int len = 0, n = 0;
+
+    if (index < 0) {
+        snprintf(pcWriteBuffer, xWriteBufferLen,
+            "rule sensor       dir        set    clear debounce actions            value   state\r\n");
+        log_from = 0;
+        index = 0;
+        return pdTRUE;
+    }
+    if (index < ALARM_RULES) {
+        alarm_get(index, &rule, &status);
+        if (ALARM_OFF == rule.dir) {
+            snprintf(pcWriteBuffer, xWriteBufferLen, "%-4d off\r\n", index++);
+            return pdTRUE;
+        }
+        for (int a = 0; a < ALARM_ACTIONS; a++)
+            if (rule.actions & (1u << a))
+                n += prvSnprintf(actions + n, sizeof(actions) - n, "%s%s", n ? "," : "", alarm_action_names[a]);
+        len = prvSnprintf(pcWriteBuffer, xWriteBufferLen, "%-4d %-12s %-5s %8ld %8ld %5lu ms %-18s ",
+            index, alarm_sensor_names[rule.sensor], dirs[rule.dir], rule.set, rule.clear,
+            rule.debounce_ms, actions);
+        if (ALARM_NONE == status.value)
+            len += prvSnprintf(pcWriteBuffer + len, xWriteBufferLen - len, "%7s ", "no data");
+        else
+            len += prvSnprintf(pcWriteBuffer + len, xWriteBufferLen - len, "%7ld ", status.value);
+        /* a pending change is towards the other state */
+        snprintf(pcWriteBuffer + len, xWriteBufferLen - len, "%s%s for %lu ms, raised %lu times\r\n",
+            status.pending ? "going " : "", status.active != status.pending ? "raised" : "clear",
+            status.since_ms, status.raised);
+        index++;
+        return pdTRUE;
+    }
+    /* the log, a few entries per call */
+    if (!log_from)
+        len = prvSnprintf(pcWriteBuffer, xWriteBufferLen, "log:\r\n");
+    for (n = 0; n < 6 && alarm_log_read(log_from, &entry, &log_from) == 0; n++) {
+        len += prvSnprintf(pcWriteBuffer + len, xWriteBufferLen - len, "%6lu.%03lu s rule %d %s",
+            entry.tick / configTICK_RATE_HZ, entry.tick % configTICK_RATE_HZ * 1000 / configTICK_RATE_HZ,
+            entry.rule, entry.raised ? "raised " : "cleared");
+        if (ALARM_NONE == entry.value)
+            len += prvSnprintf(pcWriteBuffer + len, xWriteBufferLen - len, " rule changed\r\n");
+        else
+            len += prvSnprintf(pcWriteBuffer + len, xWriteBufferLen - len, " at %ld\r\n", entry.value);
+    }
+    if (!n) {
+        index = -1;
+        if (!len)
+            pcWriteBuffer[0] = '\0';
+        return pdFALSE;
+    }
+
+    return pdTRUE;
+}
+
+/* a parameter of length len against a name */
+static int param_is(const char *param, BaseType_t len, const char *name)
+{
+    return strlen(name) == (size_t)len && !strncmp(param, name, len);
+}
+
+/**
+* @brief Set an alarm rule
+* @param *pcWriteBuffer FreeRTOS CLI write buffer.
+* @param xWriteBufferLen Length of write buffer.
+* @param *pcCommandString pointer to the command name.
+* @retval FreeRTOS status
+*/
+static BaseType_t prvCommandAlarmSet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString)
+{
+    static const char *dirs[] = { "off", "above", "below" };
+    const char *pcParam;
+    BaseType_t xParamLen;
+    struct alarm_rule rule = { 0 };
+    int index, i, len;
+
+    index = atoi(FreeRTOS_CLIGetParameter(pcCommandString, 1, &xParamLen));
+    pcParam = FreeRTOS_CLIGetParameter(pcCommandString, 2, &xParamLen);
+    for (rule.sensor = 0; rule.sensor < ALARM_SENSORS; rule.sensor++)
+        if (param_is(pcParam, xParamLen, alarm_sensor_names[rule.sensor]))
+            break;
+    pcParam = FreeRTOS_CLIGetParameter(pcCommandString, 3, &xParamLen);
+    for (rule.dir = 0; rule.dir < 3; rule.dir++)
+        if (param_is(pcParam, xParamLen, dirs[rule.dir]))
+            break;
+    rule.set = strtol(FreeRTOS_CLIGetParameter(pcCommandString, 4, &xParamLen), NULL, 10);
+    rule.clear = strtol(FreeRTOS_CLIGetParameter(pcCommandString, 5, &xParamLen), NULL, 10);
+    rule.debounce_ms = strtoul(FreeRTOS_CLIGetParameter(pcCommandString, 6, &xParamLen), NULL, 10);
+
+    /* comma separated action names */
+    pcParam = FreeRTOS_CLIGetParameter(pcCommandString, 7, &xParamLen);
+    while (xParamLen > 0 && !param_is(pcParam, xParamLen, "none")) {
+        for (len = 0; len < xParamLen && pcParam[len] != ','; len++)
+            ;
+        for (i = 0; i < ALARM_ACTIONS; i++)
+            if (param_is(pcParam, len, alarm_action_names[i]))
+                break;
+        rule.actions |= 1u << i;    // an unknown name fails the check of alarm_set()
+        pcParam += len + 1;
+        xParamLen -= len + 1;
+    }
+
+    if (alarm_set(index, &rule)) {
+        snprintf(pcWriteBuffer, xWriteBufferLen,
+            "Failed to set alarm %d, check the rule, sensor, direction, that clear is not past set, and the actions\r\n",
+            index);
+        return pdFALSE;
+    }
+    snprintf(pcWriteBuffer, xWriteBufferLen, "alarm %d set\r\n", index);
+
+    return pdFALSE;
+}
+
 /**
 * @brief Get the som power status: ON or OFF
 * @param *pcWriteBuffer FreeRTOS CLI write buffer.
@@ -1221,6 +1752,461 @@ static BaseType_t prvCommandSomSwWorkStatusGet(char *pcWriteBuffer, size_t xWrit
     return pdFALSE;
 }
 
+/**
+* @brief get the som uart link speed, negotiation state and error rates
+* @param *pcWriteBuffer FreeRTOS CLI write buffer.
+* @param xWriteBufferLen Length of write buffer.
+* @param *pcCommandString pointer to the command name.
+* @retval FreeRTOS status
+*/
+static BaseType_t prvCommandSomLinkGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString)
+{
+    struct som_link_stats stats;
+    struct som_rx_pool_stats pool;
+    uint32_t frames, errs, rate;
+    char *pcWb = pcWriteBuffer;
+    size_t size = xWriteBufferLen;
+    int len;
+
+    som_link_get_stats(&stats);
+    frames = stats.cnt[LINK_CNT_TX_FRAMES] + stats.cnt[LINK_CNT_RX_FRAMES];
+    errs = stats.cnt[LINK_CNT_TX_ERR] + stats.cnt[LINK_CNT_RX_CHECKSUM_ERR] +
+        stats.cnt[LINK_CNT_RX_FORMAT_ERR] + stats.cnt[LINK_CNT_RX_OVERRUN] +
+        stats.cnt[LINK_CNT_RX_LINE_ERR] + stats.cnt[LINK_CNT_TIMEOUT];
+    /* errors per 10000 frames */
+    rate = frames + errs ? (uint32_t)((uint64_t)errs * 10000 / (frames + errs)) : 0;
+
+    len = prvSnprintf(pcWb, size, "Baudrate: %lu (ceiling %lu%s)  framing: %s\r\n", stats.baudrate, stats.ceiling,
+        stats.unsupported ? ", not supported by SOM" : "", stats.crc_frames ? "crc32" : "legacy");
+    pcWb += len;
+    size -= len;
+    len = prvSnprintf(pcWb, size, "Negotiations: %lu  failed: %lu  fallbacks: %lu\r\n",
+        stats.negotiations, stats.negotiate_fail, stats.fallbacks);
+    pcWb += len;
+    size -= len;
+    len = prvSnprintf(pcWb, size, "TX frames: %lu  errors: %lu\r\n",
+        stats.cnt[LINK_CNT_TX_FRAMES], stats.cnt[LINK_CNT_TX_ERR]);
+    pcWb += len;
+    size -= len;
+    len = prvSnprintf(pcWb, size, "RX frames: %lu  checksum: %lu  format: %lu  overrun: %lu  line: %lu\r\n",
+        stats.cnt[LINK_CNT_RX_FRAMES], stats.cnt[LINK_CNT_RX_CHECKSUM_ERR],
+        stats.cnt[LINK_CNT_RX_FORMAT_ERR], stats.cnt[LINK_CNT_RX_OVERRUN],
+        stats.cnt[LINK_CNT_RX_LINE_ERR]);
+    pcWb += len;
+    size -= len;
+    len = prvSnprintf(pcWb, size, "RX resync: %lu  dropped bytes: %lu  no buffer: %lu\r\n",
+        stats.cnt[LINK_CNT_RX_RESYNC], stats.cnt[LINK_CNT_RX_DROPPED], stats.cnt[LINK_CNT_RX_NOBUF]);
+    pcWb += len;
+    size -= len;
+    som_rx_pool_get_stats(&pool);
+    len = prvSnprintf(pcWb, size, "RX pool: %u/%u free  low water: %u  exhausted: %lu\r\n",
+        pool.free, SOM_RX_POOL_SIZE, pool.low_water, pool.exhausted);
+    pcWb += len;
+    size -= len;
+    snprintf(pcWb, size, "Timeouts: %lu  error rate: %lu.%02lu%%\r\n",
+        stats.cnt[LINK_CNT_TIMEOUT], rate / 100, rate % 100);
+
+    return pdFALSE;
+}
+
+/**
+* @brief renegotiate the som uart link speed, done by the daemon keeplive task
+* @param *pcWriteBuffer FreeRTOS CLI write buffer.
+* @param xWriteBufferLen Length of write buffer.
+* @param *pcCommandString pointer to the command name.
+* @retval FreeRTOS status
+*/
+static BaseType_t prvCommandSomLinkSet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString)
+{
+    const char *pcBaud;
+    BaseType_t xParamLen;
+    uint32_t baud;
+
+    pcBaud = FreeRTOS_CLIGetParameter(pcCommandString, 1, &xParamLen);
+    baud = strtoul(pcBaud, NULL, 10);
+    if (get_som_daemon_state() != SOM_DAEMON_ON) {
+        snprintf(pcWriteBuffer, xWriteBufferLen, "Som daemon is not running!\r\n");
+        return pdFALSE;
+    }
+    som_link_request(baud);
+    snprintf(pcWriteBuffer, xWriteBufferLen, "Som link renegotiation up to %lu requested, check with somlink-g\r\n",
+        baud > SOM_LINK_DEFAULT_BAUD ? baud : (uint32_t)SOM_LINK_DEFAULT_BAUD);
+
+    return pdFALSE;
+}
+
+/**
+* @brief get the som daemon liveness status
+* @param *pcWriteBuffer FreeRTOS CLI write buffer.
+* @param xWriteBufferLen Length of write buffer.
+* @param *pcCommandString pointer to the command name.
+* @retval FreeRTOS status
+*/
+static BaseType_t prvCommandSomLiveGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString)
+{
+    struct som_liveness_stats stats;
+
+    som_liveness_get_stats(&stats);
+    snprintf(pcWriteBuffer, xWriteBufferLen,
+        "Som daemon: %s  last frame: %lu ms ago  deadline: %lu ms\r\n"
+        "Heartbeats: %lu  polls: %lu  failed polls: %lu\r\n",
+        (get_som_daemon_state() == SOM_DAEMON_ON) ? "on" : "off", stats.idle_ms, stats.deadline_ms,
+        stats.heartbeats, stats.polls, stats.poll_fail);
+
+    return pdFALSE;
+}
+
+/**
+* @brief set the som daemon liveness deadline
+* @param *pcWriteBuffer FreeRTOS CLI write buffer.
+* @param xWriteBufferLen Length of write buffer.
+* @param *pcCommandString pointer to the command name.
+* @retval FreeRTOS status
+*/
+static BaseType_t prvCommandSomLiveSet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString)
+{
+    const char *pcDeadline;
+    BaseType_t xParamLen;
+    uint32_t deadline;
+
+    pcDeadline = FreeRTOS_CLIGetParameter(pcCommandString, 1, &xParamLen);
+    deadline = strtoul(pcDeadline, NULL, 10);
+    if (som_liveness_set_deadline(deadline)) {
+        snprintf(pcWriteBuffer, xWriteBufferLen, "Invalid deadline %lu, must be 2000-60000 ms\r\n", deadline);
+        return pdFALSE;
+    }
+    snprintf(pcWriteBuffer, xWriteBufferLen, "Som liveness deadline set to %lu ms\r\n", deadline);
+
+    return pdFALSE;
+}
+
+/**
+* @brief get the per lane request latency towards the som
+* @param *pcWriteBuffer FreeRTOS CLI write buffer.
+* @param xWriteBufferLen Length of write buffer.
+* @param *pcCommandString pointer to the command name.
+* @retval FreeRTOS status
+*/
+static BaseType_t prvCommandSomLaneGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString)
+{
+    static const char *lanes[SOM_LANE_MAX] = { "control", "bulk" };
+    struct som_lane_stats stats;
+    char *pcWb = pcWriteBuffer;
+    size_t size = xWriteBufferLen;
+    int len;
+
+    len = prvSnprintf(pcWb, size, "lane     requests timeouts busy  wait avg/max ms  rtt avg/max ms\r\n");
+    pcWb += len; size -= len;
+    for (int i = 0; i < SOM_LANE_MAX; i++) {
+        som_lane_get_stats(i, &stats);
+        len = prvSnprintf(pcWb, size, "%-8s %8lu %8lu %4lu  %7lu/%-7lu  %6lu/%-6lu\r\n", lanes[i],
+            stats.requests, stats.timeouts, stats.busy, stats.wait_avg_ms, stats.wait_max_ms,
+            stats.rtt_avg_ms, stats.rtt_max_ms);
+        pcWb += len; size -= len;
+    }
+
+    return pdFALSE;
+}
+
+/**
+* @brief get the uart3 production line protocol frame counters and latency
+* @param *pcWriteBuffer FreeRTOS CLI write buffer.
+* @param xWriteBufferLen Length of write buffer.
+* @param *pcCommandString pointer to the command name.
+* @retval FreeRTOS status
+*/
+static BaseType_t prvCommandProtoGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString)
+{
+    struct b_frame_stats stats;
+
+    protocol_get_stats(&stats);
+    snprintf(pcWriteBuffer, xWriteBufferLen,
+        "Frames: %lu  dropped bytes: %lu\r\n"
+        "Errors: cmd %lu  len %lu  xor %lu  tail %lu  overrun %lu  line %lu  batch %lu\r\n"
+        "Latency: avg %lu ms  max %lu ms\r\n",
+        stats.frames, stats.dropped,
+        stats.cmd_err, stats.len_err, stats.xor_err, stats.tail_err, stats.overrun, stats.line_err,
+        stats.batch_err,
+        stats.lat_avg_ms, stats.lat_max_ms);
+
+    return pdFALSE;
+}
+
+/**
+* @brief get the last value of the event bus topics and the subscriber counters
+* @param *pcWriteBuffer FreeRTOS CLI write buffer.
+* @param xWriteBufferLen Length of write buffer.
+* @param *pcCommandString pointer to the command name.
+* @retval FreeRTOS status
+*/
+static BaseType_t prvCommandBusGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString)
+{
+    static const char *topics[BMC_TOPIC_MAX] = { "som power", "daemon", "dip switch", "button", "power good", "alarm" };
+    struct bmc_bus_sub_stats stats;
+    char *pcWb = pcWriteBuffer;
+    size_t size = xWriteBufferLen;
+    uint32_t value, count;
+    int len;
+
+    len = prvSnprintf(pcWb, size, "topic      value   events\r\n");
+    pcWb += len; size -= len;
+    for (int i = 0; i < BMC_TOPIC_MAX; i++) {
+        value = bmc_bus_last(i, &count);
+        len = prvSnprintf(pcWb, size, "%-10s 0x%-5lx %lu\r\n", topics[i], value, count);
+        pcWb += len; size -= len;
+    }
+    len = prvSnprintf(pcWb, size, "sub mask  type   delivered dropped\r\n");
+    pcWb += len; size -= len;
+    for (int i = 0; bmc_bus_get_sub_stats(i, &stats) == 0; i++) {
+        len = prvSnprintf(pcWb, size, "%-3d 0x%02lx  %-5s  %9lu %7lu\r\n", i, stats.mask,
+            stats.queue ? "queue" : "cb", stats.delivered, stats.dropped);
+        pcWb += len; size -= len;
+    }
+
+    return pdFALSE;
+}
+
+/**
+* @brief get the i2c bus counters and the eeprom write cycle times
+* @param *pcWriteBuffer FreeRTOS CLI write buffer.
+* @param xWriteBufferLen Length of write buffer.
+* @param *pcCommandString pointer to the command name.
+* @retval FreeRTOS status
+*/
+static BaseType_t prvCommandI2cGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString)
+{
+    static const struct {
+        const char *name;
+        I2C_HandleTypeDef *hi2c;
+    } buses[] = { { "i2c1", &hi2c1 }, { "i2c3", &hi2c3 } };
+    struct hf_i2c_stats stats;
+    struct hf_i2c_wr_stats wr;
+    char *pcWb = pcWriteBuffer;
+    size_t size = xWriteBufferLen;
+    int len;
+
+    len = prvSnprintf(pcWb, size, "bus   requests errors timeouts resets stuck failed queue busy(ms)\r\n");
+    pcWb += len; size -= len;
+    for (int i = 0; i < sizeof(buses) / sizeof(buses[0]); i++) {
+        if (hf_i2c_get_stats(buses[i].hi2c, &stats))
+            continue;
+        len = prvSnprintf(pcWb, size, "%-5s %8lu %6lu %8lu %6lu %5lu %6lu %5lu %8lu\r\n", buses[i].name,
+            stats.requests, stats.errors, stats.timeouts, stats.resets, stats.sda_stuck,
+            stats.recover_failed, stats.queue_max, stats.busy_ms);
+        pcWb += len; size -= len;
+    }
+    hf_i2c_get_wr_stats(&wr);
+    len = prvSnprintf(pcWb, size, "eeprom pages %lu  polls %lu  timeouts %lu\r\n"
+        "write cycle: last %lu us  min %lu us  avg %lu us  max %lu us\r\n",
+        wr.pages, wr.polls, wr.timeouts,
+        wr.last_us, wr.min_us, wr.pages ? wr.total_us / wr.pages : 0, wr.max_us);
+    pcWb += len; size -= len;
+
+    return pdFALSE;
+}
+
+/**
+* @brief get the per device i2c counters, one device per call
+* @param *pcWriteBuffer FreeRTOS CLI write buffer.
+* @param xWriteBufferLen Length of write buffer.
+* @param *pcCommandString pointer to the command name.
+* @retval FreeRTOS status
+*/
+static BaseType_t prvCommandI2cDevGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString)
+{
+    static const char *states[] = { "closed", "open", "half" };
+    static int index = -1;
+    struct hf_i2c_dev_stats stats;
+
+    if (index < 0) {
+        snprintf(pcWriteBuffer, xWriteBufferLen,
+            "bus addr state  requests  nacks timeouts  arb berr recov rejected opens avg(us) max(us)\r\n");
+        index = 0;
+        return pdTRUE;
+    }
+    if (hf_i2c_get_dev_stats(index, &stats)) {
+        index = -1;
+        pcWriteBuffer[0] = '\0';
+        return pdFALSE;
+    }
+    snprintf(pcWriteBuffer, xWriteBufferLen,
+        "i2c%u 0x%02x %-6s %8lu %6lu %8lu %4lu %4lu %5lu %8lu %5lu %7lu %7lu\r\n",
+        stats.bus, stats.addr, states[stats.state], stats.requests, stats.nacks, stats.timeouts,
+        stats.arb_lost, stats.bus_errors, stats.recoveries, stats.rejected, stats.opens,
+        stats.completed ? stats.total_us / stats.completed : 0, stats.max_us);
+    index++;
+
+    return pdTRUE;
+}
+
+/**
+* @brief get the eeprom write-back cache counters
+* @param *pcWriteBuffer FreeRTOS CLI write buffer.
+* @param xWriteBufferLen Length of write buffer.
+* @param *pcCommandString pointer to the command name.
+* @retval FreeRTOS status
+*/
+static BaseType_t prvCommandEepromGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString)
+{
+    struct eeprom_stats stats;
+
+    es_eeprom_get_stats(&stats);
+    snprintf(pcWriteBuffer, xWriteBufferLen,
+        "Updates: %lu  changed bytes: %lu\r\n"
+        "Pages written: %lu  flushes: %lu  syncs: %lu  errors: %lu  dirty: %lu\r\n"
+        "Journal appends: %lu  slot: %d  seq: %u\r\n"
+        "Boot preload: %lu us  loads from RAM: %lu\r\n",
+        stats.updates, stats.bytes,
+        stats.pages, stats.flushes, stats.syncs, stats.errors, stats.dirty,
+        stats.appends, stats.journal_slot, stats.journal_seq,
+        stats.preload_us, stats.hits);
+
+    return pdFALSE;
+}
+
+/**
+* @brief get the som telemetry subscription status, cpu load and thermal zones
+* @param *pcWriteBuffer FreeRTOS CLI write buffer.
+* @param xWriteBufferLen Length of write buffer.
+* @param *pcCommandString pointer to the command name.
+* @retval FreeRTOS status
+*/
+static BaseType_t prvCommandTelemetryGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString)
+{
+    static const char *topics[] = { "pvt", "cpu load", "thermal" };
+    struct som_telemetry_status status;
+    struct som_cpu_load load;
+    struct som_thermal thermal;
+    char *pcWb = pcWriteBuffer;
+    size_t size = xWriteBufferLen;
+    int len;
+
+    som_telemetry_get_status(&status);
+    len = prvSnprintf(pcWb, size, "Subscription: %s  interval: %u ms  pushes: %lu\r\n",
+        status.subscribed ? "on" : (status.unsupported ? "unsupported" : "off"),
+        status.interval_ms, status.pushes);
+    pcWb += len; size -= len;
+    for (int i = 0; i < 3; i++) {
+        if (UINT32_MAX == status.age_ms[i])
+            len = prvSnprintf(pcWb, size, "%s: never received\r\n", topics[i]);
+        else
+            len = prvSnprintf(pcWb, size, "%s: %lu ms ago\r\n", topics[i], status.age_ms[i]);
+        pcWb += len; size -= len;
+    }
+
+    if (HAL_OK == som_telemetry_get_cpu_load(&load)) {
+        len = prvSnprintf(pcWb, size, "cpu load(%%): %u.%u", load.total / 10, load.total % 10);
+        pcWb += len; size -= len;
+        for (int i = 0; i < SOM_CPU_CORES; i++) {
+            len = prvSnprintf(pcWb, size, "  core%d %u.%u", i, load.core[i] / 10, load.core[i] % 10);
+            pcWb += len; size -= len;
+        }
+        len = prvSnprintf(pcWb, size, "\r\n");
+        pcWb += len; size -= len;
+    }
+    if (HAL_OK == som_telemetry_get_thermal(&thermal)) {
+        len = prvSnprintf(pcWb, size, "thermal(Celsius):");
+        pcWb += len; size -= len;
+        for (int i = 0; i < SOM_THERMAL_ZONES; i++) {
+            len = prvSnprintf(pcWb, size, "  zone%d %ld.%03ld", i, thermal.zone[i] / 1000,
+                labs(thermal.zone[i] % 1000));
+            pcWb += len; size -= len;
+        }
+        snprintf(pcWb, size, "\r\n");
+    }
+
+    return pdFALSE;
+}
+
+/**
+* @brief set the som telemetry push interval
+* @param *pcWriteBuffer FreeRTOS CLI write buffer.
+* @param xWriteBufferLen Length of write buffer.
+* @param *pcCommandString pointer to the command name.
+* @retval FreeRTOS status
+*/
+static BaseType_t prvCommandTelemetrySet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString)
+{
+    const char *pcInterval;
+    BaseType_t xParamLen;
+    uint32_t interval;
+
+    pcInterval = FreeRTOS_CLIGetParameter(pcCommandString, 1, &xParamLen);
+    interval = strtoul(pcInterval, NULL, 10);
+    if (interval > UINT16_MAX) {
+        snprintf(pcWriteBuffer, xWriteBufferLen, "Invalid interval %lu, must be 0-65535 ms\r\n", interval);
+        return pdFALSE;
+    }
+    som_telemetry_set_interval(interval);
+    if (interval)
+        snprintf(pcWriteBuffer, xWriteBufferLen, "Som telemetry push interval set to %lu ms\r\n", interval);
+    else
+        snprintf(pcWriteBuffer, xWriteBufferLen, "Som telemetry subscription cancelled\r\n");
+
+    return pdFALSE;
+}
+
+/**
+* @brief bulk read an object from the som and report the throughput
+* @param *pcWriteBuffer FreeRTOS CLI write buffer.
+* @param xWriteBufferLen Length of write buffer.
+* @param *pcCommandString pointer to the command name.
+* @retval FreeRTOS status
+*/
+static BaseType_t prvCommandBulkGet(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString)
+{
+    static const char *objects[SOM_BULK_OBJECT_MAX] = { "boardinfo", "log", "dmesg" };
+    const char *pcObject, *pcMax;
+    BaseType_t xObjectLen, xMaxLen;
+    struct som_bulk_stats stats;
+    uint32_t max_len, len, line_bps;
+    uint8_t *buf;
+    int object, ret;
+
+    pcObject = FreeRTOS_CLIGetParameter(pcCommandString, 1, &xObjectLen);
+    pcMax = FreeRTOS_CLIGetParameter(pcCommandString, 2, &xMaxLen);
+    for (object = 0; object < SOM_BULK_OBJECT_MAX; object++) {
+        if (strlen(objects[object]) == xObjectLen && !strncmp(pcObject, objects[object], xObjectLen))
+            break;
+    }
+    max_len = strtoul(pcMax, NULL, 10);
+    if (object == SOM_BULK_OBJECT_MAX || !max_len || max_len > SOM_BULK_MAX_LEN) {
+        snprintf(pcWriteBuffer, xWriteBufferLen,
+            "Usage: bulk-g <boardinfo/log/dmesg> <max bytes, 1-%d>\r\n", SOM_BULK_MAX_LEN);
+        return pdFALSE;
+    }
+
+    buf = pvPortMalloc(max_len);
+    if (!buf) {
+        snprintf(pcWriteBuffer, xWriteBufferLen, "No memory for %lu bytes\r\n", max_len);
+        return pdFALSE;
+    }
+    ret = som_bulk_read(object, buf, max_len, &len);
+    if (HAL_OK == ret) {
+        /* the object may be far larger than the cli output buffer */
+        for (uint32_t i = 0; i < len; i++)
+            putchar(isprint(buf[i]) || buf[i] == '\n' ? buf[i] : '.');
+        printf("\r\n");
+    }
+    vPortFree(buf);
+    if (HAL_OK != ret) {
+        snprintf(pcWriteBuffer, xWriteBufferLen, "Failed to read %s(errcode:%d)\r\n", objects[object], ret);
+        return pdFALSE;
+    }
+
+    som_bulk_get_stats(&stats);
+    /* 8N1: 10 bit times per byte */
+    line_bps = som_link_get_baudrate() / 10;
+    snprintf(pcWriteBuffer, xWriteBufferLen,
+        "%lu bytes in %lu ms, %lu B/s, %lu%% of the %lu baud line\r\n"
+        "chunks: %lu  duplicates: %lu  gaps: %lu  timeouts: %lu  failed transfers: %lu\r\n",
+        len, stats.last_ms, stats.last_ms ? len * 1000 / stats.last_ms : 0,
+        stats.last_ms ? len * 1000 / stats.last_ms * 100 / line_bps : 0, som_link_get_baudrate(),
+        stats.chunks, stats.duplicates, stats.gaps, stats.timeouts, stats.failed);
+
+    return pdFALSE;
+}
+
 /**
 * @brief reboot the kernel on the som
 * @param *pcWriteBuffer FreeRTOS CLI write buffer.
@@ -1338,12 +2324,10 @@ static BaseType_t prvCommandDevmemWrite(char *pcWriteBuffer, size_t xWriteBuffer
     cValue = FreeRTOS_CLIGetParameter(pcCommandString, 2, &xParamLen);
     value = atoh(cValue, xParamLen);
 
-    esENTER_CRITICAL(gEEPROM_Mutex, portMAX_DELAY);
     /* Write memory/io and fill FreeRTOS write buffer */
     if (HAL_OK != es_spi_write((uint8_t *)&value, memAddr, 4)) {
         snprintf(pcWriteBuffer, xWriteBufferLen, "Failed to write mem/io at 0x%lx%lx\n", memAddrHigh, memAddrLow);
     }
-    esEXIT_CRITICAL(gEEPROM_Mutex);
     return pdFALSE;
 }
 
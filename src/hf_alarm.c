@@ -0,0 +1,302 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Alarm engine: threshold rules with hysteresis and debounce evaluated on the
+ * sensor samples as they come in, and the actions they run.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "main.h"
+#include "hf_common.h"
+#include "hf_event_bus.h"
+#include "hf_alarm.h"
+
+#define ALARM_DEBOUNCE_MAX_MS	600000
+#define ALARM_FANS		2
+/* raised rules holding an action */
+#define ALARM_REFS(act)		al.refs[__builtin_ctz(act)]
+
+/*
+ * The rules are set by the console while the sampler task evaluates them, so
+ * they are copied under a critical section and alarm_set() bumps the gen of a
+ * rule; the sampler clears a raised rule whose gen changed before it
+ * evaluates it again; the gens start ahead of the states so the first sample
+ * sets every state up. Everything else is only touched by the sampler task,
+ * but for the status and log read by alarm_get() and alarm_log_read().
+ */
+static struct {
+	struct alarm_rule rule[ALARM_RULES];
+	uint32_t gen[ALARM_RULES];
+	struct {
+		uint32_t gen;		// of the rule the state is for
+		uint8_t active;
+		uint8_t pending;
+		uint8_t held;		// actions taken when raised
+		int32_t value;
+		uint32_t raised;
+		TickType_t changed;	// state entered
+		TickType_t pending_tick;	// change first seen
+	} st[ALARM_RULES];
+	uint8_t refs[ALARM_ACTIONS];	// by action bit, see ALARM_REFS
+	int led_saved;			// LED status the alarm pattern replaced
+	uint8_t fan_saved[ALARM_FANS];	// duty before the boost
+	struct alarm_log_entry log[ALARM_LOG_LEN];
+	uint32_t log_next;
+} al = {
+	.rule = {
+		/* SOM too hot: full fan, then power it off if it keeps heating */
+		{ ALARM_CPU_TEMP, ALARM_ABOVE, ALARM_ACT_LOG | ALARM_ACT_LED | ALARM_ACT_FAN, 950, 850, 3000 },
+		{ ALARM_NPU_TEMP, ALARM_ABOVE, ALARM_ACT_LOG | ALARM_ACT_LED | ALARM_ACT_FAN, 950, 850, 3000 },
+		{ ALARM_CPU_TEMP, ALARM_ABOVE, ALARM_ACT_LOG | ALARM_ACT_LED | ALARM_ACT_POWER_OFF, 1050, 950, 5000 },
+		/* driven fan not turning */
+		{ ALARM_FAN_RPM, ALARM_BELOW, ALARM_ACT_LOG | ALARM_ACT_LED, 300, 600, 10000 },
+		/* the 12 V input past the INA226 alert limit */
+		{ ALARM_BOARD_MA, ALARM_ABOVE, ALARM_ACT_LOG | ALARM_ACT_LED | ALARM_ACT_POWER_OFF, 20000, 18000, 500 },
+		/* spikes past it too short for the sampler, caught by the part */
+		{ ALARM_BOARD_ALERT, ALARM_ABOVE, ALARM_ACT_LOG | ALARM_ACT_LED, 1, 0, 0 },
+	},
+	.gen = { [0 ... ALARM_RULES - 1] = 1 },
+	.led_saved = LED_MCU_RUNING,
+};
+
+const char *const alarm_sensor_names[ALARM_SENSORS] = {
+	"board_ma", "board_mw", "som_ma", "som_mw", "cpu_temp_dc", "npu_temp_dc", "fan_rpm",
+	"board_alert",
+};
+
+const char *const alarm_action_names[ALARM_ACTIONS] = {
+	"log", "led", "fan", "poweroff",
+};
+
+static void alarm_action(int action, int on)
+{
+	struct fan_control_t fan;
+
+	switch (1u << action) {
+	case ALARM_ACT_LED:
+		if (on) {
+			al.led_saved = get_mcu_led_status();
+			set_mcu_led_status(LED_ALARM);
+		} else if (LED_ALARM == get_mcu_led_status()) {
+			set_mcu_led_status(al.led_saved);
+		}
+		break;
+	case ALARM_ACT_FAN:
+		for (int i = 0; i < ALARM_FANS; i++) {
+			fan.fan_num = i;
+			if (on) {
+				es_get_fan_duty(&fan);
+				al.fan_saved[i] = fan.duty;
+				fan.duty = 100;
+			} else {
+				fan.duty = al.fan_saved[i];
+			}
+			es_set_fan_duty(&fan);
+		}
+		break;
+	/* ALARM_ACT_POWER_OFF is run by the power task on the published event */
+	}
+}
+
+static void alarm_change(int i, const struct alarm_rule *r, int raise, int32_t value, TickType_t now)
+{
+	uint8_t held;
+
+	taskENTER_CRITICAL();
+	al.st[i].active = raise;
+	al.st[i].changed = now;
+	if (raise) {
+		al.st[i].raised++;
+		al.st[i].held = r->actions;
+	}
+	held = al.st[i].held;
+	if (!raise)
+		al.st[i].held = 0;
+	al.log[al.log_next % ALARM_LOG_LEN] = (struct alarm_log_entry){ now, i, raise, value };
+	al.log_next++;
+	taskEXIT_CRITICAL();
+
+	if (held & ALARM_ACT_LOG) {
+		if (ALARM_NONE == value)
+			printf("alarm %d %s %s: rule changed\n", i, alarm_sensor_names[r->sensor],
+			       raise ? "raised" : "cleared");
+		else
+			printf("alarm %d %s %s: %ld, set %ld clear %ld\n", i, alarm_sensor_names[r->sensor],
+			       raise ? "raised" : "cleared", value, r->set, r->clear);
+	}
+	for (int a = 0; a < ALARM_ACTIONS; a++) {
+		if (!(held & (1u << a)))
+			continue;
+		if (raise && !al.refs[a]++)
+			alarm_action(a, 1);
+		else if (!raise && !--al.refs[a])
+			alarm_action(a, 0);
+	}
+	/* every raise asks for the power off again, the SOM may have been powered back on */
+	bmc_bus_publish(BMC_TOPIC_ALARM, ALARM_EVENT(i, raise) |
+			(raise && (held & ALARM_ACT_POWER_OFF) ? ALARM_EVENT_POWER_OFF : 0));
+}
+
+/* a rule changed by alarm_set(): clear it if raised and start over */
+static void alarm_reset(int i, const struct alarm_rule *r, uint32_t gen, TickType_t now)
+{
+	if (al.st[i].active)
+		alarm_change(i, r, 0, ALARM_NONE, now);
+	taskENTER_CRITICAL();
+	al.st[i].gen = gen;
+	al.st[i].pending = 0;
+	al.st[i].value = ALARM_NONE;
+	al.st[i].changed = now;
+	taskEXIT_CRITICAL();
+}
+
+static void alarm_eval(int i, const struct alarm_rule *r, int32_t value, TickType_t now)
+{
+	int change;
+
+	al.st[i].value = value;
+	/* no sample: hold the state, and a change being debounced, until one comes */
+	if (ALARM_NONE == value)
+		return;
+	if (ALARM_ABOVE == r->dir)
+		change = al.st[i].active ? value <= r->clear : value >= r->set;
+	else
+		change = al.st[i].active ? value >= r->clear : value <= r->set;
+
+	if (!change) {
+		al.st[i].pending = 0;
+		return;
+	}
+	if (!al.st[i].pending) {
+		al.st[i].pending = 1;
+		al.st[i].pending_tick = now;
+	}
+	if (now - al.st[i].pending_tick < pdMS_TO_TICKS(r->debounce_ms))
+		return;
+	al.st[i].pending = 0;
+	alarm_change(i, r, !al.st[i].active, value, now);
+}
+
+/**
+ * @brief  Evaluate the rules of a sensor on a new sample, by the sampler task.
+ * @param  sensor ALARM_*
+ * @param  value in the unit of the sensor, ALARM_NONE if there is no sample
+ */
+void alarm_feed(enum alarm_sensor sensor, int32_t value)
+{
+	TickType_t now = xTaskGetTickCount();
+	struct alarm_rule r;
+	uint32_t gen;
+
+	for (int i = 0; i < ALARM_RULES; i++) {
+		taskENTER_CRITICAL();
+		r = al.rule[i];
+		gen = al.gen[i];
+		taskEXIT_CRITICAL();
+		if (gen != al.st[i].gen)
+			alarm_reset(i, &r, gen, now);
+		if (ALARM_OFF != r.dir && r.sensor == sensor)
+			alarm_eval(i, &r, value, now);
+	}
+}
+
+/**
+ * @brief  Once a second by the sampler task: blink the alarm LEDs, clear the
+ *         raised rules that were changed since the last sample.
+ */
+void alarm_tick(void)
+{
+	TickType_t now = xTaskGetTickCount();
+	struct alarm_rule r;
+	uint32_t gen;
+
+	for (int i = 0; i < ALARM_RULES; i++) {
+		taskENTER_CRITICAL();
+		r = al.rule[i];
+		gen = al.gen[i];
+		taskEXIT_CRITICAL();
+		if (gen != al.st[i].gen)
+			alarm_reset(i, &r, gen, now);
+	}
+	if (ALARM_REFS(ALARM_ACT_LED) && LED_ALARM == get_mcu_led_status())
+		set_mcu_led_status(LED_ALARM);
+}
+
+/**
+ * @brief  Get a rule and its state.
+ * @param  rule 0 to ALARM_RULES - 1
+ * @param  r filled in
+ * @param  status filled in, NULL if not needed
+ * @retval 0 on success, -1 on a bad rule
+ */
+int alarm_get(int rule, struct alarm_rule *r, struct alarm_status *status)
+{
+	TickType_t now = xTaskGetTickCount();
+
+	if (rule < 0 || rule >= ALARM_RULES)
+		return -1;
+
+	taskENTER_CRITICAL();
+	*r = al.rule[rule];
+	if (status) {
+		status->active = al.st[rule].active;
+		status->pending = al.st[rule].pending;
+		status->value = al.st[rule].value;
+		status->raised = al.st[rule].raised;
+		status->since_ms = (now - (al.st[rule].pending ? al.st[rule].pending_tick :
+			al.st[rule].changed)) * portTICK_PERIOD_MS;
+	}
+	taskEXIT_CRITICAL();
+	return 0;
+}
+
+/**
+ * @brief  Replace a rule, a raised rule is cleared first with its actions
+ *         undone, on the next sample or second.
+ * @param  rule 0 to ALARM_RULES - 1
+ * @param  r dir ALARM_OFF to drop the rule
+ * @retval 0 on success, -1 on a bad rule
+ */
+int alarm_set(int rule, const struct alarm_rule *r)
+{
+	if (rule < 0 || rule >= ALARM_RULES || r->sensor >= ALARM_SENSORS || r->dir > ALARM_BELOW)
+		return -1;
+	if (r->actions >= (1u << ALARM_ACTIONS) || r->debounce_ms > ALARM_DEBOUNCE_MAX_MS)
+		return -1;
+	if ((ALARM_ABOVE == r->dir && r->clear > r->set) || (ALARM_BELOW == r->dir && r->clear < r->set))
+		return -1;
+
+	taskENTER_CRITICAL();
+	al.rule[rule] = *r;
+	al.gen[rule]++;
+	taskEXIT_CRITICAL();
+	return 0;
+}
+
+/**
+ * @brief  Read the alarm log, oldest first.
+ * @param  from entry to read, 0 for the oldest kept
+ * @param  entry filled in
+ * @param  next set to the entry after the one read
+ * @retval 0 on success, -1 if there is no entry at or after from
+ */
+int alarm_log_read(uint32_t from, struct alarm_log_entry *entry, uint32_t *next)
+{
+	int ret = -1;
+
+	taskENTER_CRITICAL();
+	if (al.log_next - from > ALARM_LOG_LEN)
+		from = al.log_next > ALARM_LOG_LEN ? al.log_next - ALARM_LOG_LEN : 0;
+	if (from < al.log_next) {
+		*entry = al.log[from % ALARM_LOG_LEN];
+		*next = from + 1;
+		ret = 0;
+	}
+	taskEXIT_CRITICAL();
+	return ret;
+}
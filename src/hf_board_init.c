@@ -9,6 +9,7 @@
  */
 /* Includes ------------------------------------------------------------------*/
 #include <stdio.h>
+#include <string.h>
 
 #include "cmsis_os.h"
 #include "main.h"
@@ -16,6 +17,7 @@
 
 /* Private includes ----------------------------------------------------------*/
 #include "hf_common.h"
+#include "hf_i2c.h"
 /* Private typedef -----------------------------------------------------------*/
 
 /* Private define ------------------------------------------------------------*/
@@ -97,7 +99,7 @@ void uart_init(USART_TypeDef *Instance)
 	if (Instance == UART4) {
 		MX_UART4_Init();
 		// trigger uart rx
-		HAL_UARTEx_ReceiveToIdle_DMA(&huart4, (uint8_t *)&UART4_RxMsg, sizeof(UART4_RxMsg));
+		uart4_rx_start();
 	} else if (Instance == USART6)
 		MX_USART6_UART_Init();
 	else
@@ -106,14 +108,34 @@ void uart_init(USART_TypeDef *Instance)
 
 void uart_deinit(USART_TypeDef *Instance)
 {
-	if (Instance == UART4)
+	if (Instance == UART4) {
+		HAL_NVIC_DisableIRQ(UART4_IRQn);
 		HAL_UART_DeInit(&huart4);
-	else if (Instance == USART6)
+	} else if (Instance == USART6)
 		HAL_UART_DeInit(&huart6);
 	else
 		printf("%s : uart instance err!\n", __func__);
 }
 
+/* Change the baud rate of an initialized uart, rx is re-armed for UART4 */
+int uart_set_baudrate(USART_TypeDef *Instance, uint32_t baudrate)
+{
+	if (Instance != UART4) {
+		printf("%s : uart instance err!\n", __func__);
+		return -1;
+	}
+	if (HAL_UART_STATE_RESET == huart4.gState)
+		return -1;
+
+	HAL_UART_AbortReceive(&huart4);
+	huart4.Init.BaudRate = baudrate;
+	if (HAL_UART_Init(&huart4) != HAL_OK)
+		return -1;
+
+	uart4_rx_start();
+	return 0;
+}
+
 /**
  * @brief  MCU Configuration. configure the system clock and Initialize all configured peripherals.
  * @retval int
@@ -215,7 +237,7 @@ static void MX_CRC_Init(void)
 static void MX_I2C1_Init(void)
 {
 	hi2c1.Instance = I2C1;
-	hi2c1.Init.ClockSpeed = 100000;
+	hi2c1.Init.ClockSpeed = HF_I2C1_CLOCK_SPEED;
 	hi2c1.Init.DutyCycle = I2C_DUTYCYCLE_2;
 	hi2c1.Init.OwnAddress1 = 0;
 	hi2c1.Init.AddressingMode = I2C_ADDRESSINGMODE_7BIT;
@@ -237,7 +259,7 @@ void MX_I2C3_Init(void)
 {
 	HAL_StatusTypeDef status;
 	hi2c3.Instance = I2C3;
-	hi2c3.Init.ClockSpeed = 100000;
+	hi2c3.Init.ClockSpeed = HF_I2C3_CLOCK_SPEED;
 	hi2c3.Init.DutyCycle = I2C_DUTYCYCLE_2;
 	hi2c3.Init.OwnAddress1 = 0;
 	hi2c3.Init.AddressingMode = I2C_ADDRESSINGMODE_7BIT;
@@ -578,8 +600,9 @@ static void MX_UART4_Init(void)
 	if (HAL_UART_Init(&huart4) != HAL_OK) {
 		Error_Handler();
 	}
-	// HAL_NVIC_SetPriority(UART4_IRQn, 5, 0);
-	// HAL_NVIC_EnableIRQ(UART4_IRQn);
+	/* idle line events for the circular rx dma */
+	HAL_NVIC_SetPriority(UART4_IRQn, 5, 0);
+	HAL_NVIC_EnableIRQ(UART4_IRQn);
 }
 
 /**
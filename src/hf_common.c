@@ -8,6 +8,7 @@
  *
  */
 /* Includes ------------------------------------------------------------------*/
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include "lwip.h"
@@ -18,6 +19,8 @@
 #include "semphr.h"
 #include "main.h"
 #include "hf_i2c.h"
+#include "hf_event_bus.h"
+#include "hf_eeprom.h"
 /* typedef -----------------------------------------------------------*/
 /* define ------------------------------------------------------------*/
 #define EEPROM_DEBUG_EN	0
@@ -42,10 +45,34 @@ static CarrierBoardInfo gCarrier_Board_Info;
 
 static MCUServerInfo gMCU_Server_Info;
 static SomPwrMgtDIPInfo gSOM_PwgMgtDIP_Info;
-SemaphoreHandle_t gEEPROM_Mutex;
+SemaphoreHandle_t gEEPROM_Mutex; // serialises the writers of the config above, readers use es_cfg
+static SemaphoreHandle_t gRTC_Mutex;
+static SemaphoreHandle_t gBootsel_Mutex;
+SemaphoreHandle_t gNet_Mutex; // es_set_eth()
 
 static int gSOM_ConsoleCfg = 0; //0: The default console of SOM is uart; 1: Telnet SOM Console
 
+/*
+ * Snapshot of the config for the readers, published by the writers with a
+ * seqlock latch: while copy[0] is rewritten the sequence is odd and readers use
+ * copy[1], then the other way round. A reader never waits for a writer, it only
+ * copies again if a publish ran meanwhile.
+ */
+struct es_config {
+	CarrierBoardInfo cbinfo;
+	MCUServerInfo server;
+	SomPwrMgtDIPInfo pwrmgt;
+	int som_console_cfg;
+};
+
+static struct {
+	uint32_t seq;
+	struct es_config copy[2];
+} es_cfg;
+
+#define es_config_get(field, buf) \
+	es_config_read(offsetof(struct es_config, field), buf, sizeof(((struct es_config *)0)->field))
+
 /* function prototypes -----------------------------------------------*/
 #if EEPROM_TEST_DEBUG
 #define PRIME_SEED_A	0x7091 // 29917
@@ -220,6 +247,35 @@ typedef enum {
 	cbinfo_backup
 }CbinfoPart;
 
+/* called with gEEPROM_Mutex held, after the config was changed */
+static void es_config_publish(void)
+{
+	struct es_config *cfg;
+
+	for (int i = 0; i < 2; i++) {
+		/* move the readers to the other copy before touching this one */
+		__atomic_store_n(&es_cfg.seq, es_cfg.seq + 1, __ATOMIC_RELEASE);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		cfg = &es_cfg.copy[i];
+		memcpy(&cfg->cbinfo, &gCarrier_Board_Info, sizeof(CarrierBoardInfo));
+		memcpy(&cfg->server, &gMCU_Server_Info, sizeof(MCUServerInfo));
+		memcpy(&cfg->pwrmgt, &gSOM_PwgMgtDIP_Info, sizeof(SomPwrMgtDIPInfo));
+		cfg->som_console_cfg = gSOM_ConsoleCfg;
+	}
+}
+
+/* copy len bytes at offset of the config snapshot, never blocks */
+static void es_config_read(size_t offset, void *buf, size_t len)
+{
+	uint32_t seq;
+
+	do {
+		seq = __atomic_load_n(&es_cfg.seq, __ATOMIC_ACQUIRE);
+		memcpy(buf, (uint8_t *)&es_cfg.copy[seq & 1] + offset, len);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (seq != __atomic_load_n(&es_cfg.seq, __ATOMIC_RELAXED));
+}
+
 static int read_cbinfo(CarrierBoardInfo *pCarrier_Board_Info, CbinfoPart cbinfo_part)
 {
 	int ret = 0;
@@ -229,7 +285,7 @@ static int read_cbinfo(CarrierBoardInfo *pCarrier_Board_Info, CbinfoPart cbinfo_
 			CARRIER_BOARD_INFO_EEPROM_BACKUP_OFFSET;
 
 	esENTER_CRITICAL(gEEPROM_Mutex, portMAX_DELAY);
-	ret = hf_i2c_mem_read(&hi2c1, AT24C_ADDR, reg_addr,
+	ret = es_eeprom_load(reg_addr,
 				(uint8_t *)pCarrier_Board_Info, sizeof(CarrierBoardInfo));
 	esEXIT_CRITICAL(gEEPROM_Mutex);
 	if(ret) {
@@ -246,7 +302,7 @@ static int write_cbinfo(CarrierBoardInfo *pCarrier_Board_Info, CbinfoPart cbinfo
 			CARRIER_BOARD_INFO_EEPROM_BACKUP_OFFSET;
 
 	esENTER_CRITICAL(gEEPROM_Mutex, portMAX_DELAY);
-	hf_i2c_mem_write(&hi2c1, AT24C_ADDR, reg_addr,
+	es_eeprom_update(reg_addr,
 				(uint8_t *)pCarrier_Board_Info, sizeof(CarrierBoardInfo));
 	esEXIT_CRITICAL(gEEPROM_Mutex);
 	eeprom_debug("Updated CarrierBoardInfo in EEPROM!\n");
@@ -421,7 +477,7 @@ static int get_mcu_server_info(void)
 
 	memset((uint8_t *)&gMCU_Server_Info, 0, sizeof(MCUServerInfo));
 	eeprom_debug("print MCUServerInfo:\n");
-	ret = hf_i2c_mem_read(&hi2c1, AT24C_ADDR, MCU_SERVER_INFO_EEPROM_OFFSET,
+	ret = es_eeprom_load(MCU_SERVER_INFO_EEPROM_OFFSET,
 				(uint8_t *)&gMCU_Server_Info, sizeof(MCUServerInfo));
 	if(ret) {
 		printf("Err to read mcu_server_info from EEPROM!!!\n");
@@ -461,10 +517,10 @@ static int get_mcu_server_info(void)
 	if (skip_update_eeprom == 0) {
 		eeprom_debug("Update admin_name:%s, password:%s\n",
 			gMCU_Server_Info.AdminName, gMCU_Server_Info.AdminPassword);
-		hf_i2c_mem_write(&hi2c1, AT24C_ADDR, MCU_SERVER_INFO_EEPROM_OFFSET,
+		es_eeprom_update(MCU_SERVER_INFO_EEPROM_OFFSET,
 			(uint8_t *)&gMCU_Server_Info, sizeof(MCUServerInfo));
 		// osDelay(100);
-		ret = hf_i2c_mem_read(&hi2c1, AT24C_ADDR, MCU_SERVER_INFO_EEPROM_OFFSET,
+		ret = es_eeprom_load(MCU_SERVER_INFO_EEPROM_OFFSET,
 				(uint8_t *)&gMCU_Server_Info, sizeof(MCUServerInfo));
 		eeprom_debug("Updated MCUServerInfo in EEPROM!, admin_name:%s, password:%s\n",
 			gMCU_Server_Info.AdminName, gMCU_Server_Info.AdminPassword);
@@ -477,14 +533,28 @@ static int get_mcu_server_info(void)
 	return 0;
 }
 
+/* the power and dip state goes to the eeprom journal, called with gEEPROM_Mutex held */
+static void es_save_pwrmgt_dip_info(void)
+{
+	es_journal_append(JOURNAL_TAG_PWRMGT_DIP, &gSOM_PwgMgtDIP_Info,
+			  offsetof(SomPwrMgtDIPInfo, crc32Checksum));
+}
+
 static int get_som_pwrmgt_dip_info(void)
 {
 	int ret = 0;
-	int skip_update_eeprom = 1;
 	uint32_t crc32Checksum;
 
 	memset((uint8_t *)&gSOM_PwgMgtDIP_Info,  0, sizeof(SomPwrMgtDIPInfo));
-	ret = hf_i2c_mem_read(&hi2c1, AT24C_ADDR, SOM_PWRMGT_DIP_INFO_EEPROM_OFFSET,
+	ret = es_journal_load(JOURNAL_TAG_PWRMGT_DIP, &gSOM_PwgMgtDIP_Info,
+			      offsetof(SomPwrMgtDIPInfo, crc32Checksum));
+	if (0 == ret) {
+		gSOM_PwgMgtDIP_Info.crc32Checksum = hf_crc32((uint8_t *)&gSOM_PwgMgtDIP_Info, sizeof(gSOM_PwgMgtDIP_Info) - 4);
+		return 0;
+	}
+
+	/* no journal yet, take over the record of the older firmware */
+	ret = es_eeprom_load(SOM_PWRMGT_DIP_INFO_EEPROM_OFFSET,
 				(uint8_t *)&gSOM_PwgMgtDIP_Info, sizeof(SomPwrMgtDIPInfo));
 	if(ret) {
 		printf("Err to read SomPwrMgtDIPInfo from EEPROM!!!\n");
@@ -495,7 +565,6 @@ static int get_som_pwrmgt_dip_info(void)
 
 	if (crc32Checksum != gSOM_PwgMgtDIP_Info.crc32Checksum) {
 		printf("Invalid checksum of SomPwrMgtDIPInfo, init with default value!!!\n");
-		skip_update_eeprom = 0;
 		gSOM_PwgMgtDIP_Info.som_pwr_lost_resume_attr = SOM_PWR_LOST_RESUME_DISABLE;
 		gSOM_PwgMgtDIP_Info.som_pwr_last_state = SOM_PWR_LAST_STATE_OFF;
 		gSOM_PwgMgtDIP_Info.som_dip_switch_soft_ctl_attr = SOM_DIP_SWITCH_SOFT_CTL_DISABLE;
@@ -503,21 +572,15 @@ static int get_som_pwrmgt_dip_info(void)
 		gSOM_PwgMgtDIP_Info.crc32Checksum = hf_crc32((uint8_t *)&gSOM_PwgMgtDIP_Info, sizeof(gSOM_PwgMgtDIP_Info) - 4);
 	}
 
-	if (skip_update_eeprom == 0) {
-		hf_i2c_mem_write(&hi2c1, AT24C_ADDR, SOM_PWRMGT_DIP_INFO_EEPROM_OFFSET,
-			(uint8_t *)&gSOM_PwgMgtDIP_Info, sizeof(SomPwrMgtDIPInfo));
-		eeprom_debug("Updated SomPwrMgtDIPInfo in EEPROM!\n");
-
-		ret = hf_i2c_mem_read(&hi2c1, AT24C_ADDR, SOM_PWRMGT_DIP_INFO_EEPROM_OFFSET,
-					(uint8_t *)&gSOM_PwgMgtDIP_Info, sizeof(SomPwrMgtDIPInfo));
-		eeprom_debug("Read SomPwrMgtDIPInfo again, resume_attr:0x%x, last_state:0x%x, dip_attr:0x%x, dip_state:0x%x\n",
-					gSOM_PwgMgtDIP_Info.som_pwr_lost_resume_attr,
-					gSOM_PwgMgtDIP_Info.som_pwr_last_state,
-					gSOM_PwgMgtDIP_Info.som_dip_switch_soft_ctl_attr,
-					gSOM_PwgMgtDIP_Info.som_dip_switch_soft_state);
-	}
+	es_save_pwrmgt_dip_info();
+	ret = es_eeprom_sync();
+	eeprom_debug("Moved SomPwrMgtDIPInfo to the journal, resume_attr:0x%x, last_state:0x%x, dip_attr:0x%x, dip_state:0x%x\n",
+				gSOM_PwgMgtDIP_Info.som_pwr_lost_resume_attr,
+				gSOM_PwgMgtDIP_Info.som_pwr_last_state,
+				gSOM_PwgMgtDIP_Info.som_dip_switch_soft_ctl_attr,
+				gSOM_PwgMgtDIP_Info.som_dip_switch_soft_state);
 
-	return 0;
+	return ret;
 }
 
 /* This function must be called before other es_get/set_xxx function in this file */
@@ -526,6 +589,7 @@ int es_init_info_in_eeprom(void)
 	#if EEPROM_TEST_DEBUG
 	return 0;
 	#else
+	uint32_t cycles = DWT->CYCCNT;
 	int ret = 0;
 
 	if (USER_DATA_USED_SIZE > USER_MAX_SIZE) {
@@ -534,12 +598,25 @@ int es_init_info_in_eeprom(void)
 		return -1;
 	}
 
-	gEEPROM_Mutex = xSemaphoreCreateMutex();
 	if (gEEPROM_Mutex == NULL) {
+		gEEPROM_Mutex = xSemaphoreCreateMutex();
+		gRTC_Mutex = xSemaphoreCreateMutex();
+		gBootsel_Mutex = xSemaphoreCreateMutex();
+		gNet_Mutex = xSemaphoreCreateMutex();
+	}
+	if (!gEEPROM_Mutex || !gRTC_Mutex || !gBootsel_Mutex || !gNet_Mutex) {
 		printf("Failed to xSemaphoreCreateMutex for gEEPROM_Mutex!!!\n");
 		return -1;
 	}
 
+	ret = es_eeprom_init();
+	if (ret)
+		return ret;
+
+	/* one read of the whole eeprom, the copies below are checked from RAM */
+	if (es_eeprom_preload())
+		printf("Failed to preload the eeprom, reading it record by record!\n");
+
 	ret = get_carrier_board_info();
 	if (ret) {
 		printf("Failed to get_carrier_board_info!!!\n");
@@ -557,7 +634,12 @@ int es_init_info_in_eeprom(void)
 		printf("Failed to get_som_pwrmgt_dip_info!!!\n");
 		return ret;
 	}
-	printf("es init info from epprom ok!\n");
+
+	esENTER_CRITICAL(gEEPROM_Mutex, portMAX_DELAY);
+	es_config_publish();
+	esEXIT_CRITICAL(gEEPROM_Mutex);
+	printf("es init info from epprom ok, %lu us!\n",
+		(DWT->CYCCNT - cycles) / (SystemCoreClock / 1000000));
 	return 0;
 	#endif
 }
@@ -568,9 +650,7 @@ int es_get_carrier_borad_info(CarrierBoardInfo *pCarrier_board_info)
 	if (NULL == pCarrier_board_info)
 		return -1;
 
-	esENTER_CRITICAL(gEEPROM_Mutex, portMAX_DELAY);
-	memcpy(pCarrier_board_info, &gCarrier_Board_Info, sizeof(CarrierBoardInfo));
-	esEXIT_CRITICAL(gEEPROM_Mutex);
+	es_config_get(cbinfo, pCarrier_board_info);
 	return 0;
 }
 
@@ -589,6 +669,7 @@ int es_set_carrier_borad_info(CarrierBoardInfo *pCarrier_Board_Info)
 		skip_update_eeprom = 0;
 		eeprom_debug("Updated CarrierBoardInfo in EEPROM!\n");
 	}
+	es_config_publish();
 	esEXIT_CRITICAL(gEEPROM_Mutex);
 
 	if (!skip_update_eeprom) {
@@ -597,6 +678,10 @@ int es_set_carrier_borad_info(CarrierBoardInfo *pCarrier_Board_Info)
 
 		/* write to backup partition */
 		write_cbinfo(pCarrier_Board_Info, cbinfo_backup);
+
+		/* provisioning data, on the eeprom before the caller is told it is set */
+		if (es_eeprom_sync())
+			return -1;
 	}
 
 	return 0;
@@ -611,21 +696,19 @@ int es_get_mcu_mac(uint8_t *p_mac_address, uint8_t index)
 		printf("Invalid mac index!!! Should be within(0-2)\n");
 		return -1;
 	}
-	esENTER_CRITICAL(gEEPROM_Mutex, portMAX_DELAY);
 	switch (index) {
 		case 0:
-			memcpy(p_mac_address, gCarrier_Board_Info.ethernetMAC1, sizeof(gCarrier_Board_Info.ethernetMAC1));
+			es_config_get(cbinfo.ethernetMAC1, p_mac_address);
 			break;
 		case 1:
-			memcpy(p_mac_address, gCarrier_Board_Info.ethernetMAC2, sizeof(gCarrier_Board_Info.ethernetMAC2));
+			es_config_get(cbinfo.ethernetMAC2, p_mac_address);
 			break;
 		case 2:
-			memcpy(p_mac_address, gCarrier_Board_Info.ethernetMAC3, sizeof(gCarrier_Board_Info.ethernetMAC3));
+			es_config_get(cbinfo.ethernetMAC3, p_mac_address);
 			break;
 		default:
 			break;
 	}
-	esEXIT_CRITICAL(gEEPROM_Mutex);
 
 	return 0;
 }
@@ -676,13 +759,16 @@ int es_set_mcu_mac(uint8_t *p_mac_address, uint8_t index)
 	if (update_mac) {
 		gCarrier_Board_Info.crc32Checksum = hf_crc32((uint8_t *)&gCarrier_Board_Info, sizeof(CarrierBoardInfo) - 4);
 
-		hf_i2c_mem_write(&hi2c1, AT24C_ADDR, CARRIER_BOARD_INFO_EEPROM_MAIN_OFFSET,
+		es_eeprom_update(CARRIER_BOARD_INFO_EEPROM_MAIN_OFFSET,
 					(uint8_t *)&gCarrier_Board_Info, sizeof(CarrierBoardInfo));
 
-		hf_i2c_mem_write(&hi2c1, AT24C_ADDR, CARRIER_BOARD_INFO_EEPROM_BACKUP_OFFSET,
+		es_eeprom_update(CARRIER_BOARD_INFO_EEPROM_BACKUP_OFFSET,
 					(uint8_t *)&gCarrier_Board_Info, sizeof(CarrierBoardInfo));
 	}
+	es_config_publish();
 	esEXIT_CRITICAL(gEEPROM_Mutex);
+	if (update_mac && es_eeprom_sync())
+		return -1;
 
 	return 0;
 }
@@ -693,9 +779,7 @@ int es_get_mcu_ipaddr(uint8_t *p_ip_address)
 	if (NULL == p_ip_address)
 		return -1;
 
-	esENTER_CRITICAL(gEEPROM_Mutex, portMAX_DELAY);
-	memcpy(p_ip_address, gMCU_Server_Info.ip_address, sizeof(gMCU_Server_Info.ip_address));
-	esEXIT_CRITICAL(gEEPROM_Mutex);
+	es_config_get(server.ip_address, p_ip_address);
 
 	return 0;
 }
@@ -713,9 +797,10 @@ int es_set_mcu_ipaddr(uint8_t *p_ip_address)
 	if (0 != memcmp(gMCU_Server_Info.ip_address, p_ip_address, sizeof(gMCU_Server_Info.ip_address))) {
 		memcpy(gMCU_Server_Info.ip_address, p_ip_address, sizeof(gMCU_Server_Info.ip_address));
 		gMCU_Server_Info.crc32Checksum = hf_crc32((uint8_t *)&gMCU_Server_Info, sizeof(MCUServerInfo) - 4);
-		hf_i2c_mem_write(&hi2c1, AT24C_ADDR, MCU_SERVER_INFO_EEPROM_OFFSET,
+		es_eeprom_update(MCU_SERVER_INFO_EEPROM_OFFSET,
 			(uint8_t *)&gMCU_Server_Info, sizeof(MCUServerInfo));
 	}
+	es_config_publish();
 	esEXIT_CRITICAL(gEEPROM_Mutex);
 
 	return 0;
@@ -727,9 +812,7 @@ int es_get_mcu_netmask(uint8_t *p_netmask_address)
 	if (NULL == p_netmask_address)
 		return -1;
 
-	esENTER_CRITICAL(gEEPROM_Mutex, portMAX_DELAY);
-	memcpy(p_netmask_address, gMCU_Server_Info.netmask_address, sizeof(gMCU_Server_Info.netmask_address));
-	esEXIT_CRITICAL(gEEPROM_Mutex);
+	es_config_get(server.netmask_address, p_netmask_address);
 
 	return 0;
 }
@@ -750,9 +833,10 @@ int es_set_mcu_netmask(uint8_t *p_netmask_address)
 	if (0 != memcmp(gMCU_Server_Info.netmask_address, p_netmask_address, sizeof(gMCU_Server_Info.netmask_address))) {
 		memcpy(gMCU_Server_Info.netmask_address, p_netmask_address, sizeof(gMCU_Server_Info.netmask_address));
 		gMCU_Server_Info.crc32Checksum = hf_crc32((uint8_t *)&gMCU_Server_Info, sizeof(MCUServerInfo) - 4);
-		hf_i2c_mem_write(&hi2c1, AT24C_ADDR, MCU_SERVER_INFO_EEPROM_OFFSET,
+		es_eeprom_update(MCU_SERVER_INFO_EEPROM_OFFSET,
 			(uint8_t *)&gMCU_Server_Info, sizeof(MCUServerInfo));
 	}
+	es_config_publish();
 	esEXIT_CRITICAL(gEEPROM_Mutex);
 
 	return 0;
@@ -764,9 +848,7 @@ int es_get_mcu_gateway(uint8_t *p_gateway_address)
 	if (NULL == p_gateway_address)
 		return -1;
 
-	esENTER_CRITICAL(gEEPROM_Mutex, portMAX_DELAY);
-	memcpy(p_gateway_address, gMCU_Server_Info.gateway_address, sizeof(gMCU_Server_Info.gateway_address));
-	esEXIT_CRITICAL(gEEPROM_Mutex);
+	es_config_get(server.gateway_address, p_gateway_address);
 
 	return 0;
 }
@@ -783,9 +865,45 @@ int es_set_mcu_gateway(uint8_t *p_gateway_address)
 	if (0 != memcmp(gMCU_Server_Info.gateway_address, p_gateway_address, sizeof(gMCU_Server_Info.gateway_address))) {
 		memcpy(gMCU_Server_Info.gateway_address, p_gateway_address, sizeof(gMCU_Server_Info.gateway_address));
 		gMCU_Server_Info.crc32Checksum = hf_crc32((uint8_t *)&gMCU_Server_Info, sizeof(MCUServerInfo) - 4);
-		hf_i2c_mem_write(&hi2c1, AT24C_ADDR, MCU_SERVER_INFO_EEPROM_OFFSET,
+		es_eeprom_update(MCU_SERVER_INFO_EEPROM_OFFSET,
 			(uint8_t *)&gMCU_Server_Info, sizeof(MCUServerInfo));
 	}
+	es_config_publish();
+	esEXIT_CRITICAL(gEEPROM_Mutex);
+
+	return 0;
+}
+
+int es_set_mcu_netinfo(uint8_t *p_ip_address, uint8_t *p_netmask_address, uint8_t *p_gateway_address)
+{
+	int update = 0;
+
+	if (p_ip_address && 0 == p_ip_address[0])
+		return -1;
+	if (p_netmask_address && !ip4_addr_netmask_valid(ntohl_seq(p_netmask_address)))
+		return -1;
+	if (p_gateway_address && 0 == p_gateway_address[0])
+		return -1;
+
+	esENTER_CRITICAL(gEEPROM_Mutex, portMAX_DELAY);
+	if (p_ip_address && 0 != memcmp(gMCU_Server_Info.ip_address, p_ip_address, sizeof(gMCU_Server_Info.ip_address))) {
+		memcpy(gMCU_Server_Info.ip_address, p_ip_address, sizeof(gMCU_Server_Info.ip_address));
+		update = 1;
+	}
+	if (p_netmask_address && 0 != memcmp(gMCU_Server_Info.netmask_address, p_netmask_address, sizeof(gMCU_Server_Info.netmask_address))) {
+		memcpy(gMCU_Server_Info.netmask_address, p_netmask_address, sizeof(gMCU_Server_Info.netmask_address));
+		update = 1;
+	}
+	if (p_gateway_address && 0 != memcmp(gMCU_Server_Info.gateway_address, p_gateway_address, sizeof(gMCU_Server_Info.gateway_address))) {
+		memcpy(gMCU_Server_Info.gateway_address, p_gateway_address, sizeof(gMCU_Server_Info.gateway_address));
+		update = 1;
+	}
+	if (update) {
+		gMCU_Server_Info.crc32Checksum = hf_crc32((uint8_t *)&gMCU_Server_Info, sizeof(MCUServerInfo) - 4);
+		es_eeprom_update(MCU_SERVER_INFO_EEPROM_OFFSET,
+			(uint8_t *)&gMCU_Server_Info, sizeof(MCUServerInfo));
+	}
+	es_config_publish();
 	esEXIT_CRITICAL(gEEPROM_Mutex);
 
 	return 0;
@@ -794,16 +912,17 @@ int es_set_mcu_gateway(uint8_t *p_gateway_address)
 // get and set admin info
 int es_get_username_password(char *p_admin_name, char *p_admin_password)
 {
+	MCUServerInfo info;
+
 	if (NULL == p_admin_name)
 		return -1;
 
 	if (NULL == p_admin_password)
 		return -1;
 
-	esENTER_CRITICAL(gEEPROM_Mutex, portMAX_DELAY);
-	strcpy(p_admin_name, gMCU_Server_Info.AdminName);
-	strcpy(p_admin_password, gMCU_Server_Info.AdminPassword);
-	esEXIT_CRITICAL(gEEPROM_Mutex);
+	es_config_get(server, &info);
+	strcpy(p_admin_name, info.AdminName);
+	strcpy(p_admin_password, info.AdminPassword);
 
 	return 0;
 }
@@ -829,9 +948,10 @@ int es_set_username_password(const char *p_admin_name, const char *p_admin_passw
 		strcpy(gMCU_Server_Info.AdminName, p_admin_name);
 		strcpy(gMCU_Server_Info.AdminPassword, p_admin_password);
 		gMCU_Server_Info.crc32Checksum = hf_crc32((uint8_t *)&gMCU_Server_Info, sizeof(MCUServerInfo) - 4);
-		hf_i2c_mem_write(&hi2c1, AT24C_ADDR, MCU_SERVER_INFO_EEPROM_OFFSET,
+		es_eeprom_update(MCU_SERVER_INFO_EEPROM_OFFSET,
 			(uint8_t *)&gMCU_Server_Info, sizeof(MCUServerInfo));
 	}
+	es_config_publish();
 	esEXIT_CRITICAL(gEEPROM_Mutex);
 
 	return 0;
@@ -842,13 +962,13 @@ int es_set_username_password(const char *p_admin_name, const char *p_admin_passw
 int is_som_pwr_lost_resume(void)
 {
 	int isResumePwrLost = 0;
+	uint8_t som_pwr_lost_resume_attr;
 
-	esENTER_CRITICAL(gEEPROM_Mutex, portMAX_DELAY);
-	if (gSOM_PwgMgtDIP_Info.som_pwr_lost_resume_attr == SOM_PWR_LOST_RESUME_ENABLE)
+	es_config_get(pwrmgt.som_pwr_lost_resume_attr, &som_pwr_lost_resume_attr);
+	if (som_pwr_lost_resume_attr == SOM_PWR_LOST_RESUME_ENABLE)
 		isResumePwrLost = 1;
 	else
 		isResumePwrLost = 0;
-	esEXIT_CRITICAL(gEEPROM_Mutex);
 
 	return isResumePwrLost;
 }
@@ -877,10 +997,10 @@ int es_set_som_pwr_lost_resume_attr(int isResumePwrLost)
 	if (som_pwr_lost_resume_attr != gSOM_PwgMgtDIP_Info.som_pwr_lost_resume_attr) {
 		gSOM_PwgMgtDIP_Info.som_pwr_lost_resume_attr = som_pwr_lost_resume_attr;
 		gSOM_PwgMgtDIP_Info.crc32Checksum = hf_crc32((uint8_t *)&gSOM_PwgMgtDIP_Info, sizeof(gSOM_PwgMgtDIP_Info) - 4);
-		hf_i2c_mem_write(&hi2c1, AT24C_ADDR, SOM_PWRMGT_DIP_INFO_EEPROM_OFFSET,
-			(uint8_t *)&gSOM_PwgMgtDIP_Info, sizeof(SomPwrMgtDIPInfo));
+		es_save_pwrmgt_dip_info();
 		eeprom_debug("Update SomPwrMgtDIPInfo in EEPROM for lost_resume_attr\n");
 	}
+	es_config_publish();
 	esEXIT_CRITICAL(gEEPROM_Mutex);
 
 	return 0;
@@ -891,12 +1011,13 @@ int es_set_som_pwr_lost_resume_attr(int isResumePwrLost)
 */
 int es_get_som_pwr_last_state(int *p_som_pwr_last_state)
 {
+	uint8_t som_pwr_last_state;
+
 	if (NULL == p_som_pwr_last_state)
 		return -1;
 
-	esENTER_CRITICAL(gEEPROM_Mutex, portMAX_DELAY);
-	*p_som_pwr_last_state = (gSOM_PwgMgtDIP_Info.som_pwr_last_state == SOM_PWR_LAST_STATE_ON) ? 1 : 0;
-	esEXIT_CRITICAL(gEEPROM_Mutex);
+	es_config_get(pwrmgt.som_pwr_last_state, &som_pwr_last_state);
+	*p_som_pwr_last_state = (som_pwr_last_state == SOM_PWR_LAST_STATE_ON) ? 1 : 0;
 
 	return 0;
 }
@@ -919,9 +1040,9 @@ int es_set_som_pwr_last_state(int som_pwr_last_state)
 	if (som_pwr_last_state_internal_fmt != gSOM_PwgMgtDIP_Info.som_pwr_last_state) {
 		gSOM_PwgMgtDIP_Info.som_pwr_last_state = som_pwr_last_state_internal_fmt;
 		gSOM_PwgMgtDIP_Info.crc32Checksum = hf_crc32((uint8_t *)&gSOM_PwgMgtDIP_Info, sizeof(gSOM_PwgMgtDIP_Info) - 4);
-		hf_i2c_mem_write(&hi2c1, AT24C_ADDR, SOM_PWRMGT_DIP_INFO_EEPROM_OFFSET,
-			(uint8_t *)&gSOM_PwgMgtDIP_Info, sizeof(SomPwrMgtDIPInfo));
+		es_save_pwrmgt_dip_info();
 	}
+	es_config_publish();
 	esEXIT_CRITICAL(gEEPROM_Mutex);
 
 	return 0;
@@ -932,22 +1053,32 @@ int es_set_som_pwr_last_state(int som_pwr_last_state)
 */
 int es_get_som_dip_switch_soft_ctl_attr(int *p_som_dip_switch_soft_ctl_attr)
 {
+	uint8_t som_dip_switch_soft_ctl_attr;
+
 	if (NULL == p_som_dip_switch_soft_ctl_attr)
 		return -1;
 
-	esENTER_CRITICAL(gEEPROM_Mutex, portMAX_DELAY);
-	*p_som_dip_switch_soft_ctl_attr = (gSOM_PwgMgtDIP_Info.som_dip_switch_soft_ctl_attr == SOM_DIP_SWITCH_SOFT_CTL_ENABLE) ? 1 : 0;
-	esEXIT_CRITICAL(gEEPROM_Mutex);
+	es_config_get(pwrmgt.som_dip_switch_soft_ctl_attr, &som_dip_switch_soft_ctl_attr);
+	*p_som_dip_switch_soft_ctl_attr = (som_dip_switch_soft_ctl_attr == SOM_DIP_SWITCH_SOFT_CTL_ENABLE) ? 1 : 0;
 
 	return 0;
 }
 
+/* BMC_TOPIC_DIP_SWITCH value, called with gEEPROM_Mutex held */
+static uint32_t es_dip_switch_event(void)
+{
+	return (gSOM_PwgMgtDIP_Info.som_dip_switch_soft_ctl_attr == SOM_DIP_SWITCH_SOFT_CTL_ENABLE ? 0x10 : 0) |
+		(0xF & gSOM_PwgMgtDIP_Info.som_dip_switch_soft_state);
+}
+
 /* set the som dip switch soft ctl attribute
   som_dip_switch_soft_ctl_attr: 1 means soft ctrl, 0 means hardware ctrl
 */
 int es_set_som_dip_switch_soft_ctl_attr(int som_dip_switch_soft_ctl_attr)
 {
 	int som_dip_swtich_soft_ctl_attr_internal_fmt;
+	int changed = 0;
+	uint32_t event = 0;
 
 	if (som_dip_switch_soft_ctl_attr) {
 		som_dip_swtich_soft_ctl_attr_internal_fmt = SOM_DIP_SWITCH_SOFT_CTL_ENABLE;
@@ -960,10 +1091,14 @@ int es_set_som_dip_switch_soft_ctl_attr(int som_dip_switch_soft_ctl_attr)
 	if (som_dip_swtich_soft_ctl_attr_internal_fmt != gSOM_PwgMgtDIP_Info.som_dip_switch_soft_ctl_attr) {
 		gSOM_PwgMgtDIP_Info.som_dip_switch_soft_ctl_attr = som_dip_swtich_soft_ctl_attr_internal_fmt;
 		gSOM_PwgMgtDIP_Info.crc32Checksum = hf_crc32((uint8_t *)&gSOM_PwgMgtDIP_Info, sizeof(gSOM_PwgMgtDIP_Info) - 4);
-		hf_i2c_mem_write(&hi2c1, AT24C_ADDR, SOM_PWRMGT_DIP_INFO_EEPROM_OFFSET,
-			(uint8_t *)&gSOM_PwgMgtDIP_Info, sizeof(SomPwrMgtDIPInfo));
+		es_save_pwrmgt_dip_info();
+		event = es_dip_switch_event();
+		changed = 1;
 	}
+	es_config_publish();
 	esEXIT_CRITICAL(gEEPROM_Mutex);
+	if (changed)
+		bmc_bus_publish(BMC_TOPIC_DIP_SWITCH, event);
 
 	return 0;
 }
@@ -973,12 +1108,13 @@ int es_set_som_dip_switch_soft_ctl_attr(int som_dip_switch_soft_ctl_attr)
 */
 int es_get_som_dip_switch_soft_state(uint8_t *p_som_dip_switch_soft_state)
 {
+	uint8_t som_dip_switch_soft_state;
+
 	if (NULL == p_som_dip_switch_soft_state)
 		return -1;
 
-	esENTER_CRITICAL(gEEPROM_Mutex, portMAX_DELAY);
-	*p_som_dip_switch_soft_state = 0xF & gSOM_PwgMgtDIP_Info.som_dip_switch_soft_state;
-	esEXIT_CRITICAL(gEEPROM_Mutex);
+	es_config_get(pwrmgt.som_dip_switch_soft_state, &som_dip_switch_soft_state);
+	*p_som_dip_switch_soft_state = 0xF & som_dip_switch_soft_state;
 
 	return 0;
 }
@@ -986,6 +1122,8 @@ int es_get_som_dip_switch_soft_state(uint8_t *p_som_dip_switch_soft_state)
 int es_set_som_dip_switch_soft_state(uint8_t som_dip_switch_soft_state)
 {
 	uint8_t som_dip_switch_soft_state_internal_fmt;
+	int changed = 0;
+	uint32_t event = 0;
 
 	som_dip_switch_soft_state_internal_fmt = 0xE0 | (0xF & som_dip_switch_soft_state);
 
@@ -993,10 +1131,14 @@ int es_set_som_dip_switch_soft_state(uint8_t som_dip_switch_soft_state)
 	if (som_dip_switch_soft_state_internal_fmt != gSOM_PwgMgtDIP_Info.som_dip_switch_soft_state) {
 		gSOM_PwgMgtDIP_Info.som_dip_switch_soft_state = som_dip_switch_soft_state_internal_fmt;
 		gSOM_PwgMgtDIP_Info.crc32Checksum = hf_crc32((uint8_t *)&gSOM_PwgMgtDIP_Info, sizeof(gSOM_PwgMgtDIP_Info) - 4);
-		hf_i2c_mem_write(&hi2c1, AT24C_ADDR, SOM_PWRMGT_DIP_INFO_EEPROM_OFFSET,
-			(uint8_t *)&gSOM_PwgMgtDIP_Info, sizeof(SomPwrMgtDIPInfo));
+		es_save_pwrmgt_dip_info();
+		event = es_dip_switch_event();
+		changed = 1;
 	}
+	es_config_publish();
 	esEXIT_CRITICAL(gEEPROM_Mutex);
+	if (changed)
+		bmc_bus_publish(BMC_TOPIC_DIP_SWITCH, event);
 
 	return 0;
 }
@@ -1004,13 +1146,14 @@ int es_set_som_dip_switch_soft_state(uint8_t som_dip_switch_soft_state)
 
 int es_get_som_dip_switch_soft_state_all(int *p_som_dip_switch_soft_ctl_attr, uint8_t *p_som_dip_switch_soft_state)
 {
+	SomPwrMgtDIPInfo info;
+
 	if (NULL == p_som_dip_switch_soft_state)
 		return -1;
 
-	esENTER_CRITICAL(gEEPROM_Mutex, portMAX_DELAY);
-	*p_som_dip_switch_soft_ctl_attr = (gSOM_PwgMgtDIP_Info.som_dip_switch_soft_ctl_attr == SOM_DIP_SWITCH_SOFT_CTL_ENABLE) ? 1 : 0;
-	*p_som_dip_switch_soft_state = 0xF & gSOM_PwgMgtDIP_Info.som_dip_switch_soft_state;
-	esEXIT_CRITICAL(gEEPROM_Mutex);
+	es_config_get(pwrmgt, &info);
+	*p_som_dip_switch_soft_ctl_attr = (info.som_dip_switch_soft_ctl_attr == SOM_DIP_SWITCH_SOFT_CTL_ENABLE) ? 1 : 0;
+	*p_som_dip_switch_soft_state = 0xF & info.som_dip_switch_soft_state;
 
 	return 0;
 }
@@ -1019,6 +1162,8 @@ int es_set_som_dip_switch_soft_state_all(int som_dip_switch_soft_ctl_attr, uint8
 {
 	int som_dip_swtich_soft_ctl_attr_internal_fmt;
 	uint8_t som_dip_switch_soft_state_internal_fmt;
+	int changed = 0;
+	uint32_t event = 0;
 
 	/* convert to internal ctl attr */
 	if (som_dip_switch_soft_ctl_attr) {
@@ -1038,10 +1183,14 @@ int es_set_som_dip_switch_soft_state_all(int som_dip_switch_soft_ctl_attr, uint8
 		gSOM_PwgMgtDIP_Info.som_dip_switch_soft_ctl_attr = som_dip_swtich_soft_ctl_attr_internal_fmt;
 		gSOM_PwgMgtDIP_Info.som_dip_switch_soft_state = som_dip_switch_soft_state_internal_fmt;
 		gSOM_PwgMgtDIP_Info.crc32Checksum = hf_crc32((uint8_t *)&gSOM_PwgMgtDIP_Info, sizeof(gSOM_PwgMgtDIP_Info) - 4);
-		hf_i2c_mem_write(&hi2c1, AT24C_ADDR, SOM_PWRMGT_DIP_INFO_EEPROM_OFFSET,
-			(uint8_t *)&gSOM_PwgMgtDIP_Info, sizeof(SomPwrMgtDIPInfo));
+		es_save_pwrmgt_dip_info();
+		event = es_dip_switch_event();
+		changed = 1;
 	}
+	es_config_publish();
 	esEXIT_CRITICAL(gEEPROM_Mutex);
+	if (changed)
+		bmc_bus_publish(BMC_TOPIC_DIP_SWITCH, event);
 
 	return 0;
 }
@@ -1241,7 +1390,7 @@ int es_eeprom_info_test(void)
 void set_bootsel(uint8_t is_soft_crtl, uint8_t sel)
 {
 	GPIO_InitTypeDef GPIO_InitStruct = {0};
-	esENTER_CRITICAL(gEEPROM_Mutex, portMAX_DELAY);
+	esENTER_CRITICAL(gBootsel_Mutex, portMAX_DELAY);
 	if(is_soft_crtl){
 		/*Configure GPIO pins : BOOT_SEL0_Pin BOOT_SEL1_Pin BOOT_SEL2_Pin BOOT_SEL3_Pin*/
 		GPIO_InitStruct.Pin = BOOT_SEL0_Pin | BOOT_SEL1_Pin | BOOT_SEL2_Pin | BOOT_SEL3_Pin;
@@ -1267,7 +1416,7 @@ void set_bootsel(uint8_t is_soft_crtl, uint8_t sel)
 		GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
 		HAL_GPIO_Init(GPIOD, &GPIO_InitStruct);
 	}
-	esEXIT_CRITICAL(gEEPROM_Mutex);
+	esEXIT_CRITICAL(gBootsel_Mutex);
 }
 
 int get_bootsel(int *pCtl_attr, uint8_t *pSel)
@@ -1359,12 +1508,12 @@ int32_t es_set_rtc_date(struct rtc_date_t *sdate)
 	sDate.WeekDay = sdate->WeekDay;
 
 	printf("yy/mm/dd  %04d/%02d/%02d %02d\r\n", sDate.Year + 2000, sDate.Month, sDate.Date,sDate.WeekDay);
-	esENTER_CRITICAL(gEEPROM_Mutex, portMAX_DELAY);
+	esENTER_CRITICAL(gRTC_Mutex, portMAX_DELAY);
 	if (HAL_RTC_SetDate(&hrtc, &sDate, RTC_FORMAT_BIN) != HAL_OK) {
-		esEXIT_CRITICAL(gEEPROM_Mutex);
+		esEXIT_CRITICAL(gRTC_Mutex);
 		return HAL_ERROR;
 	}
-	esEXIT_CRITICAL(gEEPROM_Mutex);
+	esEXIT_CRITICAL(gRTC_Mutex);
 	return HAL_OK;
 }
 
@@ -1376,13 +1525,13 @@ int32_t es_set_rtc_time(struct rtc_time_t *stime)
 	sTime.Seconds = stime->Seconds;
 	sTime.DayLightSaving = RTC_DAYLIGHTSAVING_NONE;
 	sTime.StoreOperation = RTC_STOREOPERATION_SET;
-	esENTER_CRITICAL(gEEPROM_Mutex, portMAX_DELAY);
+	esENTER_CRITICAL(gRTC_Mutex, portMAX_DELAY);
 	// printf("%s hh:mm:ss %02d:%02d:%02d\r\n", __func__, sTime.Hours, sTime.Minutes,sTime.Seconds);
 	if (HAL_RTC_SetTime(&hrtc, &sTime, RTC_FORMAT_BIN) != HAL_OK) {
-		esEXIT_CRITICAL(gEEPROM_Mutex);
+		esEXIT_CRITICAL(gRTC_Mutex);
 		return HAL_ERROR;
 	}
-	esEXIT_CRITICAL(gEEPROM_Mutex);
+	esEXIT_CRITICAL(gRTC_Mutex);
 	return HAL_OK;
 }
 
@@ -1466,6 +1615,17 @@ void set_mcu_led_status(led_status_t type)
 		HAL_TIM_PWM_Start(&htim1, TIM_CHANNEL_1);
 		HAL_TIM_PWM_Start(&htim1, TIM_CHANNEL_2);
 		HAL_TIM_PWM_Start(&htim1, TIM_CHANNEL_3);
+	} else if( LED_ALARM == led_status_type) {
+		/* all together on and off, toggled once a second by the alarm engine */
+		if(HAL_TIM_CHANNEL_STATE_BUSY == HAL_TIM_GetChannelState(&htim1, TIM_CHANNEL_1)) {
+			HAL_TIM_PWM_Stop(&htim1, TIM_CHANNEL_1);
+			HAL_TIM_PWM_Stop(&htim1, TIM_CHANNEL_2);
+			HAL_TIM_PWM_Stop(&htim1, TIM_CHANNEL_3);
+		} else {
+			HAL_TIM_PWM_Start(&htim1, TIM_CHANNEL_1);
+			HAL_TIM_PWM_Start(&htim1, TIM_CHANNEL_2);
+			HAL_TIM_PWM_Start(&htim1, TIM_CHANNEL_3);
+		}
 	}
 }
 
@@ -1499,7 +1659,7 @@ int es_restore_userdata_to_factory(void)
 
 	gMCU_Server_Info.crc32Checksum = hf_crc32((uint8_t *)&gMCU_Server_Info, sizeof(MCUServerInfo) - 4);
 
-	hf_i2c_mem_write(&hi2c1, AT24C_ADDR, MCU_SERVER_INFO_EEPROM_OFFSET,
+	es_eeprom_update(MCU_SERVER_INFO_EEPROM_OFFSET,
 		(uint8_t *)&gMCU_Server_Info, sizeof(MCUServerInfo));
 
 	/* restore power and dip info */
@@ -1509,9 +1669,10 @@ int es_restore_userdata_to_factory(void)
 	gSOM_PwgMgtDIP_Info.som_dip_switch_soft_state = SOM_DIP_SWITCH_STATE_EMMC;
 	gSOM_PwgMgtDIP_Info.crc32Checksum = hf_crc32((uint8_t *)&gSOM_PwgMgtDIP_Info, sizeof(gSOM_PwgMgtDIP_Info) - 4);
 
-	hf_i2c_mem_write(&hi2c1, AT24C_ADDR, SOM_PWRMGT_DIP_INFO_EEPROM_OFFSET,
-		(uint8_t *)&gSOM_PwgMgtDIP_Info, sizeof(SomPwrMgtDIPInfo));
+	es_save_pwrmgt_dip_info();
 
+	es_config_publish();
+	esEXIT_CRITICAL(gEEPROM_Mutex);
 
 	/* set bootsel to factor setting: controlled by hardware*/
 	set_bootsel(0, 0x1);
@@ -1534,8 +1695,6 @@ int es_restore_userdata_to_factory(void)
 
 	es_set_eth(&ip, &netmask, &gw, NULL);
 
-	esEXIT_CRITICAL(gEEPROM_Mutex);
-
 	return 0;
 }
 
@@ -1547,9 +1706,7 @@ int es_get_som_console_cfg(int *p_som_console_cfg)
 	if (NULL == p_som_console_cfg)
 		return -1;
 
-	esENTER_CRITICAL(gEEPROM_Mutex, portMAX_DELAY);
-	*p_som_console_cfg = gSOM_ConsoleCfg;
-	esEXIT_CRITICAL(gEEPROM_Mutex);
+	es_config_get(som_console_cfg, p_som_console_cfg);
 
 	return 0;
 }
@@ -1576,6 +1733,7 @@ int es_set_som_console_cfg(int som_console_cfg)
 
 	esENTER_CRITICAL(gEEPROM_Mutex, portMAX_DELAY);
 	gSOM_ConsoleCfg = som_console_cfg;
+	es_config_publish();
 	esEXIT_CRITICAL(gEEPROM_Mutex);
 
 	return 0;
@@ -1593,7 +1751,7 @@ int es_check_carrier_board_info(void)
 	esENTER_CRITICAL(gEEPROM_Mutex, portMAX_DELAY);
 	/* read main partintion */
 	reg_addr = CARRIER_BOARD_INFO_EEPROM_MAIN_OFFSET;
-	ret = hf_i2c_mem_read(&hi2c1, AT24C_ADDR, reg_addr,
+	ret = es_eeprom_load(reg_addr,
 				(uint8_t *)&CbinfoMain, sizeof(CarrierBoardInfo));
 	if(ret) {
 		printf("Failed to read cbinfo_main\n");
@@ -1609,7 +1767,7 @@ int es_check_carrier_board_info(void)
 		print_data((uint8_t *)&CbinfoMain, sizeof(CarrierBoardInfo));
 		/* try to read and check the backup partition */
 		reg_addr = CARRIER_BOARD_INFO_EEPROM_BACKUP_OFFSET;
-		ret = hf_i2c_mem_read(&hi2c1, AT24C_ADDR, reg_addr,
+		ret = es_eeprom_load(reg_addr,
 					(uint8_t *)&CbinfoBackup, sizeof(CarrierBoardInfo));
 		if(ret) {
 			printf("Failed to read cbinfo_backup\n");
@@ -1630,7 +1788,7 @@ int es_check_carrier_board_info(void)
 			memcpy(&gCarrier_Board_Info, &CbinfoBackup, sizeof(CarrierBoardInfo));
 			/* recover main partion with the values of backup */
 			reg_addr = CARRIER_BOARD_INFO_EEPROM_MAIN_OFFSET;
-			ret = hf_i2c_mem_write(&hi2c1, AT24C_ADDR, reg_addr,
+			ret = es_eeprom_update(reg_addr,
 						(uint8_t *)&CbinfoBackup, sizeof(CarrierBoardInfo));
 			if(ret) {
 				printf("Failed to write cbinfo_main\n");
@@ -1641,7 +1799,7 @@ int es_check_carrier_board_info(void)
 	else { // main partition is ok
 		/* check backup partion, if it's bad, recover it with main value */
 		reg_addr = CARRIER_BOARD_INFO_EEPROM_BACKUP_OFFSET;
-		ret = hf_i2c_mem_read(&hi2c1, AT24C_ADDR, reg_addr,
+		ret = es_eeprom_load(reg_addr,
 					(uint8_t *)&CbinfoBackup, sizeof(CarrierBoardInfo));
 		if(ret) {
 			printf("Failed to read cbinfo_backup\n");
@@ -1654,7 +1812,7 @@ int es_check_carrier_board_info(void)
 			printf("Bad backup checksum,0x%lx is NOT equal to calculated value:0x%lx\n", CbinfoBackup.crc32Checksum, crc32Checksum);
 			printf("Recover backup with main settings\n");
 			reg_addr = CARRIER_BOARD_INFO_EEPROM_BACKUP_OFFSET;
-			ret = hf_i2c_mem_write(&hi2c1, AT24C_ADDR, reg_addr,
+			ret = es_eeprom_update(reg_addr,
 						(uint8_t *)&CbinfoMain, sizeof(CarrierBoardInfo));
 			if(ret) {
 				printf("Failed to write cbinfo_backup\n");
@@ -1666,6 +1824,7 @@ int es_check_carrier_board_info(void)
 		}
 	}
 out:
+	es_config_publish();
 	esEXIT_CRITICAL(gEEPROM_Mutex);
 	return ret;
 }
@@ -0,0 +1,316 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Write-back cache of the AT24C eeprom with per page dirty tracking.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include "cmsis_os.h"
+#include "main.h"
+#include "hf_common.h"
+#include "hf_i2c.h"
+#include "hf_eeprom.h"
+
+static struct {
+	SemaphoreHandle_t lock;		// mirror and dirty map
+	SemaphoreHandle_t writer;	// one flush at a time, the task or a sync caller
+	TaskHandle_t task;
+	uint32_t dirty;			// bit n: page n differs from the eeprom
+	uint8_t mirror[EEPROM_SIZE];
+	struct eeprom_stats stats;
+	uint8_t loaded;			// the mirror holds the whole eeprom
+	int8_t journal_slot;		// newest record, -1 if none
+	uint8_t journal_seq;
+} ee = {
+	.journal_slot = -1,
+};
+
+/* the gaps after the cbinfo copies and the page after the user data */
+static const uint8_t journal_slots[] = { 64, 72, 144, 152, 248 };
+#define JOURNAL_SLOTS	(sizeof(journal_slots) / sizeof(journal_slots[0]))
+
+int es_eeprom_init(void)
+{
+	if (ee.lock)
+		return 0;
+	ee.lock = xSemaphoreCreateMutex();
+	ee.writer = xSemaphoreCreateMutex();
+	if (!ee.lock || !ee.writer) {
+		printf("[%s %d]:Failed to create eeprom cache mutex!\n", __func__, __LINE__);
+		return -1;
+	}
+	return 0;
+}
+
+/* write the dirty pages, lowest first: a main copy is written before its backup */
+static int es_eeprom_flush(void)
+{
+	uint8_t page[AT24C_PAGE_SIZE];
+	uint32_t dirty;
+	int ret = 0;
+	int n = 0;
+
+	xSemaphoreTake(ee.writer, portMAX_DELAY);
+	for (;;) {
+		xSemaphoreTake(ee.lock, portMAX_DELAY);
+		dirty = ee.dirty;
+		if (dirty) {
+			n = __builtin_ctz(dirty);
+			/* an update during the write dirties the page again */
+			ee.dirty &= ~(1u << n);
+			memcpy(page, &ee.mirror[n * AT24C_PAGE_SIZE], AT24C_PAGE_SIZE);
+		}
+		xSemaphoreGive(ee.lock);
+		if (!dirty)
+			break;
+
+		if (hf_i2c_mem_write(&hi2c1, AT24C_ADDR, n * AT24C_PAGE_SIZE, page, AT24C_PAGE_SIZE)) {
+			printf("[%s %d]:Failed to write eeprom page %d\n", __func__, __LINE__, n);
+			xSemaphoreTake(ee.lock, portMAX_DELAY);
+			ee.dirty |= 1u << n;
+			ee.stats.errors++;
+			xSemaphoreGive(ee.lock);
+			ret = -1;
+			break;
+		}
+		xSemaphoreTake(ee.lock, portMAX_DELAY);
+		ee.stats.pages++;
+		xSemaphoreGive(ee.lock);
+	}
+	xSemaphoreTake(ee.lock, portMAX_DELAY);
+	ee.stats.flushes++;
+	xSemaphoreGive(ee.lock);
+	xSemaphoreGive(ee.writer);
+
+	return ret;
+}
+
+/**
+ * @brief  Read the whole eeprom into the mirror in one sequential read, the
+ *         address counter rolls over the pages. Later loads are served from RAM.
+ *         Called at boot before the first update.
+ * @retval 0 on success, -1 on error
+ */
+int es_eeprom_preload(void)
+{
+	uint32_t cycles;
+	int ret;
+
+	es_eeprom_flush();
+
+	xSemaphoreTake(ee.writer, portMAX_DELAY);
+	cycles = DWT->CYCCNT;
+	xSemaphoreTake(ee.lock, portMAX_DELAY);
+	ee.loaded = 0;
+	xSemaphoreGive(ee.lock);
+	/* called at boot, before anything updates the mirror */
+	ret = hf_i2c_mem_read(&hi2c1, AT24C_ADDR, 0, ee.mirror, EEPROM_SIZE);
+	xSemaphoreTake(ee.lock, portMAX_DELAY);
+	ee.loaded = !ret;
+	ee.stats.preload_us = (DWT->CYCCNT - cycles) / (SystemCoreClock / 1000000);
+	xSemaphoreGive(ee.lock);
+	xSemaphoreGive(ee.writer);
+
+	if (ret)
+		printf("[%s %d]:Failed to read the eeprom, status %d\n", __func__, __LINE__, ret);
+	return ret ? -1 : 0;
+}
+
+/**
+ * @brief  Read from the eeprom, pending updates are written first. Once the
+ *         mirror is preloaded it is copied from RAM.
+ * @param  offset eeprom address
+ * @param  buf destination
+ * @param  len bytes to read
+ * @retval 0 on success, -1 on error
+ */
+int es_eeprom_load(uint16_t offset, void *buf, uint16_t len)
+{
+	int ret;
+
+	if (offset + len > EEPROM_SIZE)
+		return -1;
+
+	xSemaphoreTake(ee.lock, portMAX_DELAY);
+	if (ee.loaded) {
+		memcpy(buf, &ee.mirror[offset], len);
+		ee.stats.hits++;
+		xSemaphoreGive(ee.lock);
+		return 0;
+	}
+	xSemaphoreGive(ee.lock);
+
+	es_eeprom_flush();
+
+	xSemaphoreTake(ee.writer, portMAX_DELAY);
+	ret = hf_i2c_mem_read(&hi2c1, AT24C_ADDR, offset, buf, len);
+	if (!ret) {
+		xSemaphoreTake(ee.lock, portMAX_DELAY);
+		memcpy(&ee.mirror[offset], buf, len);
+		xSemaphoreGive(ee.lock);
+	}
+	xSemaphoreGive(ee.writer);
+
+	return ret ? -1 : 0;
+}
+
+/**
+ * @brief  Update the mirror, the changed pages are written by the flush task.
+ * @param  offset eeprom address
+ * @param  buf new content
+ * @param  len bytes
+ * @retval 0 on success, -1 on error
+ */
+int es_eeprom_update(uint16_t offset, const void *buf, uint16_t len)
+{
+	const uint8_t *src = buf;
+	uint32_t bytes = 0;
+
+	if (offset + len > EEPROM_SIZE)
+		return -1;
+
+	xSemaphoreTake(ee.lock, portMAX_DELAY);
+	for (uint16_t i = 0; i < len; i++) {
+		if (ee.mirror[offset + i] == src[i])
+			continue;
+		ee.mirror[offset + i] = src[i];
+		ee.dirty |= 1u << ((offset + i) / AT24C_PAGE_SIZE);
+		bytes++;
+	}
+	if (bytes) {
+		ee.stats.updates++;
+		ee.stats.bytes += bytes;
+	}
+	xSemaphoreGive(ee.lock);
+
+	if (bytes && ee.task)
+		xTaskNotifyGive(ee.task);
+	return 0;
+}
+
+/**
+ * @brief  Write all pending updates to the eeprom before returning.
+ * @retval 0 on success, -1 if a page could not be written
+ */
+int es_eeprom_sync(void)
+{
+	xSemaphoreTake(ee.lock, portMAX_DELAY);
+	ee.stats.syncs++;
+	xSemaphoreGive(ee.lock);
+	return es_eeprom_flush();
+}
+
+void es_eeprom_get_stats(struct eeprom_stats *stats)
+{
+	xSemaphoreTake(ee.lock, portMAX_DELAY);
+	*stats = ee.stats;
+	stats->dirty = __builtin_popcount(ee.dirty);
+	stats->journal_slot = ee.journal_slot;
+	stats->journal_seq = ee.journal_seq;
+	xSemaphoreGive(ee.lock);
+}
+
+static uint16_t es_journal_crc(const uint8_t *data, uint16_t len)
+{
+	uint16_t crc = 0xffff;
+
+	while (len--) {
+		crc ^= (uint16_t)*data++ << 8;
+		for (int i = 0; i < 8; i++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+/**
+ * @brief  Find the newest valid journal record of a tag.
+ * @param  tag JOURNAL_TAG_*
+ * @param  value filled in with the record value
+ * @param  len expected value length
+ * @retval 0 if found, -1 if there is no valid record
+ */
+int es_journal_load(uint8_t tag, void *value, uint8_t len)
+{
+	struct es_journal_rec rec, best;
+	int slot = -1;
+
+	if (len > JOURNAL_VALUE_MAX)
+		return -1;
+
+	for (int i = 0; i < JOURNAL_SLOTS; i++) {
+		if (es_eeprom_load(journal_slots[i], &rec, sizeof(rec)))
+			continue;
+		if (rec.crc != es_journal_crc((uint8_t *)&rec, offsetof(struct es_journal_rec, crc)))
+			continue;
+		if (rec.tag_len != ((tag << 4) | len))
+			continue;
+		if (slot < 0 || (int8_t)(rec.seq - best.seq) > 0) {
+			best = rec;
+			slot = i;
+		}
+	}
+	if (slot < 0)
+		return -1;
+
+	xSemaphoreTake(ee.lock, portMAX_DELAY);
+	ee.journal_slot = slot;
+	ee.journal_seq = best.seq;
+	xSemaphoreGive(ee.lock);
+	memcpy(value, best.value, len);
+
+	return 0;
+}
+
+/**
+ * @brief  Append a journal record, written by the flush task like any update.
+ * @param  tag JOURNAL_TAG_*
+ * @param  value the record value
+ * @param  len value length, at most JOURNAL_VALUE_MAX
+ * @retval 0 on success, -1 on error
+ */
+int es_journal_append(uint8_t tag, const void *value, uint8_t len)
+{
+	struct es_journal_rec rec = {
+		.tag_len = (tag << 4) | len,
+	};
+	int slot;
+
+	if (len > JOURNAL_VALUE_MAX || tag > 0xf)
+		return -1;
+	memcpy(rec.value, value, len);
+
+	xSemaphoreTake(ee.lock, portMAX_DELAY);
+	slot = (ee.journal_slot + 1) % JOURNAL_SLOTS;
+	rec.seq = ee.journal_slot < 0 ? 0 : ee.journal_seq + 1;
+	ee.journal_slot = slot;
+	ee.journal_seq = rec.seq;
+	ee.stats.appends++;
+	xSemaphoreGive(ee.lock);
+
+	rec.crc = es_journal_crc((uint8_t *)&rec, offsetof(struct es_journal_rec, crc));
+	return es_eeprom_update(journal_slots[slot], &rec, sizeof(rec));
+}
+
+void hf_eeprom_task(void *argument)
+{
+	ee.task = xTaskGetCurrentTaskHandle();
+	/* updates made before the task was up */
+	xTaskNotifyGive(ee.task);
+
+	for (;;) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		/* let the rest of a configuration change land in the same pages */
+		osDelay(pdMS_TO_TICKS(EEPROM_FLUSH_DELAY_MS));
+		if (es_eeprom_flush()) {
+			osDelay(pdMS_TO_TICKS(1000));
+			xTaskNotifyGive(ee.task);
+		}
+	}
+}
@@ -0,0 +1,196 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Publish/subscribe bus for BMC state changes: SOM power, daemon, DIP switch,
+ * button and power good transitions.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#include <stdio.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "hf_event_bus.h"
+
+struct bmc_bus_sub {
+	uint32_t mask;
+	QueueHandle_t queue;
+	bmc_bus_cb_t cb;
+	void *arg;
+	uint32_t delivered;
+	uint32_t dropped;
+};
+
+/* subscribers are only ever appended, publishers walk the table without a lock */
+static struct bmc_bus_sub bus_subs[BMC_BUS_MAX_SUBSCRIBERS];
+static volatile int bus_nsubs;
+
+static struct {
+	uint32_t value;
+	uint32_t count;
+} bus_last[BMC_TOPIC_MAX];
+
+static int bmc_bus_add(uint32_t mask, QueueHandle_t queue, bmc_bus_cb_t cb, void *arg)
+{
+	int sub = -1;
+
+	taskENTER_CRITICAL();
+	if (bus_nsubs < BMC_BUS_MAX_SUBSCRIBERS) {
+		sub = bus_nsubs;
+		bus_subs[sub].mask = mask;
+		bus_subs[sub].queue = queue;
+		bus_subs[sub].cb = cb;
+		bus_subs[sub].arg = arg;
+		bus_nsubs = sub + 1;
+	}
+	taskEXIT_CRITICAL();
+
+	if (sub < 0)
+		printf("[%s %d]:Too many event bus subscribers!\n", __func__, __LINE__);
+	return sub;
+}
+
+/**
+ * @brief  Subscribe with a queue, wait for the events with bmc_bus_wait().
+ * @param  mask BMC_TOPIC_MASK() of the topics
+ * @param  depth events kept before new ones are dropped
+ * @retval subscriber id, -1 on error
+ */
+int bmc_bus_subscribe_queue(uint32_t mask, uint8_t depth)
+{
+	QueueHandle_t queue = xQueueCreate(depth, sizeof(struct bmc_event));
+	int sub;
+
+	if (!queue) {
+		printf("[%s %d]:Failed to create the event queue!\n", __func__, __LINE__);
+		return -1;
+	}
+	sub = bmc_bus_add(mask, queue, NULL, NULL);
+	if (sub < 0)
+		vQueueDelete(queue);
+	return sub;
+}
+
+/**
+ * @brief  Subscribe with a callback, run in the publisher's context.
+ * @param  mask BMC_TOPIC_MASK() of the topics
+ * @param  cb callback
+ * @param  arg passed to the callback
+ * @retval subscriber id, -1 on error
+ */
+int bmc_bus_subscribe_cb(uint32_t mask, bmc_bus_cb_t cb, void *arg)
+{
+	if (!cb)
+		return -1;
+	return bmc_bus_add(mask, NULL, cb, arg);
+}
+
+/**
+ * @brief  Wait for the next event of a queue subscriber.
+ * @retval pdTRUE if ev was filled in, pdFALSE on timeout
+ */
+int bmc_bus_wait(int sub, struct bmc_event *ev, TickType_t timeout)
+{
+	if (sub < 0 || sub >= bus_nsubs || !bus_subs[sub].queue)
+		return pdFALSE;
+	return xQueueReceive(bus_subs[sub].queue, ev, timeout);
+}
+
+static void bmc_bus_deliver(const struct bmc_event *ev, int from_isr, BaseType_t *woken)
+{
+	struct bmc_bus_sub *s;
+	BaseType_t ret;
+	int n = bus_nsubs;
+
+	for (int i = 0; i < n; i++) {
+		s = &bus_subs[i];
+		if (!(s->mask & BMC_TOPIC_MASK(ev->topic)))
+			continue;
+		if (s->cb) {
+			s->cb(ev, s->arg);
+			ret = pdTRUE;
+		} else if (from_isr) {
+			ret = xQueueSendFromISR(s->queue, ev, woken);
+		} else {
+			ret = xQueueSend(s->queue, ev, 0);
+		}
+		if (pdTRUE == ret)
+			s->delivered++;
+		else
+			s->dropped++;
+	}
+}
+
+/**
+ * @brief  Publish a state change from a task.
+ * @param  topic the topic
+ * @param  value the new value, see bmc_topic_t
+ */
+void bmc_bus_publish(bmc_topic_t topic, uint32_t value)
+{
+	struct bmc_event ev = {
+		.topic = topic,
+		.value = value,
+		.tick = xTaskGetTickCount(),
+	};
+
+	taskENTER_CRITICAL();
+	bus_last[topic].value = value;
+	bus_last[topic].count++;
+	taskEXIT_CRITICAL();
+	bmc_bus_deliver(&ev, 0, NULL);
+}
+
+/**
+ * @brief  Publish a state change from an interrupt.
+ * @param  topic the topic
+ * @param  value the new value, see bmc_topic_t
+ * @param  pxHigherPriorityTaskWoken set if a subscriber was woken
+ */
+void bmc_bus_publish_from_isr(bmc_topic_t topic, uint32_t value, BaseType_t *pxHigherPriorityTaskWoken)
+{
+	struct bmc_event ev = {
+		.topic = topic,
+		.value = value,
+		.tick = xTaskGetTickCountFromISR(),
+	};
+	UBaseType_t saved;
+
+	saved = taskENTER_CRITICAL_FROM_ISR();
+	bus_last[topic].value = value;
+	bus_last[topic].count++;
+	taskEXIT_CRITICAL_FROM_ISR(saved);
+	bmc_bus_deliver(&ev, 1, pxHigherPriorityTaskWoken);
+}
+
+/**
+ * @brief  Last published value of a topic.
+ * @param  topic the topic
+ * @param  count if not NULL, number of events published on the topic
+ * @retval the value, 0 if nothing was published yet
+ */
+uint32_t bmc_bus_last(bmc_topic_t topic, uint32_t *count)
+{
+	uint32_t value;
+
+	taskENTER_CRITICAL();
+	value = bus_last[topic].value;
+	if (count)
+		*count = bus_last[topic].count;
+	taskEXIT_CRITICAL();
+	return value;
+}
+
+int bmc_bus_get_sub_stats(int sub, struct bmc_bus_sub_stats *stats)
+{
+	if (sub < 0 || sub >= bus_nsubs)
+		return -1;
+	taskENTER_CRITICAL();
+	stats->mask = bus_subs[sub].mask;
+	stats->queue = bus_subs[sub].queue != NULL;
+	stats->delivered = bus_subs[sub].delivered;
+	stats->dropped = bus_subs[sub].dropped;
+	taskEXIT_CRITICAL();
+	return 0;
+}
@@ -15,6 +15,8 @@
 
 /* Private includes ----------------------------------------------------------*/
 #include "hf_common.h"
+#include "hf_event_bus.h"
+#include "hf_power_monitor.h"
 /* Private typedef -----------------------------------------------------------*/
 
 /* Private define ------------------------------------------------------------*/
@@ -46,11 +48,14 @@ TickType_t pressStartTime = 0;
  */
 void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
 {
+	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+
 	/* Prevent unused argument(s) compilation warning */
 	UNUSED(GPIO_Pin);
 	if (PWR_SW_P_Pin == GPIO_Pin) {
 		// printf("PWR_SW_P_Pin it ticks=%ld \n", xTaskGetTickCountFromISR());
 		osEventFlagsSet(gpio_eventflags_id, FLAGS_KEY);
+		bmc_bus_publish_from_isr(BMC_TOPIC_BUTTON, KEY_PRESS_DETECTED_STATE, &xHigherPriorityTaskWoken);
 	} else if (SOM_RST_OUT_N_Pin == GPIO_Pin) {
 		// printf("SOM_RST_OUT_N_Pin it  som software reset\n");
 		osEventFlagsSet(gpio_eventflags_id, FLAGS_SOM_RST_OUT);
@@ -59,8 +64,14 @@ void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
 		osEventFlagsSet(gpio_eventflags_id, FLAGS_MCU_RESET_SOM);
 	} else if (KEY_USER_RST_Pin == GPIO_Pin) {
 		osEventFlagsSet(gpio_eventflags_id, FLAGS_KEY_USER_RST);
+#ifdef INA226_ALERT_Pin
+	} else if (INA226_ALERT_Pin == GPIO_Pin) {
+		/* open drain, falling edge, the flag is cleared by the read it triggers */
+		power_mon_kick_from_isr(&xHigherPriorityTaskWoken);
+#endif
 	}
 	pressStartTime = xTaskGetTickCountFromISR();
+	portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
 }
 
 static uint8_t get_key_status(void)
@@ -115,6 +126,7 @@ static void key_process(void)
 			break;
 		case KEY_SHORT_PRESS_STATE:
 			// bmc_debug("KEY_SHORT_PRESS_STATE time %ld\n", currentTime() - pressStartTime);
+			bmc_bus_publish(BMC_TOPIC_BUTTON, KEY_SHORT_PRESS_STATE);
 			button_state = KEY_PRESS_STATE_END;
 			if (get_som_power_state() != SOM_POWER_ON) {
 				vStopSomPowerOffTimer();
@@ -123,6 +135,7 @@ static void key_process(void)
 			break;
 		case KEY_LONG_PRESS_STATE:
 			// bmc_debug("KEY_LONG_PRESS_STATE time %ld\n", currentTime() - pressStartTime);
+			bmc_bus_publish(BMC_TOPIC_BUTTON, KEY_LONG_PRESS_STATE);
 			button_state = KEY_PRESS_STATE_END;
 			if (get_som_power_state() == SOM_POWER_ON) {
 				ret = web_cmd_handle(CMD_POWER_OFF, NULL, 0, 2000);
@@ -136,6 +149,7 @@ static void key_process(void)
 		case KEY_DOUBLE_PRESS_STATE:
 			// printf("KEY_DOUBLE_PRESS_STATE time %ld\n",currentTime - pressStartTime);
 			// printf("other currentTime - ReleaseTime %ld\n", currentTime - ReleaseTime);
+			bmc_bus_publish(BMC_TOPIC_BUTTON, KEY_DOUBLE_PRESS_STATE);
 			button_state = KEY_PRESS_STATE_END;
 			break;
 		case KEY_PRESS_STATE_END:
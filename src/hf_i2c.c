@@ -11,7 +11,12 @@
 #include "stm32f4xx_hal.h"
 #include "main.h"
 #include <stdio.h>
+#include <string.h>
 #include "cmsis_os.h"
+#include "semphr.h"
+#include "timers.h"
+#include "hf_i2c.h"
+#include "hf_power_process.h"
 
 /* Power monitoring IC definitions (INA226, PAC1934) */
 #define INA226_12V_ADDR (0X44U << 1)
@@ -22,16 +27,46 @@
 #define INA2XX_POWER 0x03		  /* readonly */
 #define INA2XX_CURRENT 0x04		  /* readonly */
 #define INA2XX_CALIBRATION 0x05
+#define INA226_MASK_ENABLE 0x06
+#define INA226_ALERT_LIMIT 0x07
+#define INA226_CONFIG_FIXED 0x4000	/* bit 14 reads back as 1 */
+#define INA226_MODE_TRIGGERED 0x3	/* shunt and bus, once per config write */
+#define INA226_MODE_CONTINUOUS 0x7
+#define INA226_MASK_SOL (1u << 15)
+#define INA226_MASK_BOL (1u << 13)
+#define INA226_MASK_BUL (1u << 12)
+#define INA226_MASK_POL (1u << 11)
+#define INA226_MASK_CNVR (1u << 10)	/* alert pin on conversion ready */
+#define INA226_MASK_AFF (1u << 4)	/* alert function flag */
+#define INA226_MASK_CVRF (1u << 3)	/* conversion ready flag */
+#define INA226_MASK_OVF (1u << 2)	/* math overflow */
+#define INA226_MASK_LEN (1u << 0)	/* latch the alert until mask/enable is read */
+#define INA226_MASK_ENABLES 0xfc01	/* the bits written, the rest are flags */
+#define INA226_CALIBRATION 2048		/* 2.5 mA current LSB with the 1 mOhm shunt */
 #define INA226_BUS_LSB 1250 /*uV*/
 #define INA226_SHUNT_RESISTOR 1000							 /*uOhm*/
 #define INA226_CURRENT_LSB (2500000 / INA226_SHUNT_RESISTOR) /*uA */
 #define INA226_POWER_LSB_FACTOR 25
+#define PAC193X_CMD_REFRESH 0x0
 #define PAC193X_CMD_CTRL 0x1
+#define PAC193X_CMD_ACC_COUNT 0x2
+#define PAC193X_CMD_VPOWER1_ACC 0x3
 #define PAC193X_CMD_VBUS1 0x7
 #define PAC193X_CMD_VSENSE1 0xb
 #define PAC193X_CMD_VPOWER1 0x17
+#define PAC193X_CMD_CHANNEL_DIS 0x1C
+#define PAC193X_CMD_NEG_PWR 0x1D
 #define PAC193X_CMD_REFRESH_V 0x1F
 #define PAC193X_CMD_NEG_PWR_ACT 0x23
+#define PAC193X_CTRL 0x8	/* 1024 samples/s, as written before */
+#define PAC193X_CHANNEL_NO_SKIP 0x2	/* block reads keep the place of every channel */
+#define PAC193X_LATCH_MS 2	/* 1 ms, rounded up to whole ticks */
+/* the 24 bit sample count wraps in 4.5 h, a longer gap loses the span */
+#define PAC193X_MAX_SPAN_MS (3600 * 1000)
+/* corrupted looking reads in a row taken for a reset part */
+#define PAC193X_BAD_READS 3
+/* count, accumulators, bus and sense voltages of all channels */
+#define PAC193X_BLOCK_LEN (3 + PAC1934_CHANNELS * (6 + 2 + 2))
 #define PAC193X_COSTANT_PWR_M 3200000000ull /* 3.2V^2*1000mO*/
 #define PAC193X_COSTANT_CURRENT_M 100000	/* 100mv*1000mO*/
 #define PAC193X_SHUNT_RESISTOR_M 4			/* mO*/
@@ -48,32 +83,795 @@
 #define SWAP16(w) ((((w) & 0xff) << 8) | (((w) & 0xff00) >> 8))
 #define SWAP32(w) ((((w) & 0xff) << 24) | (((w) & 0xff00) << 8) | (((w) & 0xff0000) >> 8) | (((w) & 0xff000000) >> 24))
 
-void hf_i2c_reinit(I2C_HandleTypeDef *hi2c)
-{
-	if (hi2c->Instance == I2C1)
+/*
+ * Per-bus request queue. Transfers are interrupt driven: the transfer complete
+ * and error interrupts finish the active request and start the next one, a
+ * one-shot timer bounds every request. The timer callback and the error
+ * interrupt only notify the driver task, hf_i2c_task(), above every other
+ * task: it expires the timed out request and recovers the bus before the
+ * queue moves on, so a long recovery holds neither the timer task nor an
+ * interrupt. Blocking callers go through
+ * hf_i2c_xfer(), one at a time per bus, sleeping on a semaphore instead of
+ * spinning in the HAL polling loops; a caller still asleep past the timeout
+ * expires the request itself, so a dropped timer command or a late timer task
+ * cannot leave it waiting.
+ *
+ * Every slave address gets a circuit breaker: after HF_I2C_BREAKER_FAILS
+ * failures in a row its requests fail at once for a while, then a single
+ * trial request decides whether it is back, so a dead sensor costs one
+ * timeout now and then instead of one per caller.
+ */
+struct hf_i2c_dev {
+	uint8_t addr;			// 8 bit, 0: free slot
+	uint8_t fails;			// in a row
+	uint32_t open_ms;
+	TickType_t opened;
+	struct hf_i2c_dev_stats stats;
+};
+
+struct hf_i2c_bus {
+	I2C_HandleTypeDef *hi2c;
+	uint8_t id;
+	GPIO_TypeDef *scl_port;
+	uint16_t scl_pin;
+	GPIO_TypeDef *sda_port;
+	uint16_t sda_pin;
+	SemaphoreHandle_t sync_lock;	// one blocking caller at a time
+	SemaphoreHandle_t sync_done;
+	TimerHandle_t timer;		// timeout of the active request
+	/* the fields below are shared with the isr, under critical section */
+	struct hf_i2c_req *head;
+	struct hf_i2c_req *tail;
+	struct hf_i2c_req *active;
+	uint8_t recovering;
+	uint32_t depth;
+	TickType_t start;
+	uint32_t start_cyc;
+	TickType_t recovered;
+	struct hf_i2c_stats stats;
+	struct hf_i2c_dev devs[HF_I2C_MAX_DEVS];
+};
+
+static struct hf_i2c_bus i2c_buses[] = {
 	{
-		printf("I2C1 reinit\n");
-		i2c_deinit(I2C1);
-		i2c_init(I2C1);
-	}
-	else if (hi2c->Instance == I2C3)
+		.hi2c = &hi2c1, .id = 1,
+		.scl_port = GPIOB, .scl_pin = GPIO_PIN_6,
+		.sda_port = GPIOB, .sda_pin = GPIO_PIN_7,
+	},
 	{
-		printf("I2C3 reinit\n");
-		i2c_deinit(I2C3);
-		i2c_init(I2C3);
+		.hi2c = &hi2c3, .id = 3,
+		.scl_port = GPIOA, .scl_pin = GPIO_PIN_8,
+		.sda_port = GPIOC, .sda_pin = GPIO_PIN_9,
+	},
+};
+
+#define HF_I2C_BUSES		(sizeof(i2c_buses) / sizeof(i2c_buses[0]))
+/* notification bits of the driver task, per bus */
+#define HF_I2C_EV_EXPIRE(i)	(1u << (2 * (i)))
+#define HF_I2C_EV_RECOVER(i)	(1u << (2 * (i) + 1))
+
+static TaskHandle_t i2c_task;
+static struct hf_i2c_wr_stats wr_stats;
+
+static void hf_i2c_kick(struct hf_i2c_bus *bus);
+
+static struct hf_i2c_bus *hf_i2c_bus_of(I2C_HandleTypeDef *hi2c)
+{
+	for (int i = 0; i < HF_I2C_BUSES; i++) {
+		if (i2c_buses[i].hi2c == hi2c)
+			return &i2c_buses[i];
+	}
+	return NULL;
+}
+
+static UBaseType_t hf_i2c_enter(int isr)
+{
+	if (isr)
+		return taskENTER_CRITICAL_FROM_ISR();
+	taskENTER_CRITICAL();
+	return 0;
+}
+
+static void hf_i2c_exit(int isr, UBaseType_t saved)
+{
+	if (isr)
+		taskEXIT_CRITICAL_FROM_ISR(saved);
+	else
+		taskEXIT_CRITICAL();
+}
+
+static TickType_t hf_i2c_req_ticks(struct hf_i2c_req *req)
+{
+	return pdMS_TO_TICKS(req->timeout_ms ? req->timeout_ms : HF_I2C_TIMEOUT_MS);
+}
+
+static TickType_t hf_i2c_now(int isr)
+{
+	return isr ? xTaskGetTickCountFromISR() : xTaskGetTickCount();
+}
+
+/* the device of an address, a free slot is taken on first use, under critical section */
+static struct hf_i2c_dev *hf_i2c_dev_of(struct hf_i2c_bus *bus, uint8_t addr)
+{
+	struct hf_i2c_dev *dev;
+
+	for (int i = 0; i < HF_I2C_MAX_DEVS; i++) {
+		dev = &bus->devs[i];
+		if (dev->addr == addr)
+			return dev;
+		if (!dev->addr) {
+			dev->addr = addr;
+			dev->stats.bus = bus->id;
+			dev->stats.addr = addr >> 1;
+			return dev;
+		}
+	}
+	return NULL;
+}
+
+/* closed, or open long enough to let one trial request through, under critical section */
+static int hf_i2c_dev_admit(struct hf_i2c_dev *dev, TickType_t now)
+{
+	if (HF_I2C_BREAKER_CLOSED == dev->stats.state)
+		return 1;
+	if (HF_I2C_BREAKER_OPEN == dev->stats.state &&
+	    now - dev->opened >= pdMS_TO_TICKS(dev->open_ms)) {
+		dev->stats.state = HF_I2C_BREAKER_HALF_OPEN;
+		return 1;
+	}
+	dev->stats.rejected++;
+	return 0;
+}
+
+/* account a finished request to its device, under critical section */
+static void hf_i2c_dev_done(struct hf_i2c_dev *dev, struct hf_i2c_req *req, int status,
+			    uint32_t err, uint32_t us, TickType_t now)
+{
+	/* a nacked probe is the expected answer of a busy slave */
+	int probe_nack = !req->len && !req->write && HAL_I2C_ERROR_AF == err;
+
+	dev->stats.requests++;
+	if (HAL_OK == status || probe_nack) {
+		dev->stats.completed++;
+		dev->stats.last_us = us;
+		dev->stats.max_us = MAX(dev->stats.max_us, us);
+		dev->stats.total_us += us;
+		dev->fails = 0;
+		dev->open_ms = 0;
+		dev->stats.state = HF_I2C_BREAKER_CLOSED;
+		return;
+	}
+	if (HAL_TIMEOUT != status && !err) {
+		/* never reached the device, the bus is down or stuck */
+		if (HF_I2C_BREAKER_HALF_OPEN == dev->stats.state) {
+			dev->stats.state = HF_I2C_BREAKER_OPEN;
+			dev->opened = now;
+		}
+		return;
+	}
+
+	if (HAL_TIMEOUT == status)
+		dev->stats.timeouts++;
+	if (err & HAL_I2C_ERROR_AF)
+		dev->stats.nacks++;
+	if (err & HAL_I2C_ERROR_ARLO)
+		dev->stats.arb_lost++;
+	if (err & (HAL_I2C_ERROR_BERR | HAL_I2C_ERROR_OVR))
+		dev->stats.bus_errors++;
+	if (HAL_TIMEOUT == status || (err & ~HAL_I2C_ERROR_AF))
+		dev->stats.recoveries++;
+
+	if (HF_I2C_BREAKER_HALF_OPEN == dev->stats.state || ++dev->fails >= HF_I2C_BREAKER_FAILS) {
+		dev->open_ms = dev->open_ms ? MIN(dev->open_ms * 2, HF_I2C_BREAKER_OPEN_MAX_MS) :
+			       HF_I2C_BREAKER_OPEN_MS;
+		dev->opened = now;
+		dev->fails = 0;
+		dev->stats.state = HF_I2C_BREAKER_OPEN;
+		dev->stats.opens++;
+	}
+}
+
+/*
+ * Complete the active request, the interrupt and the timeout race for it and
+ * only one wins. err is the HAL error code of the transfer, 0 if it never
+ * reached the device.
+ */
+static void hf_i2c_finish(struct hf_i2c_bus *bus, int status, uint32_t err)
+{
+	int isr = xPortIsInsideInterrupt();
+	BaseType_t woken = pdFALSE;
+	struct hf_i2c_req *req;
+	struct hf_i2c_dev *dev;
+	UBaseType_t saved;
+	TickType_t now;
+	uint32_t ms, us;
+
+	us = (DWT->CYCCNT - bus->start_cyc) / (SystemCoreClock / 1000000);
+	saved = hf_i2c_enter(isr);
+	req = bus->active;
+	bus->active = NULL;
+	if (req) {
+		now = hf_i2c_now(isr);
+		ms = (now - bus->start) * portTICK_PERIOD_MS;
+		bus->stats.busy_ms = MAX(bus->stats.busy_ms, ms);
+		bus->stats.requests++;
+		/* a nacked probe is the expected answer of a busy slave */
+		if (HAL_TIMEOUT == status)
+			bus->stats.timeouts++;
+		else if (HAL_OK != status && (req->len || req->write))
+			bus->stats.errors++;
+		dev = hf_i2c_dev_of(bus, req->addr);
+		if (dev)
+			hf_i2c_dev_done(dev, req, status, err, us, now);
+	}
+	hf_i2c_exit(isr, saved);
+	if (!req)
+		return;
+
+	/* a stop that does not make it into the timer queue leaves a stale expiry, ignored */
+	if (isr)
+		xTimerStopFromISR(bus->timer, &woken);
+	else
+		xTimerStop(bus->timer, 0);
+	req->status = status;
+	if (req->done)
+		req->done(req);
+	if (isr)
+		portYIELD_FROM_ISR(woken);
+}
+
+static void hf_i2c_delay_us(uint32_t us)
+{
+	uint32_t start = DWT->CYCCNT;
+	uint32_t cycles = us * (SystemCoreClock / 1000000);
+
+	while (DWT->CYCCNT - start < cycles)
+		;
+}
+
+/* release SCL and wait for a clock stretching slave, -1 if it holds it low too long */
+static int hf_i2c_scl_high(struct hf_i2c_bus *bus)
+{
+	uint32_t waited = 0;
+
+	HAL_GPIO_WritePin(bus->scl_port, bus->scl_pin, GPIO_PIN_SET);
+	while (GPIO_PIN_RESET == HAL_GPIO_ReadPin(bus->scl_port, bus->scl_pin)) {
+		if (waited >= HF_I2C_STRETCH_MAX_US)
+			return -1;
+		hf_i2c_delay_us(1);
+		waited++;
+	}
+	hf_i2c_delay_us(HF_I2C_RECOVER_HALF_US);
+	return 0;
+}
+
+static void hf_i2c_scl_low(struct hf_i2c_bus *bus)
+{
+	HAL_GPIO_WritePin(bus->scl_port, bus->scl_pin, GPIO_PIN_RESET);
+	hf_i2c_delay_us(HF_I2C_RECOVER_HALF_US);
+}
+
+static void hf_i2c_sda(struct hf_i2c_bus *bus, GPIO_PinState state)
+{
+	HAL_GPIO_WritePin(bus->sda_port, bus->sda_pin, state);
+	hf_i2c_delay_us(HF_I2C_RECOVER_HALF_US);
+}
+
+/*
+ * A slave reset or glitched in the middle of a read holds SDA low until it gets
+ * the rest of its clocks. With the peripheral disabled, clock SCL by hand until
+ * SDA is released (9 pulses finish any byte and its ack), then send a START and
+ * a STOP. The same toggles with the pins as gpio are the workaround for the F4
+ * analog filter latching BUSY (errata 2.8.7), which then asks for the pins back
+ * in alternate function and a software reset before the peripheral is set up
+ * again.
+ */
+static int hf_i2c_bus_recover(struct hf_i2c_bus *bus)
+{
+	I2C_HandleTypeDef *hi2c = bus->hi2c;
+	GPIO_InitTypeDef gpio = {
+		.Mode = GPIO_MODE_OUTPUT_OD,
+		.Pull = GPIO_NOPULL,
+		.Speed = GPIO_SPEED_FREQ_LOW,
+	};
+	int ret = 0;
+
+	__HAL_I2C_DISABLE(hi2c);
+	HAL_GPIO_WritePin(bus->scl_port, bus->scl_pin, GPIO_PIN_SET);
+	HAL_GPIO_WritePin(bus->sda_port, bus->sda_pin, GPIO_PIN_SET);
+	gpio.Pin = bus->scl_pin;
+	HAL_GPIO_Init(bus->scl_port, &gpio);
+	gpio.Pin = bus->sda_pin;
+	HAL_GPIO_Init(bus->sda_port, &gpio);
+
+	if (hf_i2c_scl_high(bus)) {
+		ret = -1;
+		goto reset;
+	}
+	if (GPIO_PIN_RESET == HAL_GPIO_ReadPin(bus->sda_port, bus->sda_pin)) {
+		bus->stats.sda_stuck++;
+		for (int i = 0; i < HF_I2C_RECOVER_CLOCKS; i++) {
+			hf_i2c_scl_low(bus);
+			if (hf_i2c_scl_high(bus)) {
+				ret = -1;
+				goto reset;
+			}
+			if (GPIO_PIN_SET == HAL_GPIO_ReadPin(bus->sda_port, bus->sda_pin))
+				break;
+		}
 	}
+	/* START, then STOP */
+	hf_i2c_sda(bus, GPIO_PIN_RESET);
+	hf_i2c_scl_low(bus);
+	if (hf_i2c_scl_high(bus))
+		ret = -1;
+	hf_i2c_sda(bus, GPIO_PIN_SET);
+	if (GPIO_PIN_RESET == HAL_GPIO_ReadPin(bus->sda_port, bus->sda_pin))
+		ret = -1;
+
+reset:
+	/* pins back to the peripheral, software reset, then the configuration again */
+	HAL_I2C_MspInit(hi2c);
+	hi2c->Instance->CR1 |= I2C_CR1_SWRST;
+	hi2c->Instance->CR1 &= ~I2C_CR1_SWRST;
+	hi2c->State = HAL_I2C_STATE_READY;
+	hi2c->Lock = HAL_UNLOCKED;
+	HAL_I2C_Init(hi2c);
+
+	bus->stats.resets++;
+	if (ret) {
+		bus->stats.recover_failed++;
+		printf("[%s %d]:i2c%d still held low after recovery\n", __func__, __LINE__, bus->id);
+	}
+	return ret;
+}
 
+/* driver task context: recover the bus, then let the queue move on */
+static void hf_i2c_recover(struct hf_i2c_bus *bus)
+{
+	/* a bus the power task has shut down stays down, its requests fail to start */
+	if (HAL_I2C_STATE_RESET != bus->hi2c->State)
+		hf_i2c_bus_recover(bus);
+	taskENTER_CRITICAL();
+	bus->recovering = 0;
+	bus->recovered = xTaskGetTickCount();
+	taskEXIT_CRITICAL();
+	hf_i2c_kick(bus);
+}
+
+/* hand events to the driver task, 0 if it is not running yet */
+static int hf_i2c_notify(uint32_t bits, int isr, BaseType_t *woken)
+{
+	if (!i2c_task)
+		return 0;
+	if (isr)
+		xTaskNotifyFromISR(i2c_task, bits, eSetBits, woken);
+	else
+		xTaskNotify(i2c_task, bits, eSetBits);
+	return 1;
+}
+
+/* hand the recovery to the driver task, 0 if it could not be */
+static int hf_i2c_schedule_recover(struct hf_i2c_bus *bus, int isr, BaseType_t *woken)
+{
+	UBaseType_t saved;
+
+	saved = hf_i2c_enter(isr);
+	bus->recovering = 1;
+	hf_i2c_exit(isr, saved);
+	if (hf_i2c_notify(HF_I2C_EV_RECOVER(bus - i2c_buses), isr, woken))
+		return 1;
+
+	saved = hf_i2c_enter(isr);
+	bus->recovering = 0;
+	hf_i2c_exit(isr, saved);
+	return 0;
 }
+
+/*
+ * Time out the active request if it has run past its timeout, from the driver
+ * task or from a caller that woke up first. The transfer is stopped, its
+ * interrupts masked and the peripheral disabled, before the request completes:
+ * the caller may return at once and its buffer must not be written any more.
+ */
+static void hf_i2c_expire(struct hf_i2c_bus *bus)
+{
+	int expired;
+
+	taskENTER_CRITICAL();
+	/* a stale expiry of the previous request must not cut the next one short */
+	expired = bus->active && !bus->recovering &&
+		  xTaskGetTickCount() - bus->start >= hf_i2c_req_ticks(bus->active);
+	if (expired) {
+		bus->recovering = 1;
+		__HAL_I2C_DISABLE_IT(bus->hi2c, I2C_IT_EVT | I2C_IT_BUF | I2C_IT_ERR);
+		__HAL_I2C_DISABLE(bus->hi2c);
+	}
+	taskEXIT_CRITICAL();
+	if (!expired)
+		return;
+
+	hf_i2c_finish(bus, HAL_TIMEOUT, HAL_I2C_ERROR_TIMEOUT);
+	hf_i2c_recover(bus);
+}
+
+/* timer task context: the expiry is the driver task's job */
+static void hf_i2c_timeout(TimerHandle_t timer)
+{
+	struct hf_i2c_bus *bus = pvTimerGetTimerID(timer);
+
+	hf_i2c_notify(HF_I2C_EV_EXPIRE(bus - i2c_buses), 0, NULL);
+}
+
+static int hf_i2c_start(struct hf_i2c_bus *bus, struct hf_i2c_req *req)
+{
+	if (0 == req->len) {
+		if (req->write)
+			return HAL_I2C_Master_Transmit_IT(bus->hi2c, req->addr, &req->reg, 1);
+		/* ack probe, the byte read at the current address is dropped in reg */
+		return HAL_I2C_Master_Receive_IT(bus->hi2c, req->addr, &req->reg, 1);
+	}
+	if (req->write)
+		return HAL_I2C_Mem_Write_IT(bus->hi2c, req->addr, req->reg,
+					I2C_MEMADD_SIZE_8BIT, req->buf, req->len);
+	return HAL_I2C_Mem_Read_IT(bus->hi2c, req->addr, req->reg,
+				I2C_MEMADD_SIZE_8BIT, req->buf, req->len);
+}
+
+/* start the next queued request if the bus is idle, from a task or an isr */
+static void hf_i2c_kick(struct hf_i2c_bus *bus)
+{
+	int isr = xPortIsInsideInterrupt();
+	BaseType_t woken = pdFALSE;
+	struct hf_i2c_req *req;
+	UBaseType_t saved;
+	TickType_t ticks;
+	BaseType_t armed;
+	int stuck;
+
+	for (;;) {
+		saved = hf_i2c_enter(isr);
+		req = bus->head;
+		if (bus->active || bus->recovering || !req) {
+			hf_i2c_exit(isr, saved);
+			break;
+		}
+		bus->head = req->next;
+		if (!bus->head)
+			bus->tail = NULL;
+		bus->depth--;
+		bus->active = req;
+		bus->start = hf_i2c_now(isr);
+		bus->start_cyc = DWT->CYCCNT;
+		hf_i2c_exit(isr, saved);
+
+		/* armed first, so the stop from the complete interrupt is queued after it */
+		ticks = hf_i2c_req_ticks(req);
+		if (isr)
+			armed = xTimerChangePeriodFromISR(bus->timer, ticks, &woken);
+		else
+			armed = xTimerChangePeriod(bus->timer, ticks, 0);
+		/* not started without its timeout (timer queue full), a hang would hold the bus */
+		if (pdPASS == armed && HAL_OK == hf_i2c_start(bus, req))
+			break;
+		/* BUSY with nothing started: SDA held low, or the filter latched it */
+		stuck = pdPASS == armed && HAL_I2C_STATE_RESET != bus->hi2c->State &&
+			__HAL_I2C_GET_FLAG(bus->hi2c, I2C_FLAG_BUSY) &&
+			hf_i2c_now(isr) - bus->recovered >= pdMS_TO_TICKS(HF_I2C_RECOVER_MIN_MS);
+		/* bus down or busy, fail the request and go on with the next one */
+		hf_i2c_finish(bus, HAL_ERROR, 0);
+		if (stuck && hf_i2c_schedule_recover(bus, isr, &woken))
+			break;
+	}
+	if (isr)
+		portYIELD_FROM_ISR(woken);
+}
+
+static void hf_i2c_irq_done(I2C_HandleTypeDef *hi2c, int status)
+{
+	struct hf_i2c_bus *bus = hf_i2c_bus_of(hi2c);
+	uint32_t err = HAL_OK != status ? hi2c->ErrorCode : 0;
+	BaseType_t woken = pdFALSE;
+	UBaseType_t saved;
+
+	if (!bus)
+		return;
+	/* a nack leaves the peripheral usable, anything else gets a bus recovery */
+	if (err & ~HAL_I2C_ERROR_AF) {
+		saved = taskENTER_CRITICAL_FROM_ISR();
+		bus->recovering = 1;
+		taskEXIT_CRITICAL_FROM_ISR(saved);
+		hf_i2c_finish(bus, status, err);
+		if (hf_i2c_schedule_recover(bus, 1, &woken)) {
+			portYIELD_FROM_ISR(woken);
+			return;
+		}
+	} else {
+		hf_i2c_finish(bus, status, err);
+	}
+	hf_i2c_kick(bus);
+}
+
+void HAL_I2C_MemTxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+	hf_i2c_irq_done(hi2c, HAL_OK);
+}
+
+void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+	hf_i2c_irq_done(hi2c, HAL_OK);
+}
+
+void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+	hf_i2c_irq_done(hi2c, HAL_OK);
+}
+
+void HAL_I2C_MasterRxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+	hf_i2c_irq_done(hi2c, HAL_OK);
+}
+
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c)
+{
+	hf_i2c_irq_done(hi2c, HAL_ERROR);
+}
+
+/**
+ * @brief  Create the bus queues, before the scheduler is started.
+ */
+void hf_i2c_init(void)
+{
+	struct hf_i2c_bus *bus;
+
+	/* cycle counter for the eeprom write cycle times */
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	for (int i = 0; i < HF_I2C_BUSES; i++) {
+		bus = &i2c_buses[i];
+		bus->sync_lock = xSemaphoreCreateMutex();
+		bus->sync_done = xSemaphoreCreateBinary();
+		bus->timer = xTimerCreate("i2c", pdMS_TO_TICKS(HF_I2C_TIMEOUT_MS), pdFALSE,
+					bus, hf_i2c_timeout);
+		if (!bus->sync_lock || !bus->sync_done || !bus->timer)
+			printf("[%s %d]:Failed to create i2c bus %d queue!\n", __func__, __LINE__, i);
+	}
+}
+
+/**
+ * @brief  The driver task: timed out requests and bus recoveries, notified by
+ *         the request timers and the error interrupt.
+ * @param  argument not used
+ */
+void hf_i2c_task(void *argument)
+{
+	uint32_t events;
+
+	i2c_task = xTaskGetCurrentTaskHandle();
+	for (;;) {
+		xTaskNotifyWait(0, UINT32_MAX, &events, portMAX_DELAY);
+		for (int i = 0; i < HF_I2C_BUSES; i++) {
+			if (events & HF_I2C_EV_EXPIRE(i))
+				hf_i2c_expire(&i2c_buses[i]);
+			if (events & HF_I2C_EV_RECOVER(i))
+				hf_i2c_recover(&i2c_buses[i]);
+		}
+	}
+}
+
+/**
+ * @brief  Queue a request, callable from tasks and interrupts.
+ * @param  hi2c &hi2c1 or &hi2c3
+ * @param  req the request, req->done is called when it is over
+ * @retval HAL_OK if queued, HAL_BUSY while the breaker of the device is open
+ */
+int hf_i2c_submit(I2C_HandleTypeDef *hi2c, struct hf_i2c_req *req)
+{
+	struct hf_i2c_bus *bus = hf_i2c_bus_of(hi2c);
+	int isr = xPortIsInsideInterrupt();
+	struct hf_i2c_dev *dev;
+	UBaseType_t saved;
+
+	if (!bus || !bus->timer || !req)
+		return HAL_ERROR;
+
+	req->next = NULL;
+	req->status = HAL_BUSY;
+	saved = hf_i2c_enter(isr);
+	dev = hf_i2c_dev_of(bus, req->addr);
+	if (dev && !hf_i2c_dev_admit(dev, hf_i2c_now(isr))) {
+		hf_i2c_exit(isr, saved);
+		return HAL_BUSY;
+	}
+	if (bus->tail)
+		bus->tail->next = req;
+	else
+		bus->head = req;
+	bus->tail = req;
+	bus->depth++;
+	bus->stats.queue_max = MAX(bus->stats.queue_max, bus->depth);
+	hf_i2c_exit(isr, saved);
+
+	hf_i2c_kick(bus);
+	return HAL_OK;
+}
+
+/* sleep until the requests waited for are over, expiring any the timer has missed */
+static void hf_i2c_wait(struct hf_i2c_bus *bus, TickType_t ticks)
+{
+	while (xSemaphoreTake(bus->sync_done, ticks + 1) != pdTRUE)
+		hf_i2c_expire(bus);
+}
+
+static void hf_i2c_wake(struct hf_i2c_req *req)
+{
+	BaseType_t woken = pdFALSE;
+
+	if (xPortIsInsideInterrupt()) {
+		xSemaphoreGiveFromISR(req->arg, &woken);
+		portYIELD_FROM_ISR(woken);
+	} else {
+		xSemaphoreGive(req->arg);
+	}
+}
+
+/**
+ * @brief  Run a request and sleep until it is over, task context only.
+ * @param  hi2c &hi2c1 or &hi2c3
+ * @param  req the request, done and arg are overwritten
+ * @retval HAL status of the transfer
+ */
+int hf_i2c_xfer(I2C_HandleTypeDef *hi2c, struct hf_i2c_req *req)
+{
+	struct hf_i2c_bus *bus = hf_i2c_bus_of(hi2c);
+	int status;
+
+	if (!bus || !bus->sync_lock)
+		return HAL_ERROR;
+	if (xSemaphoreTake(bus->sync_lock, portMAX_DELAY) != pdTRUE)
+		return HAL_BUSY;
+
+	req->done = hf_i2c_wake;
+	req->arg = bus->sync_done;
+	status = hf_i2c_submit(hi2c, req);
+	if (HAL_OK == status) {
+		hf_i2c_wait(bus, hf_i2c_req_ticks(req));
+		status = req->status;
+	}
+	xSemaphoreGive(bus->sync_lock);
+	return status;
+}
+
+int hf_i2c_get_stats(I2C_HandleTypeDef *hi2c, struct hf_i2c_stats *stats)
+{
+	struct hf_i2c_bus *bus = hf_i2c_bus_of(hi2c);
+
+	if (!bus)
+		return -1;
+	taskENTER_CRITICAL();
+	*stats = bus->stats;
+	taskEXIT_CRITICAL();
+	return 0;
+}
+
+/**
+ * @brief  Counters of the index-th device seen on the buses.
+ * @retval 0, -1 past the last device
+ */
+int hf_i2c_get_dev_stats(int index, struct hf_i2c_dev_stats *stats)
+{
+	struct hf_i2c_dev *dev;
+
+	for (int i = 0; i < HF_I2C_BUSES; i++) {
+		for (int j = 0; j < HF_I2C_MAX_DEVS; j++) {
+			dev = &i2c_buses[i].devs[j];
+			if (!dev->addr || index--)
+				continue;
+			taskENTER_CRITICAL();
+			*stats = dev->stats;
+			taskEXIT_CRITICAL();
+			return 0;
+		}
+	}
+	return -1;
+}
+
+void hf_i2c_get_wr_stats(struct hf_i2c_wr_stats *stats)
+{
+	taskENTER_CRITICAL();
+	*stats = wr_stats;
+	taskEXIT_CRITICAL();
+}
+
+struct hf_i2c_burst {
+	uint32_t pending;
+	SemaphoreHandle_t done;
+};
+
+static void hf_i2c_burst_done(struct hf_i2c_req *req)
+{
+	struct hf_i2c_burst *burst = req->arg;
+	BaseType_t woken = pdFALSE;
+
+	if (__atomic_sub_fetch(&burst->pending, 1, __ATOMIC_ACQ_REL))
+		return;
+	if (xPortIsInsideInterrupt()) {
+		xSemaphoreGiveFromISR(burst->done, &woken);
+		portYIELD_FROM_ISR(woken);
+	} else {
+		xSemaphoreGive(burst->done);
+	}
+}
+
+/**
+ * @brief  Queue several requests at once and sleep until the last is over,
+ *         they run back to back from the interrupts without a wakeup between.
+ *         Task context only.
+ * @param  hi2c &hi2c1 or &hi2c3
+ * @param  reqs the requests, done and arg are overwritten
+ * @param  n number of requests
+ * @retval HAL_OK if all succeeded, else the status of the first that failed
+ */
+int hf_i2c_xfer_burst(I2C_HandleTypeDef *hi2c, struct hf_i2c_req *reqs, int n)
+{
+	struct hf_i2c_bus *bus = hf_i2c_bus_of(hi2c);
+	struct hf_i2c_burst burst = {
+		.pending = n,
+	};
+	TickType_t ticks = 0;
+	int status = HAL_OK;
+	int i;
+
+	if (!bus || !bus->sync_lock || n <= 0)
+		return HAL_ERROR;
+	if (xSemaphoreTake(bus->sync_lock, portMAX_DELAY) != pdTRUE)
+		return HAL_BUSY;
+
+	burst.done = bus->sync_done;
+	for (i = 0; i < n; i++) {
+		reqs[i].done = hf_i2c_burst_done;
+		reqs[i].arg = &burst;
+		ticks = MAX(ticks, hf_i2c_req_ticks(&reqs[i]));
+		if (HAL_OK != hf_i2c_submit(hi2c, &reqs[i]))
+			break;
+	}
+	/* the rest was refused, nothing left to wait for if the queued ones are over */
+	for (int j = i; j < n; j++)
+		reqs[j].status = HAL_BUSY;
+	if (__atomic_sub_fetch(&burst.pending, n - i, __ATOMIC_ACQ_REL) || i == n)
+		hf_i2c_wait(bus, ticks);
+	xSemaphoreGive(bus->sync_lock);
+
+	for (i = 0; i < n && HAL_OK == status; i++)
+		status = reqs[i].status;
+	return status;
+}
+
+static int hf_i2c_reg_xfer(I2C_HandleTypeDef *hi2c, uint8_t slave_addr, uint8_t reg_addr,
+			   uint8_t *data_ptr, uint16_t len, uint8_t write, uint16_t timeout_ms)
+{
+	struct hf_i2c_req req = {
+		.addr = slave_addr,
+		.reg = reg_addr,
+		.write = write,
+		.buf = data_ptr,
+		.len = len,
+		.timeout_ms = timeout_ms,
+	};
+
+	return hf_i2c_xfer(hi2c, &req);
+}
+
 int hf_i2c_reg_write(I2C_HandleTypeDef *hi2c, uint8_t slave_addr,
 					 uint8_t reg_addr, uint8_t *data_ptr)
 {
 	HAL_StatusTypeDef status = HAL_OK;
 
-	status = HAL_I2C_Mem_Write(hi2c, slave_addr, reg_addr, I2C_MEMADD_SIZE_8BIT,
-							   data_ptr, 0x1, 0xff);
+	status = hf_i2c_reg_xfer(hi2c, slave_addr, reg_addr, data_ptr, 0x1, 1, 0xff);
 	if (status != HAL_OK) {
 		printf("I2Cx_write_Error(%x) reg %x; status %x\r\n", slave_addr, reg_addr, status);
-		hf_i2c_reinit(hi2c);
 		return status;
 	}
 	return status;
@@ -83,11 +881,9 @@ int hf_i2c_reg_read(I2C_HandleTypeDef *hi2c, uint8_t slave_addr,
 					uint8_t reg_addr, uint8_t *data_ptr)
 {
 	HAL_StatusTypeDef status = HAL_OK;
-	status = HAL_I2C_Mem_Read(hi2c, slave_addr, reg_addr, I2C_MEMADD_SIZE_8BIT,
-							  data_ptr, 0x1, 0xff);
+	status = hf_i2c_reg_xfer(hi2c, slave_addr, reg_addr, data_ptr, 0x1, 0, 0xff);
 	if (status != HAL_OK){
 		printf("I2Cx_read_Error(%x) reg %x; status %x\r\n", slave_addr, reg_addr, status);
-		hf_i2c_reinit(hi2c);
 		return status;
 	}
 	return status;
@@ -101,101 +897,95 @@ int hf_i2c_mem_read(I2C_HandleTypeDef *hi2c, uint8_t slave_addr,
 
 	do {
 		retry_cnt++;
-		status = HAL_I2C_Mem_Read(hi2c, slave_addr, reg_addr, I2C_MEMADD_SIZE_8BIT,
-					data_ptr, len, 1000);
+		status = hf_i2c_reg_xfer(hi2c, slave_addr, reg_addr, data_ptr, len, 0, 0);
+		if (HAL_BUSY == status)
+			break;
 		if ((status != HAL_OK))
 		{
 			printf("I2Cx_read_Error(%x) reg %x; status %x, tried times: %ld\r\n", slave_addr, reg_addr, status, retry_cnt);
 			osDelay(pdMS_TO_TICKS(50));
-			hf_i2c_reinit(hi2c);
 		}
 	}while((HAL_OK != status) && (retry_cnt < 10));
 
 	return status;
 }
 
+/*
+ * tWR is the time from the Stop condition of a write to the end of the internal
+ * write cycle, the eeprom nacks its address until then. Probe it back to back
+ * instead of sleeping the worst case, bounded by HF_I2C_WRITE_CYCLE_MAX_MS. A
+ * probe that hangs is cut at HF_I2C_PROBE_TIMEOUT_MS and the bus recovered,
+ * then the probing goes on until the deadline.
+ */
+static int hf_i2c_wait_write_cycle(I2C_HandleTypeDef *hi2c, uint8_t slave_addr)
+{
+	struct hf_i2c_req req = {
+		.addr = slave_addr,
+		.timeout_ms = HF_I2C_PROBE_TIMEOUT_MS,
+	};
+	TickType_t start = xTaskGetTickCount();
+	uint32_t cycles = DWT->CYCCNT;
+	uint32_t polls = 0, us;
+	int status;
+
+	do {
+		polls++;
+		status = hf_i2c_xfer(hi2c, &req);
+	} while (HAL_OK != status && HAL_BUSY != status &&
+		 xTaskGetTickCount() - start < pdMS_TO_TICKS(HF_I2C_WRITE_CYCLE_MAX_MS));
+	us = (DWT->CYCCNT - cycles) / (SystemCoreClock / 1000000);
+
+	taskENTER_CRITICAL();
+	if (HAL_OK == status) {
+		wr_stats.pages++;
+		wr_stats.total_us += us;
+		wr_stats.last_us = us;
+		wr_stats.max_us = MAX(wr_stats.max_us, us);
+		wr_stats.min_us = wr_stats.min_us ? MIN(wr_stats.min_us, us) : us;
+	} else {
+		wr_stats.timeouts++;
+	}
+	wr_stats.polls += polls;
+	taskEXIT_CRITICAL();
+
+	if (HAL_OK != status)
+		printf("I2Cx_write_cycle_Timeout(%x) after %lu us\r\n", slave_addr, us);
+	return status;
+}
+
 int hf_i2c_mem_write(I2C_HandleTypeDef *hi2c, uint8_t slave_addr,
 					  uint8_t reg_addr, uint8_t *data_ptr, uint32_t len)
 {
-	int i, offset;
-	int unaligned_bytes = 0, aligned_bytes; // the reg_addr offset that is not aligned with 8Bytes
 	HAL_StatusTypeDef status = HAL_OK;
-	uint32_t retry_cnt = 6;
+	uint32_t offset, chunk, retry_cnt;
 
 	// printf("slave_addr %x, reg_addr %x len %ld\n",slave_addr, reg_addr, len);
 	if (hi2c->Instance == I2C1)
 		HAL_GPIO_WritePin(EEPROM_WP_GPIO_Port, EEPROM_WP_Pin, GPIO_PIN_RESET);
 
-	// unaligned addr
-	unaligned_bytes = ALIGN(reg_addr, 8) - reg_addr;
-	unaligned_bytes = MIN(unaligned_bytes, len);
-	for (i = 0; i < unaligned_bytes; i++) {
+	// page write, up to the end of the page the address is in
+	for (offset = 0; offset < len; offset += chunk) {
+		chunk = AT24C_PAGE_SIZE - (reg_addr + offset) % AT24C_PAGE_SIZE;
+		chunk = MIN(chunk, len - offset);
 		retry_cnt = 0;
 		do {
 			retry_cnt++;
-			status = HAL_I2C_Mem_Write(hi2c, slave_addr, reg_addr + i,
-									I2C_MEMADD_SIZE_8BIT, data_ptr + i, 1,
-									1000);
+			status = hf_i2c_reg_xfer(hi2c, slave_addr, reg_addr + offset,
+						 data_ptr + offset, chunk, 1, 0);
+			if (HAL_BUSY == status)
+				goto out;
 			if (status != HAL_OK)
 			{
-				printf("I2Cx_write_Error(%x) reg %x; status %x, tried times: %ld\r\n", slave_addr, reg_addr + i, status, retry_cnt);
+				printf("I2Cx_write_Error(%x) reg %lx; status %x, tried times: %ld\r\n", slave_addr, reg_addr + offset, status, retry_cnt);
 				osDelay(pdMS_TO_TICKS(50));
-				hf_i2c_reinit(hi2c);
 			}
 		}while((HAL_OK != status) && (retry_cnt < 6));
-		// while (HAL_I2C_IsDeviceReady(hi2c, slave_addr, 0xff, 0xff) == HAL_TIMEOUT);
 		if (HAL_OK != status)
 			goto out;
 
-		/* tWR=5ms is the time from a valid Stop condition of a write sequence to the end of the internal clear/write cycle*/
-		osDelay(pdMS_TO_TICKS(5));
-	}
-	offset = i;
-	// 8 bytes page write
-	aligned_bytes = ((len - unaligned_bytes) / 8) * 8;
-	for (i = 0; i < aligned_bytes;) {
-		retry_cnt = 0;
-		do {
-			retry_cnt++;
-			status = HAL_I2C_Mem_Write(hi2c, slave_addr, reg_addr + offset + i,
-									I2C_MEMADD_SIZE_8BIT, data_ptr + offset + i, 8,
-									1000);
-			if (status != HAL_OK)
-			{
-				printf("I2Cx_write_Error(%x) reg %x; status %x, tried times: %ld\r\n", slave_addr, reg_addr + offset + i, status, retry_cnt);
-				osDelay(pdMS_TO_TICKS(50));
-				hf_i2c_reinit(hi2c);
-			}
-		}while((HAL_OK != status) && (retry_cnt < 6));
-		// while (HAL_I2C_IsDeviceReady(hi2c, slave_addr, 0xff, 0xff) == HAL_TIMEOUT);
+		status = hf_i2c_wait_write_cycle(hi2c, slave_addr);
 		if (HAL_OK != status)
 			goto out;
-
-		i = i + 8;
-		osDelay(pdMS_TO_TICKS(5));
-	}
-	offset = offset + i;
-	// the left bytes
-	unaligned_bytes = len - unaligned_bytes - aligned_bytes;
-	for (i = 0; i < unaligned_bytes; i++) {
-		retry_cnt = 0;
-		do {
-			retry_cnt++;
-			status = HAL_I2C_Mem_Write(hi2c, slave_addr, reg_addr + offset + i,
-									I2C_MEMADD_SIZE_8BIT, data_ptr + offset + i, 1,
-									1000);
-			if (status != HAL_OK)
-			{
-				printf("I2Cx_write_Error(%x) reg %x; status %x, tried times: %ld\r\n", slave_addr, reg_addr + offset + i, status, retry_cnt);
-				osDelay(pdMS_TO_TICKS(50));
-				hf_i2c_reinit(hi2c);
-			}
-		}while((HAL_OK != status) && (retry_cnt < 6));
-		// while (HAL_I2C_IsDeviceReady(hi2c, slave_addr, 0xff, 0xff) == HAL_TIMEOUT);
-		if (HAL_OK != status)
-			goto out;
-
-		osDelay(pdMS_TO_TICKS(5));
 	}
 out:
 	if (hi2c->Instance == I2C1)
@@ -208,11 +998,9 @@ int hf_i2c_reg_write_block(I2C_HandleTypeDef *hi2c, uint8_t slave_addr,
 {
 	HAL_StatusTypeDef status = HAL_OK;
 
-	status = HAL_I2C_Mem_Write(hi2c, slave_addr, reg_addr, I2C_MEMADD_SIZE_8BIT,
-							   data_ptr, len, 0xff);
+	status = hf_i2c_reg_xfer(hi2c, slave_addr, reg_addr, data_ptr, len, 1, 0xff);
 	if (status != HAL_OK) {
 		printf("I2Cx_write_Error(%x) reg %x; status %x\r\n", slave_addr, reg_addr, status);
-		hf_i2c_reinit(hi2c);
 		return status;
 	}
 	return status;
@@ -222,78 +1010,225 @@ int hf_i2c_reg_read_block(I2C_HandleTypeDef *hi2c, uint8_t slave_addr,
 					uint8_t reg_addr, uint8_t *data_ptr, uint8_t len)
 {
 	HAL_StatusTypeDef status = HAL_OK;
-	status = HAL_I2C_Mem_Read(hi2c, slave_addr, reg_addr, I2C_MEMADD_SIZE_8BIT,
-							  data_ptr, len, pdMS_TO_TICKS(100));
+	status = hf_i2c_reg_xfer(hi2c, slave_addr, reg_addr, data_ptr, len, 0, 100);
 	if (status != HAL_OK){
 		printf("I2Cx_read_Error(%x) reg %x; status %x\r\n", slave_addr, reg_addr, status);
-		hf_i2c_reinit(hi2c);
 		return status;
 	}
 	return status;
 }
 
 /* Power monitoring functions */
-static int ina226_init(void)
+
+/*
+ * INA226 configuration: averaging and conversion times set the result rate,
+ * (vbus_ct + vshunt_ct) * avg, and the noise of every result. The alert
+ * function is latched, so a limit crossed by any conversion is seen at the
+ * next read even if the reading is back in range by then.
+ */
+static const uint16_t ina226_avgs[] = { 1, 4, 16, 64, 128, 256, 512, 1024 };
+static const uint16_t ina226_cts[] = { 140, 204, 332, 588, 1100, 2116, 4156, 8244 };
+
+static struct {
+	struct ina226_cfg cfg;
+	uint16_t config;	// the register values of cfg
+	uint16_t mask;
+	uint16_t limit;
+	uint8_t configured;
+	uint8_t primed;		// a conversion completed since the configuration
+	struct ina226_stats stats;
+} ina226 = {
+	.cfg = {
+		.avg = INA226_DEFAULT_AVG,
+		.vbus_ct_us = INA226_DEFAULT_CT_US,
+		.vshunt_ct_us = INA226_DEFAULT_CT_US,
+		.continuous = 1,
+		.alert = INA226_ALERT_OVER_CURRENT,
+		.alert_limit = INA226_DEFAULT_OC_LIMIT_MA,
+	},
+};
+
+static int ina226_index(const uint16_t *tab, uint16_t val)
 {
-	uint16_t default_cfg = SWAP16(0x4527);
-	uint16_t calibration_value = SWAP16(2048);
-	int ret = 0;
+	for (int i = 0; i < 8; i++)
+		if (tab[i] == val)
+			return i;
+	return -1;
+}
 
-	ret = hf_i2c_reg_write_block(&hi2c3, INA226_12V_ADDR, INA2XX_CONFIG, (uint8_t *)&default_cfg, 2);
-	if (ret)
-	{
-		printf("init ina226 error1\n");
+/* the register values of a configuration, -1 if it is not supported */
+static int ina226_encode(const struct ina226_cfg *cfg, uint16_t *config, uint16_t *mask, uint16_t *limit)
+{
+	static const uint16_t funcs[] = {
+		[INA226_ALERT_NONE] = 0,
+		[INA226_ALERT_OVER_CURRENT] = INA226_MASK_SOL,
+		[INA226_ALERT_OVER_VOLTAGE] = INA226_MASK_BOL,
+		[INA226_ALERT_UNDER_VOLTAGE] = INA226_MASK_BUL,
+		[INA226_ALERT_OVER_POWER] = INA226_MASK_POL,
+	};
+	int avg = ina226_index(ina226_avgs, cfg->avg);
+	int vbus = ina226_index(ina226_cts, cfg->vbus_ct_us);
+	int vshunt = ina226_index(ina226_cts, cfg->vshunt_ct_us);
+	uint32_t val;
+
+	if (avg < 0 || vbus < 0 || vshunt < 0 || cfg->alert >= INA226_ALERT_MAX)
 		return -1;
+
+	*config = INA226_CONFIG_FIXED | avg << 9 | vbus << 6 | vshunt << 3 |
+		  (cfg->continuous ? INA226_MODE_CONTINUOUS : INA226_MODE_TRIGGERED);
+	*mask = funcs[cfg->alert] | (cfg->alert_cnvr ? INA226_MASK_CNVR : 0) | INA226_MASK_LEN;
+	switch (cfg->alert) {
+	case INA226_ALERT_OVER_CURRENT:
+		/* shunt voltage, 2.5 uV per bit */
+		val = (uint64_t)cfg->alert_limit * INA226_SHUNT_RESISTOR / 2500;
+		break;
+	case INA226_ALERT_OVER_VOLTAGE:
+	case INA226_ALERT_UNDER_VOLTAGE:
+		val = cfg->alert_limit * 1000 / INA226_BUS_LSB;
+		break;
+	case INA226_ALERT_OVER_POWER:
+		val = (uint64_t)cfg->alert_limit * 1000 / (INA226_CURRENT_LSB * INA226_POWER_LSB_FACTOR);
+		break;
+	default:
+		val = 0;
+		break;
 	}
-	ret = hf_i2c_reg_write_block(&hi2c3, INA226_12V_ADDR, INA2XX_CALIBRATION, (uint8_t *)&calibration_value, 2);
-	if (ret)
-	{
-		printf("init ina226 error2\n");
+	if (val > 0x7fff)
 		return -1;
-	}
+	*limit = val;
+	return 0;
+}
+
+static int ina226_write_reg(uint8_t reg, uint16_t val)
+{
+	uint16_t be = SWAP16(val);
 
+	return hf_i2c_reg_write_block(&hi2c3, INA226_12V_ADDR, reg, (uint8_t *)&be, 2);
+}
+
+/* called by the sampler, or by a setter with the sampler's reads queued behind */
+static int ina226_apply(void)
+{
+	if (ina226_write_reg(INA2XX_CONFIG, ina226.config) ||
+	    ina226_write_reg(INA2XX_CALIBRATION, INA226_CALIBRATION) ||
+	    ina226_write_reg(INA226_ALERT_LIMIT, ina226.limit) ||
+	    ina226_write_reg(INA226_MASK_ENABLE, ina226.mask)) {
+		printf("init ina226 error\n");
+		ina226.configured = 0;
+		return -1;
+	}
+	ina226.configured = 1;
+	ina226.primed = 0;
+	ina226.stats.configs++;
 	return 0;
 }
 
+/**
+ * @brief  Change the INA226 configuration, written to the part at once.
+ * @param  cfg the new configuration
+ * @retval 0 on success, -1 if unsupported or the write failed
+ */
+int ina226_set_cfg(const struct ina226_cfg *cfg)
+{
+	uint16_t config, mask, limit;
+
+	if (ina226_encode(cfg, &config, &mask, &limit))
+		return -1;
+	taskENTER_CRITICAL();
+	ina226.cfg = *cfg;
+	ina226.config = config;
+	ina226.mask = mask;
+	ina226.limit = limit;
+	ina226.configured = 0;
+	taskEXIT_CRITICAL();
+	return ina226_apply();
+}
+
+void ina226_get_cfg(struct ina226_cfg *cfg)
+{
+	taskENTER_CRITICAL();
+	*cfg = ina226.cfg;
+	taskEXIT_CRITICAL();
+}
+
+void ina226_get_stats(struct ina226_stats *stats)
+{
+	taskENTER_CRITICAL();
+	*stats = ina226.stats;
+	taskEXIT_CRITICAL();
+}
+
+/* time between two results */
+uint32_t ina226_conv_time_us(const struct ina226_cfg *cfg)
+{
+	return (cfg->vbus_ct_us + cfg->vshunt_ct_us) * cfg->avg;
+}
+
+/*
+ * The mask/enable register and the results in one burst. Reading mask/enable
+ * clears the conversion ready and latched alert flags, its enable bits tell a
+ * power cycled part (they come back cleared), and the results follow without
+ * a wakeup between them, well within one conversion time.
+ */
 int get_board_power(uint32_t *volt, uint32_t *curr, uint32_t *power)
 {
-	uint32_t reg_bus = 0x0;
-	uint32_t reg_power = 0x0;
-	uint32_t reg_curr = 0x0;
-	int ret = 0;
-	static int is_first = 1;
+	static const uint8_t addrs[] = {
+		INA226_MASK_ENABLE, INA2XX_BUS_VOLTAGE, INA2XX_CURRENT, INA2XX_POWER,
+	};
+	uint16_t regs[4] = { 0 };
+	struct hf_i2c_req reqs[4];
+	uint32_t reg_bus, reg_curr, reg_power;
+	uint16_t mask;
 
-	if (1 == is_first)
-	{
-		/*Write failure, not find wrong reason*/
-		ret = ina226_init();
-		if (ret)
-		{
+	if (!ina226.configured) {
+		if (!ina226.config)
+			ina226_encode(&ina226.cfg, &ina226.config, &ina226.mask, &ina226.limit);
+		if (ina226_apply())
 			return -1;
-		}
-		is_first = 0;
 	}
-	ret = hf_i2c_reg_read_block(&hi2c3, INA226_12V_ADDR, INA2XX_BUS_VOLTAGE, (uint8_t *)&reg_bus, 2);
-	if (ret)
-	{
-		printf("get board volt error\n");
-		return -1;
+
+	for (int i = 0; i < 4; i++) {
+		reqs[i] = (struct hf_i2c_req) {
+			.addr = INA226_12V_ADDR,
+			.reg = addrs[i],
+			.buf = (uint8_t *)&regs[i],
+			.len = 2,
+		};
 	}
-	ret = hf_i2c_reg_read_block(&hi2c3, INA226_12V_ADDR, INA2XX_POWER, (uint8_t *)&reg_power, 2);
-	if (ret)
-	{
+	if (hf_i2c_xfer_burst(&hi2c3, reqs, 4)) {
 		printf("get board power error\n");
+		ina226.stats.errors++;
 		return -1;
 	}
-	ret = hf_i2c_reg_read_block(&hi2c3, INA226_12V_ADDR, INA2XX_CURRENT, (uint8_t *)&reg_curr, 2);
-	if (ret)
-	{
-		printf("get board current error\n");
+	ina226.stats.reads++;
+
+	mask = SWAP16(regs[0]);
+	if ((mask & INA226_MASK_ENABLES) != (ina226.mask & INA226_MASK_ENABLES)) {
+		/* lost its configuration, the results are from the reset settings */
+		ina226.stats.resets++;
+		ina226.configured = 0;
 		return -1;
 	}
-	reg_bus = SWAP16(reg_bus);
-	reg_curr = SWAP16(reg_curr);
-	reg_power = SWAP16(reg_power);
+	if (mask & INA226_MASK_CVRF) {
+		ina226.primed = 1;
+		ina226.stats.fresh++;
+	}
+	if (mask & INA226_MASK_AFF) {
+		ina226.stats.alerts++;
+		ina226.stats.alert_tick = xTaskGetTickCount();
+	}
+	if (mask & INA226_MASK_OVF)
+		ina226.stats.overflows++;
+	/* a triggered conversion is started for the next read */
+	if (!ina226.cfg.continuous)
+		ina226_write_reg(INA2XX_CONFIG, ina226.config);
+	/* the registers hold nothing of the new configuration yet */
+	if (!ina226.primed)
+		return -1;
+
+	reg_bus = SWAP16(regs[1]);
+	reg_curr = SWAP16(regs[2]);
+	reg_power = SWAP16(regs[3]);
 
 	*volt = reg_bus * INA226_BUS_LSB;
 	*volt = DIV_ROUND_CLOSEST(*volt, 1000);
@@ -305,95 +1240,241 @@ int get_board_power(uint32_t *volt, uint32_t *curr, uint32_t *power)
 	return 0;
 }
 
-int get_som_power(uint32_t *volt, uint32_t *curr, uint32_t *power)
-{
-	uint32_t reg_bus = 0x0;
-	uint32_t reg_power = 0x0;
-	uint32_t reg_curr = 0x0;
-	int ret = 0;
-	static int is_first = 1;
-	uint8_t act_val = 0;
-	uint8_t is_neg = 0;
-	uint8_t ctrl_value = 0x8;
+/*
+ * PAC1934: the four channels are sampled 1024 times a second into 48 bit power
+ * accumulators, with a 24 bit sample count. REFRESH_V latches the count, the
+ * accumulators and the last readings without clearing the accumulators, the
+ * latched values are readable 1 ms later. Every read takes the values latched
+ * by the refresh issued at the end of the read before, so it never waits for
+ * the latch, and adds the accumulator deltas to 64 bit counters: the energy of
+ * every channel is exact whatever the read rate, and the power returned is the
+ * mean since the previous read, not one sample.
+ */
+static struct {
+	uint8_t configured;
+	uint8_t primed;			// a refresh is latched, waiting to be read
+	uint8_t bad_reads;		// in a row
+	TickType_t latch_tick;		// of that refresh
+	TickType_t base_tick;		// of the refresh the baseline was read from
+	uint32_t count;			// baseline, 24 bit sample count
+	uint64_t acc[PAC1934_CHANNELS];	// baseline, 48 bit accumulators
+	struct pac1934_channel ch[PAC1934_CHANNELS];
+	struct pac1934_energy energy;
+} pac1934;
 
-	taskENTER_CRITICAL();
-	if (1 == is_first)
-	{
-		/*Write failure, not find wrong reason*/
-		hf_i2c_reg_write(&hi2c3, PAC1934_ADDR, PAC193X_CMD_CTRL, &ctrl_value);
+static int pac1934_config(void)
+{
+	uint8_t ctrl = PAC193X_CTRL;
+	uint8_t channel_dis = PAC193X_CHANNEL_NO_SKIP;
+	uint8_t neg_pwr = 0;
 
-		if (ret)
-		{
-			ret = -1;
-			goto out;
-		}
-		is_first = 0;
+	/* the settings are taken at the refresh, which also clears the accumulators */
+	if (hf_i2c_reg_write(&hi2c3, PAC1934_ADDR, PAC193X_CMD_CTRL, &ctrl) ||
+	    hf_i2c_reg_write(&hi2c3, PAC1934_ADDR, PAC193X_CMD_CHANNEL_DIS, &channel_dis) ||
+	    hf_i2c_reg_write(&hi2c3, PAC1934_ADDR, PAC193X_CMD_NEG_PWR, &neg_pwr) ||
+	    hf_i2c_reg_write_block(&hi2c3, PAC1934_ADDR, PAC193X_CMD_REFRESH, NULL, 0)) {
+		printf("init pac1934 error\n");
+		return -1;
 	}
+	pac1934.configured = 1;
+	pac1934.primed = 0;
+	pac1934.count = 0;
+	memset(pac1934.acc, 0, sizeof(pac1934.acc));
+	pac1934.base_tick = xTaskGetTickCount();
+	pac1934.latch_tick = pac1934.base_tick;
+	return 0;
+}
 
-	hf_i2c_reg_write_block(&hi2c3, PAC1934_ADDR, PAC193X_CMD_REFRESH_V, (uint8_t *)&ctrl_value, 0);
-	osDelay(1);
-	ret = hf_i2c_reg_read(&hi2c3, PAC1934_ADDR, PAC193X_CMD_NEG_PWR_ACT, &act_val);
-	if (ret)
-	{
-		printf("get PAC1934 act_val error\n");
-		ret = -1;
-		goto out;
+static uint32_t pac1934_get_be(const uint8_t *buf, int len)
+{
+	uint32_t val = 0;
+
+	while (len--)
+		val = val << 8 | *buf++;
+	return val;
+}
+
+/* mean power of a span of accumulator in uW */
+static uint32_t pac1934_acc_power_uw(uint64_t acc, uint64_t samples)
+{
+	const uint64_t c = PAC193X_COSTANT_PWR_M / PAC193X_SHUNT_RESISTOR_M;
+
+	if (!samples)
+		return 0;
+	/* an accumulated sample is 28 bits, full scale 3.2 V^2 / Rsense */
+	return (acc / samples * c + acc % samples * c / samples) >> 28;
+}
+
+/*
+ * The latched values into the counters. A read that does not add up, a count
+ * off the time since the baseline or more power than full scale, is taken for
+ * a corrupted one and skipped, the baseline stays: -1. A few in a row, or a
+ * span long enough for the count to wrap, and the part is taken for reset or
+ * lost track of: -2, the span since the baseline is left out.
+ */
+static int pac1934_parse(const uint8_t *buf)
+{
+	uint32_t count = pac1934_get_be(buf, 3);
+	uint32_t span = pac1934.latch_tick - pac1934.base_tick;
+	uint32_t samples = (count - pac1934.count) & 0xffffff;
+	uint32_t expect = (uint64_t)span * portTICK_PERIOD_MS * PAC1934_SPS / 1000;
+	uint32_t slack = expect / 8 + PAC1934_SPS / 64;
+	const uint8_t *p = buf + 3;
+	uint64_t acc[PAC1934_CHANNELS], delta[PAC1934_CHANNELS];
+	uint32_t vbus, vsense;
+	int bad = samples + slack < expect || samples > expect + slack;
+
+	for (int i = 0; i < PAC1934_CHANNELS; i++, p += 6) {
+		acc[i] = (uint64_t)pac1934_get_be(p, 2) << 32 | pac1934_get_be(p + 2, 4);
+		delta[i] = (acc[i] - pac1934.acc[i]) & 0xffffffffffffull;
+		if (delta[i] > (uint64_t)samples << 28)
+			bad = 1;
 	}
-	ret = hf_i2c_reg_read_block(&hi2c3, PAC1934_ADDR, PAC193X_CMD_VBUS1, (uint8_t *)&reg_bus, 2);
-	if (ret)
-	{
-		printf("get PAC1934 voltage error\n");
-		ret = -1;
-		goto out;
+	if (span * portTICK_PERIOD_MS > PAC193X_MAX_SPAN_MS ||
+	    (bad && ++pac1934.bad_reads >= PAC193X_BAD_READS)) {
+		pac1934.bad_reads = 0;
+		pac1934.energy.resyncs++;
+		return -2;
 	}
-	reg_bus = reg_bus & 0XFFFF;
-	reg_bus = SWAP16(reg_bus);
-	if (0x1 == ((act_val >> 3) & 0x1))
-	{
-		*volt = reg_bus * 1000 / 1024;
-		is_neg = 1;
+	if (bad)
+		return -1;
+	pac1934.bad_reads = 0;
+	pac1934.count = count;
+	memcpy(pac1934.acc, acc, sizeof(acc));
+	pac1934.base_tick = pac1934.latch_tick;
+
+	taskENTER_CRITICAL();
+	for (int i = 0; i < PAC1934_CHANNELS; i++) {
+		vbus = pac1934_get_be(p + 2 * i, 2);
+		vsense = pac1934_get_be(p + 2 * PAC1934_CHANNELS + 2 * i, 2);
+		pac1934.ch[i].volt = vbus * 1000 / 2048;
+		pac1934.ch[i].curr = vsense * PAC193X_COSTANT_CURRENT_M / (65536 * PAC193X_SHUNT_RESISTOR_M);
+		pac1934.ch[i].power = pac1934_acc_power_uw(delta[i], samples);
+		pac1934.energy.acc[i] += delta[i];
 	}
-	else
-	{
-		*volt = reg_bus * 1000 / 2048;
+	pac1934.energy.samples += samples;
+	pac1934.energy.tick = pac1934.latch_tick;
+	taskEXIT_CRITICAL();
+	return 0;
+}
+
+/**
+ * @brief  Read the PAC1934 channels and accumulators, and latch the next read.
+ *         Called by the power sampler, not meant for concurrent callers.
+ * @retval 0 on new readings, -1 on an error or while a first refresh is latched
+ */
+int pac1934_update(void)
+{
+	uint8_t buf[PAC193X_BLOCK_LEN];
+	struct hf_i2c_req reqs[2] = {
+		{ .addr = PAC1934_ADDR, .reg = PAC193X_CMD_ACC_COUNT, .buf = buf, .len = sizeof(buf) },
+		{ .addr = PAC1934_ADDR, .reg = PAC193X_CMD_REFRESH_V, .write = 1 },
+	};
+	TickType_t since;
+	int ret;
+
+	if (!pac1934.configured && pac1934_config()) {
+		pac1934.energy.errors++;
+		return -1;
 	}
-	ret = hf_i2c_reg_read_block(&hi2c3, PAC1934_ADDR, PAC193X_CMD_VSENSE1, (uint8_t *)&reg_curr, 2);
-	reg_curr = SWAP16(reg_curr);
-	if (ret)
-	{
-		printf("get PAC1934 current error\n");
-		ret = -1;
-		goto out;
+	/* the latch needs 1 ms, only a read right after the last one waits */
+	since = xTaskGetTickCount() - pac1934.latch_tick;
+	if (since < pdMS_TO_TICKS(PAC193X_LATCH_MS))
+		vTaskDelay(pdMS_TO_TICKS(PAC193X_LATCH_MS) - since);
+
+	if (!pac1934.primed) {
+		if (hf_i2c_reg_write_block(&hi2c3, PAC1934_ADDR, PAC193X_CMD_REFRESH_V, NULL, 0)) {
+			pac1934.energy.errors++;
+			return -1;
+		}
+		pac1934.latch_tick = xTaskGetTickCount();
+		pac1934.primed = 1;
+		return -1;
 	}
-	reg_curr = reg_curr & 0XFFFF;
-	if (0x1 == ((act_val >> 7) & 0x1))
-	{
-		*curr = reg_curr * PAC193X_COSTANT_CURRENT_M / (32768 * PAC193X_SHUNT_RESISTOR_M);
-		is_neg = 1;
+
+	ret = hf_i2c_xfer_burst(&hi2c3, reqs, 2);
+	if (ret) {
+		printf("get pac1934 error %d\n", ret);
+		pac1934.energy.errors++;
+		/* the baseline stays, the next good read covers the span */
+		pac1934.primed = 0;
+		return -1;
 	}
-	else
-	{
-		*curr = reg_curr * PAC193X_COSTANT_CURRENT_M / (65536 * PAC193X_SHUNT_RESISTOR_M);
+	ret = pac1934_parse(buf);
+	if (-2 == ret) {
+		/* start over from a clearing refresh, a reset part lost our settings */
+		pac1934.configured = 0;
+		return -1;
 	}
-	ret = hf_i2c_reg_read_block(&hi2c3, PAC1934_ADDR, PAC193X_CMD_VPOWER1, (uint8_t *)&reg_power, 4);
-	reg_power = SWAP32(reg_power);
+	pac1934.latch_tick = xTaskGetTickCount();
 	if (ret)
-	{
-		printf("get PAC1934 power error\n");
-		ret = -1;
-		goto out;
-	}
-	reg_power = reg_power >> 4;
-	if (1 == is_neg)
-	{
-		*power = reg_power * PAC193X_COSTANT_PWR_M / (PAC193X_SHUNT_RESISTOR_M * 134217728ULL);
-	}
-	else
-	{
-		*power = reg_power * PAC193X_COSTANT_PWR_M / (PAC193X_SHUNT_RESISTOR_M * 268435456ULL);
-	}
+		pac1934.energy.errors++;
+	return ret;
+}
 
-out:
+/**
+ * @brief  Get the last readings of a channel.
+ * @param  ch 0 to PAC1934_CHANNELS - 1, channel 1 of the part is 0
+ * @param  c filled in
+ * @retval 0 on success, -1 on a bad channel
+ */
+int pac1934_get_channel(int ch, struct pac1934_channel *c)
+{
+	if (ch < 0 || ch >= PAC1934_CHANNELS)
+		return -1;
+	taskENTER_CRITICAL();
+	*c = pac1934.ch[ch];
 	taskEXIT_CRITICAL();
-	return ret;
+	return 0;
+}
+
+void pac1934_get_energy(struct pac1934_energy *energy)
+{
+	taskENTER_CRITICAL();
+	*energy = pac1934.energy;
+	taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief  Energy of a channel since boot.
+ * @param  energy counters from pac1934_get_energy()
+ * @param  ch 0 to PAC1934_CHANNELS - 1
+ * @retval uWh
+ */
+uint64_t pac1934_energy_uwh(const struct pac1934_energy *energy, int ch)
+{
+	const uint64_t c = PAC193X_COSTANT_PWR_M / PAC193X_SHUNT_RESISTOR_M;
+	const uint64_t per_uj = (1ull << 28) * PAC1934_SPS;
+	uint64_t acc = energy->acc[ch];
+	uint64_t uj;
+
+	/* c * acc does not fit, the remainder is taken with 10 bits less */
+	uj = acc / per_uj * c + (acc % per_uj >> 10) * c / (per_uj >> 10);
+	return uj / 3600;
+}
+
+/**
+ * @brief  Mean power of a channel between two reads of the counters, taken
+ *         any time apart.
+ * @param  from the earlier counters
+ * @param  to the later counters
+ * @param  ch 0 to PAC1934_CHANNELS - 1
+ * @retval uW, 0 if no sample was accumulated in between
+ */
+uint32_t pac1934_avg_power_uw(const struct pac1934_energy *from, const struct pac1934_energy *to, int ch)
+{
+	return pac1934_acc_power_uw(to->acc[ch] - from->acc[ch], to->samples - from->samples);
+}
+
+int get_som_power(uint32_t *volt, uint32_t *curr, uint32_t *power)
+{
+	struct pac1934_channel c;
+
+	if (pac1934_update())
+		return -1;
+	pac1934_get_channel(PAC1934_SOM_CHANNEL, &c);
+	*volt = c.volt;
+	*curr = c.curr;
+	*power = c.power;
+	return 0;
 }
@@ -12,6 +12,7 @@
 
 #include "cmsis_os.h"
 #include "hf_common.h"
+#include "hf_som_link.h"
 #include "main.h"
 #include "stm32f4xx_hal_iwdg.h"
 #include "FreeRTOS.h"
@@ -83,45 +84,38 @@ void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
 extern DMA_HandleTypeDef hdma_usart3_rx;
 extern DMA_HandleTypeDef hdma_uart4_rx;
 
-#include "protocol_lib/protocol.h"
-#include "protocol_lib/ringbuffer.h"
 #include "stm32f4xx_hal_dma.h"
-extern uint32_t RxBuf_SIZE;
-extern uint8_t RxBuf[96];
-extern b_frame_class_t frame_uart3;
 void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size)
 {
 	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
 
 	if (huart->Instance == USART3) {
-		// printf("uart3_rx Size %d\n", Size);
-		es_frame_put(&frame_uart3, RxBuf, Size);
-		memset(RxBuf, 0, sizeof(RxBuf) / sizeof(uint8_t));
-		HAL_UARTEx_ReceiveToIdle_IT(&huart3, RxBuf, RxBuf_SIZE);
-		// HAL_UARTEx_ReceiveToIdle_DMA(&huart3, RxBuf, RxBuf_SIZE);
+		// circular dma: half/full transfer and idle line events, Size is the write position
+		uart3_rx_event_from_isr(Size, &xHigherPriorityTaskWoken);
+		portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
 	} else if (huart->Instance == UART4) {
-		//printf("[%s %d]: Size %d sizeof(UART4_RxMsg) %d\n", __func__, __LINE__, Size, sizeof(UART4_RxMsg));
-		if (HAL_UART_RXEVENT_TC == huart->RxEventType) {
-			if (xQueueSendFromISR(xUart4MsgQueue,
-				(void *)&UART4_RxMsg, &xHigherPriorityTaskWoken) != pdPASS) {
-				// The queue was full - handle this appropriately.
-				// This could involve waiting for space to become available
-				// or simply dropping the data if it is not critical.
-				printf("[%s %d]: xUart4MsgQueue is full, drop the msg!\n", __func__, __LINE__);
-			}
-			memset(&UART4_RxMsg, 0, sizeof(UART4_RxMsg) / sizeof(uint8_t));
-			HAL_UARTEx_ReceiveToIdle_DMA(&huart4, (uint8_t *)&UART4_RxMsg, sizeof(UART4_RxMsg));
-			// If xHigherPriorityTaskWoken was set to true, there may be a higher priority task that can run now.
-			if (xHigherPriorityTaskWoken) {
-				// Force a context switch if xHigherPriorityTaskWoken is now set to pdTRUE.
-				portYIELD_FROM_ISR( xHigherPriorityTaskWoken);
-			}
-		}
+		// circular dma: half/full transfer and idle line events, Size is the write position
+		uart4_rx_event_from_isr(Size, &xHigherPriorityTaskWoken);
+		portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
 	} else if (huart->Instance == USART6) {
 		printf("%s UART6\n", __func__);
 	}
 }
 
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+	if (huart->Instance == USART3) {
+		uart3_rx_error_from_isr();
+		if (HAL_UART_STATE_READY == huart->RxState)
+			uart3_rx_start();
+	} else if (huart->Instance == UART4) {
+		som_link_count_from_isr(LINK_CNT_RX_LINE_ERR);
+		// an overrun aborts the dma reception, restart it
+		if (HAL_UART_STATE_READY == huart->RxState)
+			uart4_rx_start();
+	}
+}
+
 /**
   * @brief  Input Capture callback in non-blocking mode
   * @param  htim TIM IC handle
@@ -0,0 +1,275 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Power and thermal history: 1 s samples delta/varint encoded into a ring of
+ * blocks in the CCM RAM, read back by time range in bulk.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "main.h"
+#include "hf_power_history.h"
+
+#define HIST_MASK_GAP	(1u << POWER_HIST_FIELDS)	// a time step other than 1 s follows
+/* mask, gap and every field at their longest */
+#define HIST_REC_MAX	(2 + 5 + POWER_HIST_FIELDS * 5)
+
+struct power_hist_block {
+	uint32_t seq;		// of the block, changes when it is reused
+	uint32_t time;		// of the first sample
+	uint32_t last;		// of the last sample
+	uint16_t len;		// bytes of data in use
+	uint16_t count;		// samples
+	uint8_t data[POWER_HIST_BLOCK_SIZE - 16];
+};
+
+#ifdef CCMDATARAM_BASE
+/* the CCM is not in the linker script, the ring is its only user */
+static struct power_hist_block *const blocks = (struct power_hist_block *)CCMDATARAM_BASE;
+#else
+static struct power_hist_block blocks[POWER_HIST_BLOCKS];
+#endif
+
+/*
+ * Bounds of the ring and the writer state, in zeroed RAM: blocks first to
+ * next are in use, next is filled, nothing is until next is set. Only the
+ * sampler task writes. A block is appended to or reset under a critical
+ * section, readers decode it without one and drop what they decoded if its
+ * seq changed meanwhile.
+ */
+static struct {
+	uint32_t first;
+	uint32_t next;
+	int32_t prev[POWER_HIST_FIELDS];	// last sample added
+	uint32_t bytes;
+	uint32_t samples;
+	uint32_t dropped;
+} ph;
+
+const char *const power_hist_names[POWER_HIST_FIELDS] = {
+	"board_mw", "board_mv", "board_ma", "som_mw", "som_mv", "som_ma",
+	"cpu_temp_dc", "npu_temp_dc", "fan_rpm",
+};
+
+static int hist_put_varint(uint8_t *p, uint32_t val)
+{
+	int n = 0;
+
+	while (val >= 0x80) {
+		p[n++] = val | 0x80;
+		val >>= 7;
+	}
+	p[n++] = val;
+	return n;
+}
+
+/* bytes used, 0 if the data ends first */
+static int hist_get_varint(const uint8_t *p, int len, uint32_t *val)
+{
+	*val = 0;
+	for (int n = 0; n < len && n < 5; n++) {
+		*val |= (uint32_t)(p[n] & 0x7f) << (7 * n);
+		if (!(p[n] & 0x80))
+			return n + 1;
+	}
+	return 0;
+}
+
+static uint32_t hist_zigzag(int32_t val)
+{
+	return ((uint32_t)val << 1) ^ (uint32_t)(val >> 31);
+}
+
+static int32_t hist_unzigzag(uint32_t val)
+{
+	return (int32_t)(val >> 1) ^ -(int32_t)(val & 1);
+}
+
+static int power_hist_encode(uint8_t *p, const struct power_hist_sample *sample,
+			     const int32_t *prev, uint32_t step)
+{
+	uint32_t mask = step != 1 ? HIST_MASK_GAP : 0;
+	int n;
+
+	for (int i = 0; i < POWER_HIST_FIELDS; i++)
+		if (sample->val[i] != prev[i])
+			mask |= 1u << i;
+	n = hist_put_varint(p, mask);
+	if (mask & HIST_MASK_GAP)
+		n += hist_put_varint(p + n, step);
+	for (int i = 0; i < POWER_HIST_FIELDS; i++)
+		if (mask & (1u << i))
+			n += hist_put_varint(p + n, hist_zigzag((uint32_t)sample->val[i] - (uint32_t)prev[i]));
+	return n;
+}
+
+/* start the next block, the oldest one is dropped when the ring is full */
+static struct power_hist_block *power_hist_next_block(void)
+{
+	struct power_hist_block *b;
+
+	taskENTER_CRITICAL();
+	ph.next++;
+	if (ph.next - ph.first >= POWER_HIST_BLOCKS) {
+		b = &blocks[ph.first % POWER_HIST_BLOCKS];
+		ph.bytes -= b->len;
+		ph.samples -= b->count;
+		ph.first++;
+		ph.dropped++;
+	}
+	b = &blocks[ph.next % POWER_HIST_BLOCKS];
+	b->seq = ph.next;
+	b->time = 0;
+	b->last = 0;
+	b->len = 0;
+	b->count = 0;
+	taskEXIT_CRITICAL();
+	return b;
+}
+
+void power_hist_init(void)
+{
+#ifdef __HAL_RCC_CCMDATARAMEN_CLK_ENABLE
+	__HAL_RCC_CCMDATARAMEN_CLK_ENABLE();
+#endif
+	memset(&ph, 0, sizeof(ph));
+	memset(blocks, 0, POWER_HIST_BLOCKS * sizeof(blocks[0]));
+	ph.first = 1;
+}
+
+/**
+ * @brief  Append a sample, by the sampler task once a second.
+ * @param  sample time must be past the last sample, POWER_HIST_NONE for a
+ *         missing value
+ */
+void power_hist_add(const struct power_hist_sample *sample)
+{
+	static const int32_t zero[POWER_HIST_FIELDS];
+	uint8_t rec[HIST_REC_MAX];
+	struct power_hist_block *b;
+	int n;
+
+	b = ph.next ? &blocks[ph.next % POWER_HIST_BLOCKS] : power_hist_next_block();
+	if (b->count && sample->time <= b->last)
+		return;
+	if (b->count)
+		n = power_hist_encode(rec, sample, ph.prev, sample->time - b->last);
+	if (!b->count || b->len + n > sizeof(b->data)) {
+		if (b->count)
+			b = power_hist_next_block();
+		/* the first sample of a block against zero, the time is in the block */
+		n = power_hist_encode(rec, sample, zero, 1);
+	}
+
+	taskENTER_CRITICAL();
+	memcpy(b->data + b->len, rec, n);
+	if (!b->count)
+		b->time = sample->time;
+	b->last = sample->time;
+	b->len += n;
+	b->count++;
+	ph.bytes += n;
+	ph.samples++;
+	taskEXIT_CRITICAL();
+	memcpy(ph.prev, sample->val, sizeof(ph.prev));
+}
+
+/* samples from to to of the first len bytes, count samples of a block */
+static int power_hist_decode(const struct power_hist_block *b, uint16_t len, uint16_t count,
+			     uint32_t from, uint32_t to, struct power_hist_sample *out, int max)
+{
+	int32_t val[POWER_HIST_FIELDS] = { 0 };
+	uint32_t t = b->time;
+	uint32_t mask, step, delta;
+	int pos = 0, n = 0, used;
+
+	for (int k = 0; k < count && n < max; k++) {
+		used = hist_get_varint(b->data + pos, len - pos, &mask);
+		if (!used)
+			break;
+		pos += used;
+		step = k ? 1 : 0;
+		if (mask & HIST_MASK_GAP) {
+			used = hist_get_varint(b->data + pos, len - pos, &step);
+			if (!used)
+				break;
+			pos += used;
+		}
+		t += step;
+		for (int i = 0; i < POWER_HIST_FIELDS; i++) {
+			if (!(mask & (1u << i)))
+				continue;
+			used = hist_get_varint(b->data + pos, len - pos, &delta);
+			if (!used)
+				return n;
+			pos += used;
+			val[i] = (uint32_t)val[i] + (uint32_t)hist_unzigzag(delta);
+		}
+		if (t > to)
+			break;
+		if (t < from)
+			continue;
+		out[n].time = t;
+		memcpy(out[n].val, val, sizeof(val));
+		n++;
+	}
+	return n;
+}
+
+/**
+ * @brief  Read the samples of a time range, oldest first.
+ * @param  from s since boot, the first sample at or after it
+ * @param  to s since boot, the last sample at or before it
+ * @param  out filled in
+ * @param  max samples out holds, read on from the time of the last one + 1
+ * @retval samples read
+ */
+int power_hist_read(uint32_t from, uint32_t to, struct power_hist_sample *out, int max)
+{
+	struct power_hist_block *b;
+	uint32_t first, next, seq;
+	uint16_t len, count;
+	int n = 0, got;
+
+	taskENTER_CRITICAL();
+	first = ph.first;
+	next = ph.next;
+	taskEXIT_CRITICAL();
+	if (!next)
+		return 0;
+
+	for (uint32_t s = first; s <= next && n < max; s++) {
+		b = &blocks[s % POWER_HIST_BLOCKS];
+		taskENTER_CRITICAL();
+		seq = b->seq;
+		len = b->len;
+		count = b->count;
+		taskEXIT_CRITICAL();
+		if (seq != s || !count || b->last < from)
+			continue;
+		if (b->time > to)
+			break;
+		got = power_hist_decode(b, len, count, from, to, out + n, max - n);
+		/* reused while it was decoded, its samples are gone */
+		if (__atomic_load_n(&b->seq, __ATOMIC_ACQUIRE) != s)
+			continue;
+		n += got;
+	}
+	return n;
+}
+
+void power_hist_get_stats(struct power_hist_stats *stats)
+{
+	taskENTER_CRITICAL();
+	stats->samples = ph.samples;
+	stats->bytes = ph.bytes;
+	stats->dropped = ph.dropped;
+	stats->blocks = ph.next ? ph.next - ph.first + 1 : 0;
+	stats->oldest = ph.next ? blocks[ph.first % POWER_HIST_BLOCKS].time : 0;
+	stats->newest = ph.next ? blocks[ph.next % POWER_HIST_BLOCKS].last : 0;
+	taskEXIT_CRITICAL();
+}
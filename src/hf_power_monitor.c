@@ -0,0 +1,376 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Power sampler: the board and SOM rails read at a fixed rate, with rolling
+ * min, max and mean windows served to the readers from a snapshot.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "main.h"
+#include "hf_common.h"
+#include "hf_power_process.h"
+#include "hf_power_monitor.h"
+#include "hf_power_history.h"
+#include "hf_som_telemetry.h"
+#include "hf_alarm.h"
+
+#define SECOND_SLOTS	10	// 1 s buckets, the 10 s window
+#define TEN_SLOTS	6	// 10 s buckets, the 60 s window
+
+/* a reading older than this is not handed out as the current value */
+#define POWER_MON_MAX_AGE_MS	(10 * POWER_MON_PERIOD_MS)
+
+struct power_acc {
+	uint32_t n;
+	uint32_t min[POWER_VALUE_MAX];
+	uint32_t max[POWER_VALUE_MAX];
+	uint64_t sum[POWER_VALUE_MAX];
+};
+
+/* everything below is only touched by the sampler task */
+static struct {
+	struct power_acc cur[POWER_RAIL_MAX];			// the second in progress
+	struct power_acc sec[POWER_RAIL_MAX][SECOND_SLOTS];	// the last complete seconds
+	struct power_acc ten[POWER_RAIL_MAX][TEN_SLOTS];	// the last complete 10 s spans
+	uint8_t sec_idx;					// next slot of sec
+	uint8_t ten_idx;					// next slot of ten
+	TickType_t sec_start;
+	uint64_t total_us;
+	TaskHandle_t task;
+	TickType_t boot_tick;	// time 0 of the history
+} pm;
+
+/*
+ * Snapshot for the readers, published after every round with the same seqlock
+ * latch as the config in hf_common.c: the sampler rewrites one copy while the
+ * readers use the other, a reader only copies again if a publish ran meanwhile.
+ */
+struct power_mon_rail {
+	TickType_t tick;	// of the last sample
+	uint8_t valid;		// sampled at least once
+	struct power_rail_stats stats;
+};
+
+struct power_mon_snap {
+	struct power_mon_rail rail[POWER_RAIL_MAX];
+	struct power_mon_cost cost;
+};
+
+static struct power_mon_snap snap;	// the sampler's working copy
+
+static struct {
+	uint32_t seq;
+	struct power_mon_snap copy[2];
+} pm_pub;
+
+static void power_mon_publish(void)
+{
+	for (int i = 0; i < 2; i++) {
+		__atomic_store_n(&pm_pub.seq, pm_pub.seq + 1, __ATOMIC_RELEASE);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		pm_pub.copy[i] = snap;
+	}
+}
+
+/* copy len bytes at offset of the snapshot, never blocks */
+static void power_mon_read(size_t offset, void *buf, size_t len)
+{
+	uint32_t seq;
+
+	do {
+		seq = __atomic_load_n(&pm_pub.seq, __ATOMIC_ACQUIRE);
+		memcpy(buf, (uint8_t *)&pm_pub.copy[seq & 1] + offset, len);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (seq != __atomic_load_n(&pm_pub.seq, __ATOMIC_RELAXED));
+}
+
+static void power_acc_add(struct power_acc *acc, const uint32_t *val)
+{
+	for (int i = 0; i < POWER_VALUE_MAX; i++) {
+		acc->min[i] = acc->n ? MIN(acc->min[i], val[i]) : val[i];
+		acc->max[i] = acc->n ? MAX(acc->max[i], val[i]) : val[i];
+		acc->sum[i] += val[i];
+	}
+	acc->n++;
+}
+
+static void power_acc_merge(struct power_acc *dst, const struct power_acc *src)
+{
+	if (!src->n)
+		return;
+	for (int i = 0; i < POWER_VALUE_MAX; i++) {
+		dst->min[i] = dst->n ? MIN(dst->min[i], src->min[i]) : src->min[i];
+		dst->max[i] = dst->n ? MAX(dst->max[i], src->max[i]) : src->max[i];
+		dst->sum[i] += src->sum[i];
+	}
+	dst->n += src->n;
+}
+
+static void power_acc_window(const struct power_acc *acc, struct power_window_stats *win)
+{
+	memset(win, 0, sizeof(*win));
+	win->samples = acc->n;
+	if (!acc->n)
+		return;
+	for (int i = 0; i < POWER_VALUE_MAX; i++) {
+		win->min[i] = acc->min[i];
+		win->max[i] = acc->max[i];
+		win->mean[i] = acc->sum[i] / acc->n;
+	}
+}
+
+/* close the second in progress and recompute the windows */
+static void power_mon_roll(void)
+{
+	struct power_acc acc;
+	int last = pm.sec_idx;
+
+	for (int r = 0; r < POWER_RAIL_MAX; r++) {
+		pm.sec[r][pm.sec_idx] = pm.cur[r];
+		memset(&pm.cur[r], 0, sizeof(pm.cur[r]));
+	}
+	pm.sec_idx = (pm.sec_idx + 1) % SECOND_SLOTS;
+
+	/* every tenth second the 1 s buckets make up one 10 s bucket */
+	if (!pm.sec_idx) {
+		for (int r = 0; r < POWER_RAIL_MAX; r++) {
+			memset(&acc, 0, sizeof(acc));
+			for (int i = 0; i < SECOND_SLOTS; i++)
+				power_acc_merge(&acc, &pm.sec[r][i]);
+			pm.ten[r][pm.ten_idx] = acc;
+		}
+		pm.ten_idx = (pm.ten_idx + 1) % TEN_SLOTS;
+	}
+
+	for (int r = 0; r < POWER_RAIL_MAX; r++) {
+		power_acc_window(&pm.sec[r][last], &snap.rail[r].stats.win[POWER_WIN_1S]);
+
+		memset(&acc, 0, sizeof(acc));
+		for (int i = 0; i < SECOND_SLOTS; i++)
+			power_acc_merge(&acc, &pm.sec[r][i]);
+		power_acc_window(&acc, &snap.rail[r].stats.win[POWER_WIN_10S]);
+
+		memset(&acc, 0, sizeof(acc));
+		for (int i = 0; i < TEN_SLOTS; i++)
+			power_acc_merge(&acc, &pm.ten[r][i]);
+		power_acc_window(&acc, &snap.rail[r].stats.win[POWER_WIN_60S]);
+	}
+}
+
+/* mA and mW alarm sensors of a rail */
+static const enum alarm_sensor rail_alarms[POWER_RAIL_MAX][2] = {
+	{ ALARM_BOARD_MA, ALARM_BOARD_MW },
+	{ ALARM_SOM_MA, ALARM_SOM_MW },
+};
+
+/*
+ * The second just closed into the history: 1 s means, the last SOM PVT. The
+ * PVT goes to the alarms from here, as do the rails that were not sampled.
+ */
+static void power_mon_history(void)
+{
+	static const int fields[POWER_RAIL_MAX] = { POWER_HIST_BOARD_MW, POWER_HIST_SOM_MW };
+	struct power_hist_sample sample;
+	struct power_window_stats *win;
+	struct fan_control_t fan = { 0 };
+	int32_t *val;
+	PVTInfo pvt;
+
+	sample.time = (pm.sec_start - pm.boot_tick) / pdMS_TO_TICKS(1000);
+	for (int r = 0; r < POWER_RAIL_MAX; r++) {
+		win = &snap.rail[r].stats.win[POWER_WIN_1S];
+		val = &sample.val[fields[r]];	// mW, mV, mA
+		val[0] = win->samples ? win->mean[POWER_POWER] / 1000 : POWER_HIST_NONE;
+		val[1] = win->samples ? win->mean[POWER_VOLT] : POWER_HIST_NONE;
+		val[2] = win->samples ? win->mean[POWER_CURR] : POWER_HIST_NONE;
+		if (!win->samples) {
+			alarm_feed(rail_alarms[r][0], ALARM_NONE);
+			alarm_feed(rail_alarms[r][1], ALARM_NONE);
+			if (POWER_RAIL_BOARD == r)
+				alarm_feed(ALARM_BOARD_ALERT, ALARM_NONE);
+		}
+	}
+	if (som_telemetry_peek_pvt(&pvt)) {
+		sample.val[POWER_HIST_CPU_TEMP] = POWER_HIST_NONE;
+		sample.val[POWER_HIST_NPU_TEMP] = POWER_HIST_NONE;
+		sample.val[POWER_HIST_FAN_RPM] = POWER_HIST_NONE;
+	} else {
+		sample.val[POWER_HIST_CPU_TEMP] = pvt.cpu_temp / 100;
+		sample.val[POWER_HIST_NPU_TEMP] = pvt.npu_temp / 100;
+		sample.val[POWER_HIST_FAN_RPM] = pvt.fan_speed;
+	}
+	power_hist_add(&sample);
+
+	/* a fan at 0 duty is not stalled */
+	es_get_fan_duty(&fan);
+	alarm_feed(ALARM_CPU_TEMP, sample.val[POWER_HIST_CPU_TEMP]);
+	alarm_feed(ALARM_NPU_TEMP, sample.val[POWER_HIST_NPU_TEMP]);
+	alarm_feed(ALARM_FAN_RPM, fan.duty ? sample.val[POWER_HIST_FAN_RPM] : ALARM_NONE);
+	alarm_tick();
+}
+
+/* the INA226 latches an over limit result between reads, the alarms hear of it */
+static void power_mon_alert(void)
+{
+	struct ina226_stats stats;
+
+	ina226_get_stats(&stats);
+	alarm_feed(ALARM_BOARD_ALERT, stats.alerts &&
+		   xTaskGetTickCount() - stats.alert_tick < pdMS_TO_TICKS(1000));
+}
+
+static void power_mon_add(enum power_rail rail, int ret, uint32_t volt, uint32_t curr, uint32_t power)
+{
+	struct power_mon_rail *r = &snap.rail[rail];
+
+	if (ret) {
+		r->stats.errors++;
+		return;
+	}
+	r->stats.last[POWER_VOLT] = volt;
+	r->stats.last[POWER_CURR] = curr;
+	r->stats.last[POWER_POWER] = power;
+	power_acc_add(&pm.cur[rail], r->stats.last);
+	r->tick = xTaskGetTickCount();
+	r->valid = 1;
+	alarm_feed(rail_alarms[rail][0], curr);
+	alarm_feed(rail_alarms[rail][1], power / 1000);
+	if (POWER_RAIL_BOARD == rail)
+		power_mon_alert();
+}
+
+/* one round over the rails, the time it takes is the sampling cost */
+static void power_mon_sample(void)
+{
+	struct power_mon_cost *cost = &snap.cost;
+	uint32_t volt, curr, power;
+	uint32_t cycles = DWT->CYCCNT;
+	uint32_t us;
+	int ret;
+
+	ret = get_board_power(&volt, &curr, &power);
+	power_mon_add(POWER_RAIL_BOARD, ret, volt, curr, power);
+	ret = get_som_power(&volt, &curr, &power);
+	power_mon_add(POWER_RAIL_SOM, ret, volt, curr, power);
+
+	us = (DWT->CYCCNT - cycles) / (SystemCoreClock / 1000000);
+	cost->rounds++;
+	cost->last_us = us;
+	cost->max_us = MAX(cost->max_us, us);
+	pm.total_us += us;
+	cost->avg_us = pm.total_us / cost->rounds;
+}
+
+/* an INA226 alert between two rounds, read the board rail right away */
+static void power_mon_early(void)
+{
+	uint32_t volt, curr, power;
+	int ret;
+
+	ret = get_board_power(&volt, &curr, &power);
+	power_mon_add(POWER_RAIL_BOARD, ret, volt, curr, power);
+	snap.cost.early++;
+}
+
+void hf_power_monitor_task(void *argument)
+{
+	TickType_t wake;
+	TickType_t now;
+
+	pm.task = xTaskGetCurrentTaskHandle();
+	pm.sec_start = xTaskGetTickCount();
+	pm.boot_tick = pm.sec_start % pdMS_TO_TICKS(1000);
+	power_hist_init();
+	wake = pm.sec_start + pdMS_TO_TICKS(POWER_MON_PERIOD_MS);
+	for (;;) {
+		now = xTaskGetTickCount();
+		if ((int32_t)(wake - now) > 0 && ulTaskNotifyTake(pdTRUE, wake - now)) {
+			if (SOM_POWER_ON == get_som_power_state())
+				power_mon_early();
+			power_mon_publish();
+			continue;
+		}
+		if (SOM_POWER_ON == get_som_power_state())
+			power_mon_sample();
+
+		/* a round that ran past the period is not made up for */
+		now = xTaskGetTickCount();
+		if (now - wake >= pdMS_TO_TICKS(POWER_MON_PERIOD_MS)) {
+			snap.cost.overruns++;
+			wake = now;
+		}
+		wake += pdMS_TO_TICKS(POWER_MON_PERIOD_MS);
+		while (xTaskGetTickCount() - pm.sec_start >= pdMS_TO_TICKS(1000)) {
+			pm.sec_start += pdMS_TO_TICKS(1000);
+			power_mon_roll();
+			power_mon_history();
+		}
+		power_mon_publish();
+	}
+}
+
+/**
+ * @brief  Get the last reading and the windows of a rail.
+ * @param  rail POWER_RAIL_*
+ * @param  stats filled in, age_ms is UINT32_MAX if the rail was never sampled
+ * @retval 0 on success, -1 on a bad rail
+ */
+int power_mon_get(enum power_rail rail, struct power_rail_stats *stats)
+{
+	struct power_mon_rail r;
+
+	if (rail >= POWER_RAIL_MAX)
+		return -1;
+
+	power_mon_read(offsetof(struct power_mon_snap, rail[rail]), &r, sizeof(r));
+	*stats = r.stats;
+	stats->age_ms = r.valid ? (xTaskGetTickCount() - r.tick) * portTICK_PERIOD_MS : UINT32_MAX;
+
+	return 0;
+}
+
+/**
+ * @brief  Get the last reading of a rail, in place of reading the sensor.
+ * @param  rail POWER_RAIL_*
+ * @param  volt mV
+ * @param  curr mA
+ * @param  power uW
+ * @retval 0 on success, -1 if there is no recent reading, the SOM is off
+ */
+int power_mon_get_last(enum power_rail rail, uint32_t *volt, uint32_t *curr, uint32_t *power)
+{
+	struct power_mon_rail r;
+
+	if (rail >= POWER_RAIL_MAX)
+		return -1;
+
+	power_mon_read(offsetof(struct power_mon_snap, rail[rail]), &r, sizeof(r));
+	if (!r.valid || xTaskGetTickCount() - r.tick > pdMS_TO_TICKS(POWER_MON_MAX_AGE_MS))
+		return -1;
+	*volt = r.stats.last[POWER_VOLT];
+	*curr = r.stats.last[POWER_CURR];
+	*power = r.stats.last[POWER_POWER];
+	return 0;
+}
+
+void power_mon_get_cost(struct power_mon_cost *cost)
+{
+	power_mon_read(offsetof(struct power_mon_snap, cost), cost, sizeof(*cost));
+}
+
+/**
+ * @brief  Wake the sampler for a board rail read ahead of the next round, from
+ *         the INA226 ALERT interrupt.
+ * @param  woken set if a yield is needed on the way out of the interrupt
+ */
+void power_mon_kick_from_isr(BaseType_t *woken)
+{
+	if (pm.task)
+		vTaskNotifyGiveFromISR(pm.task, woken);
+}
@@ -7,6 +7,9 @@
 /* Private includes ----------------------------------------------------------*/
 #include "hf_common.h"
 #include "hf_i2c.h"
+#include "hf_som_link.h"
+#include "hf_event_bus.h"
+#include "hf_alarm.h"
 /* Private typedef -----------------------------------------------------------*/
  #define AUTO_BOOT
 /* Private define ------------------------------------------------------------*/
@@ -27,17 +30,24 @@ static void atx_power_on(uint8_t turnon);
 static void dc_power_on(uint8_t turnon);
 static void power_led_on(uint8_t turnon);
 static int pmic_b6out_105v(void);
+static void alarm_power_off(const struct bmc_event *ev);
 
 void hf_power_task(void *parameter)
 {
 	HAL_StatusTypeDef status = HAL_OK;
 	power_state_t power_state = IDLE_STATE;
 	GPIO_PinState pin_state = GPIO_PIN_RESET;
+	struct bmc_event ev;
+	int power_sub;
 	printf("hf_power_task started!!!\r\n");
 
+	/* subscribe before the first look at som_power_state so no change is missed */
+	power_sub = bmc_bus_subscribe_queue(BMC_TOPIC_MASK(BMC_TOPIC_SOM_POWER) |
+					    BMC_TOPIC_MASK(BMC_TOPIC_ALARM), 8);
+
 	#ifdef AUTO_BOOT
 	power_state = ATX_PS_ON_STATE;
-	som_power_state = SOM_POWER_ON;
+	change_som_power_state(SOM_POWER_ON);
 	#endif
 	power_led_on(pdFALSE);
 	while (1) {
@@ -71,6 +81,7 @@ void hf_power_task(void *parameter)
 
 		/* Only initialize I2C if DC power is good */
 		if (retry_count > 0) {
+			bmc_bus_publish(BMC_TOPIC_POWER_GOOD, 1);
 			i2c_init(I2C3);
 			osDelay(100);
 			i2c_init(I2C1);
@@ -85,31 +96,49 @@ void hf_power_task(void *parameter)
 		printf("SOM_STATUS_CHECK_STATE\r\n");
 		// pmic_power_on(pdTRUE);  // Removed in patch 0078
 		som_reset_control(pdFALSE);
+		/* the som is released, uart4 no longer leaks into it */
+		uart_init(UART4);
+		som_link_reset();
 		pmic_status_led_on(pdTRUE);
 		power_led_on(pdTRUE);
 		power_state = POWERON;
 		printf("POWERON\r\n");
 		break;
 		case POWERON:
-			if (som_power_state == SOM_POWER_OFF) {
+			if (get_som_power_state() == SOM_POWER_OFF) {
 				power_state = STOP_POWER;
+				break;
+			}
+			/* steady state, sleep until the power state changes or an alarm */
+			if (power_sub >= 0) {
+				if (bmc_bus_wait(power_sub, &ev, portMAX_DELAY) == pdTRUE &&
+				    BMC_TOPIC_ALARM == ev.topic)
+					alarm_power_off(&ev);
+				continue;
 			}
 			break;
 		case STOP_POWER:
 			printf("STOP_POWER\r\n");
 			i2c_deinit(I2C3);
+			uart_deinit(UART4);
 
 			// pmic_power_on(pdFALSE);  // Removed in patch 0078
 			dc_power_on(pdFALSE);
 			atx_power_on(pdFALSE);
 			pmic_status_led_on(pdFALSE);
 			power_led_on(pdFALSE);
-			som_power_state = SOM_POWER_OFF;
+			bmc_bus_publish(BMC_TOPIC_POWER_GOOD, 0);
+			change_som_power_state(SOM_POWER_OFF);
 			power_state = IDLE_STATE;
 			break;
 		case IDLE_STATE:
-			if (som_power_state == SOM_POWER_ON) {
+			if (get_som_power_state() == SOM_POWER_ON) {
 				power_state = ATX_PS_ON_STATE;
+				break;
+			}
+			if (power_sub >= 0) {
+				bmc_bus_wait(power_sub, &ev, portMAX_DELAY);
+				continue;
 			}
 			break;
 		}
@@ -117,6 +146,30 @@ void hf_power_task(void *parameter)
 	}
 }
 
+/**
+ * @brief  Run the power off of a raised alarm, as a long press of the power
+ *         button. An event queued while powering on is dropped if the rule
+ *         has cleared since.
+ * @param  ev BMC_TOPIC_ALARM event
+ * @retval None
+ */
+static void alarm_power_off(const struct bmc_event *ev)
+{
+	struct alarm_rule rule;
+	struct alarm_status status;
+	int ret;
+
+	if (!(ev->value & ALARM_EVENT_POWER_OFF) || SOM_POWER_ON != get_som_power_state())
+		return;
+	if (alarm_get(ALARM_EVENT_RULE(ev->value), &rule, &status) || !status.active)
+		return;
+	printf("alarm %lu: powering the SOM off\r\n", ALARM_EVENT_RULE(ev->value));
+	ret = web_cmd_handle(CMD_POWER_OFF, NULL, 0, 2000);
+	if (HAL_OK != ret)
+		change_som_power_state(SOM_POWER_OFF);
+	TriggerSomPowerOffTimer();
+}
+
 /**
  * @brief  atx power switch .
  * @param  turnon turn on/off atx power 1:turnon; 0:turnoff.
@@ -227,9 +280,14 @@ power_switch_t get_som_power_state(void)
 
 void change_som_power_state(power_switch_t newState)
 {
+	power_switch_t oldState;
+
 	taskENTER_CRITICAL();
+	oldState = som_power_state;
 	som_power_state = newState;
 	taskEXIT_CRITICAL();
+	if (oldState != newState)
+		bmc_bus_publish(BMC_TOPIC_SOM_POWER, newState);
 }
 
 void som_reset_control(uint8_t reset)
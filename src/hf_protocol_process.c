@@ -15,6 +15,8 @@
 #include "list.h"
 #include "main.h"
 #include "protocol_lib/protocol.h"
+#include "protocol_lib/ringbuffer.h"
+#include "protocol_lib/som_frame.h"
 #include "stm32f4xx.h"
 #include "stm32f4xx_hal.h"
 #include "task.h"
@@ -23,6 +25,12 @@
 #include "timers.h"
 #include "hf_spi_slv.h"
 #include "web-server.h"
+#include "hf_som_link.h"
+#include "hf_som_telemetry.h"
+#include "hf_som_bulk.h"
+#include "hf_event_bus.h"
+#include "hf_eeprom.h"
+#include "lwip.h"
 
 #define head_meg "\xA5\x5A\xAA\x55"
 #define end_msg "\x0D\x0A\x0D\x0A"
@@ -102,6 +110,9 @@ int32_t es_set_gpio(struct gpio_cmd *gpio)
 
 int32_t es_set_eth(struct ip_t *ip, struct netmask_t *netmask, struct getway_t *gw, struct eth_mac_t *mac)
 {
+	extern SemaphoreHandle_t gNet_Mutex;
+
+	esENTER_CRITICAL(gNet_Mutex, portMAX_DELAY);
 	if (ip != NULL) {
 		ip_address[0] = ip->ip_addr0;
 		ip_address[1] = ip->ip_addr1;
@@ -128,6 +139,7 @@ int32_t es_set_eth(struct ip_t *ip, struct netmask_t *netmask, struct getway_t *
 	}
 	extern void dynamic_change_eth(void);
 	dynamic_change_eth();
+	esEXIT_CRITICAL(gNet_Mutex);
 	return HAL_OK;
 }
 
@@ -251,6 +263,127 @@ int32_t es_spi_rl32(struct spi_slv_w32_t *spi)
 
 
 typedef enum req_type { REQ_OK = 0x0, REQ_FAIL = 0x1, REQ_OTHER } req_type_t;
+
+/* CMD_BATCH, see protocol.h */
+static void es_process_batch(b_frame_class_t *pframe)
+{
+	const uint8_t *p = pframe->frame.data.batch;
+	uint16_t len = pframe->frame.len, off = 0;
+	struct batch_status status = { .result = REQ_FAIL, .index = 0xff };
+	struct {
+		uint8_t *ip, *netmask, *gw, *mac;
+		uint8_t net_index, mac_index, date_index, time_index;
+		struct rtc_date_t date;
+		struct rtc_time_t time;
+	} set = {
+		.net_index = 0xff, .mac_index = 0xff, .date_index = 0xff, .time_index = 0xff,
+	};
+	uint8_t i, type, n;
+	uint8_t *v;
+
+	/* check all of it first, a bad TLV leaves everything untouched */
+	for (i = 0; off < len; i++, off += 2 + n) {
+		status.index = i;
+		if (len - off < 2)
+			goto out;
+		type = p[off];
+		n = p[off + 1];
+		v = (uint8_t *)&p[off + 2];
+		if (n > len - off - 2)
+			goto out;
+		switch (type) {
+		case CMD_SET_IP:
+			if (n != sizeof(struct ip_t))
+				goto out;
+			set.ip = v;
+			break;
+		case CMD_SET_NETMASK:
+			if (n != sizeof(struct netmask_t))
+				goto out;
+			set.netmask = v;
+			break;
+		case CMD_SET_GATWAY:
+			if (n != sizeof(struct getway_t))
+				goto out;
+			set.gw = v;
+			break;
+		case CMD_SET_MAC:
+			if (n != sizeof(struct eth_mac_t) || 1 != is_valid_ethaddr(v))
+				goto out;
+			set.mac = v;
+			set.mac_index = i;
+			break;
+		case CMD_SET_DATE:
+			if (n != sizeof(struct rtc_date_t) - 1)
+				goto out;
+			set.date.Year = (v[0] << 8) | v[1];
+			set.date.Month = v[2];
+			set.date.Date = v[3];
+			set.date.WeekDay = v[4];
+			if (set.date.Year < 2000 || set.date.Year > 2099 ||
+				set.date.Month < 1 || set.date.Month > 12 ||
+				set.date.Date < 1 || set.date.Date > 31 ||
+				set.date.WeekDay < 1 || set.date.WeekDay > 7)
+				goto out;
+			set.date_index = i;
+			break;
+		case CMD_SET_TIME:
+			if (n != sizeof(struct rtc_time_t) || v[0] > 23 || v[1] > 59 || v[2] > 59)
+				goto out;
+			memcpy(&set.time, v, sizeof(set.time));
+			set.time_index = i;
+			break;
+		default:
+			goto out;
+		}
+		if (CMD_SET_IP == type || CMD_SET_NETMASK == type || CMD_SET_GATWAY == type) {
+			if (0xff == set.net_index)
+				set.net_index = i;
+		}
+	}
+
+	/* the rtc first: an rtc failure leaves the eeprom untouched */
+	if (0xff != set.date_index) {
+		status.index = set.date_index;
+		if (es_set_rtc_date(&set.date) != HAL_OK)
+			goto out;
+		status.applied |= BATCH_APPLIED_DATE;
+	}
+	if (0xff != set.time_index) {
+		status.index = set.time_index;
+		if (es_set_rtc_time(&set.time) != HAL_OK)
+			goto out;
+		status.applied |= BATCH_APPLIED_TIME;
+	}
+	/* one eeprom write per region, on the eeprom before the reply */
+	if (0xff != set.net_index) {
+		status.index = set.net_index;
+		if (es_set_mcu_netinfo(set.ip, set.netmask, set.gw))
+			goto out;
+		es_set_eth((struct ip_t *)set.ip, (struct netmask_t *)set.netmask,
+			(struct getway_t *)set.gw, NULL);
+		status.applied |= BATCH_APPLIED_NET;
+	}
+	if (set.mac) {
+		status.index = set.mac_index;
+		if (es_set_mcu_mac(set.mac, 0))
+			goto out;
+		status.applied |= BATCH_APPLIED_MAC;
+	}
+	if (status.applied & (BATCH_APPLIED_NET | BATCH_APPLIED_MAC)) {
+		status.index = 0xff != set.net_index ? set.net_index : set.mac_index;
+		if (es_eeprom_sync()) {
+			status.applied &= ~(BATCH_APPLIED_NET | BATCH_APPLIED_MAC);
+			goto out;
+		}
+	}
+	status.result = REQ_OK;
+	status.index = 0xff;
+out:
+	if (REQ_OK != status.result)
+		pframe->stats.batch_err++;
+	es_send_req(pframe, CMD_BATCH, (char *)&status, sizeof(status));
+}
 void es_process_cmd(b_frame_class_t *pframe)
 {
 	uint8_t cmd = pframe->frame.cmd;
@@ -312,6 +445,10 @@ void es_process_cmd(b_frame_class_t *pframe)
 				req_type = REQ_OK;
 		}
 		break;
+	case CMD_BATCH:
+		es_process_batch(pframe);
+		req_type = REQ_OTHER;
+		break;
 	case CMD_GET_DATE:
 		if (pframe->frame.len == 0) {
 			if (es_get_rtc_date(&pframe->frame.data.rtc_date) == HAL_OK)
@@ -334,7 +471,6 @@ void es_process_cmd(b_frame_class_t *pframe)
 						// pframe->frame.data.rtc_time.Minutes, pframe->frame.data.rtc_time.Seconds);
 		break;
 	case CMD_GET_FAN_DUTY:
-		printf("len %xuint8_t\n",pframe->frame.len);
 		if (pframe->frame.len == sizeof(uint8_t)) {
 			if (es_get_fan_duty(&pframe->frame.data.fan) == HAL_OK){
 				es_send_req(pframe, CMD_GET_FAN_DUTY, (char *)&pframe->frame.data.fan, sizeof(struct fan_control_t));
@@ -359,74 +495,161 @@ void es_process_cmd(b_frame_class_t *pframe)
 		es_send_req(pframe, CMD_RES, req_fail, sizeof(req_fail) - 1);
 }
 
-uint32_t RxBuf_SIZE = 64;
-uint8_t RxBuf[96];
+/* a partial frame older than this is a false header or a truncated frame */
+#define UART3_RX_IDLE_FLUSH_MS	100
+
+uint8_t UART3_RxBuf[UART3_RX_DMA_SIZE];
+/* the dma is the producer, the rx event isr commits what it wrote */
+static ring_buf_t uart3_rx_ring = {
+	.buf = UART3_RxBuf,
+	.mask = UART3_RX_DMA_SIZE - 1,
+};
+static volatile uint16_t uart3_rx_pos; // dma write position at the last rx event
+static volatile uint8_t uart3_rx_restart;
+static volatile uint32_t uart3_rx_restart_at; // ring index of dma position 0
+static volatile TickType_t uart3_rx_tick; // tick of the last rx event
+static volatile uint32_t uart3_line_err;
+static TaskHandle_t xUart3TaskHandle;
+static uint32_t uart3_lat_sum;
 b_frame_class_t frame_uart3;
+
+/* (re)arm the circular rx dma, the protocol task restarts from position 0 */
+void uart3_rx_start(void)
+{
+	uart3_rx_pos = 0;
+	uart3_rx_restart_at = ring_buf_write_realign(&uart3_rx_ring);
+	uart3_rx_restart = 1;
+	HAL_UARTEx_ReceiveToIdle_DMA(&huart3, UART3_RxBuf, sizeof(UART3_RxBuf));
+}
+
+/* rx event from HAL_UARTEx_RxEventCallback, Size is the dma write position */
+void uart3_rx_event_from_isr(uint16_t Size, BaseType_t *pxHigherPriorityTaskWoken)
+{
+	uint16_t pos = Size % UART3_RX_DMA_SIZE;
+
+	ring_buf_write_commit(&uart3_rx_ring, (pos + UART3_RX_DMA_SIZE - uart3_rx_pos) % UART3_RX_DMA_SIZE);
+	uart3_rx_pos = pos;
+	uart3_rx_tick = xTaskGetTickCountFromISR();
+	if (xUart3TaskHandle)
+		vTaskNotifyGiveFromISR(xUart3TaskHandle, pxHigherPriorityTaskWoken);
+}
+
+void uart3_rx_error_from_isr(void)
+{
+	uart3_line_err++;
+}
+
+/* feed everything the dma wrote since the last call to the frame parser */
+static void uart3_rx_drain(void)
+{
+	const uint8_t *span;
+	uint32_t n;
+
+	if (uart3_rx_restart) {
+		uart3_rx_restart = 0;
+		ring_buf_read_seek(&uart3_rx_ring, uart3_rx_restart_at);
+		es_frame_reset(&frame_uart3);
+	}
+
+	n = ring_buf_len(&uart3_rx_ring);
+	if (n > UART3_RX_DMA_SIZE) {
+		/* the dma lapped us, the ring content is torn */
+		frame_uart3.stats.overrun++;
+		es_frame_reset(&frame_uart3);
+		ring_buf_read_seek(&uart3_rx_ring, uart3_rx_ring.tail + n);
+		return;
+	}
+
+	while ((n = ring_buf_peek_span(&uart3_rx_ring, &span))) {
+		es_frame_parse(&frame_uart3, span, n);
+		ring_buf_read_commit(&uart3_rx_ring, n);
+	}
+}
+
+static void uart3_frame_handler(b_frame_class_t *pframe, uint8_t err)
+{
+	struct b_frame_stats *stats = &pframe->stats;
+	uint32_t ms;
+
+	if (B_SUCCESS != err) {
+		es_send_req(pframe, CMD_RES, req_fail, sizeof(req_fail) - 1);
+		return;
+	}
+	es_process_cmd(pframe);
+
+	ms = (xTaskGetTickCount() - uart3_rx_tick) * portTICK_PERIOD_MS;
+	taskENTER_CRITICAL();
+	uart3_lat_sum += ms;
+	stats->lat_avg_ms = uart3_lat_sum / stats->frames;
+	if (ms > stats->lat_max_ms)
+		stats->lat_max_ms = ms;
+	taskEXIT_CRITICAL();
+}
+
+void protocol_get_stats(struct b_frame_stats *stats)
+{
+	taskENTER_CRITICAL();
+	*stats = frame_uart3.stats;
+	stats->line_err = uart3_line_err;
+	taskEXIT_CRITICAL();
+}
+
 void protocol_task(void *argument)
 {
-	// printf("%s %d\n", __func__, __LINE__);
-	uint8_t protocol_status = 0;
+	uint32_t events;
 	b_frame_t frame_info;
 	frame_info.head = head_meg;
 	frame_info.head_len = sizeof(head_meg) - 1;
 	frame_info.end = end_msg;
 	frame_info.end_len = sizeof(end_msg) - 1;
 	frame_info.pname = "uart3";
-	frame_uart3._in_frame_buffer_size = 256;
 	frame_uart3.uart = &huart3;
-	es_frame_init(&frame_uart3, &frame_info);
-	/* enable uart3 dma rx */
-	HAL_UARTEx_ReceiveToIdle_IT(frame_uart3.uart, RxBuf, RxBuf_SIZE);
-	// HAL_UARTEx_ReceiveToIdle_DMA(frame_uart3.uart, RxBuf, RxBuf_SIZE);
+	es_frame_init(&frame_uart3, &frame_info, uart3_frame_handler);
+
+	xUart3TaskHandle = xTaskGetCurrentTaskHandle();
+	/* enable uart3 circular dma rx, idle line and half/full events wake us */
+	uart3_rx_start();
 	for (;;) {
-		switch (protocol_status) {
-		case CHECK_HEAD:
-			if (!es_check_head(&frame_uart3))
-				protocol_status = CHECK_CMD;
-			break;
-		case CHECK_CMD:
-			// printf("%s CHECK_CMD\n", __func__);
-			if (!es_get_cmd_and_data(&frame_uart3)) {
-				protocol_status = CHECK_TAIL;
-			} else {
-				// printf("%s CHECK_CMD fail\n", __func__);
-				es_send_req(&frame_uart3, CMD_RES, req_fail, sizeof(req_fail) - 1);
-				protocol_status = CHECK_HEAD;
-			}
-			break;
-		case CHECK_TAIL:
-			// printf("%s CHECK_TAIL\n", __func__);
-			if (!es_check_tail(&frame_uart3)) {
-				protocol_status = PROCESS_CMD;
-			} else {
-				es_send_req(&frame_uart3, CMD_RES, req_fail, sizeof(req_fail) - 1);
-				protocol_status = CHECK_HEAD;
-			}
-			break;
-		case PROCESS_CMD:
-			es_process_cmd(&frame_uart3);
-			protocol_status = CHECK_HEAD;
-			break;
-		default:
-			protocol_status = CHECK_HEAD;
-		}
-		osDelay(10);
+		events = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(UART3_RX_IDLE_FLUSH_MS));
+		uart3_rx_drain();
+		if (!events && frame_uart3.state != CHECK_HEAD)
+			es_frame_reset(&frame_uart3);
 	}
 }
 
-#define FRAME_HEADER    0xA55AAA55
-#define FRAME_TAIL      0xBDBABDBA
-
-Message UART4_RxMsg;
+/* a partial frame older than this is a false header or a truncated frame */
+#define UART4_RX_IDLE_FLUSH_MS	100
+
+uint8_t UART4_RxBuf[UART4_RX_DMA_SIZE];
+/* the dma is the producer, the rx event isr commits what it wrote */
+static ring_buf_t uart4_rx_ring = {
+	.buf = UART4_RxBuf,
+	.mask = UART4_RX_DMA_SIZE - 1,
+};
+static volatile uint16_t uart4_rx_pos; // dma write position at the last rx event
+static volatile uint8_t uart4_rx_restart;
+static volatile uint32_t uart4_rx_restart_at; // ring index of dma position 0
+static TaskHandle_t xUart4TaskHandle;
+static struct som_frame_decoder som_decoder;
+static union {
+	Message msg;
+	uint8_t raw[SOM_FRAME_MAX_LEN];
+} som_rx_pool[SOM_RX_POOL_SIZE];
+static uint32_t som_rx_pool_map; // bit set: buffer in use
+static struct som_rx_pool_stats som_rx_pool_stat = {
+	.free = SOM_RX_POOL_SIZE,
+	.low_water = SOM_RX_POOL_SIZE,
+};
+static uint8_t som_tx_buf[SOM_FRAME_MAX_LEN]; // protected by xMutex
 extern DMA_HandleTypeDef hdma_uart4_rx;
 List_t WebCmdList;
-QueueHandle_t xUart4MsgQueue;
 
 // Define command types
 typedef enum {
 	MSG_REQUEST = 0x01,
 	MSG_REPLY,
 	MSG_NOTIFLY,
+	MSG_HEARTBEAT, // pushed by the SOM daemon, no payload, no reply
 } MsgType;
 
 void dump_message(Message data)
@@ -436,6 +659,20 @@ void dump_message(Message data)
 }
 // Define a mutex handle
 SemaphoreHandle_t xMutex = NULL;
+// bulk lane: one waiter at the transmit lock, SOM_LANE_BULK_INFLIGHT requests at the SOM
+static SemaphoreHandle_t xBulkGate = NULL;
+static SemaphoreHandle_t xBulkSlots = NULL;
+static struct {
+	uint32_t requests;
+	uint32_t timeouts;
+	uint32_t busy;
+	uint32_t sent;
+	uint32_t replies;
+	uint32_t wait_sum;
+	uint32_t wait_max;
+	uint32_t rtt_sum;
+	uint32_t rtt_max;
+} som_lane[SOM_LANE_MAX];
 TimerHandle_t xSomPowerOffTimer;
 TimerHandle_t xSomRebootTimer;
 TimerHandle_t xSomRestartTimer;
@@ -449,6 +686,10 @@ void init_transmit_mutex(void) {
 		// Mutex creation failed
 		// Handle the error here
 	}
+	xBulkGate = xSemaphoreCreateMutex();
+	xBulkSlots = xSemaphoreCreateCounting(SOM_LANE_BULK_INFLIGHT, SOM_LANE_BULK_INFLIGHT);
+	if (xBulkGate == NULL || xBulkSlots == NULL)
+		printf("[%s %d]:Failed to create the bulk lane semaphores!\n", __func__, __LINE__);
 }
 
 // Function to acquire the mutex
@@ -466,49 +707,178 @@ void release_transmit_mutex(void) {
 	xSemaphoreGive(xMutex);
 }
 
-// Function to check message checksum
-int check_checksum(Message *msg)
+static uint8_t *som_rx_alloc(void *arg)
 {
-	unsigned char checksum = 0;
-	checksum ^= msg->msg_type;
-	checksum ^= msg->cmd_type;
-	checksum ^= msg->data_len;
-	for (int i = 0; i < msg->data_len; ++i) {
-		checksum ^= msg->data[i];
+	uint8_t *buf = NULL;
+	uint8_t report;
+	int i;
+
+	taskENTER_CRITICAL();
+	for (i = 0; i < SOM_RX_POOL_SIZE; i++) {
+		if (!(som_rx_pool_map & (1u << i))) {
+			som_rx_pool_map |= 1u << i;
+			buf = som_rx_pool[i].raw;
+			som_rx_pool_stat.free--;
+			som_rx_pool_stat.low_water = MIN(som_rx_pool_stat.low_water, som_rx_pool_stat.free);
+			break;
+		}
 	}
-	return checksum == msg->checksum;
+	report = !buf && !som_rx_pool_stat.exhausted++;
+	taskEXIT_CRITICAL();
+
+	if (report)
+		printf("[%s %d]:SOM rx buffer pool exhausted, dropping frames!\n", __func__, __LINE__);
+	return buf;
 }
 
-void generate_checksum(Message *msg)
+/* give a frame handed out by the protocol task back to the pool */
+void som_rx_release(Message *msg)
 {
-	unsigned char checksum = 0;
-	checksum ^= msg->msg_type;
-	checksum ^= msg->cmd_type;
-	checksum ^= msg->data_len;
-	for (int i = 0; i < msg->data_len; ++i) {
-		checksum ^= msg->data[i];
+	uint32_t i = ((uint8_t *)msg - som_rx_pool[0].raw) / sizeof(som_rx_pool[0]);
+
+	if (i >= SOM_RX_POOL_SIZE) {
+		printf("[%s %d]:Not a SOM rx buffer %p!\n", __func__, __LINE__, msg);
+		return;
+	}
+	taskENTER_CRITICAL();
+	if (som_rx_pool_map & (1u << i)) {
+		som_rx_pool_map &= ~(1u << i);
+		som_rx_pool_stat.free++;
 	}
-	msg->checksum = checksum;
+	taskEXIT_CRITICAL();
 }
 
-static BaseType_t xTransmitRequestToSOM(Message *msg)
+void som_rx_pool_get_stats(struct som_rx_pool_stats *stats)
+{
+	taskENTER_CRITICAL();
+	*stats = som_rx_pool_stat;
+	taskEXIT_CRITICAL();
+}
+
+/* (re)arm the circular rx dma, the protocol task restarts from position 0 */
+void uart4_rx_start(void)
+{
+	uart4_rx_pos = 0;
+	uart4_rx_restart_at = ring_buf_write_realign(&uart4_rx_ring);
+	uart4_rx_restart = 1;
+	HAL_UARTEx_ReceiveToIdle_DMA(&huart4, UART4_RxBuf, sizeof(UART4_RxBuf));
+}
+
+/* rx event from HAL_UARTEx_RxEventCallback, Size is the dma write position */
+void uart4_rx_event_from_isr(uint16_t Size, BaseType_t *pxHigherPriorityTaskWoken)
+{
+	uint16_t pos = Size % UART4_RX_DMA_SIZE;
+
+	ring_buf_write_commit(&uart4_rx_ring, (pos + UART4_RX_DMA_SIZE - uart4_rx_pos) % UART4_RX_DMA_SIZE);
+	uart4_rx_pos = pos;
+	if (xUart4TaskHandle)
+		vTaskNotifyGiveFromISR(xUart4TaskHandle, pxHigherPriorityTaskWoken);
+}
+
+/* feed everything the dma wrote since the last call to the frame decoder */
+static void uart4_rx_drain(void)
+{
+	const uint8_t *span;
+	uint32_t n;
+
+	if (uart4_rx_restart) {
+		uart4_rx_restart = 0;
+		ring_buf_read_seek(&uart4_rx_ring, uart4_rx_restart_at);
+		som_frame_decoder_reset(&som_decoder);
+	}
+
+	n = ring_buf_len(&uart4_rx_ring);
+	if (n > UART4_RX_DMA_SIZE) {
+		/* the dma lapped us, the ring content is torn */
+		som_link_count(LINK_CNT_RX_OVERRUN);
+		som_frame_decoder_reset(&som_decoder);
+		ring_buf_read_seek(&uart4_rx_ring, uart4_rx_ring.tail + n);
+		return;
+	}
+
+	while ((n = ring_buf_peek_span(&uart4_rx_ring, &span))) {
+		som_frame_decode(&som_decoder, span, n);
+		ring_buf_read_commit(&uart4_rx_ring, n);
+	}
+}
+
+/* move the decoder counters over to the link statistics */
+static void uart4_rx_account(void)
+{
+	static struct som_frame_stats last;
+	struct som_frame_stats *stats = &som_decoder.stats;
+
+	som_link_add(LINK_CNT_RX_FRAMES, stats->frames - last.frames);
+	som_link_add(LINK_CNT_RX_CHECKSUM_ERR, stats->crc_err - last.crc_err);
+	som_link_add(LINK_CNT_RX_FORMAT_ERR, stats->len_err - last.len_err +
+		stats->tail_err - last.tail_err);
+	som_link_add(LINK_CNT_RX_RESYNC, stats->resync - last.resync);
+	som_link_add(LINK_CNT_RX_DROPPED, stats->dropped - last.dropped);
+	som_link_add(LINK_CNT_RX_NOBUF, stats->nobuf - last.nobuf);
+	last = *stats;
+}
+
+static som_lane_t som_cmd_lane(CommandType cmd)
+{
+	switch (cmd) {
+	case CMD_POWER_OFF:
+	case CMD_REBOOT:
+	case CMD_RESTART:
+	case CMD_LINK_BAUD:
+	case CMD_LINK_ECHO:
+		return SOM_LANE_CONTROL;
+	default:
+		return SOM_LANE_BULK;
+	}
+}
+
+static void som_lane_account(uint32_t *sum, uint32_t *max, TickType_t start)
+{
+	uint32_t ms = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+
+	taskENTER_CRITICAL();
+	*sum += ms;
+	*max = MAX(*max, ms);
+	taskEXIT_CRITICAL();
+}
+
+void som_lane_get_stats(som_lane_t lane, struct som_lane_stats *stats)
+{
+	taskENTER_CRITICAL();
+	stats->requests = som_lane[lane].requests;
+	stats->timeouts = som_lane[lane].timeouts;
+	stats->busy = som_lane[lane].busy;
+	stats->wait_avg_ms = som_lane[lane].sent ? som_lane[lane].wait_sum / som_lane[lane].sent : 0;
+	stats->wait_max_ms = som_lane[lane].wait_max;
+	stats->rtt_avg_ms = som_lane[lane].replies ? som_lane[lane].rtt_sum / som_lane[lane].replies : 0;
+	stats->rtt_max_ms = som_lane[lane].rtt_max;
+	taskEXIT_CRITICAL();
+}
+
+static BaseType_t xTransmitRequestToSOM(Message *msg, som_lane_t lane)
 {
 	UART_HandleTypeDef *huart = &huart4;
+	size_t len;
 
+	/* control frames only ever wait for the frame on the wire and one bulk frame */
+	if (SOM_LANE_BULK == lane)
+		xSemaphoreTake(xBulkGate, portMAX_DELAY);
 	// Acquire the mutex before transmitting
 	acquire_transmit_mutex();
 
-	generate_checksum(msg);
-	// Transmit using DMA
-	HAL_StatusTypeDef status = HAL_UART_Transmit(huart, (uint8_t *)msg,
-			sizeof(Message), HAL_MAX_DELAY);
+	len = som_frame_encode(msg, som_link_get_crc_frames(), som_tx_buf);
+	HAL_StatusTypeDef status = HAL_UART_Transmit(huart, som_tx_buf, len, HAL_MAX_DELAY);
 
 	// Release the mutex after transmitting
 	release_transmit_mutex();
+	if (SOM_LANE_BULK == lane)
+		xSemaphoreGive(xBulkGate);
 
 	if (status == HAL_OK) {
+		som_link_count(LINK_CNT_TX_FRAMES);
 		return status; // Successful transmission
 	} else {
+		som_link_count(LINK_CNT_TX_ERR);
 		if (SOM_DAEMON_ON == get_som_daemon_state()) {
 			printf("[%s %d]:Failed to transmit msg, status %d!\n",__func__,__LINE__, status);
 		}
@@ -516,15 +886,25 @@ static BaseType_t xTransmitRequestToSOM(Message *msg)
 	}
 }
 
-int web_cmd_handle(CommandType cmd, void *data, int data_len, uint32_t timeout)
+/**
+ * @brief  Send a request to the SOM daemon and wait for its reply.
+ * @param  replied set to 1 if the SOM replied, the result is then its
+ *         cmd_result, 0 if the request failed here or timed out; NULL if not
+ *         needed
+ * @retval HAL_OK, the cmd_result of the reply or the local failure
+ */
+int som_cmd_request(CommandType cmd, void *data, int data_len, uint32_t timeout, uint8_t *replied)
 {
 	HAL_StatusTypeDef status;
 	uint32_t ulNotificationValue;
 	int ret = HAL_ERROR;
+	Message *reply;
+	int len;
+	som_lane_t lane = som_cmd_lane(cmd);
+	TickType_t start = xTaskGetTickCount();
 
 	WebCmd webcmd = {
-		.cmd_result = -1,
-		.data = {0},
+		.reply = NULL,
 		.xTaskToNotify = xTaskGetCurrentTaskHandle(),
 	};
 
@@ -535,10 +915,22 @@ int web_cmd_handle(CommandType cmd, void *data, int data_len, uint32_t timeout)
 		.data_len = data_len,
 		.tail = FRAME_TAIL,
 	};
+	if (replied)
+		*replied = 0;
 	if (SOM_POWER_ON != get_som_power_state()) {
 		ret = HAL_ERROR;
 		return ret;
 	}
+	if (data_len > FRAME_DATA_MAX)
+		return HAL_ERROR;
+	som_lane[lane].requests++;
+	if (SOM_LANE_BULK == lane &&
+		xSemaphoreTake(xBulkSlots, pdMS_TO_TICKS(timeout)) != pdTRUE) {
+		som_lane[lane].busy++;
+		return HAL_BUSY;
+	}
+	if (data)
+		memcpy(msg.data, data, data_len);
 	/*Add webcmd to waiting list*/
 		// Initialize list item
 	vListInitialiseItem(&(webcmd.xListItem));
@@ -548,34 +940,66 @@ int web_cmd_handle(CommandType cmd, void *data, int data_len, uint32_t timeout)
 	taskENTER_CRITICAL();
 	vListInsertEnd(&WebCmdList, &(webcmd.xListItem));
 	taskEXIT_CRITICAL();
+	// drop a notification left over by a reply that came in after its timeout
+	xTaskNotifyStateClear(NULL);
 
 	msg.xTaskToNotify = (uint32_t)webcmd.xTaskToNotify;
 	//dump_message(msg);
-	status = xTransmitRequestToSOM(&msg);
+	status = xTransmitRequestToSOM(&msg, lane);
 	if (HAL_OK != status) {
 		ret = status;
 		goto err_msg;
 	}
+	som_lane[lane].sent++;
+	som_lane_account(&som_lane[lane].wait_sum, &som_lane[lane].wait_max, start);
 	/*wait to get the result*/
-	if (xTaskNotifyWait(0, 0, &ulNotificationValue, pdMS_TO_TICKS(timeout)) == pdTRUE) {
-		ret = webcmd.cmd_result;
+	if (xTaskNotifyWait(0, 0, &ulNotificationValue, pdMS_TO_TICKS(timeout)) == pdTRUE &&
+		webcmd.reply) {
+		reply = webcmd.reply;
+		ret = reply->cmd_result;
+		if (replied)
+			*replied = 1;
 		if (HAL_OK != ret) {
 			printf("[%s %d]:Som process cmd %d failed, ret %d\n",__func__,__LINE__, cmd, ret);
 		}
-		memcpy(data, webcmd.data, data_len);
+		if (data) {
+			len = MIN(data_len, reply->data_len);
+			memcpy(data, reply->data, len);
+			memset((uint8_t *)data + len, 0, data_len - len);
+		}
+		som_rx_release(reply);
+		som_lane[lane].replies++;
+		som_lane_account(&som_lane[lane].rtt_sum, &som_lane[lane].rtt_max, start);
 	} else {
+		som_link_count(LINK_CNT_TIMEOUT);
+		som_lane[lane].timeouts++;
 		ret = HAL_TIMEOUT;
 		goto err_msg;
 	}
+	if (SOM_LANE_BULK == lane)
+		xSemaphoreGive(xBulkSlots);
 	return ret;
 
 err_msg:
 	taskENTER_CRITICAL();
-	uxListRemove(&(webcmd.xListItem));
+	if (listIS_CONTAINED_WITHIN(&WebCmdList, &(webcmd.xListItem)))
+		uxListRemove(&(webcmd.xListItem));
+	// the reply may have been handed over right after the timeout
+	reply = webcmd.reply;
+	webcmd.reply = NULL;
 	taskEXIT_CRITICAL();
+	if (reply)
+		som_rx_release(reply);
+	if (SOM_LANE_BULK == lane)
+		xSemaphoreGive(xBulkSlots);
 	return ret;
 }
 
+int web_cmd_handle(CommandType cmd, void *data, int data_len, uint32_t timeout)
+{
+	return som_cmd_request(cmd, data, data_len, timeout, NULL);
+}
+
 static void buf_dump(uint8_t *data, uint32_t len)
 {
 	int i;
@@ -604,41 +1028,132 @@ deamon_stats_t get_som_daemon_state(void)
 
 void change_som_daemon_state(deamon_stats_t newState)
 {
+	deamon_stats_t oldState;
 
 	// Enter critical section to ensure thread safety when traversing and deleting
 	taskENTER_CRITICAL();
+	oldState = som_daemon_state;
 	som_daemon_state = newState;
 	taskEXIT_CRITICAL();
+	if (oldState != newState)
+		bmc_bus_publish(BMC_TOPIC_DAEMON, newState);
 	return ;
 }
 
+/*
+ * SOM liveness: every valid frame from the SOM (replies, notifications and the
+ * MSG_HEARTBEAT it pushes) proves the daemon alive. CMD_BOARD_STATUS is only
+ * sent once the link has been quiet for SOM_LIVENESS_IDLE_MS, backing off up to
+ * SOM_LIVENESS_POLL_MAX_MS while the daemon is off. No frame within the
+ * deadline turns the daemon off.
+ */
+#define SOM_LIVENESS_TICK_MS		100
+#define SOM_LIVENESS_IDLE_MS		1000
+#define SOM_LIVENESS_POLL_MAX_MS	8000
+#define SOM_LIVENESS_DEADLINE_MS	3000
+#define SOM_LIVENESS_DEADLINE_MIN_MS	(2 * SOM_LIVENESS_IDLE_MS)
+#define SOM_LIVENESS_DEADLINE_MAX_MS	60000
+
+static volatile TickType_t som_last_rx_tick;
+static struct som_liveness_stats som_liveness = {
+	.deadline_ms = SOM_LIVENESS_DEADLINE_MS,
+};
+
+/* a valid frame came in from the SOM */
+static void som_liveness_touch(void)
+{
+	som_last_rx_tick = xTaskGetTickCount();
+}
+
+int som_liveness_set_deadline(uint32_t ms)
+{
+	if (ms < SOM_LIVENESS_DEADLINE_MIN_MS || ms > SOM_LIVENESS_DEADLINE_MAX_MS)
+		return -1;
+	som_liveness.deadline_ms = ms;
+	return 0;
+}
+
+void som_liveness_get_stats(struct som_liveness_stats *stats)
+{
+	taskENTER_CRITICAL();
+	*stats = som_liveness;
+	stats->idle_ms = (xTaskGetTickCount() - som_last_rx_tick) * portTICK_PERIOD_MS;
+	taskEXIT_CRITICAL();
+}
+
 void deamon_keeplive_task(void *argument)
 {
 	int ret = HAL_OK;
-	deamon_stats_t old_status;
-	static uint8_t count = 0;
+	deamon_stats_t old_status, new_status;
+	TickType_t now, idle, next_poll, last_second, timeout;
+	uint32_t backoff = SOM_LIVENESS_IDLE_MS;
 	struct rtc_date_t date = {0};
 	struct rtc_time_t time = {0};
+	struct bmc_event ev;
+	uint32_t power;
+	int power_sub, off_done = 0;
+
+	/*
+	 * The SOM power state comes from the bus: subscribe before reading the
+	 * last value so no change is missed, then sleep while the SOM is off
+	 * once the daemon state, link and telemetry have been dropped.
+	 */
+	power_sub = bmc_bus_subscribe_queue(BMC_TOPIC_MASK(BMC_TOPIC_SOM_POWER), 4);
+	power = bmc_bus_last(BMC_TOPIC_SOM_POWER, NULL);
+	now = xTaskGetTickCount();
+	som_last_rx_tick = now - pdMS_TO_TICKS(som_liveness.deadline_ms);
+	next_poll = now;
+	last_second = now;
 	for (;;) {
+		timeout = SOM_POWER_ON != power && off_done ? portMAX_DELAY : pdMS_TO_TICKS(SOM_LIVENESS_TICK_MS);
+		if (power_sub < 0) {
+			osDelay(pdMS_TO_TICKS(SOM_LIVENESS_TICK_MS));
+			power = get_som_power_state();
+		} else {
+			while (bmc_bus_wait(power_sub, &ev, timeout)) {
+				power = ev.value;
+				off_done = 0;
+				timeout = 0;
+			}
+		}
 		old_status = get_som_daemon_state();
-		if (SOM_POWER_ON != get_som_power_state()) {
-			ret = HAL_ERROR;
+		now = xTaskGetTickCount();
+		if (SOM_POWER_ON != power) {
+			/* nothing heard from a powered off SOM counts */
+			som_last_rx_tick = now - pdMS_TO_TICKS(som_liveness.deadline_ms);
+			backoff = SOM_LIVENESS_IDLE_MS;
+			new_status = SOM_DAEMON_OFF;
 		} else {
-			ret = web_cmd_handle(CMD_BOARD_STATUS, NULL, 0, 1000);
+			idle = now - som_last_rx_tick;
+			if (idle >= pdMS_TO_TICKS(SOM_LIVENESS_IDLE_MS) && (int32_t)(now - next_poll) >= 0) {
+				som_liveness.polls++;
+				ret = web_cmd_handle(CMD_BOARD_STATUS, NULL, 0, 1000);
+				if (HAL_OK != ret) {
+					som_liveness.poll_fail++;
+					if (SOM_DAEMON_ON == old_status && backoff == SOM_LIVENESS_IDLE_MS)
+						printf("SOM keeplive request failed(ret %d)!\n", ret);
+					if (SOM_DAEMON_OFF == old_status)
+						backoff = MIN(backoff * 2, SOM_LIVENESS_POLL_MAX_MS);
+				} else {
+					backoff = SOM_LIVENESS_IDLE_MS;
+				}
+				now = xTaskGetTickCount();
+				next_poll = now + pdMS_TO_TICKS(backoff);
+				idle = now - som_last_rx_tick;
+			}
+			new_status = idle < pdMS_TO_TICKS(som_liveness.deadline_ms) ?
+				SOM_DAEMON_ON : SOM_DAEMON_OFF;
 		}
-		if (HAL_OK != ret) {
-			if (count <= 5 && SOM_DAEMON_ON == get_som_daemon_state())
-				printf("SOM keeplive request failed(ret %d)!\n", ret);
+		change_som_daemon_state(new_status);
 
-			count++;
-			if (count >= 5) {
-				change_som_daemon_state(SOM_DAEMON_OFF);
-			}
-		} else {
-			change_som_daemon_state(SOM_DAEMON_ON);
-			if(LED_USER_INFO_RESET != get_mcu_led_status())
+		if (now - last_second >= pdMS_TO_TICKS(1000) || (SOM_POWER_ON != power && !off_done)) {
+			last_second = now;
+			off_done = SOM_POWER_ON != power;
+			if (SOM_DAEMON_ON == new_status && LED_USER_INFO_RESET != get_mcu_led_status() &&
+			    LED_ALARM != get_mcu_led_status())
 				set_mcu_led_status(LED_SOM_KERNEL_RUNING);
-			count = 0;
+			som_link_poll(new_status);
+			som_telemetry_poll(new_status);
 		}
 		if (old_status != get_som_daemon_state()) {
 			es_get_rtc_date(&date);
@@ -647,8 +1162,6 @@ void deamon_keeplive_task(void *argument)
 				get_som_daemon_state() == SOM_DAEMON_ON ? "on" : "off",
 				date.Year, date.Month, date.Date, time.Hours, time.Minutes, time.Seconds);
 		}
-		/*check every 1 second*/
-		osDelay(pdMS_TO_TICKS(1000));
 	}
 }
 
@@ -663,9 +1176,14 @@ void handle_notify_mesage(Message *msg)
 		StopSomRestartTimer();
 		printf("Restart SOM normaly!\n");
 		vRestartSOM();
+	} else if (CMD_BULK_DATA == msg->cmd_type) {
+		som_bulk_push(msg);
+	} else {
+		som_telemetry_push(msg);
 	}
 }
 
+/* msg is a rx pool buffer, it is passed on to the waiter or released here */
 void handle_som_mesage(Message *msg)
 {
 	if (MSG_REPLY == msg->msg_type) {
@@ -677,9 +1195,10 @@ void handle_som_mesage(Message *msg)
 					WebCmd * pxWebCmd = (WebCmd *)listGET_LIST_ITEM_OWNER(pxItem);
 					// Get the next item before deleting the current one
 					ListItem_t *pxNextItem = listGET_NEXT(pxItem);
-					if ((uint32_t)pxWebCmd->xTaskToNotify == msg->xTaskToNotify) {
-						pxWebCmd->cmd_result = msg->cmd_result;
-						memcpy(pxWebCmd->data, msg->data, msg->data_len);
+					if (msg && (uint32_t)pxWebCmd->xTaskToNotify == msg->xTaskToNotify) {
+						// hand the buffer over, the waiter releases it
+						pxWebCmd->reply = msg;
+						msg = NULL;
 						// Remove the current item from the list
 						uxListRemove(pxItem);
 						xTaskNotifyGive(pxWebCmd->xTaskToNotify);
@@ -691,11 +1210,15 @@ void handle_som_mesage(Message *msg)
 		}
 	} else if (MSG_NOTIFLY == msg->msg_type) {
 		handle_notify_mesage(msg);
+	} else if (MSG_HEARTBEAT == msg->msg_type) {
+		som_liveness.heartbeats++;
 	} else {
 		printf("Unsupport msg type: 0x%x\n", msg->msg_type);
 		buf_dump((uint8_t *)msg, sizeof(*msg));
 		dump_message(*msg);
 	}
+	if (msg)
+		som_rx_release(msg);
 }
 
 void vSomPowerOffTimerCallback(TimerHandle_t Timer)
@@ -761,19 +1284,25 @@ void StopSomRestartTimer(void)
 	}
 }
 
-#define QUEUE_LENGTH 8
+static void som_frame_received(Message *msg, int crc, void *arg)
+{
+	som_liveness_touch();
+	if (crc && !som_link_get_crc_frames()) {
+		printf("SOM daemon uses crc frames\n");
+		som_link_set_crc_frames(1);
+	}
+	handle_som_mesage(msg);
+}
 
 void uart4_protocol_task(void *argument)
 {
-	Message msg;
+	uint32_t events;
 
+	som_frame_init();
 	init_transmit_mutex();
+	som_bulk_init();
 
-	xUart4MsgQueue = xQueueCreate(QUEUE_LENGTH, sizeof(Message));
-	if (xUart4MsgQueue == NULL) {
-		printf("[%s %d]:Failed to create SOM msg queue!\n",__func__,__LINE__);
-		return;
-	}
+	som_frame_decoder_init(&som_decoder, som_rx_alloc, som_frame_received, NULL);
 
 	//Init web server cmd list
 	vListInitialise(&WebCmdList);
@@ -804,23 +1333,12 @@ void uart4_protocol_task(void *argument)
 		printf("[%s %d]:Failed to create SOM restart timer!\n",__func__,__LINE__);
 		return;
 	}
+	xUart4TaskHandle = xTaskGetCurrentTaskHandle();
 	for (;;) {
-		if (xQueueReceive(xUart4MsgQueue, &(msg), portMAX_DELAY)) {
-			if (msg.header == FRAME_HEADER && msg.tail == FRAME_TAIL) {
-				// Check checksum
-				if (check_checksum(&msg)) {
-					// handle command
-					handle_som_mesage(&msg);
-				} else {
-					printf("[%s %d]:SOM msg checksum error!\n",__func__,__LINE__);
-					buf_dump((uint8_t *)&msg, sizeof(msg));
-					dump_message(msg);
-				}
-			} else {
-				printf("[%s %d]:Invalid SOM message format!\n",__func__,__LINE__);
-				buf_dump((uint8_t *)&msg, sizeof(msg));
-				dump_message(msg);
-			}
-		}
+		events = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(UART4_RX_IDLE_FLUSH_MS));
+		uart4_rx_drain();
+		if (!events && som_decoder.len)
+			som_frame_decoder_flush(&som_decoder);
+		uart4_rx_account();
 	}
 }
\ No newline at end of file
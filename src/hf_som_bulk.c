@@ -0,0 +1,235 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Bulk read of SOM objects larger than one frame: chunked with offsets, a
+ * sliding window of unacknowledged chunks and selective retransmit.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include "hf_common.h"
+#include "hf_som_bulk.h"
+#include "protocol_lib/som_frame.h"
+
+static struct {
+	SemaphoreHandle_t lock;		// one transfer at a time
+	SemaphoreHandle_t arrived;	// given for every new chunk
+	/* the fields below are shared with the protocol task, under critical section */
+	uint8_t active;
+	uint8_t object;
+	uint8_t *buf;
+	uint32_t size;
+	uint16_t nchunks;
+	uint16_t base;			// all chunks below have been received
+	uint32_t map;			// bit n: chunk base + n received
+} bulk;
+
+static struct som_bulk_stats bulk_stats;
+
+void som_bulk_init(void)
+{
+	bulk.lock = xSemaphoreCreateMutex();
+	bulk.arrived = xSemaphoreCreateBinary();
+	if (!bulk.lock || !bulk.arrived)
+		printf("[%s %d]:Failed to create bulk transfer semaphores!\n", __func__, __LINE__);
+}
+
+/**
+ * @brief  Store a CMD_BULK_DATA chunk pushed by the SOM, called from the
+ *         protocol task.
+ * @param  msg the notification, still owned by the caller
+ */
+void som_bulk_push(Message *msg)
+{
+	struct som_bulk_chunk *chunk = (struct som_bulk_chunk *)msg->data;
+	uint32_t offset, len;
+	uint16_t bit;
+	int fresh = 0;
+
+	if (msg->data_len < offsetof(struct som_bulk_chunk, data))
+		return;
+
+	taskENTER_CRITICAL();
+	if (!bulk.active || chunk->object != bulk.object || chunk->index >= bulk.nchunks)
+		goto out;
+	if (chunk->index < bulk.base || chunk->index - bulk.base >= 32 ||
+		(bulk.map & (1u << (chunk->index - bulk.base)))) {
+		bulk_stats.duplicates++;
+		goto out;
+	}
+	offset = (uint32_t)chunk->index * SOM_BULK_CHUNK_SIZE;
+	len = MIN(bulk.size - offset, SOM_BULK_CHUNK_SIZE);
+	if (msg->data_len != offsetof(struct som_bulk_chunk, data) + len)
+		goto out;
+
+	memcpy(bulk.buf + offset, chunk->data, len);
+	bit = chunk->index - bulk.base;
+	bulk.map |= 1u << bit;
+	while (bulk.map & 1) {
+		bulk.map >>= 1;
+		bulk.base++;
+	}
+	bulk_stats.chunks++;
+	fresh = 1;
+out:
+	taskEXIT_CRITICAL();
+	if (fresh)
+		xSemaphoreGive(bulk.arrived);
+}
+
+static int som_bulk_ack(uint8_t flags)
+{
+	struct som_bulk_ack ack = {
+		.object = bulk.object,
+		.flags = flags,
+	};
+
+	taskENTER_CRITICAL();
+	ack.base = bulk.base;
+	ack.map = bulk.map;
+	taskEXIT_CRITICAL();
+
+	return web_cmd_handle(CMD_BULK_ACK, &ack, sizeof(ack), 1000);
+}
+
+/* the stream runs ahead of the window base: a chunk in between was lost */
+static int som_bulk_gap(void)
+{
+	int gap;
+
+	taskENTER_CRITICAL();
+	gap = bulk.map != 0;
+	taskEXIT_CRITICAL();
+
+	return gap;
+}
+
+/**
+ * @brief  Read a SOM object with a windowed bulk transfer.
+ * @param  object the object to read
+ * @param  buf destination, max_len bytes
+ * @param  max_len buffer size, larger objects are clipped by the SOM
+ * @param  len bytes read
+ * @retval HAL_OK, or HAL_ERROR/HAL_TIMEOUT/SOM error code
+ */
+int som_bulk_read(som_bulk_object_t object, uint8_t *buf, uint32_t max_len, uint32_t *len)
+{
+	/* the reply comes back in the request buffer */
+	union {
+		struct som_bulk_open req;
+		struct som_bulk_info info;
+	} open = {
+		.req = {
+			.object = object,
+			.window = SOM_BULK_WINDOW,
+			.max_len = max_len,
+		},
+	};
+	struct som_bulk_info info;
+	TickType_t start = xTaskGetTickCount();
+	uint16_t acked, gap_base = UINT16_MAX;
+	int retry = 0;
+	int ret;
+
+	*len = 0;
+	if (object >= SOM_BULK_OBJECT_MAX || !bulk.lock)
+		return HAL_ERROR;
+	if (xSemaphoreTake(bulk.lock, pdMS_TO_TICKS(1000)) != pdTRUE)
+		return HAL_BUSY;
+
+	ret = web_cmd_handle(CMD_BULK_OPEN, &open, sizeof(open), 1000);
+	if (HAL_OK != ret)
+		goto out;
+	info = open.info;
+	if (info.size > max_len) {
+		printf("[%s %d]:SOM object %d size %lu over %lu\n", __func__, __LINE__,
+			object, info.size, max_len);
+		ret = HAL_ERROR;
+		goto out;
+	}
+
+	taskENTER_CRITICAL();
+	bulk.object = object;
+	bulk.buf = buf;
+	bulk.size = info.size;
+	bulk.nchunks = (info.size + SOM_BULK_CHUNK_SIZE - 1) / SOM_BULK_CHUNK_SIZE;
+	bulk.base = 0;
+	bulk.map = 0;
+	bulk.active = 1;
+	taskEXIT_CRITICAL();
+	xSemaphoreTake(bulk.arrived, 0);
+
+	/* the first ack opens the window */
+	acked = 0;
+	ret = som_bulk_ack(0);
+	while (bulk.base < bulk.nchunks) {
+		/* a lost ack or ack reply is recovered like a lost chunk */
+		if (HAL_TIMEOUT == ret && retry < SOM_BULK_RETRY)
+			ret = HAL_OK;
+		if (HAL_OK != ret)
+			break;
+		if (xSemaphoreTake(bulk.arrived, pdMS_TO_TICKS(SOM_BULK_CHUNK_TIMEOUT_MS)) != pdTRUE) {
+			if (++retry > SOM_BULK_RETRY) {
+				ret = HAL_TIMEOUT;
+				break;
+			}
+			bulk_stats.timeouts++;
+			acked = bulk.base;
+			ret = som_bulk_ack(SOM_BULK_ACK_TIMEOUT);
+			continue;
+		}
+		retry = 0;
+		if (som_bulk_gap() && gap_base != bulk.base) {
+			/* one early ack per hole, the SOM resends what is missing */
+			bulk_stats.gaps++;
+			gap_base = acked = bulk.base;
+			ret = som_bulk_ack(0);
+		} else if (bulk.base - acked >= SOM_BULK_WINDOW / 2 && bulk.base < bulk.nchunks) {
+			acked = bulk.base;
+			ret = som_bulk_ack(0);
+		}
+	}
+
+	/* complete even if the reply to the last ack got lost, the crc has the final say */
+	if (bulk.base >= bulk.nchunks)
+		ret = HAL_OK;
+	taskENTER_CRITICAL();
+	bulk.active = 0;
+	taskEXIT_CRITICAL();
+
+	if (HAL_OK == ret) {
+		/* base at the chunk count closes the transfer on the SOM */
+		som_bulk_ack(0);
+		if (som_frame_crc32(buf, info.size) != info.crc) {
+			printf("[%s %d]:SOM object %d crc mismatch\n", __func__, __LINE__, object);
+			ret = HAL_ERROR;
+		}
+	} else {
+		som_bulk_ack(SOM_BULK_ACK_ABORT);
+	}
+
+out:
+	if (HAL_OK == ret) {
+		*len = info.size;
+		bulk_stats.transfers++;
+		bulk_stats.last_bytes = info.size;
+		bulk_stats.last_ms = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+	} else {
+		bulk_stats.failed++;
+	}
+	xSemaphoreGive(bulk.lock);
+	return ret;
+}
+
+void som_bulk_get_stats(struct som_bulk_stats *stats)
+{
+	taskENTER_CRITICAL();
+	*stats = bulk_stats;
+	taskEXIT_CRITICAL();
+}
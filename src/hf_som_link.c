@@ -0,0 +1,339 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * SOM UART4 link management: runtime baud rate negotiation, echo verification,
+ * link quality accounting and automatic fallback to the default rate.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "cmsis_os2.h"
+#include "main.h"
+#include "hf_common.h"
+#include "hf_som_link.h"
+
+#define ARRAY_SIZE(x)	(sizeof(x) / sizeof((x)[0]))
+
+void acquire_transmit_mutex(void);
+void release_transmit_mutex(void);
+static void som_link_fallback(void);
+
+/* candidate rates, highest first, all above SOM_LINK_DEFAULT_BAUD */
+static const uint32_t link_rates[] = {
+	2000000, 1500000, 1000000, 921600, 460800, 230400,
+};
+
+static struct som_link_stats link = {
+	.baudrate = SOM_LINK_DEFAULT_BAUD,
+	.ceiling = SOM_LINK_MAX_BAUD,
+};
+static uint32_t link_err_snapshot;
+static TickType_t link_retry_at;
+static volatile uint32_t link_request;
+
+void som_link_count(som_link_counter_t counter)
+{
+	taskENTER_CRITICAL();
+	link.cnt[counter]++;
+	taskEXIT_CRITICAL();
+}
+
+void som_link_add(som_link_counter_t counter, uint32_t n)
+{
+	taskENTER_CRITICAL();
+	link.cnt[counter] += n;
+	taskEXIT_CRITICAL();
+}
+
+void som_link_count_from_isr(som_link_counter_t counter)
+{
+	UBaseType_t uxSavedInterruptStatus;
+
+	uxSavedInterruptStatus = taskENTER_CRITICAL_FROM_ISR();
+	link.cnt[counter]++;
+	taskEXIT_CRITICAL_FROM_ISR(uxSavedInterruptStatus);
+}
+
+uint32_t som_link_get_baudrate(void)
+{
+	uint32_t baudrate;
+
+	taskENTER_CRITICAL();
+	baudrate = link.baudrate;
+	taskEXIT_CRITICAL();
+
+	return baudrate;
+}
+
+void som_link_set_crc_frames(uint8_t enable)
+{
+	link.crc_frames = enable;
+}
+
+uint8_t som_link_get_crc_frames(void)
+{
+	return link.crc_frames;
+}
+
+void som_link_get_stats(struct som_link_stats *stats)
+{
+	taskENTER_CRITICAL();
+	memcpy(stats, &link, sizeof(link));
+	taskEXIT_CRITICAL();
+}
+
+static uint32_t som_link_errors(void)
+{
+	uint32_t errs;
+
+	taskENTER_CRITICAL();
+	errs = link.cnt[LINK_CNT_TX_ERR] + link.cnt[LINK_CNT_RX_CHECKSUM_ERR] +
+		link.cnt[LINK_CNT_RX_FORMAT_ERR] + link.cnt[LINK_CNT_RX_OVERRUN] +
+		link.cnt[LINK_CNT_RX_LINE_ERR] + link.cnt[LINK_CNT_TIMEOUT];
+	taskEXIT_CRITICAL();
+
+	return errs;
+}
+
+/* reject rates the UART4 (APB1, 16x oversampling) can not hit within 1% */
+static int som_link_baud_ok(uint32_t baud)
+{
+	uint32_t pclk = HAL_RCC_GetPCLK1Freq();
+	uint32_t div, real, diff;
+
+	if (baud == 0 || baud > pclk / 16)
+		return 0;
+
+	div = (pclk + baud / 2) / baud;
+	real = pclk / div;
+	diff = real > baud ? real - baud : baud - real;
+
+	return diff * 1000 / baud <= 10;
+}
+
+/* next candidate strictly below baud, SOM_LINK_DEFAULT_BAUD if there is none */
+static uint32_t som_link_lower_rate(uint32_t baud)
+{
+	for (int i = 0; i < ARRAY_SIZE(link_rates); i++) {
+		if (link_rates[i] < baud)
+			return link_rates[i];
+	}
+	return SOM_LINK_DEFAULT_BAUD;
+}
+
+static int som_link_switch(uint32_t baud)
+{
+	int ret;
+
+	/* hold the transmit lock so no frame leaves half way through the switch */
+	acquire_transmit_mutex();
+	ret = uart_set_baudrate(UART4, baud);
+	release_transmit_mutex();
+	if (ret) {
+		printf("[%s %d]:Failed to set UART4 to %lu baud!\n", __func__, __LINE__, baud);
+		return ret;
+	}
+
+	taskENTER_CRITICAL();
+	link.baudrate = baud;
+	taskEXIT_CRITICAL();
+
+	return 0;
+}
+
+static int som_link_echo(void)
+{
+	uint8_t pattern[SOM_LINK_ECHO_LEN];
+	uint8_t echo[SOM_LINK_ECHO_LEN];
+	uint32_t seed = xTaskGetTickCount();
+	int i;
+
+	/* pseudo random payload, plus the frame magic to catch bit slips on it */
+	for (i = 0; i < SOM_LINK_ECHO_LEN; i++) {
+		seed = seed * 1103515245 + 12345;
+		pattern[i] = seed >> 16;
+	}
+	memcpy(pattern, "\x55\xAA\x5A\xA5\xBA\xBD\x00\xFF", 8);
+
+	for (i = 0; i < SOM_LINK_ECHO_RETRY; i++) {
+		memcpy(echo, pattern, sizeof(echo));
+		if (HAL_OK == web_cmd_handle(CMD_LINK_ECHO, echo, sizeof(echo), 200) &&
+			0 == memcmp(echo, pattern, sizeof(echo)))
+			return 0;
+	}
+
+	return -1;
+}
+
+static void som_link_put_le32(uint8_t *p, uint32_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
+
+static uint32_t som_link_get_le32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* negotiate the fastest rate up to max_baud, 0 on success */
+static int som_link_negotiate(uint32_t max_baud)
+{
+	uint8_t buf[sizeof(link_rates)];
+	uint32_t baud;
+	int i, n = 0;
+	int ret;
+
+	if (SOM_DAEMON_ON != get_som_daemon_state())
+		return -1;
+
+	if (SOM_LINK_DEFAULT_BAUD != som_link_get_baudrate())
+		som_link_fallback();
+	if (max_baud <= SOM_LINK_DEFAULT_BAUD)
+		return 0;
+
+	for (i = 0; i < ARRAY_SIZE(link_rates); i++) {
+		if (link_rates[i] <= max_baud && som_link_baud_ok(link_rates[i]))
+			som_link_put_le32(&buf[4 * n++], link_rates[i]);
+	}
+	if (n == 0)
+		return -1;
+
+	link.negotiations++;
+	ret = web_cmd_handle(CMD_LINK_BAUD, buf, 4 * n, 1000);
+	if (HAL_OK != ret) {
+		/* older daemons either reject or ignore the request */
+		printf("SOM link speed negotiation not supported(ret %d)!\n", ret);
+		link.unsupported = 1;
+		link.negotiate_fail++;
+		return -1;
+	}
+
+	baud = som_link_get_le32(buf);
+	if (baud != SOM_LINK_DEFAULT_BAUD && (baud > max_baud || !som_link_baud_ok(baud))) {
+		printf("SOM link: invalid rate %lu chosen by SOM!\n", baud);
+		link.negotiate_fail++;
+		osDelay(SOM_LINK_REVERT_MS);
+		return -1;
+	}
+
+	osDelay(SOM_LINK_SWITCH_SETTLE_MS);
+	if (som_link_switch(baud) == 0 && som_link_echo() == 0) {
+		link_err_snapshot = som_link_errors();
+		printf("SOM link switched to %lu baud\n", baud);
+		return 0;
+	}
+
+	printf("SOM link echo at %lu baud failed, back to %d\n", baud, SOM_LINK_DEFAULT_BAUD);
+	som_link_switch(SOM_LINK_DEFAULT_BAUD);
+	link.ceiling = som_link_lower_rate(baud);
+	link.negotiate_fail++;
+	/* give the SOM time to revert on its own */
+	osDelay(SOM_LINK_REVERT_MS);
+	link_err_snapshot = som_link_errors();
+
+	return -1;
+}
+
+/* drop back to the default rate and lower the ceiling for the next attempt */
+static void som_link_fallback(void)
+{
+	uint8_t buf[4];
+	uint32_t baud = som_link_get_baudrate();
+
+	if (SOM_LINK_DEFAULT_BAUD == baud)
+		return;
+
+	/* best effort, the SOM reverts by itself when the link is too bad for this */
+	som_link_put_le32(buf, SOM_LINK_DEFAULT_BAUD);
+	web_cmd_handle(CMD_LINK_BAUD, buf, sizeof(buf), 200);
+	osDelay(SOM_LINK_SWITCH_SETTLE_MS);
+	som_link_switch(SOM_LINK_DEFAULT_BAUD);
+
+	link.fallbacks++;
+	link.ceiling = som_link_lower_rate(baud);
+	link_retry_at = xTaskGetTickCount() + pdMS_TO_TICKS(SOM_LINK_RETRY_MS);
+	link_err_snapshot = som_link_errors();
+}
+
+/**
+ * @brief  Forget the negotiated state, UART4 has just been (re)initialized at
+ *         the default rate.
+ */
+void som_link_reset(void)
+{
+	taskENTER_CRITICAL();
+	link.baudrate = SOM_LINK_DEFAULT_BAUD;
+	link.ceiling = SOM_LINK_MAX_BAUD;
+	link.unsupported = 0;
+	link.crc_frames = 0;
+	taskEXIT_CRITICAL();
+	link_retry_at = xTaskGetTickCount();
+}
+
+/**
+ * @brief  Ask the keeplive task to renegotiate the link.
+ * @param  max_baud highest rate to propose, SOM_LINK_DEFAULT_BAUD or lower
+ *         forces the link back to the default rate.
+ */
+void som_link_request(uint32_t max_baud)
+{
+	link_request = max_baud ? max_baud : SOM_LINK_DEFAULT_BAUD;
+}
+
+/**
+ * @brief  Link quality check, called once per keeplive period.
+ * @param  daemon_state current SOM daemon state.
+ */
+void som_link_poll(deamon_stats_t daemon_state)
+{
+	uint32_t errs;
+	uint32_t request;
+
+	if (SOM_DAEMON_ON != daemon_state) {
+		link_request = 0;
+		/* the daemon restarts at the default rate */
+		if (SOM_LINK_DEFAULT_BAUD != som_link_get_baudrate() &&
+			SOM_POWER_ON == get_som_power_state())
+			som_link_switch(SOM_LINK_DEFAULT_BAUD);
+		som_link_reset();
+		link_err_snapshot = som_link_errors();
+		return;
+	}
+
+	request = link_request;
+	if (request) {
+		link_request = 0;
+		taskENTER_CRITICAL();
+		link.unsupported = 0;
+		link.ceiling = MIN(request, SOM_LINK_MAX_BAUD);
+		taskEXIT_CRITICAL();
+		som_link_negotiate(link.ceiling);
+		if (request <= SOM_LINK_DEFAULT_BAUD)
+			link.ceiling = SOM_LINK_DEFAULT_BAUD;
+		return;
+	}
+
+	errs = som_link_errors();
+	if (SOM_LINK_DEFAULT_BAUD != som_link_get_baudrate() &&
+		errs - link_err_snapshot >= SOM_LINK_ERR_THRESHOLD) {
+		printf("SOM link at %lu baud: %lu errors, falling back to %d\n",
+			som_link_get_baudrate(), errs - link_err_snapshot, SOM_LINK_DEFAULT_BAUD);
+		som_link_fallback();
+		return;
+	}
+	link_err_snapshot = errs;
+
+#if SOM_LINK_AUTO_NEGOTIATE
+	if (SOM_LINK_DEFAULT_BAUD == som_link_get_baudrate() && !link.unsupported &&
+		link.ceiling > SOM_LINK_DEFAULT_BAUD &&
+		(int32_t)(xTaskGetTickCount() - link_retry_at) >= 0)
+		som_link_negotiate(link.ceiling);
+#endif
+}
@@ -0,0 +1,228 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * SOM telemetry subscription: the SOM daemon pushes PVT, CPU load and thermal
+ * data, readers are served from the cached values instead of a UART round trip.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "hf_common.h"
+#include "hf_som_telemetry.h"
+
+enum {
+	TOPIC_PVT,
+	TOPIC_CPU_LOAD,
+	TOPIC_THERMAL,
+	TOPIC_MAX,
+};
+
+static struct {
+	PVTInfo pvt;
+	struct som_cpu_load load;
+	struct som_thermal thermal;
+	TickType_t tick[TOPIC_MAX];
+	uint8_t valid;			// bit per topic
+	uint8_t subscribed;
+	uint8_t unsupported;
+	uint8_t resubscribe;
+	uint16_t interval_ms;
+	uint32_t pushes;
+} telemetry = {
+	.interval_ms = SOM_TELEMETRY_INTERVAL_MS,
+};
+
+/*
+ * Values older than this are not trusted: the SOM missed its push schedule,
+ * or the PVT read on demand once a keeplive period stopped coming.
+ */
+static TickType_t som_telemetry_max_age(void)
+{
+	uint16_t interval = telemetry.subscribed ? telemetry.interval_ms : SOM_TELEMETRY_INTERVAL_MS;
+
+	return pdMS_TO_TICKS(2 * interval + 500);
+}
+
+/*
+ * Copy the cached topic out if it is fresh, 0 on success. pushed: only while
+ * the subscription keeps it fresh, otherwise a reply to an on demand read
+ * counts as well.
+ */
+static int som_telemetry_cached(int topic, int pushed, void *dst, const void *src, size_t len)
+{
+	int ret = -1;
+
+	taskENTER_CRITICAL();
+	if ((telemetry.subscribed || !pushed) && (telemetry.valid & (1 << topic)) &&
+		xTaskGetTickCount() - telemetry.tick[topic] <= som_telemetry_max_age()) {
+		memcpy(dst, src, len);
+		ret = 0;
+	}
+	taskEXIT_CRITICAL();
+
+	return ret;
+}
+
+static void som_telemetry_store(int topic, void *dst, const void *src, size_t len)
+{
+	taskENTER_CRITICAL();
+	memcpy(dst, src, len);
+	telemetry.tick[topic] = xTaskGetTickCount();
+	telemetry.valid |= 1 << topic;
+	taskEXIT_CRITICAL();
+}
+
+/* cached value when subscribed, otherwise a round trip that refreshes the cache */
+static int som_telemetry_get(int topic, CommandType cmd, void *dst, void *cache, size_t len)
+{
+	int ret;
+
+	if (som_telemetry_cached(topic, 1, dst, cache, len) == 0)
+		return HAL_OK;
+
+	ret = web_cmd_handle(cmd, dst, len, 1000);
+	if (HAL_OK == ret)
+		som_telemetry_store(topic, cache, dst, len);
+	return ret;
+}
+
+int som_telemetry_get_pvt(PVTInfo *pvt)
+{
+	return som_telemetry_get(TOPIC_PVT, CMD_PVT_INFO, pvt, &telemetry.pvt, sizeof(*pvt));
+}
+
+/* the last PVT, pushed or read on demand, never a round trip: -1 if stale */
+int som_telemetry_peek_pvt(PVTInfo *pvt)
+{
+	return som_telemetry_cached(TOPIC_PVT, 0, pvt, &telemetry.pvt, sizeof(*pvt));
+}
+
+int som_telemetry_get_cpu_load(struct som_cpu_load *load)
+{
+	return som_telemetry_get(TOPIC_CPU_LOAD, CMD_CPU_LOAD, load, &telemetry.load, sizeof(*load));
+}
+
+int som_telemetry_get_thermal(struct som_thermal *thermal)
+{
+	return som_telemetry_get(TOPIC_THERMAL, CMD_THERMAL_INFO, thermal, &telemetry.thermal,
+		sizeof(*thermal));
+}
+
+/**
+ * @brief  Store a telemetry MSG_NOTIFLY pushed by the SOM.
+ * @param  msg the notification, still owned by the caller
+ */
+void som_telemetry_push(Message *msg)
+{
+	switch (msg->cmd_type) {
+	case CMD_PVT_INFO:
+		if (msg->data_len < sizeof(PVTInfo))
+			return;
+		som_telemetry_store(TOPIC_PVT, &telemetry.pvt, msg->data, sizeof(PVTInfo));
+		break;
+	case CMD_CPU_LOAD:
+		if (msg->data_len < sizeof(struct som_cpu_load))
+			return;
+		som_telemetry_store(TOPIC_CPU_LOAD, &telemetry.load, msg->data, sizeof(struct som_cpu_load));
+		break;
+	case CMD_THERMAL_INFO:
+		if (msg->data_len < sizeof(struct som_thermal))
+			return;
+		som_telemetry_store(TOPIC_THERMAL, &telemetry.thermal, msg->data, sizeof(struct som_thermal));
+		break;
+	default:
+		return;
+	}
+	telemetry.pushes++;
+}
+
+/**
+ * @brief  Change the push interval, 0 cancels the subscription and reads go
+ *         back to on demand requests.
+ */
+void som_telemetry_set_interval(uint16_t interval_ms)
+{
+	telemetry.interval_ms = interval_ms;
+	telemetry.unsupported = 0;
+	telemetry.resubscribe = 1;
+}
+
+void som_telemetry_get_status(struct som_telemetry_status *status)
+{
+	TickType_t now;
+
+	taskENTER_CRITICAL();
+	now = xTaskGetTickCount();
+	status->subscribed = telemetry.subscribed;
+	status->unsupported = telemetry.unsupported;
+	status->interval_ms = telemetry.interval_ms;
+	status->pushes = telemetry.pushes;
+	for (int i = 0; i < TOPIC_MAX; i++) {
+		status->age_ms[i] = (telemetry.valid & (1 << i)) ?
+			(now - telemetry.tick[i]) * portTICK_PERIOD_MS : UINT32_MAX;
+	}
+	taskEXIT_CRITICAL();
+}
+
+static void som_telemetry_subscribe(void)
+{
+	struct som_telemetry_sub sub = {
+		.topics = SOM_TELEMETRY_ALL,
+		.temp_delta = SOM_TELEMETRY_TEMP_DELTA,
+		.load_delta = SOM_TELEMETRY_LOAD_DELTA,
+	};
+	uint8_t replied;
+	int ret;
+
+	if (telemetry.unsupported || (telemetry.subscribed && !telemetry.resubscribe))
+		return;
+	if (!telemetry.subscribed && !telemetry.interval_ms && !telemetry.resubscribe)
+		return;
+
+	telemetry.resubscribe = 0;
+	sub.interval_ms = telemetry.interval_ms;
+	if (!sub.interval_ms)
+		sub.topics = 0;
+	ret = som_cmd_request(CMD_TELEMETRY_SUB, &sub, sizeof(sub), 1000, &replied);
+	if (HAL_OK != ret && !replied) {
+		/* lost or not sent (timeout, bulk lane busy): try again next period */
+		telemetry.resubscribe = 1;
+		return;
+	}
+	if (HAL_OK != ret) {
+		printf("SOM telemetry subscription not supported(ret %d), reading on demand\n", ret);
+		telemetry.unsupported = 1;
+		telemetry.subscribed = 0;
+		return;
+	}
+	telemetry.subscribed = sub.topics != 0;
+}
+
+/**
+ * @brief  Keep the subscription in line with the daemon state, called once per
+ *         keeplive period. Without a subscription the PVT is read on demand, so
+ *         the temperature alarms get a sample every period either way.
+ * @param  daemon_state current SOM daemon state.
+ */
+void som_telemetry_poll(deamon_stats_t daemon_state)
+{
+	PVTInfo pvt;
+
+	if (SOM_DAEMON_ON != daemon_state) {
+		/* a restarted daemon has forgotten us, and the cache is stale */
+		taskENTER_CRITICAL();
+		telemetry.subscribed = 0;
+		telemetry.unsupported = 0;
+		telemetry.valid = 0;
+		taskEXIT_CRITICAL();
+		return;
+	}
+
+	som_telemetry_subscribe();
+	if (!telemetry.subscribed)
+		som_telemetry_get_pvt(&pvt);
+}
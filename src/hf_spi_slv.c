@@ -9,11 +9,23 @@
  */
 #include "main.h"
 #include <stdio.h>
+#include "FreeRTOS.h"
+#include "semphr.h"
 #include "hf_spi_slv.h"
 #include "stm32f4xx_hal.h"
 
 uint32_t get_regval(uint8_t reg);
 
+/* one SOM memory access on SPI2 at a time, a read is two transfers */
+static SemaphoreHandle_t spi_lock;
+
+void es_spi_init(void)
+{
+	spi_lock = xSemaphoreCreateMutex();
+	if (!spi_lock)
+		printf("[%s %d]:Failed to create spi mutex!\n", __func__, __LINE__);
+}
+
 HAL_StatusTypeDef spi_transmit(uint8_t *pData, uint16_t Size)
 {
 	HAL_StatusTypeDef ret;
@@ -183,6 +195,8 @@ int eswin_rx(uint8_t *rcvBuf, uint64_t addr, int len)
 {
 	int ret = HAL_OK, xlen, offset = 0;
 	uint8_t sndBuf[32];
+
+	xSemaphoreTake(spi_lock, portMAX_DELAY);
 	while (len) {
 		if (len >= 32) {
 			sndBuf[0] = 0x2;
@@ -223,6 +237,7 @@ int eswin_rx(uint8_t *rcvBuf, uint64_t addr, int len)
 		offset += xlen;
 	}
 fail:
+	xSemaphoreGive(spi_lock);
 	return ret;
 }
 
@@ -242,6 +257,8 @@ int es_spi_writel(uint64_t addr, uint32_t val)
 int es_spi_write(uint8_t *buf, uint64_t addr, int len)
 {
 	int xlen, offset = 0, ret = HAL_OK;
+
+	xSemaphoreTake(spi_lock, portMAX_DELAY);
 	while (len) {
 		if (len >= 32) {
 			len -= 32;
@@ -273,6 +290,7 @@ int es_spi_write(uint8_t *buf, uint64_t addr, int len)
 		offset += xlen;
 	}
 fail:
+	xSemaphoreGive(spi_lock);
 	return ret;
 }
 
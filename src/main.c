@@ -31,6 +31,10 @@
 #include "telnet_mcu_server.h"
 /* Private includes ----------------------------------------------------------*/
 #include "hf_common.h"
+#include "hf_i2c.h"
+#include "hf_eeprom.h"
+#include "hf_power_monitor.h"
+#include "hf_spi_slv.h"
 /* Private typedef -----------------------------------------------------------*/
 
 /* Private define ------------------------------------------------------------*/
@@ -68,6 +72,13 @@ const osThreadAttr_t power_task_attributes = {
   .priority = (osPriority_t) osPriorityNormal,
 };
 
+osThreadId_t power_monitor_task_handle;
+const osThreadAttr_t power_monitor_task_attributes = {
+  .name = "PowerMonTask",
+  .stack_size = 1024 * 2,
+  .priority = (osPriority_t) osPriorityNormal,
+};
+
 osThreadId_t key_task_handle;
 const osThreadAttr_t gpio_task_attributes = {
   .name = "KeyTask",
@@ -82,6 +93,21 @@ const osThreadAttr_t http_task_attributes = {
   .priority = (osPriority_t) osPriorityNormal,
 };
 
+/* I2C timeouts and bus recovery, ahead of every task waiting on the bus */
+osThreadId_t i2c_task_handle;
+const osThreadAttr_t i2c_task_attributes = {
+  .name = "I2cTask",
+  .stack_size = 1024,
+  .priority = (osPriority_t) osPriorityHigh,
+};
+
+osThreadId_t eeprom_task_handle;
+const osThreadAttr_t eeprom_task_attributes = {
+  .name = "EepromTask",
+  .stack_size = 1024,
+  .priority = (osPriority_t) osPriorityNormal,
+};
+
 /* Private function prototypes -----------------------------------------------*/
 void hf_main_task(void *argument);
 void protocol_task(void *argument);
@@ -108,6 +134,8 @@ int main(void)
   osKernelInitialize();
 
   /* add mutexes, ... */
+  hf_i2c_init();
+  es_spi_init();
 
   /* add semaphores, ... */
 
@@ -120,6 +148,7 @@ int main(void)
   main_task_handle = osThreadNew(hf_main_task, NULL, &main_task_attributes);
 
   /* add threads, ... */
+  i2c_task_handle = osThreadNew(hf_i2c_task, NULL, &i2c_task_attributes);
 
   /* add events, ... */
 
@@ -160,12 +189,14 @@ void hf_main_task(void *argument)
   #if ES_EEPROM_INFO_TEST
   es_eeprom_info_test();
   #endif
+  eeprom_task_handle = osThreadNew(hf_eeprom_task, NULL, &eeprom_task_attributes);
 
   /* init code for LWIP */
   eth_get_address();
   MX_LWIP_Init();
 
   power_task_handle = osThreadNew(hf_power_task, NULL, &power_task_attributes);
+  power_monitor_task_handle = osThreadNew(hf_power_monitor_task, NULL, &power_monitor_task_attributes);
   http_task_handle = osThreadNew(hf_http_task, NULL, &http_task_attributes);
   key_task_handle = osThreadNew(hf_gpio_task, NULL, &gpio_task_attributes);
   uart4_protocol_task_handle = osThreadNew(uart4_protocol_task, NULL, &protocol_task_attributes);
@@ -1,10 +1,9 @@
 #include "protocol_lib/protocol.h"
 #include <stdio.h>
 
-uint8_t es_frame_init(b_frame_class_t *pframe, b_frame_t *pframeinit)
+uint8_t es_frame_init(b_frame_class_t *pframe, b_frame_t *pframeinit, b_frame_handler_t handler)
 {
-	uint8_t err = 0;
-	if ((!pframeinit) || (!pframe)) {
+	if ((!pframeinit) || (!pframe) || (!handler)) {
 		return B_ERROR;
 	}
 
@@ -13,145 +12,143 @@ uint8_t es_frame_init(b_frame_class_t *pframe, b_frame_t *pframeinit)
 	pframe->frame_info.head_len = pframeinit->head_len;
 	pframe->frame_info.end = pframeinit->end;
 	pframe->frame_info.end_len = pframeinit->end_len;
+	pframe->handler = handler;
+	memset(&pframe->stats, 0, sizeof(pframe->stats));
+	es_frame_reset(pframe);
 
-	err = ring_buf_init(&pframe->_frame_ring, pframe->_in_frame_buffer_size);
-	if (!err)
-		return B_SUCCESS;
-	return B_ERROR;
-}
-
-uint8_t es_frame_put(b_frame_class_t *pframe, uint8_t *dat, uint32_t len)
-{
-	if (!dat || len == 0) {
-		return B_ERROR;
-	}
-	uint32_t putlen = write_ring_buf(&pframe->_frame_ring, dat, len);
-
-	if (putlen != len) {
-		ring_buf_clr(&pframe->_frame_ring);
-		// printf("%s-err:The ringbuffer is full putlen %x\r\n", pframe->frame_info.pname, putlen);
-		return B_ERROR;
-	}
 	return B_SUCCESS;
 }
 
-void es_frame_fifo_clear(b_frame_class_t *pframe)
+/* drop any partial frame and hunt for the next header */
+void es_frame_reset(b_frame_class_t *pframe)
 {
-	if (!pframe) {
-		// printf("%s-err:pframe is null\r\n", pframe->frame_info.pname);
-		return;
-	}
-	ring_buf_clr(&pframe->_frame_ring);
+	pframe->state = pframe->frame_info.head_len ? CHECK_HEAD : CHECK_CMD;
+	pframe->pos = 0;
 }
 
-uint8_t es_check_head(b_frame_class_t *pframe)
+static void es_frame_reject(b_frame_class_t *pframe, uint32_t *counter)
 {
-	uint8_t i = 0;
-	uint8_t tmp;
-	int32_t len = get_ring_buf_len(&pframe->_frame_ring);
-	if (len < 0 || (len < pframe->frame_info.head_len + pframe->frame_info.end_len + 1))
-		return B_ERROR;
-
-	if (pframe->frame_info.head_len == 0)
-		return B_SUCCESS;
-
-	do {
-		read_ring_buf(&pframe->_frame_ring, &tmp, 1);
-		if (tmp == pframe->frame_info.head[i]) {
-			if (++i == pframe->frame_info.head_len) {
-				return B_SUCCESS;
-			}
-		} else {
-			break;
-		}
-	} while (1);
-	// printf("%s %d B_ERROR\n", __func__, __LINE__);
-
-	return B_ERROR;
+	(*counter)++;
+	es_frame_reset(pframe);
+	pframe->handler(pframe, B_ERROR);
 }
 
-uint8_t es_get_cmd(b_frame_class_t *pframe)
+static void es_frame_done(b_frame_class_t *pframe)
 {
-	uint8_t cmd, ret = B_ERROR;
-	if (read_ring_buf(&pframe->_frame_ring, &cmd, 1) == 1) {
-		// printf("cmd %x\n", cmd);
-		if (CMD_EEPROM_WP <= cmd && CMD_RES >= cmd) {
-			pframe->frame.cmd = cmd;
-			ret = B_SUCCESS;
-		}
-	}
-	// printf("%s %d, ret %d\n", __func__, __LINE__, ret);
-	return ret;
+	pframe->frame.is_valid = 1;
+	pframe->stats.frames++;
+	es_frame_reset(pframe);
+	pframe->handler(pframe, B_SUCCESS);
 }
 
-uint8_t es_check_frame(b_frame_class_t *pframe)
+/* skip to the header and match it, returns the number of bytes consumed */
+static uint32_t es_check_head(b_frame_class_t *pframe, const uint8_t *dat, uint32_t len)
 {
-	uint8_t len, xor;
-	uint8_t buf[MAX_FRAME_LEN];
-	uint8_t current_xor = 0;
-
-	// printf("%s %d\n", __func__, __LINE__);
-	if (read_ring_buf(&pframe->_frame_ring, &len, 1) != 1)
-		return B_ERROR;
-
-	// printf("%s %d\n", __func__, __LINE__);
-	memset(buf, 0, MAX_FRAME_LEN * sizeof(uint8_t));
-	// printf("%s %d\n", __func__, __LINE__);
-	if (read_ring_buf(&pframe->_frame_ring, buf, len) != len)
-		return B_ERROR;
-	pframe->frame.len = len;
-	for (int i = 0; i < len; i++) {
-		current_xor ^= buf[i];
-		printf("buf[%d] %x\n", i, buf[i]);
-	}
-
-	if (read_ring_buf(&pframe->_frame_ring, &xor, 1) != 1)
-		return B_ERROR;
-	if (current_xor == xor) {
-		memset(&pframe->frame.data.value, 0, sizeof(pframe->frame.data.value));
-		memcpy(&pframe->frame.data.value, buf, len);
-		return B_SUCCESS;
+	const uint8_t *head = (const uint8_t *)pframe->frame_info.head;
+	const uint8_t *p;
+	uint32_t i = 0;
+
+	while (i < len) {
+		if (pframe->pos == 0) {
+			p = memchr(dat + i, head[0], len - i);
+			if (!p) {
+				pframe->stats.dropped += len - i;
+				return len;
+			}
+			pframe->stats.dropped += p - (dat + i);
+			i = p - dat;
+		}
+		if (dat[i] == head[pframe->pos]) {
+			i++;
+			if (++pframe->pos == pframe->frame_info.head_len) {
+				pframe->state = CHECK_CMD;
+				pframe->pos = 0;
+				return i;
+			}
+		} else {
+			/* no repeated prefix in the header, retry this byte as its first */
+			pframe->stats.dropped += pframe->pos;
+			pframe->pos = 0;
+		}
 	}
-	return B_ERROR;
-}
-
-uint8_t es_get_cmd_and_data(b_frame_class_t *pframe)
-{
-	if (es_get_cmd(pframe) != B_SUCCESS)
-		return B_ERROR;
-	if (es_check_frame(pframe) != B_SUCCESS)
-		return B_ERROR;
-	return B_SUCCESS;
+	return i;
 }
 
-uint8_t es_check_tail(b_frame_class_t *pframe)
+/**
+ * @brief  Feed a contiguous span of received bytes to the frame parser, the
+ *         handler is called for every complete or rejected frame.
+ * @param  pframe the frame parser
+ * @param  dat received bytes
+ * @param  len number of bytes
+ */
+void es_frame_parse(b_frame_class_t *pframe, const uint8_t *dat, uint32_t len)
 {
-	uint8_t i = 0;
-	uint8_t tmp;
-	uint16_t len = get_ring_buf_len(&pframe->_frame_ring);
-
-	if (len < pframe->frame_info.end_len) {
-		// printf("%s %d B_ERROR\n", __func__, __LINE__);
-		return B_ERROR;
-	}
-
-	if (pframe->frame_info.end_len == 0) {
-		// printf("%s %d B_SUCCESS\n", __func__, __LINE__);
-		return B_SUCCESS;
-	}
-
-	do {
-		ring_buf_check_get(&pframe->_frame_ring, &tmp, 1);
-		// printf("tmp(%d) %x end %x\n", i, tmp, pframe->frame_info.end[i]);
-		if (tmp == pframe->frame_info.end[i]) {
-			ring_buf_clr_len(&pframe->_frame_ring, 1);
-			if (++i == pframe->frame_info.end_len) {
-				return B_SUCCESS;
+	struct frame_data *frame = &pframe->frame;
+	const uint8_t *end = (const uint8_t *)pframe->frame_info.end;
+	uint32_t i = 0, n;
+	uint8_t c;
+
+	while (i < len) {
+		switch (pframe->state) {
+		case CHECK_HEAD:
+			i += es_check_head(pframe, dat + i, len - i);
+			break;
+		case CHECK_CMD:
+			c = dat[i++];
+			if (CMD_EEPROM_WP > c || CMD_RES < c) {
+				es_frame_reject(pframe, &pframe->stats.cmd_err);
+				break;
 			}
-		} else {
+			frame->cmd = c;
+			frame->is_valid = 0;
+			pframe->state = CHECK_FRAME_LEN;
+			break;
+		case CHECK_FRAME_LEN:
+			c = dat[i++];
+			if (c > sizeof(frame->data)) {
+				es_frame_reject(pframe, &pframe->stats.len_err);
+				break;
+			}
+			frame->len = c;
+			memset(&frame->data, 0, sizeof(frame->data));
+			pframe->xor = 0;
+			pframe->pos = 0;
+			pframe->state = c ? CHECK_DATA : CHECK_XOR;
+			break;
+		case CHECK_DATA:
+			n = MIN(len - i, (uint32_t)(frame->len - pframe->pos));
+			memcpy((uint8_t *)&frame->data + pframe->pos, dat + i, n);
+			for (uint32_t k = 0; k < n; k++)
+				pframe->xor ^= dat[i + k];
+			pframe->pos += n;
+			i += n;
+			if (pframe->pos == frame->len)
+				pframe->state = CHECK_XOR;
+			break;
+		case CHECK_XOR:
+			if (dat[i++] != pframe->xor) {
+				es_frame_reject(pframe, &pframe->stats.xor_err);
+				break;
+			}
+			pframe->pos = 0;
+			if (pframe->frame_info.end_len == 0)
+				es_frame_done(pframe);
+			else
+				pframe->state = CHECK_TAIL;
+			break;
+		case CHECK_TAIL:
+			/* a mismatching byte is not consumed, it may start the next header */
+			if (dat[i] != end[pframe->pos]) {
+				es_frame_reject(pframe, &pframe->stats.tail_err);
+				break;
+			}
+			i++;
+			if (++pframe->pos == pframe->frame_info.end_len)
+				es_frame_done(pframe);
+			break;
+		default:
+			es_frame_reset(pframe);
 			break;
 		}
-	} while (1);
-
-	return B_ERROR;
+	}
 }
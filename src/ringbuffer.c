@@ -1,207 +1,155 @@
 #include "protocol_lib/ringbuffer.h"
 #include <stdint.h>
-#include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
 
 #define B_ERROR 1
 #define B_SUCCESS 0
-uint8_t ring_buf_init(ring_buf_t *r, uint32_t size)
-{
-	if (NULL != r->pHead)
-		free(r->pHead);
 
-	r->pHead = (uint8_t *)malloc(size * sizeof(uint8_t));
-	if (r->pHead == NULL)
-	{
-		printf("pHead is null\n");
+/* on Cortex-M4 these are plain loads/stores with a dmb, which also orders them against dma */
+#define ring_load_acquire(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define ring_store_release(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/**
+ * @brief  Set up a ring on caller provided storage.
+ * @param  r the ring
+ * @param  buf storage, size bytes
+ * @param  size a power of two
+ * @retval B_SUCCESS, B_ERROR if size is not a power of two
+ */
+uint8_t ring_buf_init(ring_buf_t *r, uint8_t *buf, uint32_t size)
+{
+	if (!r || !buf || size < 2 || (size & (size - 1)))
 		return B_ERROR;
-	}
-	memset(r->pHead, 0, sizeof(size));
 
-	r->pWrite = r->pHead;
-	r->pRead = r->pHead;
-	r->pTail = r->pHead + size;
-	r->is_full = 0; // Initialize is_full to false
+	r->buf = buf;
+	r->mask = size - 1;
+	r->head = 0;
+	r->tail = 0;
 
 	return B_SUCCESS;
 }
 
-void ring_buf_free(ring_buf_t *r)
+uint32_t ring_buf_size(const ring_buf_t *r)
 {
-	if (NULL != r->pHead)
-		free(r->pHead);
+	return r->mask + 1;
 }
 
-void ring_buf_clr(ring_buf_t *r)
+/**
+ * @brief  Contiguous free space at the write index, producer only.
+ * @param  r the ring
+ * @param  span set to the start of the space
+ * @retval bytes that may be written at span before ring_buf_write_commit()
+ */
+uint32_t ring_buf_write_span(ring_buf_t *r, uint8_t **span)
 {
-	if (NULL == r->pHead) {
-		printf("%s : RingBuff is not Init!\n", __func__);
-	}
-	r->pWrite = r->pHead;
-	r->pRead = r->pHead;
-	r->is_full = 0; // Clear the is_full flag
-}
+	uint32_t head = r->head;
+	uint32_t free = ring_buf_size(r) - (head - ring_load_acquire(&r->tail));
+	uint32_t off = head & r->mask;
 
-int32_t get_ring_buf_len(ring_buf_t *r)
-{
-	uint32_t len;
+	*span = &r->buf[off];
+	if (free > ring_buf_size(r) - off)
+		free = ring_buf_size(r) - off;
 
-	if (NULL == r->pHead) {
-		printf("%s : RingBuff is not Init!\n", __func__);
-		return -1;
-	}
-	if (r->is_full) {
-		return r->pTail - r->pHead; // If buffer is full, length is equal to size
-	}
-	if (r->pRead > r->pWrite) {
-		len = r->pTail - r->pRead;
-		len += r->pWrite - r->pHead;
-	} else {
-		len = r->pWrite - r->pRead;
-	}
-	return len;
+	return free;
 }
 
-int32_t get_ring_buf_free_space(ring_buf_t *r)
+/* publish len bytes written at the write index, producer only */
+void ring_buf_write_commit(ring_buf_t *r, uint32_t len)
 {
-	uint32_t len;
-	if (NULL == r->pHead) {
-		printf("%s : RingBuff is not Init!\n", __func__);
-		return -1;
-	}
-	if (r->is_full) {
-		return 0; // If buffer is full, free space is 0
-	}
-	if (r->pRead > r->pWrite) {
-		len = r->pRead - r->pWrite;
-	} else {
-		len = r->pTail - r->pWrite;
-		len += r->pRead - r->pHead;
-	}
-	return len;
+	ring_store_release(&r->head, r->head + len);
 }
 
-int32_t write_ring_buf(ring_buf_t *r, uint8_t *pBuff, uint32_t len)
+/**
+ * @brief  Copy into the ring, producer only.
+ * @retval bytes written, less than len when the ring is full
+ */
+uint32_t ring_buf_write(ring_buf_t *r, const uint8_t *data, uint32_t len)
 {
-	if (NULL == r->pHead) {
-		printf("%s : RingBuff is not Init!\n", __func__);
-		return -1;
-	}
-	if (len > r->pTail - r->pHead) {
-		printf("%s :New add buff is too long\n", __func__);
-		return -1;
-	}
-	if (len > get_ring_buf_free_space(r)) {
-		printf("%s :New add buff is larger than the free area!\n", __func__);
-		return -1;
-	}
-	if (r->pWrite + len > r->pTail) {
-		int32_t pre_len = r->pTail - r->pWrite;
-		int32_t last_len = len - pre_len;
-		memcpy(r->pWrite, pBuff, pre_len);
-		memcpy(r->pHead, pBuff + pre_len, last_len);
-		r->pWrite = r->pHead + last_len;
-	} else {
-		memcpy(r->pWrite, pBuff, len);
-		r->pWrite += len;
-	}
+	uint32_t done = 0, n;
+	uint8_t *span;
 
-	if (r->pWrite == r->pRead)
-		r->is_full = 1; // Update is_full flag
+	while (done < len) {
+		n = ring_buf_write_span(r, &span);
+		if (!n)
+			break;
+		if (n > len - done)
+			n = len - done;
+		memcpy(span, data + done, n);
+		ring_buf_write_commit(r, n);
+		done += n;
+	}
 
-	return len;
+	return done;
 }
 
-int32_t read_ring_buf(ring_buf_t *r, uint8_t *pBuff, uint32_t len)
+/**
+ * @brief  Move the write index to the next start of the buffer, for a producer
+ *         that restarts at offset 0 like a re-armed dma, producer only.
+ * @retval the new write index, the consumer resumes there with ring_buf_read_seek()
+ */
+uint32_t ring_buf_write_realign(ring_buf_t *r)
 {
-	if (0 == len)
-		return len;
+	uint32_t head = (r->head + r->mask) & ~r->mask;
 
-	if (NULL == r->pHead) {
-		printf("%s : RingBuff is not Init!\n", __func__);
-		return -1;
-	}
-
-	if (len > r->pTail - r->pHead) {
-		printf("%s :Read buff size is too long\n", __func__);
-		return -1;
-	}
-
-	if (len > get_ring_buf_len(r)) {
-		printf("%s :Read buff size is larger than the valid area!\n", __func__);
-		return -1;
-	}
-
-	if (r->is_full)
-		r->is_full = 0; // Clear is_full flag when reading
-
-	if (r->pRead + len > r->pTail) {
-		uint32_t pre_len = r->pTail - r->pRead;
-		uint32_t last_len = len - pre_len;
-		memcpy(pBuff, r->pRead, pre_len);
-		memcpy(pBuff + pre_len, r->pHead, last_len);
-		r->pRead = r->pHead + last_len;
-	} else {
-		memcpy(pBuff, r->pRead, len);
-		r->pRead += len;
-	}
-	return len;
+	ring_store_release(&r->head, head);
+	return head;
 }
 
-uint32_t ring_buf_check_get(ring_buf_t *r, uint8_t *pBuff, uint32_t len)
+/* bytes ready to read, more than the size if a dma producer lapped the consumer */
+uint32_t ring_buf_len(const ring_buf_t *r)
 {
-	if (0 == len)
-		return B_SUCCESS;
-
-	if (NULL == r->pHead) {
-		printf("%s : RingBuff is not Init!\n", __func__);
-		return -1;
-	}
+	return ring_load_acquire(&r->head) - r->tail;
+}
 
-	if (len > r->pTail - r->pHead) {
-		printf("%s :Read buff size is too long\n", __func__);
-		return -1;
-	}
+/**
+ * @brief  Contiguous readable bytes at the read index, consumer only.
+ * @param  r the ring
+ * @param  span set to the first byte
+ * @retval bytes that may be parsed in place before ring_buf_read_commit()
+ */
+uint32_t ring_buf_peek_span(ring_buf_t *r, const uint8_t **span)
+{
+	uint32_t len = ring_buf_len(r);
+	uint32_t off = r->tail & r->mask;
 
-	if (len > get_ring_buf_len(r)) {
-		printf("%s :Read buff size is larger than the valid area!\n", __func__);
-		return -1;
-	}
+	*span = &r->buf[off];
+	if (len > ring_buf_size(r) - off)
+		len = ring_buf_size(r) - off;
 
-	if (r->pRead + len > r->pTail) {
-		uint32_t pre_len = r->pTail - r->pRead;
-		uint32_t last_len = len - pre_len;
-		memcpy(pBuff, r->pRead, pre_len);
-		memcpy(pBuff + pre_len, r->pHead, last_len);
-	} else {
-		memcpy(pBuff, r->pRead, len);
-	}
 	return len;
 }
 
-int ring_buf_clr_len(ring_buf_t *r, uint32_t len)
+/* release len bytes at the read index back to the producer, consumer only */
+void ring_buf_read_commit(ring_buf_t *r, uint32_t len)
 {
-	if (0 == len)
-		return B_SUCCESS;
+	ring_store_release(&r->tail, r->tail + len);
+}
 
-	if (NULL == r->pHead) {
-		printf("%s : RingBuff is not Init!\n", __func__);
-		return -1;
-	}
+/**
+ * @brief  Copy out of the ring, consumer only.
+ * @retval bytes read
+ */
+uint32_t ring_buf_read(ring_buf_t *r, uint8_t *data, uint32_t len)
+{
+	uint32_t done = 0, n;
+	const uint8_t *span;
 
-	if (len > get_ring_buf_len(r)) {
-		printf("%s : len is larger than the valid area and clean the buf!\n", __func__);
-		r->pRead = r->pWrite = r->pHead;
-	} else if (r->pRead + len > r->pTail) {
-		uint32_t last_len = len - (r->pTail - r->pRead);
-		r->pRead = r->pHead + last_len;
-	} else {
-		r->pRead += len;
+	while (done < len) {
+		n = ring_buf_peek_span(r, &span);
+		if (!n)
+			break;
+		if (n > len - done)
+			n = len - done;
+		memcpy(data + done, span, n);
+		ring_buf_read_commit(r, n);
+		done += n;
 	}
 
-	if (r->pRead == r->pWrite)
-		r->is_full = 0; // Update is_full flag after clearing
+	return done;
+}
 
-	return 0;
-}
\ No newline at end of file
+/* move the read index, to tail + ring_buf_len() to drop everything, consumer only */
+void ring_buf_read_seek(ring_buf_t *r, uint32_t index)
+{
+	ring_store_release(&r->tail, index);
+}
@@ -0,0 +1,292 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Byte stream decoder/encoder for the MCU <-> SOM UART4 frames. Frames may be
+ * split over or merged within rx chunks, corrupted frames are dropped and the
+ * decoder resyncs on the next header.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "protocol_lib/som_frame.h"
+
+#ifdef HAL_CRC_MODULE_ENABLED
+#include "semphr.h"
+
+extern CRC_HandleTypeDef hcrc;
+/*
+ * The crc unit has no init register, a computation owns it from the reset to
+ * the last word. Every user is a task and bulk objects run to several KB, so
+ * it is held with a mutex rather than with the interrupts masked.
+ */
+static SemaphoreHandle_t crc_lock;
+#endif
+
+#define CRC_HDR_LEN	12	// header, id, msg_type, cmd_type, result, data_len
+
+static uint32_t get_le32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
+
+/* create the crc unit lock, before any task sends or receives frames */
+void som_frame_init(void)
+{
+#ifdef HAL_CRC_MODULE_ENABLED
+	crc_lock = xSemaphoreCreateMutex();
+	if (!crc_lock)
+		printf("[%s %d]:Failed to create the crc lock!\n", __func__, __LINE__);
+#endif
+}
+
+/* the same crc bit by bit, on the host and until the lock exists */
+static uint32_t som_frame_crc32_soft(const uint8_t *p, uint32_t len)
+{
+	uint32_t word, crc = 0xFFFFFFFF;
+
+	for (uint32_t i = 0; i < len; i += 4) {
+		word = 0;
+		memcpy(&word, p + i, len - i >= 4 ? 4 : len - i);
+		crc ^= word;
+		for (int bit = 0; bit < 32; bit++)
+			crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+	}
+	return crc;
+}
+
+/* task context only */
+uint32_t som_frame_crc32(const uint8_t *p, uint32_t len)
+{
+#ifdef HAL_CRC_MODULE_ENABLED
+	uint32_t word, crc;
+
+	if (!crc_lock)
+		return som_frame_crc32_soft(p, len);
+
+	xSemaphoreTake(crc_lock, portMAX_DELAY);
+	__HAL_CRC_DR_RESET(&hcrc);
+	for (uint32_t i = 0; i < len; i += 4) {
+		word = 0;
+		memcpy(&word, p + i, len - i >= 4 ? 4 : len - i);
+		hcrc.Instance->DR = word;
+	}
+	crc = hcrc.Instance->DR;
+	xSemaphoreGive(crc_lock);
+	return crc;
+#else
+	return som_frame_crc32_soft(p, len);
+#endif
+}
+
+static uint8_t legacy_checksum(const Message *msg)
+{
+	uint8_t checksum = msg->msg_type ^ msg->cmd_type ^ msg->data_len;
+
+	for (int i = 0; i < msg->data_len; i++)
+		checksum ^= msg->data[i];
+	return checksum;
+}
+
+void som_frame_decoder_reset(struct som_frame_decoder *dec)
+{
+	dec->len = 0;
+}
+
+void som_frame_decoder_init(struct som_frame_decoder *dec, som_frame_alloc_t alloc,
+			    som_frame_handler_t handler, void *arg)
+{
+	memset(dec, 0, sizeof(*dec));
+	dec->alloc = alloc;
+	dec->handler = handler;
+	dec->arg = arg;
+}
+
+/* drop n bytes from the front of the buffer */
+static void decoder_consume(struct som_frame_decoder *dec, uint16_t n)
+{
+	dec->len -= n;
+	memmove(dec->buf, dec->buf + n, dec->len);
+}
+
+/* bad frame: skip its first header byte and hunt for the next header */
+static void decoder_resync(struct som_frame_decoder *dec)
+{
+	dec->stats.resync++;
+	dec->stats.dropped++;
+	decoder_consume(dec, 1);
+}
+
+/* 1 if buf[0..len) can still be the start of a header */
+static int header_prefix(const uint8_t *buf, uint16_t len)
+{
+	static const uint8_t legacy[4] = { 0x55, 0xAA, 0x5A, 0xA5 };
+	static const uint8_t crc[4] = { 0x5C, 0xAA, 0x5A, 0xA5 };
+	uint16_t n = len < 4 ? len : 4;
+
+	return !memcmp(buf, legacy, n) || !memcmp(buf, crc, n);
+}
+
+/* try to take one frame off the buffer, 0 when more bytes are needed */
+static int decoder_step(struct som_frame_decoder *dec)
+{
+	Message *msg = (Message *)dec->buf;
+	uint8_t *next;
+	uint32_t header;
+	uint16_t total;
+	uint8_t data_len;
+	uint16_t i;
+
+	if (!header_prefix(dec->buf, dec->len)) {
+		/* skip everything up to the next possible header byte */
+		for (i = 1; i < dec->len; i++) {
+			if (header_prefix(dec->buf + i, dec->len - i))
+				break;
+		}
+		dec->stats.dropped += i;
+		decoder_consume(dec, i);
+		return dec->len != 0;
+	}
+	if (dec->len < CRC_HDR_LEN)
+		return 0;
+
+	header = get_le32(dec->buf);
+	data_len = dec->buf[11];
+	if (data_len > FRAME_DATA_MAX) {
+		dec->stats.len_err++;
+		decoder_resync(dec);
+		return 1;
+	}
+	total = FRAME_HEADER == header ? sizeof(Message) : SOM_FRAME_CRC_OVERHEAD + data_len;
+	if (dec->len < total)
+		return 0;
+
+	if (get_le32(dec->buf + total - 4) != FRAME_TAIL) {
+		dec->stats.tail_err++;
+		decoder_resync(dec);
+		return 1;
+	}
+
+	if (FRAME_HEADER == header) {
+		if (legacy_checksum(msg) != msg->checksum) {
+			dec->stats.crc_err++;
+			decoder_resync(dec);
+			return 1;
+		}
+	} else if (som_frame_crc32(dec->buf + 4, CRC_HDR_LEN - 4 + data_len) !=
+		get_le32(dec->buf + CRC_HDR_LEN + data_len)) {
+		dec->stats.crc_err++;
+		decoder_resync(dec);
+		return 1;
+	}
+
+	/* the frame leaves with its buffer, whatever follows it moves on */
+	next = dec->alloc(dec->arg);
+	if (!next) {
+		dec->stats.nobuf++;
+		decoder_consume(dec, total);
+		return 1;
+	}
+	memcpy(next, dec->buf + total, dec->len - total);
+	dec->len -= total;
+	dec->buf = next;
+
+	if (FRAME_HEADER != header) {
+		/* same first 12 bytes, only the trailer differs from Message */
+		msg->header = FRAME_HEADER;
+		msg->checksum = legacy_checksum(msg);
+		msg->tail = FRAME_TAIL;
+	}
+	dec->stats.frames++;
+	dec->handler(msg, FRAME_HEADER != header, dec->arg);
+	return 1;
+}
+
+/**
+ * @brief  Feed received bytes to the decoder, the handler is called for every
+ *         complete and valid frame.
+ * @param  dec decoder state
+ * @param  data received bytes
+ * @param  len number of bytes
+ */
+void som_frame_decode(struct som_frame_decoder *dec, const uint8_t *data, size_t len)
+{
+	size_t n;
+
+	if (!dec->buf) {
+		dec->buf = dec->alloc(dec->arg);
+		if (!dec->buf) {
+			dec->stats.dropped += len;
+			return;
+		}
+	}
+
+	while (len) {
+		n = SOM_FRAME_MAX_LEN - dec->len;
+		if (n > len)
+			n = len;
+		memcpy(dec->buf + dec->len, data, n);
+		dec->len += n;
+		data += n;
+		len -= n;
+
+		while (dec->len && decoder_step(dec))
+			;
+	}
+}
+
+/**
+ * @brief  The line went quiet with a partial frame pending: it was a false
+ *         header or a truncated frame, rescan whatever follows it.
+ * @param  dec decoder state
+ */
+void som_frame_decoder_flush(struct som_frame_decoder *dec)
+{
+	while (dec->buf && dec->len) {
+		decoder_resync(dec);
+		while (dec->len && decoder_step(dec))
+			;
+	}
+}
+
+/**
+ * @brief  Encode msg for transmission.
+ * @param  msg message to send, data_len must not exceed FRAME_DATA_MAX
+ * @param  crc 1 for the crc format, 0 for the legacy one
+ * @param  out buffer of at least SOM_FRAME_MAX_LEN bytes
+ * @retval number of bytes to send
+ */
+size_t som_frame_encode(const Message *msg, int crc, uint8_t *out)
+{
+	Message *legacy = (Message *)out;
+	uint8_t data_len = msg->data_len;
+
+	if (!crc) {
+		memcpy(legacy, msg, sizeof(Message));
+		legacy->header = FRAME_HEADER;
+		legacy->tail = FRAME_TAIL;
+		legacy->checksum = legacy_checksum(legacy);
+		return sizeof(Message);
+	}
+
+	put_le32(out, FRAME_HEADER_CRC);
+	put_le32(out + 4, msg->xTaskToNotify);
+	out[8] = msg->msg_type;
+	out[9] = msg->cmd_type;
+	out[10] = msg->cmd_result;
+	out[11] = data_len;
+	memcpy(out + CRC_HDR_LEN, msg->data, data_len);
+	put_le32(out + CRC_HDR_LEN + data_len, som_frame_crc32(out + 4, CRC_HDR_LEN - 4 + data_len));
+	put_le32(out + CRC_HDR_LEN + data_len + 4, FRAME_TAIL);
+
+	return SOM_FRAME_CRC_OVERHEAD + data_len;
+}
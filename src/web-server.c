@@ -18,6 +18,9 @@
 #include "string.h"
 #include "hf_common.h"
 #include "hf_power_process.h"
+#include "hf_power_monitor.h"
+#include "hf_power_history.h"
+#include "hf_som_telemetry.h"
 
 #define SESSION_ID_LENGTH 32
 #define SESSION_DATA_LENGTH 20
@@ -10256,6 +10259,48 @@ void send_response_200(struct netconn *conn) {
    netconn_write(conn, http_html_200, sizeof(http_html_200), NETCONN_COPY);
 }
 
+/*
+ * The power history from to to (s since boot) in one response, decoded a few
+ * samples at a time. The length is not known up front, the body ends with the
+ * connection. Missing values are null.
+ */
+void send_power_history(struct netconn *conn, const char *cookies, uint32_t from, uint32_t to)
+{
+	static struct power_hist_sample samples[8];
+	static char buf[BUF_SIZE];
+	const char http_json_hdr_patt[] = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nConnection: close\r\n%s\r\n";
+	int len, n, first = 1;
+
+	len = snprintf(buf, sizeof(buf), http_json_hdr_patt, cookies ? cookies : "");
+	netconn_write(conn, buf, len, NETCONN_COPY);
+
+	len = snprintf(buf, sizeof(buf), "{\"status\":0,\"message\":\"success\",\"data\":{\"now\":%lu,\"fields\":[\"time\"",
+		xTaskGetTickCount() / configTICK_RATE_HZ);
+	for (int i = 0; i < POWER_HIST_FIELDS; i++)
+		len += snprintf(buf + len, sizeof(buf) - len, ",\"%s\"", power_hist_names[i]);
+	len += snprintf(buf + len, sizeof(buf) - len, "],\"samples\":[");
+	netconn_write(conn, buf, len, NETCONN_COPY);
+
+	while (from <= to && (n = power_hist_read(from, to, samples, 8)) > 0) {
+		len = 0;
+		for (int k = 0; k < n; k++) {
+			len += snprintf(buf + len, sizeof(buf) - len, "%s[%lu", first ? "" : ",", samples[k].time);
+			for (int i = 0; i < POWER_HIST_FIELDS; i++) {
+				if (POWER_HIST_NONE == samples[k].val[i])
+					len += snprintf(buf + len, sizeof(buf) - len, ",null");
+				else
+					len += snprintf(buf + len, sizeof(buf) - len, ",%ld", samples[k].val[i]);
+			}
+			len += snprintf(buf + len, sizeof(buf) - len, "]");
+			first = 0;
+		}
+		if (netconn_write(conn, buf, len, NETCONN_COPY) != ERR_OK)
+			return;
+		from = samples[n - 1].time + 1;
+	}
+	netconn_write(conn, "]}}", 3, NETCONN_COPY);
+}
+
 
 // ------------------------ parse params  ---------------------
 
@@ -10627,7 +10672,8 @@ power_info get_power_info(void)
 	}
 #else
 	if (get_power_status())
-		get_board_power(&power_info.voltage,&power_info.current,&power_info.consumption);
+		power_mon_get_last(POWER_RAIL_BOARD, &power_info.voltage, &power_info.current,
+				   &power_info.consumption);
 #endif
 	web_debug("web call get_power_info, consumption %d, current %d, voltage %d, ret %d\n",
 		power_info.consumption, power_info.current, power_info.voltage, ret);
@@ -10743,7 +10789,7 @@ int set_net_info(NETInfo netinfo) {
 int get_pvt_info(PVTInfo *ppvtInfo)
 {
 	int ret = HAL_OK;
-	ret = web_cmd_handle(CMD_PVT_INFO, ppvtInfo, sizeof(PVTInfo), 1000);
+	ret = som_telemetry_get_pvt(ppvtInfo);
 	if (HAL_OK != ret) {
 		web_debug("Failed to get PVT info %d\n", ret);
 	}
@@ -11066,6 +11112,62 @@ http_server_netconn_serve(struct netconn *conn)
 				netconn_write(conn, response_header, strlen(response_header), NETCONN_COPY);
 				netconn_write(conn, json_response, strlen(json_response), NETCONN_COPY);
 
+			}else if(strcmp(path, "/power_energy")==0 ){
+				/* energy since boot per rail, mean power between two polls is the energy difference over the time difference */
+				static const char *rails[PAC1934_CHANNELS] = { "som", "ch2", "ch3", "ch4" };
+				struct pac1934_energy energy;
+				struct pac1934_channel ch;
+				char json_response[BUF_SIZE]={0};
+				uint64_t uwh;
+				int len;
+
+				pac1934_get_energy(&energy);
+				len = snprintf(json_response, sizeof(json_response),
+					"{\"status\":0,\"message\":\"success\",\"data\":{\"seconds\":\"%lu.%03lu\",\"errors\":\"%lu\",\"resyncs\":\"%lu\",\"rails\":[",
+					(uint32_t)(energy.samples / PAC1934_SPS), (uint32_t)(energy.samples % PAC1934_SPS * 1000 / PAC1934_SPS),
+					energy.errors, energy.resyncs);
+				for (int i = 0; i < PAC1934_CHANNELS; i++) {
+					pac1934_get_channel(i, &ch);
+					uwh = pac1934_energy_uwh(&energy, i);
+					len += snprintf(json_response + len, sizeof(json_response) - len,
+						"%s{\"name\":\"%s\",\"voltage\":\"%lu\",\"current\":\"%lu\",\"power\":\"%lu\",\"energy_wh\":\"%lu.%06lu\"}",
+						i ? "," : "", rails[i], ch.volt, ch.curr, ch.power,
+						(uint32_t)(uwh / 1000000), (uint32_t)(uwh % 1000000));
+				}
+				snprintf(json_response + len, sizeof(json_response) - len, "]}}");
+
+				char response_header[BUF_SIZE_256];
+				if(found_session_user_name!=NULL && strlen(found_session_user_name)>0 && byhand ){
+					found_session->tick_value=HAL_GetTick();
+					sprintf(resp_cookies, "Set-Cookie: sid=%.31s; Max-Age=%d; Path=/\r\n",sidValue,MAX_AGE);
+					sprintf(response_header, json_header_withcookie,resp_cookies, strlen(json_response));
+				}else{
+					sprintf(response_header, json_header, strlen(json_response));
+				}
+
+				netconn_write(conn, response_header, strlen(response_header), NETCONN_COPY);
+				netconn_write(conn, json_response, strlen(json_response), NETCONN_COPY);
+
+			}else if(strcmp(path, "/power_history")==0 ){
+				/* from and to in s since boot, the whole history by default */
+				web_debug("GET location: power_history \n");
+				uint32_t from = 0, to = UINT32_MAX;
+				kv_pair *current = params.head;
+				while (current) {
+					if(strcmp(current->key,"from")==0)
+						from = strtoul(current->value, NULL, 10);
+					if(strcmp(current->key,"to")==0)
+						to = strtoul(current->value, NULL, 10);
+					current = current->next;
+				}
+				if(found_session_user_name!=NULL && strlen(found_session_user_name)>0 && byhand ){
+					found_session->tick_value=HAL_GetTick();
+					sprintf(resp_cookies, "Set-Cookie: sid=%.31s; Max-Age=%d; Path=/\r\n",sidValue,MAX_AGE);
+					send_power_history(conn, resp_cookies, from, to);
+				}else{
+					send_power_history(conn, NULL, from, to);
+				}
+
 			}else if(strcmp(path, "/pvt_info")==0 ){
 				web_debug("GET location: pvt_info \n");
 
@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Host tests of the I2C layer, the eeprom cache and the power readings through
+ * the `all` scenario of scripts/i2c_sim, clean and with bus faults injected:
+ * no sync may leave the eeprom unlike what was written through the cache, the
+ * PAC1934 energy stays within 0.1% of the simulated loads, and the faults
+ * are recovered from. Every run is forked, the simulator state is built once
+ * per process, and hands its i2c_sim_results back through a pipe.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unity.h>
+
+#include "i2c_sim.h"
+
+#define RUN_COUNT	"300"
+/* the PAC1934 check of i2c_sim, 0.1% */
+#define ENERGY_ERR_MAX_PPM	1000
+
+/* i2c_sim with these arguments in a child, its exit status, the results in *res */
+static int run(struct i2c_sim_results *res, const char *const *args)
+{
+	char *argv[16] = { "i2c_sim" };
+	int argc = 1, fds[2], status;
+	ssize_t n = 0;
+	pid_t pid;
+
+	while (*args && argc < 15)
+		argv[argc++] = (char *)*args++;
+	memset(res, 0, sizeof(*res));
+	fflush(stdout);
+	TEST_ASSERT_EQUAL_INT(0, pipe(fds));
+	pid = fork();
+	TEST_ASSERT_TRUE(pid >= 0);
+	if (!pid) {
+		close(fds[0]);
+		/* the printout of the simulator is not the test output */
+		if (!freopen("/dev/null", "w", stdout))
+			_exit(3);
+		status = i2c_sim_run(argc, argv);
+		if (write(fds[1], &i2c_sim_results, sizeof(i2c_sim_results)) != sizeof(i2c_sim_results))
+			_exit(3);
+		_exit(status);
+	}
+	close(fds[1]);
+	n = read(fds[0], res, sizeof(*res));
+	close(fds[0]);
+	TEST_ASSERT_EQUAL_INT(pid, waitpid(pid, &status, 0));
+	TEST_ASSERT_TRUE(WIFEXITED(status));
+	TEST_ASSERT_EQUAL_INT(sizeof(*res), n);
+	return WEXITSTATUS(status);
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+/* no fault: every sync lands, every spike is caught by the alert */
+static void test_all_clean(void)
+{
+	static const char *const args[] = { "-n", RUN_COUNT, "all", NULL };
+	struct i2c_sim_results res;
+
+	TEST_ASSERT_EQUAL_INT(0, run(&res, args));
+	TEST_ASSERT_GREATER_THAN_UINT32(0, res.eeprom_syncs);
+	TEST_ASSERT_EQUAL_UINT32(0, res.eeprom_failed);
+	TEST_ASSERT_EQUAL_UINT32(0, res.eeprom_mismatched);
+	TEST_ASSERT_EQUAL_INT(0, res.eeprom_final_diff);
+	TEST_ASSERT_EQUAL_INT(0, res.journal_lost);
+	TEST_ASSERT_EQUAL_INT(0, res.mirror_differs);
+	TEST_ASSERT_LESS_OR_EQUAL_INT(ENERGY_ERR_MAX_PPM, res.energy_err_ppm);
+	TEST_ASSERT_GREATER_THAN_UINT32(0, res.spikes);
+	TEST_ASSERT_EQUAL_UINT32(res.spikes, res.spikes_alerted);
+	TEST_ASSERT_EQUAL_UINT32(0, res.timeouts);
+	TEST_ASSERT_EQUAL_UINT32(0, res.resets);
+}
+
+/*
+ * Hung transfers, SDA held low and bus errors on every part, timer commands
+ * dropped and late: syncs may fail but never lie, and the bus comes back.
+ */
+static void test_all_faults(void)
+{
+	static const char *const args[] = {
+		"-n", RUN_COUNT, "-f", "all:timeout=0.002,stuck=0.002,berr=0.002",
+		"-t", "0.01,5", "all", NULL,
+	};
+	struct i2c_sim_results res;
+
+	TEST_ASSERT_EQUAL_INT(0, run(&res, args));
+	TEST_ASSERT_GREATER_THAN_UINT32(0, res.eeprom_syncs);
+	TEST_ASSERT_EQUAL_UINT32(0, res.eeprom_mismatched);
+	TEST_ASSERT_EQUAL_INT(0, res.eeprom_final_diff);
+	TEST_ASSERT_EQUAL_INT(0, res.journal_lost);
+	TEST_ASSERT_EQUAL_INT(0, res.mirror_differs);
+	TEST_ASSERT_LESS_OR_EQUAL_INT(ENERGY_ERR_MAX_PPM, res.energy_err_ppm);
+	TEST_ASSERT_GREATER_THAN_UINT32(0, res.timeouts);
+	TEST_ASSERT_GREATER_THAN_UINT32(0, res.resets);
+	TEST_ASSERT_EQUAL_UINT32(0, res.recover_failed);
+}
+
+int main(int argc, char **argv)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_all_clean);
+	RUN_TEST(test_all_faults);
+	return UNITY_END();
+}
@@ -0,0 +1,318 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Host tests of the SPSC byte ring: the index and buffer wrap, full and empty,
+ * the dma realign and lapping, then a producer and a consumer thread pushing
+ * a position dependent pattern through a small ring with its indices started
+ * just short of the 32 bit wrap, and a throughput figure for the span API.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unity.h>
+
+#include "protocol_lib/ringbuffer.h"
+
+#define STRESS_RING	64
+#define STRESS_BYTES	(16u << 20)
+#define BENCH_RING	4096
+#define BENCH_BYTES	(256u << 20)
+#define BENCH_CHUNK	512
+
+/* the byte at stream position i, so a lost, doubled or stale byte shows */
+static uint8_t pattern(uint32_t i)
+{
+	return i ^ (i >> 8) ^ (i >> 16) ^ (i >> 24);
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+static void test_init_rejects_bad_size(void)
+{
+	static uint8_t buf[64];
+	ring_buf_t r;
+
+	TEST_ASSERT_EQUAL_INT(1, ring_buf_init(&r, buf, 0));
+	TEST_ASSERT_EQUAL_INT(1, ring_buf_init(&r, buf, 1));
+	TEST_ASSERT_EQUAL_INT(1, ring_buf_init(&r, buf, 3));
+	TEST_ASSERT_EQUAL_INT(1, ring_buf_init(&r, buf, 48));
+	TEST_ASSERT_EQUAL_INT(1, ring_buf_init(&r, NULL, 64));
+	TEST_ASSERT_EQUAL_INT(0, ring_buf_init(&r, buf, 2));
+	TEST_ASSERT_EQUAL_INT(0, ring_buf_init(&r, buf, 64));
+	TEST_ASSERT_EQUAL_UINT32(64, ring_buf_size(&r));
+	TEST_ASSERT_EQUAL_UINT32(0, ring_buf_len(&r));
+}
+
+static void test_full_and_empty(void)
+{
+	uint8_t buf[8], in[8], out[8];
+	const uint8_t *rspan;
+	uint8_t *wspan;
+	ring_buf_t r;
+
+	ring_buf_init(&r, buf, sizeof(buf));
+	for (int i = 0; i < 8; i++)
+		in[i] = pattern(i);
+	TEST_ASSERT_EQUAL_UINT32(8, ring_buf_write(&r, in, 8));
+	TEST_ASSERT_EQUAL_UINT32(0, ring_buf_write(&r, in, 1));
+	TEST_ASSERT_EQUAL_UINT32(0, ring_buf_write_span(&r, &wspan));
+	TEST_ASSERT_EQUAL_UINT32(8, ring_buf_len(&r));
+	TEST_ASSERT_EQUAL_UINT32(8, ring_buf_read(&r, out, sizeof(out)));
+	TEST_ASSERT_EQUAL_MEMORY(in, out, 8);
+	TEST_ASSERT_EQUAL_UINT32(0, ring_buf_peek_span(&r, &rspan));
+	TEST_ASSERT_EQUAL_UINT32(0, ring_buf_read(&r, out, 1));
+}
+
+/* both the buffer offset and the free running indices wrap in one write */
+static void test_wrap(void)
+{
+	uint8_t buf[8], in[6], out[6];
+	const uint8_t *rspan;
+	uint8_t *wspan;
+	ring_buf_t r;
+
+	ring_buf_init(&r, buf, sizeof(buf));
+	r.head = r.tail = 0xFFFFFFFC;
+	for (int i = 0; i < 6; i++)
+		in[i] = pattern(i);
+
+	TEST_ASSERT_EQUAL_UINT32(4, ring_buf_write_span(&r, &wspan));
+	TEST_ASSERT_EQUAL_PTR(&buf[4], wspan);
+	TEST_ASSERT_EQUAL_UINT32(6, ring_buf_write(&r, in, 6));
+	TEST_ASSERT_EQUAL_UINT32(2, r.head);
+	TEST_ASSERT_EQUAL_UINT32(6, ring_buf_len(&r));
+	TEST_ASSERT_EQUAL_UINT32(2, ring_buf_write_span(&r, &wspan));
+	TEST_ASSERT_EQUAL_PTR(&buf[2], wspan);
+
+	TEST_ASSERT_EQUAL_UINT32(4, ring_buf_peek_span(&r, &rspan));
+	TEST_ASSERT_EQUAL_PTR(&buf[4], rspan);
+	TEST_ASSERT_EQUAL_UINT32(6, ring_buf_read(&r, out, sizeof(out)));
+	TEST_ASSERT_EQUAL_MEMORY(in, out, 6);
+	TEST_ASSERT_EQUAL_UINT32(0, ring_buf_len(&r));
+}
+
+/* a re-armed dma restarts at offset 0, and one that is not drained laps the consumer */
+static void test_realign_and_lap(void)
+{
+	uint8_t buf[8], in[3] = { 1, 2, 3 }, out[3];
+	const uint8_t *rspan;
+	ring_buf_t r;
+	uint32_t head;
+
+	ring_buf_init(&r, buf, sizeof(buf));
+	r.head = r.tail = 0xFFFFFFF5;
+	ring_buf_write(&r, in, 3);
+	head = ring_buf_write_realign(&r);
+	TEST_ASSERT_EQUAL_UINT32(0xFFFFFFF8, head);
+	ring_buf_read_seek(&r, head);
+	TEST_ASSERT_EQUAL_UINT32(0, ring_buf_len(&r));
+	ring_buf_write(&r, in, 3);
+	TEST_ASSERT_EQUAL_UINT32(3, ring_buf_peek_span(&r, &rspan));
+	TEST_ASSERT_EQUAL_PTR(&buf[0], rspan);
+	TEST_ASSERT_EQUAL_UINT32(3, ring_buf_read(&r, out, 3));
+	TEST_ASSERT_EQUAL_MEMORY(in, out, 3);
+
+	/* realigned across the index wrap, then already aligned it stays */
+	head = ring_buf_write_realign(&r);
+	TEST_ASSERT_EQUAL_UINT32(0, head);
+	TEST_ASSERT_EQUAL_UINT32(head, ring_buf_write_realign(&r));
+
+	ring_buf_read_seek(&r, head);
+	ring_buf_write_commit(&r, sizeof(buf) + 5);
+	TEST_ASSERT_GREATER_THAN_UINT32(ring_buf_size(&r), ring_buf_len(&r));
+}
+
+static struct {
+	ring_buf_t r;
+	uint8_t buf[STRESS_RING];
+	volatile uint32_t bad;	// first wrong position + 1, 0 if none, stops both sides
+	uint32_t seed;
+} stress;
+
+static uint32_t rnd(uint32_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 17;
+	*s ^= *s << 5;
+	return *s;
+}
+
+/* either side stalls now and then, so the ring runs full and wrapped too, not only near empty */
+static void stall(uint32_t *seed)
+{
+	if (!(rnd(seed) % 16)) {
+		for (int i = 0; i < 4; i++)
+			sched_yield();
+	}
+}
+
+/*
+ * Half of the writes fill a span in place, the other half copy through
+ * ring_buf_write(), in random sizes. If the head were published before the
+ * bytes, or the tail before they were read, the consumer would see stale
+ * bytes of the previous lap.
+ */
+static void *stress_producer(void *arg)
+{
+	uint32_t seed = stress.seed, pos = 0, n, done;
+	uint8_t chunk[STRESS_RING], *span;
+
+	while (pos < STRESS_BYTES && !stress.bad) {
+		stall(&seed);
+		n = 1 + rnd(&seed) % STRESS_RING;
+		if (n > STRESS_BYTES - pos)
+			n = STRESS_BYTES - pos;
+		if (rnd(&seed) & 1) {
+			done = ring_buf_write_span(&stress.r, &span);
+			if (n > done)
+				n = done;
+			for (uint32_t i = 0; i < n; i++)
+				span[i] = pattern(pos + i);
+			ring_buf_write_commit(&stress.r, n);
+			done = n;
+		} else {
+			for (uint32_t i = 0; i < n; i++)
+				chunk[i] = pattern(pos + i);
+			done = ring_buf_write(&stress.r, chunk, n);
+		}
+		if (!done)
+			sched_yield();
+		pos += done;
+	}
+	return NULL;
+}
+
+static void *stress_consumer(void *arg)
+{
+	uint32_t seed = ~stress.seed, pos = 0, n, max;
+	const uint8_t *span;
+	uint8_t chunk[STRESS_RING];
+
+	while (pos < STRESS_BYTES && !stress.bad) {
+		stall(&seed);
+		max = 1 + rnd(&seed) % STRESS_RING;
+		if (rnd(&seed) & 1) {
+			n = ring_buf_peek_span(&stress.r, &span);
+			if (n > max)
+				n = max;
+		} else {
+			n = ring_buf_read(&stress.r, chunk, max);
+			span = chunk;
+		}
+		if (!n) {
+			sched_yield();
+			continue;
+		}
+		for (uint32_t i = 0; i < n; i++) {
+			if (span[i] != pattern(pos + i)) {
+				stress.bad = pos + i + 1;
+				break;
+			}
+		}
+		if (span != chunk)
+			ring_buf_read_commit(&stress.r, n);
+		pos += n;
+	}
+	return NULL;
+}
+
+static void test_stress_threads(void)
+{
+	pthread_t prod, cons;
+
+	ring_buf_init(&stress.r, stress.buf, sizeof(stress.buf));
+	/* the indices wrap a few KB into the run */
+	stress.r.head = stress.r.tail = 0xFFFFF000;
+	stress.seed = 0x2545F491;
+	stress.bad = 0;
+
+	TEST_ASSERT_EQUAL_INT(0, pthread_create(&cons, NULL, stress_consumer, NULL));
+	TEST_ASSERT_EQUAL_INT(0, pthread_create(&prod, NULL, stress_producer, NULL));
+	pthread_join(prod, NULL);
+	pthread_join(cons, NULL);
+
+	TEST_ASSERT_EQUAL_UINT32(0, stress.bad);
+	TEST_ASSERT_EQUAL_UINT32(0, ring_buf_len(&stress.r));
+	TEST_ASSERT_EQUAL_UINT32(0xFFFFF000 + STRESS_BYTES, stress.r.tail);
+}
+
+static struct {
+	ring_buf_t r;
+	uint8_t buf[BENCH_RING];
+} bench;
+
+static void *bench_producer(void *arg)
+{
+	uint32_t pos = 0, n;
+	uint8_t *span;
+
+	while (pos < BENCH_BYTES) {
+		n = ring_buf_write_span(&bench.r, &span);
+		if (!n) {
+			sched_yield();
+			continue;
+		}
+		if (n > BENCH_CHUNK)
+			n = BENCH_CHUNK;
+		memset(span, pos >> 9, n);
+		ring_buf_write_commit(&bench.r, n);
+		pos += n;
+	}
+	return NULL;
+}
+
+/* span in, span out, the way the uart dma and the frame decoder use the ring */
+static void test_throughput(void)
+{
+	struct timespec t0, t1;
+	uint32_t pos = 0, n, sum = 0;
+	const uint8_t *span;
+	char msg[80];
+	pthread_t prod;
+	double s;
+
+	ring_buf_init(&bench.r, bench.buf, sizeof(bench.buf));
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	TEST_ASSERT_EQUAL_INT(0, pthread_create(&prod, NULL, bench_producer, NULL));
+	while (pos < BENCH_BYTES) {
+		n = ring_buf_peek_span(&bench.r, &span);
+		if (!n) {
+			sched_yield();
+			continue;
+		}
+		sum += span[0] + span[n - 1];
+		ring_buf_read_commit(&bench.r, n);
+		pos += n;
+	}
+	pthread_join(prod, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	snprintf(msg, sizeof(msg), "%u MiB through a %u byte ring: %.0f MiB/s (%08x)",
+		 BENCH_BYTES >> 20, BENCH_RING, (BENCH_BYTES >> 20) / s, (unsigned int)sum);
+	TEST_MESSAGE(msg);
+	TEST_ASSERT_EQUAL_UINT32(BENCH_BYTES, pos);
+}
+
+int main(int argc, char **argv)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_init_rejects_bad_size);
+	RUN_TEST(test_full_and_empty);
+	RUN_TEST(test_wrap);
+	RUN_TEST(test_realign_and_lap);
+	RUN_TEST(test_stress_threads);
+	RUN_TEST(test_throughput);
+	return UNITY_END();
+}
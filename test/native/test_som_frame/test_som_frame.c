@@ -0,0 +1,272 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Host fuzz test of the UART4 frame decoder: random legacy and crc frames fed
+ * whole, split at random points, merged into one write, and with corrupted,
+ * truncated and garbage bytes in between. The crc runs in software here, the
+ * same polynomial and word order as the STM32 CRC unit.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include "protocol_lib/som_frame.h"
+
+#define FRAMES		2000
+#define STREAM_MAX	(FRAMES * (SOM_FRAME_MAX_LEN + 16))
+#define POOL		4
+
+static uint32_t rnd_state;
+
+static uint32_t rnd(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 17;
+	rnd_state ^= rnd_state << 5;
+	return rnd_state;
+}
+
+/* the decoder's buffer pool, as the protocol task's rx pool */
+static uint8_t pool[POOL][SOM_FRAME_MAX_LEN];
+static uint8_t pool_used[POOL];
+
+static uint8_t *pool_alloc(void *arg)
+{
+	for (int i = 0; i < POOL; i++) {
+		if (!pool_used[i]) {
+			pool_used[i] = 1;
+			return pool[i];
+		}
+	}
+	return NULL;
+}
+
+static void pool_free(void *p)
+{
+	pool_used[((uint8_t *)p - pool[0]) / SOM_FRAME_MAX_LEN] = 0;
+}
+
+/* what was sent, and whether it should come out of the decoder */
+static Message sent[FRAMES];
+static uint8_t sent_crc[FRAMES];
+static uint8_t sent_intact[FRAMES];
+static int nsent;
+
+static int got;			// frames out of the decoder
+static int next_intact;		// index in sent of the next frame expected
+static int mismatches;
+
+static void msg_expect(const Message *msg, int crc)
+{
+	const Message *m;
+
+	while (next_intact < nsent && !sent_intact[next_intact])
+		next_intact++;
+	if (next_intact >= nsent) {
+		mismatches++;
+		return;
+	}
+	m = &sent[next_intact];
+	if (crc != sent_crc[next_intact++] || msg->header != FRAME_HEADER || msg->tail != FRAME_TAIL ||
+	    msg->xTaskToNotify != m->xTaskToNotify || msg->msg_type != m->msg_type ||
+	    msg->cmd_type != m->cmd_type || msg->cmd_result != m->cmd_result ||
+	    msg->data_len != m->data_len || memcmp(msg->data, m->data, m->data_len))
+		mismatches++;
+}
+
+static void frame_received(Message *msg, int crc, void *arg)
+{
+	got++;
+	msg_expect(msg, crc);
+	pool_free(msg);
+}
+
+static struct som_frame_decoder dec;
+static uint8_t stream[STREAM_MAX];
+
+void setUp(void)
+{
+	rnd_state = 0x2545F491;
+	memset(pool_used, 0, sizeof(pool_used));
+	nsent = got = next_intact = mismatches = 0;
+	som_frame_decoder_init(&dec, pool_alloc, frame_received, NULL);
+}
+
+void tearDown(void)
+{
+}
+
+static void random_msg(Message *m)
+{
+	memset(m, 0, sizeof(*m));
+	m->xTaskToNotify = rnd();
+	m->msg_type = rnd();
+	m->cmd_type = rnd();
+	m->cmd_result = rnd();
+	m->data_len = rnd() % (FRAME_DATA_MAX + 1);
+	for (int i = 0; i < m->data_len; i++)
+		m->data[i] = rnd();
+}
+
+/* count frames back to back, crc_pct percent in the crc format */
+static size_t build_stream(int count, int crc_pct)
+{
+	size_t len = 0;
+
+	for (int i = 0; i < count; i++) {
+		random_msg(&sent[nsent]);
+		sent_crc[nsent] = rnd() % 100 < (uint32_t)crc_pct;
+		sent_intact[nsent] = 1;
+		len += som_frame_encode(&sent[nsent], sent_crc[nsent], stream + len);
+		nsent++;
+	}
+	return len;
+}
+
+static void feed_split(size_t len, size_t max_chunk)
+{
+	size_t pos = 0, n;
+
+	while (pos < len) {
+		n = 1 + rnd() % max_chunk;
+		if (n > len - pos)
+			n = len - pos;
+		som_frame_decode(&dec, stream + pos, n);
+		pos += n;
+	}
+	som_frame_decoder_flush(&dec);
+}
+
+/* the crc of little-endian words is CRC-32/MPEG-2 of the bytes of each word, msb first */
+static uint32_t crc_mpeg2(uint32_t crc, const uint8_t *p, size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		crc ^= (uint32_t)p[i] << 24;
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+	}
+	return crc;
+}
+
+static void test_crc_matches_reference(void)
+{
+	uint8_t buf[64], swapped[64];
+
+	TEST_ASSERT_EQUAL_HEX32(0x0376E6E7, crc_mpeg2(0xFFFFFFFF, (const uint8_t *)"123456789", 9));
+	for (int len = 0; len <= (int)sizeof(buf); len++) {
+		for (int i = 0; i < (int)sizeof(buf); i++)
+			buf[i] = rnd();
+		/* the last word zero padded */
+		memset(swapped, 0, sizeof(swapped));
+		for (int i = 0; i < len; i++)
+			swapped[(i & ~3) + 3 - (i & 3)] = buf[i];
+		TEST_ASSERT_EQUAL_HEX32(crc_mpeg2(0xFFFFFFFF, swapped, (len + 3) & ~3),
+					som_frame_crc32(buf, len));
+	}
+}
+
+static void test_whole_frames(void)
+{
+	size_t len = build_stream(200, 50), pos = 0, n;
+
+	for (int i = 0; i < nsent; i++) {
+		n = sent_crc[i] ? SOM_FRAME_CRC_OVERHEAD + sent[i].data_len : sizeof(Message);
+		som_frame_decode(&dec, stream + pos, n);
+		pos += n;
+	}
+	TEST_ASSERT_EQUAL_UINT32(len, pos);
+	TEST_ASSERT_EQUAL_INT(nsent, got);
+	TEST_ASSERT_EQUAL_INT(0, mismatches);
+	TEST_ASSERT_EQUAL_UINT32(0, dec.stats.dropped);
+}
+
+static void test_split_frames(void)
+{
+	size_t len = build_stream(FRAMES, 50);
+
+	feed_split(len, 7);
+	TEST_ASSERT_EQUAL_INT(nsent, got);
+	TEST_ASSERT_EQUAL_INT(0, mismatches);
+	TEST_ASSERT_EQUAL_UINT32(0, dec.stats.dropped);
+}
+
+static void test_merged_frames(void)
+{
+	size_t len = build_stream(FRAMES, 50);
+
+	som_frame_decode(&dec, stream, len);
+	TEST_ASSERT_EQUAL_INT(nsent, got);
+	TEST_ASSERT_EQUAL_INT(0, mismatches);
+	TEST_ASSERT_EQUAL_UINT32(nsent, dec.stats.frames);
+}
+
+/*
+ * Crc frames with a third of them damaged: a flipped bit anywhere, cut short,
+ * or with garbage in front that may itself look like a header. Every frame
+ * left intact must come out, in order, and nothing else.
+ */
+static void test_corrupted_frames(void)
+{
+	static const uint8_t header_bytes[] = { 0x5C, 0xAA, 0x5A, 0xA5, 0x55 };
+	size_t len = 0, n;
+	int intact = 0;
+
+	for (int i = 0; i < FRAMES; i++) {
+		random_msg(&sent[nsent]);
+		sent_crc[nsent] = 1;
+		sent_intact[nsent] = 1;
+		n = som_frame_encode(&sent[nsent], 1, stream + len);
+		switch (rnd() % 9) {
+		case 0:
+			stream[len + rnd() % n] ^= 1 << (rnd() % 8);
+			sent_intact[nsent] = 0;
+			break;
+		case 1:
+			n = rnd() % n;
+			sent_intact[nsent] = 0;
+			break;
+		case 2:
+			/* garbage goes in front, the frame after it is intact */
+			memmove(stream + len + 16, stream + len, n);
+			for (int k = 0; k < 16; k++)
+				stream[len + k] = rnd() % 2 ? header_bytes[rnd() % sizeof(header_bytes)] : rnd();
+			n += 16;
+			break;
+		}
+		intact += sent_intact[nsent];
+		len += n;
+		nsent++;
+	}
+
+	feed_split(len, 64);
+	TEST_ASSERT_EQUAL_INT(intact, got);
+	TEST_ASSERT_EQUAL_INT(0, mismatches);
+	TEST_ASSERT_TRUE(dec.stats.crc_err + dec.stats.tail_err + dec.stats.len_err > 0);
+}
+
+/* no free buffer: the frame is counted and dropped, the stream goes on */
+static void test_pool_exhausted(void)
+{
+	size_t len = build_stream(10, 100);
+
+	for (int i = 0; i < POOL; i++)
+		pool_used[i] = 1;
+	pool_used[0] = 0;	// the decoder's own buffer
+	som_frame_decode(&dec, stream, len);
+	TEST_ASSERT_EQUAL_INT(0, got);
+	TEST_ASSERT_EQUAL_UINT32(10, dec.stats.nobuf);
+}
+
+int main(int argc, char **argv)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_crc_matches_reference);
+	RUN_TEST(test_whole_frames);
+	RUN_TEST(test_split_frames);
+	RUN_TEST(test_merged_frames);
+	RUN_TEST(test_corrupted_frames);
+	RUN_TEST(test_pool_exhausted);
+	return UNITY_END();
+}
@@ -0,0 +1,269 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Host tests of the BMC side of the SOM UART4 protocol: hf_protocol_process.c
+ * with its uart4 protocol and keeplive tasks, on the FreeRTOS and HAL shims of
+ * scripts/som_sim and UART4 on a pty. A thread on the other end of the pty
+ * plays the SOM daemon with the som_frame.c decoder, and can be told to fail,
+ * to go silent or to send noise between its replies.
+ *
+ * Copyright 2024 Beijing ESWIN Computing Technology Co., Ltd.
+ *
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <unity.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "hf_common.h"
+#include "protocol_lib/som_frame.h"
+#include "som_sim.h"
+
+#define CALLERS		4
+#define CALLS		50
+
+/* MsgType of hf_protocol_process.c */
+#define MSG_REQUEST	0x01
+#define MSG_REPLY	0x02
+
+/* the SOM daemon end of the line */
+static struct {
+	int fd;
+	pthread_mutex_t lock;
+	struct som_frame_decoder dec;
+	uint8_t buf[2][SOM_FRAME_MAX_LEN];
+	int next;
+	int silent;		// read and drop every request
+	int result;		// cmd_result of the replies to CMD_BOARD_STATUS and CMD_LINK_ECHO
+	int noise;		// garbage bytes before every reply
+	int requests;
+	int polls;		// CMD_BOARD_STATUS
+} som = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* the decoder takes the next buffer before it hands a frame over, two take turns */
+static uint8_t *som_alloc(void *arg)
+{
+	som.next ^= 1;
+	return som.buf[som.next];
+}
+
+static void som_write(const uint8_t *p, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(som.fd, p, len);
+		if (n < 0 && EINTR == errno)
+			continue;
+		if (n <= 0)
+			return;
+		p += n;
+		len -= n;
+	}
+}
+
+/* crc replies, the link rate switch and the telemetry subscription are refused */
+static void som_request(Message *msg, int crc, void *arg)
+{
+	static uint8_t out[SOM_FRAME_MAX_LEN + 64];
+	Message reply = *msg;
+	size_t len = 0;
+
+	if (MSG_REQUEST != msg->msg_type)
+		return;
+	pthread_mutex_lock(&som.lock);
+	som.requests++;
+	if (CMD_BOARD_STATUS == msg->cmd_type)
+		som.polls++;
+	reply.msg_type = MSG_REPLY;
+	switch (msg->cmd_type) {
+	case CMD_BOARD_STATUS:
+	case CMD_LINK_ECHO:
+		reply.cmd_result = som.result;
+		break;
+	default:
+		reply.cmd_result = HAL_ERROR;
+		reply.data_len = 0;
+		break;
+	}
+	if (!som.silent) {
+		for (int i = 0; i < som.noise; i++)
+			out[len++] = 0xA5 ^ (i * 37);
+		len += som_frame_encode(&reply, 1, out + len);
+	}
+	pthread_mutex_unlock(&som.lock);
+	som_write(out, len);
+}
+
+static void *som_daemon(void *arg)
+{
+	struct pollfd pfd = { .fd = som.fd, .events = POLLIN };
+	uint8_t data[256];
+	ssize_t n;
+
+	for (;;) {
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+		n = read(som.fd, data, sizeof(data));
+		if (n > 0)
+			som_frame_decode(&som.dec, data, n);
+	}
+	return NULL;
+}
+
+static void som_set(int silent, int result, int noise)
+{
+	pthread_mutex_lock(&som.lock);
+	som.silent = silent;
+	som.result = result;
+	som.noise = noise;
+	pthread_mutex_unlock(&som.lock);
+}
+
+static int som_polls(void)
+{
+	int polls;
+
+	pthread_mutex_lock(&som.lock);
+	polls = som.polls;
+	pthread_mutex_unlock(&som.lock);
+	return polls;
+}
+
+static uint32_t now_ms(void)
+{
+	return xTaskGetTickCount();
+}
+
+/* 1 once the keeplive task reports state within ms */
+static int wait_daemon(deamon_stats_t state, uint32_t ms)
+{
+	uint32_t start = now_ms();
+
+	while (get_som_daemon_state() != state) {
+		if (now_ms() - start > ms)
+			return 0;
+		usleep(10000);
+	}
+	return 1;
+}
+
+void setUp(void)
+{
+	som_set(0, HAL_OK, 0);
+}
+
+void tearDown(void)
+{
+}
+
+/* the keeplive poll of a quiet link is answered: the daemon comes up */
+static void test_keeplive_daemon_on(void)
+{
+	TEST_ASSERT_TRUE(wait_daemon(SOM_DAEMON_ON, 3000));
+	TEST_ASSERT_GREATER_OR_EQUAL_INT(1, som_polls());
+}
+
+static void test_reply_result(void)
+{
+	uint8_t echo[16] = "echo me";
+
+	TEST_ASSERT_EQUAL_INT(HAL_OK, web_cmd_handle(CMD_BOARD_STATUS, NULL, 0, 1000));
+	TEST_ASSERT_EQUAL_INT(HAL_OK, web_cmd_handle(CMD_LINK_ECHO, echo, sizeof(echo), 1000));
+	TEST_ASSERT_EQUAL_STRING("echo me", (char *)echo);
+
+	som_set(0, HAL_ERROR, 0);
+	TEST_ASSERT_EQUAL_INT(HAL_ERROR, web_cmd_handle(CMD_BOARD_STATUS, NULL, 0, 1000));
+}
+
+/* the wait is bounded by the timeout, and the next call gets its own reply */
+static void test_timeout(void)
+{
+	uint32_t start;
+
+	som_set(1, HAL_OK, 0);
+	start = now_ms();
+	TEST_ASSERT_EQUAL_INT(HAL_TIMEOUT, web_cmd_handle(CMD_BOARD_STATUS, NULL, 0, 200));
+	TEST_ASSERT_UINT32_WITHIN(150, 275, now_ms() - start);
+
+	som_set(0, HAL_ERROR, 0);
+	TEST_ASSERT_EQUAL_INT(HAL_ERROR, web_cmd_handle(CMD_BOARD_STATUS, NULL, 0, 1000));
+}
+
+static void *caller(void *arg)
+{
+	int id = (int)(intptr_t)arg, bad = 0;
+	uint8_t data[8];
+
+	for (int i = 0; i < CALLS; i++) {
+		memset(data, id * CALLS + i, sizeof(data));
+		if (HAL_OK != web_cmd_handle(CMD_LINK_ECHO, data, sizeof(data), 1000) ||
+		    data[0] != (uint8_t)(id * CALLS + i) || data[7] != data[0])
+			bad++;
+	}
+	return (void *)(intptr_t)bad;
+}
+
+/* several tasks at once, with noise on the line, each gets its own reply */
+static void test_concurrent_callers(void)
+{
+	pthread_t t[CALLERS];
+	void *bad;
+	int total = 0;
+
+	som_set(0, HAL_OK, 7);
+	for (int i = 0; i < CALLERS; i++)
+		TEST_ASSERT_EQUAL_INT(0, pthread_create(&t[i], NULL, caller, (void *)(intptr_t)i));
+	for (int i = 0; i < CALLERS; i++) {
+		pthread_join(t[i], &bad);
+		total += (int)(intptr_t)bad;
+	}
+	TEST_ASSERT_EQUAL_INT(0, total);
+}
+
+/* a silent SOM turns the daemon off at the deadline, its answers turn it back on */
+static void test_keeplive_daemon_off_and_back(void)
+{
+	struct som_liveness_stats live;
+
+	som_liveness_get_stats(&live);
+	som_set(1, HAL_OK, 0);
+	/* the state is updated once the keeplive poll running at the deadline has timed out */
+	TEST_ASSERT_TRUE(wait_daemon(SOM_DAEMON_OFF, live.deadline_ms + 2500));
+	TEST_ASSERT_EQUAL_INT(HAL_TIMEOUT, web_cmd_handle(CMD_BOARD_STATUS, NULL, 0, 100));
+
+	som_set(0, HAL_OK, 0);
+	/* the polls back off while the daemon is off */
+	TEST_ASSERT_TRUE(wait_daemon(SOM_DAEMON_ON, 5000));
+	som_liveness_get_stats(&live);
+	TEST_ASSERT_GREATER_OR_EQUAL_UINT32(1, live.poll_fail);
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t thread;
+
+	som_frame_init();
+	som_frame_decoder_init(&som.dec, som_alloc, som_request, NULL);
+	if (sim_uart_openpty(&som.fd) < 0 || pthread_create(&thread, NULL, som_daemon, NULL)) {
+		perror("pty");
+		return 1;
+	}
+	sim_protocol_start();
+
+	UNITY_BEGIN();
+	RUN_TEST(test_keeplive_daemon_on);
+	RUN_TEST(test_reply_result);
+	RUN_TEST(test_timeout);
+	RUN_TEST(test_concurrent_callers);
+	RUN_TEST(test_keeplive_daemon_off_and_back);
+	return UNITY_END();
+}